@@ -0,0 +1,462 @@
+/*
+ * arith.c
+ *
+ * A precedence-climbing evaluator of arithmetic expressions. The
+ * expression is evaluated as it is parsed, with no tree built; the
+ * operands that are not evaluated are parsed with side effects off.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "arith.h"
+#include "mem.h"
+
+// the operators, longest first so that a prefix never matches early
+static const char *_ARITH_ops[] = {"<<=", ">>=", "**", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++",
+                                   "--", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", "+", "-", "*",
+                                   "/", "%", "<", ">", "&", "^", "|", "!", "~", "?", ":", "=", "(", ")",
+                                   ",", NULL};
+
+// the binary operators from || up, by precedence
+static const struct
+{
+    const char *op;
+    int prec;
+} _ARITH_binary[] = {
+    {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5}, {"==", 6}, {"!=", 6}, {"<", 7}, {"<=", 7},
+    {">", 7}, {">=", 7}, {"<<", 8}, {">>", 8}, {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10},
+    {"**", 11},
+};
+
+// the state of an evaluation
+struct _arith
+{
+    VarTable vars;
+    const char *p;   // the next character of the expression
+    int skip;        // > 0 while parsing an operand that is not evaluated
+    bool failed;     // an error message is in errmsg
+    char *errmsg;
+    size_t errmsg_sz;
+};
+
+static int64_t _ARITH_comma(struct _arith *a);
+static int64_t _ARITH_assign(struct _arith *a);
+
+/*
+ * Record the first error; the evaluation unwinds from there
+ */
+static int64_t _ARITH_error(struct _arith *a, const char *msg, const char *arg)
+{
+    if (!a->failed)
+        snprintf(a->errmsg, a->errmsg_sz, msg, arg);
+    a->failed = true;
+    return 0;
+}
+
+/*
+ * Skip spaces, and return the operator at the next character, or NULL
+ * if there is none
+ */
+static const char *_ARITH_peek(struct _arith *a)
+{
+    while (isspace(*a->p))
+        a->p++;
+
+    for (int i = 0; _ARITH_ops[i] != NULL; i++)
+        if (strncmp(a->p, _ARITH_ops[i], strlen(_ARITH_ops[i])) == 0)
+            return _ARITH_ops[i];
+
+    return NULL;
+}
+
+/*
+ * Consume the operator op if it is next
+ */
+static bool _ARITH_accept(struct _arith *a, const char *op)
+{
+    const char *next = _ARITH_peek(a);
+    if (next == NULL || strcmp(next, op) != 0)
+        return false;
+
+    a->p += strlen(op);
+    return true;
+}
+
+/*
+ * The precedence of a binary operator, or 0 if op is not one
+ */
+static int _ARITH_precedence(const char *op)
+{
+    for (int i = 0; op != NULL && i < sizeof(_ARITH_binary) / sizeof(_ARITH_binary[0]); i++)
+        if (strcmp(op, _ARITH_binary[i].op) == 0)
+            return _ARITH_binary[i].prec;
+
+    return 0;
+}
+
+/*
+ * Read a variable name at the next character
+ *
+ * Returns: The name, from MEM_alloc, or NULL if there is none
+ */
+static char *_ARITH_name(struct _arith *a)
+{
+    const char *start = a->p;
+
+    if (!isalpha(*a->p) && *a->p != '_')
+        return NULL;
+
+    while (isalnum(*a->p) || *a->p == '_')
+        a->p++;
+
+    return MEM_strndup(MEM_TOKENS, start, a->p - start);
+}
+
+/*
+ * Get the value of a variable, 0 if it is not set or empty
+ */
+static int64_t _ARITH_get(struct _arith *a, const char *name)
+{
+    const char *value = VAR_get(a->vars, name);
+    char *end;
+
+    while (value != NULL && isspace(*value))
+        value++;
+
+    if (value == NULL || *value == '\0')
+        return 0;
+
+    errno = 0;
+    int64_t n = strtoll(value, &end, 0);
+    while (isspace(*end))
+        end++;
+
+    if (*end != '\0' || errno == ERANGE)
+        return _ARITH_error(a, "Invalid number '%s'", value);
+
+    return n;
+}
+
+/*
+ * Set a variable to a number, unless the operand is not evaluated
+ */
+static int64_t _ARITH_set(struct _arith *a, const char *name, int64_t value)
+{
+    char str[24];
+
+    if (a->skip == 0 && !a->failed)
+    {
+        snprintf(str, sizeof(str), "%" PRId64, value);
+        VAR_set(a->vars, name, str);
+    }
+
+    return value;
+}
+
+/*
+ * Apply a binary operator, other than && and ||. Division by zero is an
+ * error only where it is evaluated.
+ */
+static int64_t _ARITH_apply(struct _arith *a, const char *op, int64_t x, int64_t y)
+{
+    uint64_t ux = (uint64_t)x, uy = (uint64_t)y;
+
+    if ((op[0] == '/' || op[0] == '%') && y == 0)
+        return a->skip > 0 ? 0 : _ARITH_error(a, "Division by zero", NULL);
+
+    switch (op[0])
+    {
+    case '+':
+        return (int64_t)(ux + uy);
+    case '-':
+        return (int64_t)(ux - uy);
+    case '/':
+        return y == -1 ? (int64_t)(0 - ux) : x / y;
+    case '%':
+        return y == -1 ? 0 : x % y;
+    case '^':
+        return x ^ y;
+    case '|':
+        return x | y;
+    case '&':
+        return x & y;
+    case '=':
+        return x == y;
+    case '!':
+        return x != y;
+    case '*':
+        if (op[1] == '*')
+        {
+            if (y < 0)
+                return a->skip > 0 ? 0 : _ARITH_error(a, "Exponent less than 0", NULL);
+
+            // square and multiply, wrapping like the other operators
+            uint64_t result = 1;
+            for (; y > 0; y >>= 1, ux *= ux)
+                if (y & 1)
+                    result *= ux;
+            return (int64_t)result;
+        }
+        return (int64_t)(ux * uy);
+    case '<':
+        if (op[1] == '<')
+            return (int64_t)(ux << (y & 63));
+        return op[1] == '=' ? x <= y : x < y;
+    case '>':
+        if (op[1] == '>')
+            return x >> (y & 63);
+        return op[1] == '=' ? x >= y : x > y;
+    }
+
+    return _ARITH_error(a, "Unknown operator '%s'", op);
+}
+
+/*
+ * primary: number | NAME [++ | --] | $NAME | $DIGIT | $# | ( comma )
+ */
+static int64_t _ARITH_primary(struct _arith *a)
+{
+    char param[2] = {0};
+    char *name;
+
+    if (_ARITH_accept(a, "("))
+    {
+        int64_t value = _ARITH_comma(a);
+        if (!a->failed && !_ARITH_accept(a, ")"))
+            return _ARITH_error(a, "Expect ')'", NULL);
+        return value;
+    }
+
+    if (isdigit(*a->p))
+    {
+        char *end;
+        errno = 0;
+        int64_t value = (int64_t)strtoull(a->p, &end, 0);
+        if (isalnum(*end) || *end == '_' || errno == ERANGE)
+            return _ARITH_error(a, "Invalid number '%s'", a->p);
+
+        a->p = end;
+        return value;
+    }
+
+    // a positional parameter, or a variable written as in a word
+    if (*a->p == '$')
+    {
+        a->p++;
+        if (isdigit(*a->p) || *a->p == '#')
+        {
+            param[0] = *a->p++;
+            return _ARITH_get(a, param);
+        }
+
+        name = _ARITH_name(a);
+        if (name == NULL)
+            return _ARITH_error(a, "Expect variable name after '$'", NULL);
+
+        int64_t value = _ARITH_get(a, name);
+        MEM_free(name);
+        return value;
+    }
+
+    name = _ARITH_name(a);
+    if (name == NULL)
+        return _ARITH_error(a, *a->p == '\0' ? "Expect operand" : "Unexpected '%s'", a->p);
+
+    int64_t value = _ARITH_get(a, name);
+
+    // a postfix ++ or -- yields the value from before
+    if (_ARITH_accept(a, "++"))
+        _ARITH_set(a, name, (int64_t)((uint64_t)value + 1));
+    else if (_ARITH_accept(a, "--"))
+        _ARITH_set(a, name, (int64_t)((uint64_t)value - 1));
+
+    MEM_free(name);
+    return value;
+}
+
+/*
+ * unary: (! | ~ | + | -) unary | (++ | --) NAME | primary
+ */
+static int64_t _ARITH_unary(struct _arith *a)
+{
+    const char *op = _ARITH_peek(a);
+
+    if (op != NULL && (strcmp(op, "++") == 0 || strcmp(op, "--") == 0))
+    {
+        // a prefix ++ or -- changes a variable; otherwise it is two signs
+        const char *after = a->p + 2;
+        while (isspace(*after))
+            after++;
+
+        if (isalpha(*after) || *after == '_')
+        {
+            a->p = after;
+            char *name = _ARITH_name(a);
+            int64_t value = _ARITH_get(a, name);
+            value = _ARITH_set(a, name, (int64_t)((uint64_t)value + (op[0] == '+' ? 1 : -1)));
+            MEM_free(name);
+            return value;
+        }
+    }
+
+    if (op == NULL || strchr("!~+-", op[0]) == NULL || (op[1] != '\0' && op[1] != op[0]))
+        return _ARITH_primary(a);
+
+    a->p++;
+    int64_t value = _ARITH_unary(a);
+
+    switch (op[0])
+    {
+    case '!':
+        return !value;
+    case '~':
+        return ~value;
+    case '-':
+        return (int64_t)(0 - (uint64_t)value);
+    default:
+        return value;
+    }
+}
+
+/*
+ * Parse the binary operators of at least precedence min, all left
+ * associative but **
+ */
+static int64_t _ARITH_binary_op(struct _arith *a, int min)
+{
+    int64_t lhs = _ARITH_unary(a);
+
+    while (!a->failed)
+    {
+        const char *op = _ARITH_peek(a);
+        int prec = _ARITH_precedence(op);
+        if (prec == 0 || prec < min)
+            break;
+
+        a->p += strlen(op);
+
+        // && and || do not evaluate an operand that cannot change the result
+        if (strcmp(op, "&&") == 0 || strcmp(op, "||") == 0)
+        {
+            bool decided = (op[0] == '&') == (lhs == 0);
+            a->skip += decided;
+            int64_t rhs = _ARITH_binary_op(a, prec + 1);
+            a->skip -= decided;
+
+            lhs = op[0] == '&' ? lhs && rhs : lhs || rhs;
+            continue;
+        }
+
+        int64_t rhs = _ARITH_binary_op(a, strcmp(op, "**") == 0 ? prec : prec + 1);
+        lhs = _ARITH_apply(a, op, lhs, rhs);
+    }
+
+    return lhs;
+}
+
+/*
+ * conditional: binary [? assign : assign]
+ */
+static int64_t _ARITH_conditional(struct _arith *a)
+{
+    int64_t cond = _ARITH_binary_op(a, 1);
+
+    if (a->failed || !_ARITH_accept(a, "?"))
+        return cond;
+
+    a->skip += cond == 0;
+    int64_t then = _ARITH_assign(a);
+    a->skip -= cond == 0;
+
+    if (!a->failed && !_ARITH_accept(a, ":"))
+        return _ARITH_error(a, "Expect ':'", NULL);
+
+    a->skip += cond != 0;
+    int64_t otherwise = _ARITH_assign(a);
+    a->skip -= cond != 0;
+
+    return cond != 0 ? then : otherwise;
+}
+
+/*
+ * assign: NAME (= | += | -= | ...) assign | conditional
+ */
+static int64_t _ARITH_assign(struct _arith *a)
+{
+    const char *start = a->p;
+
+    _ARITH_peek(a);
+    char *name = _ARITH_name(a);
+    const char *op = name != NULL ? _ARITH_peek(a) : NULL;
+
+    // an assignment operator ends in '=', as do the comparisons
+    size_t len = op != NULL ? strlen(op) : 0;
+    if (len == 0 || op[len - 1] != '=' || strcmp(op, "==") == 0 || strcmp(op, "!=") == 0 ||
+        strcmp(op, "<=") == 0 || strcmp(op, ">=") == 0)
+    {
+        MEM_free(name);
+        a->p = start;
+        return _ARITH_conditional(a);
+    }
+
+    a->p += len;
+    int64_t value = _ARITH_assign(a);
+
+    // the compound assignments apply the operator without the '='
+    if (len > 1)
+    {
+        char binary[3] = {0};
+        strncpy(binary, op, len - 1);
+        value = _ARITH_apply(a, binary, _ARITH_get(a, name), value);
+    }
+
+    value = _ARITH_set(a, name, value);
+    MEM_free(name);
+    return value;
+}
+
+/*
+ * comma: assign [, assign]...
+ */
+static int64_t _ARITH_comma(struct _arith *a)
+{
+    int64_t value = _ARITH_assign(a);
+
+    while (!a->failed && _ARITH_accept(a, ","))
+        value = _ARITH_assign(a);
+
+    return value;
+}
+
+// Documented in .h file
+bool ARITH_eval(VarTable vars, const char *expr, int64_t *result, char *errmsg, size_t errmsg_sz)
+{
+    struct _arith a = {vars, expr, 0, false, errmsg, errmsg_sz};
+
+    errmsg[0] = '\0';
+    *result = 0;
+
+    // an empty expression is 0
+    _ARITH_peek(&a);
+    if (*a.p == '\0')
+        return true;
+
+    int64_t value = _ARITH_comma(&a);
+
+    // whatever is left could not be parsed
+    _ARITH_peek(&a);
+    if (*a.p != '\0')
+        _ARITH_error(&a, "Unexpected '%s'", a.p);
+
+    if (a.failed)
+        return false;
+
+    *result = value;
+    return true;
+}
@@ -0,0 +1,45 @@
+/*
+ * arith.h
+ *
+ * Arithmetic expressions over 64-bit integers, for $(( ... )), that
+ * read and assign the shell variables
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _ARITH_H_
+#define _ARITH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vars.h"
+
+/*
+ * Evaluate an arithmetic expression. It has C's operators and
+ * precedence, from the comma up to the unary operators, with ** for
+ * powers:
+ *
+ *   ,  = += -= *= /= %= <<= >>= &= ^= |=  ?:  ||  &&  |  ^  &
+ *   == !=  < <= > >=  << >>  + -  * / %  **  ! ~ + - ++ --
+ *
+ * Numbers are decimal, hexadecimal with 0x or octal with a leading 0.
+ * A variable is named with or without a '$', and $0 to $9 and $# are
+ * the positional parameters; a variable that is not set or is empty is
+ * 0. Assignments, ++ and -- set variables. Operands that are not
+ * evaluated, after a && or || that decides the result or in the branch
+ * of ?: not taken, have no effect. Arithmetic wraps around on overflow.
+ *
+ * Parameters:
+ *   vars       The variables to read and assign
+ *   expr       The expression
+ *   result     Return space for the value of the expression
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, or false with an error message in errmsg.
+ *   An expression that fails may have assigned some variables already.
+ */
+bool ARITH_eval(VarTable vars, const char *expr, int64_t *result, char *errmsg, size_t errmsg_sz);
+
+#endif /* _ARITH_H_ */
@@ -0,0 +1,214 @@
+/**
+ * arith_test.c
+ *
+ * This file contains the test cases for arith.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arith.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Returns true if expr evaluates to expected
+ */
+static bool evaluates(VarTable vars, const char *expr, int64_t expected)
+{
+    char errmsg[128];
+    int64_t result;
+
+    if (!ARITH_eval(vars, expr, &result, errmsg, sizeof(errmsg)))
+    {
+        printf("  %s: %s\n", expr, errmsg);
+        return false;
+    }
+
+    if (result != expected)
+        printf("  %s: got %lld, expected %lld\n", expr, (long long)result, (long long)expected);
+
+    return result == expected;
+}
+
+/*
+ * Returns true if expr fails with the error message expected
+ */
+static bool fails(VarTable vars, const char *expr, const char *expected)
+{
+    char errmsg[128] = "";
+    int64_t result;
+
+    if (ARITH_eval(vars, expr, &result, errmsg, sizeof(errmsg)))
+    {
+        printf("  %s: evaluated to %lld\n", expr, (long long)result);
+        return false;
+    }
+
+    if (strcmp(errmsg, expected) != 0)
+        printf("  %s: got '%s', expected '%s'\n", expr, errmsg, expected);
+
+    return strcmp(errmsg, expected) == 0;
+}
+
+/*
+ * Tests the operators, their precedence and number formats
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_operators()
+{
+    VarTable vars = VAR_new();
+
+    test_assert(evaluates(vars, "", 0));
+    test_assert(evaluates(vars, "  42  ", 42));
+    test_assert(evaluates(vars, "1 + 2 * 3", 7));
+    test_assert(evaluates(vars, "(1 + 2) * 3", 9));
+    test_assert(evaluates(vars, "10 - 4 - 3", 3));
+    test_assert(evaluates(vars, "7 / 2", 3));
+    test_assert(evaluates(vars, "-7 % 3", -1));
+    test_assert(evaluates(vars, "2 ** 3 ** 2", 512));
+    test_assert(evaluates(vars, "-2 ** 2", 4));
+    test_assert(evaluates(vars, "1 << 4 | 1", 17));
+    test_assert(evaluates(vars, "6 & 3 ^ 1", 3));
+    test_assert(evaluates(vars, "1 < 2 == 2 > 1", 1));
+    test_assert(evaluates(vars, "3 <= 2 || 2 >= 2 && !0", 1));
+    test_assert(evaluates(vars, "~0", -1));
+    test_assert(evaluates(vars, "- -3", 3));
+    test_assert(evaluates(vars, "--3", 3));
+    test_assert(evaluates(vars, "0 ? 1 : 2 ? 3 : 4", 3));
+    test_assert(evaluates(vars, "1, 2, 3", 3));
+    test_assert(evaluates(vars, "0x1f + 010", 39));
+
+    // arithmetic wraps around instead of overflowing
+    test_assert(evaluates(vars, "9223372036854775807 + 1", INT64_MIN));
+    test_assert(evaluates(vars, "-9223372036854775807 - 1", INT64_MIN));
+    test_assert(evaluates(vars, "(-9223372036854775807 - 1) / -1", INT64_MIN));
+    test_assert(evaluates(vars, "2 ** 64", 0));
+
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests reading and assigning variables, including operands that are
+ * not evaluated
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_variables()
+{
+    VarTable vars = VAR_new();
+    char *args[] = {"f", "5", "7", NULL};
+
+    test_assert(evaluates(vars, "unset + 1", 1));
+    VAR_set(vars, "empty", "");
+    test_assert(evaluates(vars, "empty", 0));
+
+    VAR_set(vars, "n", " 12 ");
+    test_assert(evaluates(vars, "n * 2", 24));
+    test_assert(evaluates(vars, "$n + 1", 13));
+
+    test_assert(evaluates(vars, "x = 3", 3));
+    test_assert(strcmp(VAR_get(vars, "x"), "3") == 0);
+    test_assert(evaluates(vars, "x += 4", 7));
+    test_assert(evaluates(vars, "x <<= 1", 14));
+    test_assert(evaluates(vars, "a = b = 2", 2));
+    test_assert(strcmp(VAR_get(vars, "a"), "2") == 0);
+    test_assert(strcmp(VAR_get(vars, "b"), "2") == 0);
+    test_assert(evaluates(vars, "x == 14", 1));
+
+    test_assert(evaluates(vars, "i++", 0));
+    test_assert(evaluates(vars, "i++ + i", 3));
+    test_assert(evaluates(vars, "++i", 3));
+    test_assert(evaluates(vars, "--i", 2));
+    test_assert(evaluates(vars, "i--", 2));
+    test_assert(strcmp(VAR_get(vars, "i"), "1") == 0);
+
+    // the operands that cannot matter are not evaluated
+    test_assert(evaluates(vars, "0 && (y = 1)", 0));
+    test_assert(evaluates(vars, "1 || y++", 1));
+    test_assert(evaluates(vars, "1 ? 2 : (y = 3)", 2));
+    test_assert(evaluates(vars, "0 && 1 / 0", 0));
+    test_assert(VAR_get(vars, "y") == NULL);
+    test_assert(evaluates(vars, "1 && (y = 1)", 1));
+    test_assert(strcmp(VAR_get(vars, "y"), "1") == 0);
+
+    test_assert(evaluates(vars, "$#", 0));
+    VAR_push_args(vars, args);
+    test_assert(evaluates(vars, "$# + $1 * $2", 37));
+    VAR_pop_args(vars);
+
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests malformed expressions and runtime errors
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_errors()
+{
+    VarTable vars = VAR_new();
+
+    test_assert(fails(vars, "1 / 0", "Division by zero"));
+    test_assert(fails(vars, "1 % (2 - 2)", "Division by zero"));
+    test_assert(fails(vars, "2 ** -1", "Exponent less than 0"));
+    test_assert(fails(vars, "1 +", "Expect operand"));
+    test_assert(fails(vars, "(1 + 2", "Expect ')'"));
+    test_assert(fails(vars, "1 ? 2", "Expect ':'"));
+    test_assert(fails(vars, "1 2", "Unexpected '2'"));
+    test_assert(fails(vars, "12abc", "Invalid number '12abc'"));
+    test_assert(fails(vars, "$", "Expect variable name after '$'"));
+
+    VAR_set(vars, "s", "hello");
+    test_assert(fails(vars, "s + 1", "Invalid number 'hello'"));
+
+    // an error stops the assignments
+    test_assert(fails(vars, "z = 1 / 0", "Division by zero"));
+    test_assert(VAR_get(vars, "z") == NULL);
+
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_operators();
+    num_tests++;
+    passed += test_variables();
+    num_tests++;
+    passed += test_errors();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
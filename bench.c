@@ -0,0 +1,1366 @@
+/**
+ * bench.c
+ *
+ * Micro-benchmarks for the shell. Each benchmark reports the average
+ * time of one operation; run with a benchmark name to run only that one.
+ *
+ *  Usage: ./plaid_bench [benchmark-name]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "zygote.h"
+#include "histfile.h"
+#include "histindex.h"
+#include "pathcache.h"
+#include "cmdindex.h"
+#include "snapshot.h"
+#include "parsecache.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "speculate.h"
+#include "vars.h"
+#include "script.h"
+#include "control.h"
+#include "builtins.h"
+#include "functions.h"
+#include "serve.h"
+#include "libplaid.h"
+#include "flatpipe.h"
+#include "mem.h"
+
+// how many times each operation is repeated
+#define LAUNCH_ITERATIONS 200
+
+// how many times the history is opened and loaded, and how much of it
+#define HISTORY_ITERATIONS 200
+#define HISTORY_LOAD_MAX 1000
+
+// the size of the history searched, and how many searches are timed
+#define SEARCH_ENTRIES 100000
+#define SEARCH_ITERATIONS 1000
+
+// the PATH the shell starts with: how many directories, how many
+// commands in each, and how many startups are timed
+#define STARTUP_DIRS 64
+#define STARTUP_COMMANDS 200
+#define STARTUP_ITERATIONS 20
+
+// how many files are in the directory a parsed line globs, and how many
+// times the line is parsed
+#define PARSE_FILES 500
+#define PARSE_ITERATIONS 2000
+
+// a command line that reads a directory of PARSE_FILES files twice, to
+// match a few of them
+#define PARSE_LINE "grep -n TODO file4?.c file4?.h | sort -u > $HOME/todo"
+
+// how many commands are in a script, and how many times it is read
+#define SCRIPT_COMMANDS 200
+#define SCRIPT_ITERATIONS 200
+
+// how many times a loop body runs, and the body, which runs a builtin
+#define LOOP_ITERATIONS 10000
+#define LOOP_BODY "test \"$i\" != \"a word that the loop tokenizes once\""
+
+// how many times a function is called, and its definition, whose body
+// runs a builtin
+#define FUNCTION_ITERATIONS 1000
+#define FUNCTION_DEF "wrap() { test \"$1\" != \"$2\"; }"
+
+// how many times a counter is incremented
+#define ARITH_ITERATIONS 1000
+
+// how many lines a while read loop reads, of about 40 bytes each
+#define READ_LINES 1000000
+
+// how many command lines are run, by a shell started for each or by a
+// shell serving them
+#define SERVE_ITERATIONS 100
+
+// how many command lines a program runs, with /bin/sh -c or the library
+#define EMBED_ITERATIONS 500
+#define EMBED_LINE "for w in a b c; do echo $w; done"
+
+// how many times a pipeline handed to another process is parsed or decoded
+#define FLAT_ITERATIONS 100000
+#define FLAT_LINE "grep -n -e TODO -e FIXME main.c util.c parse.c <(ls) | sort -u > todo.txt"
+
+// the heap of an interactive shell with history and caches, which every
+// fork of the shell has to copy the page tables of
+#define SHELL_HEAP_SIZE (64 * 1024 * 1024)
+
+extern char **environ;
+
+// started by main before the heap grows, as the shell starts its zygote
+static Zygote zygote;
+
+/*
+ * Returns the current time in microseconds
+ */
+static double now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Launches /bin/true by forking this process, as the shell does without
+ * a zygote
+ *
+ * Returns: microseconds per launch
+ */
+static double bench_launch_fork()
+{
+    char *argv[] = {"/bin/true", NULL};
+    double start = now_usec();
+
+    for (int i = 0; i < LAUNCH_ITERATIONS; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execve(argv[0], argv, environ);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+    }
+
+    return (now_usec() - start) / LAUNCH_ITERATIONS;
+}
+
+/*
+ * Launches /bin/true through a zygote, as the shell does with -z
+ *
+ * Returns: microseconds per launch
+ */
+static double bench_launch_zygote()
+{
+    char *argv[] = {"/bin/true", NULL};
+    if (zygote == NULL)
+        return -1;
+
+    double start = now_usec();
+
+    for (int i = 0; i < LAUNCH_ITERATIONS; i++)
+    {
+        pid_t pid;
+        int pidfd = ZYG_spawn(zygote, NULL, argv, environ, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, &pid);
+        if (pidfd < 0)
+            break;
+
+        struct pollfd pfd = {pidfd, POLLIN, 0};
+        poll(&pfd, 1, -1);
+        ZYG_wait(zygote, pid);
+        close(pidfd);
+    }
+
+    return (now_usec() - start) / LAUNCH_ITERATIONS;
+}
+
+/*
+ * Counts the commands loaded from the history
+ */
+static void count_line(const char *line, size_t len, void *cb_data)
+{
+    (*(int *)cb_data)++;
+}
+
+/*
+ * Opens a full history file and loads its tail, as the shell does when
+ * it starts
+ *
+ * Returns: microseconds per startup
+ */
+static double bench_history_load()
+{
+    char file[] = "/tmp/plaid_bench_hist_XXXXXX";
+    int fd = mkstemp(file);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    unlink(file);
+
+    History hist = HIST_open(file);
+    char line[64];
+    for (int i = 0; hist != NULL && i < 8000; i++)
+    {
+        snprintf(line, sizeof(line), "echo command number %d | wc -c", i);
+        HIST_append(hist, line);
+    }
+    HIST_close(hist);
+
+    int loaded = 0;
+    double start = now_usec();
+
+    for (int i = 0; i < HISTORY_ITERATIONS; i++)
+    {
+        hist = HIST_open(file);
+        if (hist != NULL)
+            HIST_load_tail(hist, HISTORY_LOAD_MAX, count_line, &loaded);
+        HIST_close(hist);
+    }
+
+    double usec = (now_usec() - start) / HISTORY_ITERATIONS;
+    unlink(file);
+    return loaded > 0 ? usec : -1;
+}
+
+/*
+ * Searches a history of distinct commands made from common words, with
+ * queries that are exact, misspelled, short and common
+ *
+ * Returns: microseconds per search
+ */
+static double bench_history_search()
+{
+    const char *cmds[] = {"git", "make", "grep", "ssh", "docker", "kubectl", "cd", "ls", "vim", "python3"};
+    const char *args[] = {"status", "build", "-rn", "server", "logs", "apply", "src", "-la", "main.c", "test.py"};
+    const char *queries[] = {"docker logs", "kubetcl aply", "gi", "status 4217", "make build"};
+    const char *results[10];
+    char line[64];
+
+    HistIndex hi = HI_new();
+    for (int i = 0; i < SEARCH_ENTRIES; i++)
+    {
+        snprintf(line, sizeof(line), "%s %s %d", cmds[i % 10], args[(i / 10) % 10], i);
+        HI_add(hi, line, strlen(line));
+    }
+
+    int found = 0;
+    double start = now_usec();
+
+    for (int i = 0; i < SEARCH_ITERATIONS; i++)
+        found += HI_search(hi, queries[i % 5], results, 10);
+
+    double usec = (now_usec() - start) / SEARCH_ITERATIONS;
+    HI_free(hi);
+    return found > 0 ? usec : -1;
+}
+
+/*
+ * Creates a PATH of many directories full of commands under /tmp
+ *
+ * Parameters:
+ *   root       Where to create it; filled in
+ *   path       Return space for the PATH
+ *   size       The size of path
+ *
+ * Returns: true on success
+ */
+static bool make_startup_path(char *root, char *path, size_t size)
+{
+    char file[128];
+    size_t len = 0;
+
+    if (mkdtemp(root) == NULL)
+        return false;
+
+    for (int i = 0; i < STARTUP_DIRS; i++)
+    {
+        snprintf(file, sizeof(file), "%s/bin%d", root, i);
+        mkdir(file, 0755);
+        len += snprintf(path + len, size - len, "%s%s", i ? ":" : "", file);
+
+        for (int j = 0; j < STARTUP_COMMANDS; j++)
+        {
+            snprintf(file, sizeof(file), "%s/bin%d/cmd%d_%d", root, i, i, j);
+            int fd = open(file, O_WRONLY | O_CREAT, 0755);
+            if (fd >= 0)
+                close(fd);
+        }
+
+        // as installed programs are, long before the shell starts
+        snprintf(file, sizeof(file), "%s/bin%d", root, i);
+        struct timespec times[2] = {{time(NULL) - 3600, 0}, {time(NULL) - 3600, 0}};
+        utimensat(AT_FDCWD, file, times, 0);
+    }
+
+    return len < size;
+}
+
+/*
+ * Removes what make_startup_path() created
+ */
+static void remove_startup_path(const char *root)
+{
+    char file[128];
+
+    for (int i = 0; i < STARTUP_DIRS; i++)
+    {
+        for (int j = 0; j < STARTUP_COMMANDS; j++)
+        {
+            snprintf(file, sizeof(file), "%s/bin%d/cmd%d_%d", root, i, i, j);
+            unlink(file);
+        }
+        snprintf(file, sizeof(file), "%s/bin%d", root, i);
+        rmdir(file);
+    }
+    rmdir(root);
+}
+
+/*
+ * Starts the caches as the shell does, then either runs a command from
+ * the last PATH directory or completes its name, which are when a cold
+ * shell first has to wait for them. Stopping them again, as the shell
+ * does when it exits, is not timed.
+ *
+ * Parameters:
+ *   path       The PATH
+ *   snap_file  The snapshot to start from, or NULL
+ *   complete   Whether to complete the name instead of running it
+ *
+ * Returns: microseconds until the command was found, or -1 if it was not
+ */
+static double time_startup(const char *path, const char *snap_file, bool complete)
+{
+    char name[32];
+    char **matches = NULL;
+    char *file = NULL;
+    snprintf(name, sizeof(name), "cmd%d_%d", STARTUP_DIRS - 1, STARTUP_COMMANDS - 1);
+
+    double start = now_usec();
+
+    SnapReader snap = snap_file != NULL ? SNAP_open(snap_file) : NULL;
+    PathCache pc = PC_new();
+    if (snap != NULL)
+        PC_load(pc, snap);
+    CommandIndex ci = CI_new(path, NULL, snap);
+
+    if (complete && ci != NULL)
+        matches = CI_complete(ci, path, name);
+    else if (!complete)
+        file = PC_lookup(pc, path, name);
+
+    double usec = now_usec() - start;
+    bool found = matches != NULL || file != NULL;
+
+    for (int i = 0; matches != NULL && matches[i] != NULL; i++)
+        free(matches[i]);
+    free(matches);
+    MEM_free(file);
+    CI_free(ci);
+    PC_free(pc);
+
+    return found ? usec : -1;
+}
+
+/*
+ * Times startups with a PATH of STARTUP_DIRS directories, cold or from
+ * a snapshot that the session before saved when it exited
+ *
+ * Parameters:
+ *   use_snapshot   Whether to start from a snapshot
+ *   complete       Whether to time the first completion instead of the
+ *                  first command
+ *
+ * Returns: microseconds per startup
+ */
+static double bench_startup(bool use_snapshot, bool complete)
+{
+    char root[] = "/tmp/plaid_bench_path_XXXXXX";
+    char snap_file[] = "/tmp/plaid_bench_snap_XXXXXX";
+    char path[STARTUP_DIRS * 64];
+    char name[32];
+    snprintf(name, sizeof(name), "cmd%d_%d", STARTUP_DIRS - 1, STARTUP_COMMANDS - 1);
+
+    bool ok = make_startup_path(root, path, sizeof(path));
+    int fd = mkstemp(snap_file);
+    if (fd >= 0)
+        close(fd);
+
+    // the session before: fill the caches, and save them on exit
+    if (ok && use_snapshot)
+    {
+        PathCache pc = PC_new();
+        CommandIndex ci = CI_new(path, NULL, NULL);
+        MEM_free(PC_lookup(pc, path, name));
+
+        SnapWriter w = SNAP_new();
+        PC_save(pc, w);
+        if (ci != NULL)
+            CI_save(ci, w);
+        ok = fd >= 0 && SNAP_write(w, snap_file);
+        SNAP_free(w);
+        CI_free(ci);
+        PC_free(pc);
+    }
+
+    double usec = ok ? 0 : -1;
+
+    for (int i = 0; usec >= 0 && i < STARTUP_ITERATIONS; i++)
+    {
+        double one = time_startup(path, use_snapshot ? snap_file : NULL, complete);
+        usec = one >= 0 ? usec + one / STARTUP_ITERATIONS : -1;
+    }
+
+    unlink(snap_file);
+    remove_startup_path(root);
+    return usec;
+}
+
+/*
+ * Time to the first prompt and the first command, with no snapshot
+ */
+static double bench_startup_cold()
+{
+    return bench_startup(false, false);
+}
+
+/*
+ * Time to the first prompt and the first command, from a snapshot
+ */
+static double bench_startup_snapshot()
+{
+    return bench_startup(true, false);
+}
+
+/*
+ * Time to the first completion of a command name, with no snapshot
+ */
+static double bench_completion_cold()
+{
+    return bench_startup(false, true);
+}
+
+/*
+ * Time to the first completion of a command name, from a snapshot
+ */
+static double bench_completion_snapshot()
+{
+    return bench_startup(true, true);
+}
+
+/*
+ * Expands a glob as the shell does, noting its directory in the cache
+ */
+static char **parse_glob(const char *pattern, void *cb_data)
+{
+    if (cb_data != NULL)
+        PCACHE_note_glob((ParseCache)cb_data, pattern);
+    return SPEC_glob(NULL, pattern);
+}
+
+/*
+ * Runs PARSE_LINE over and over in a directory of PARSE_FILES files, as
+ * a script or an operator repeating it does
+ *
+ * Parameters:
+ *   use_cache  Whether to look the line up in a parse cache before
+ *              tokenizing, expanding and parsing it again
+ *
+ * Returns: microseconds per line
+ */
+static double bench_parse(bool use_cache)
+{
+    char dir[] = "/tmp/plaid_bench_glob_XXXXXX";
+    char file[64];
+    char errmsg[100];
+    char cwd[4096];
+
+    if (mkdtemp(dir) == NULL || getcwd(cwd, sizeof(cwd)) == NULL)
+        return -1;
+    for (int i = 0; i < PARSE_FILES; i++)
+    {
+        snprintf(file, sizeof(file), "%s/file%d.%c", dir, i, i % 2 ? 'c' : 'h');
+        int fd = open(file, O_WRONLY | O_CREAT, 0644);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    VarTable vars = VAR_new();
+    VAR_set(vars, "HOME", "/home/plaid");
+    ParseCache cache = use_cache ? PCACHE_new(16) : NULL;
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, vars);
+    TOK_state_set_glob(state, parse_glob, cache);
+
+    int parsed = 0;
+    double usec = -1;
+    if (chdir(dir) != 0)
+        goto cleanup;
+
+    double start = now_usec();
+
+    for (int i = 0; i < PARSE_ITERATIONS; i++)
+    {
+        if (cache != NULL && PCACHE_lookup(cache, PARSE_LINE, VAR_generation(vars)) != NULL)
+        {
+            parsed++;
+            continue;
+        }
+
+        if (cache != NULL)
+            PCACHE_begin(cache, PARSE_LINE, VAR_generation(vars));
+        CList tokens = TOK_tokenize_chunk(state, PARSE_LINE, errmsg, sizeof(errmsg));
+        if (tokens == NULL)
+            break;
+        pipeline_t *pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+        parsed += pipeline != NULL;
+
+        if (cache == NULL || !PCACHE_insert(cache, tokens, pipeline))
+        {
+            pipeline_free(pipeline);
+            CL_free(tokens);
+        }
+    }
+
+    if (parsed == PARSE_ITERATIONS)
+        usec = (now_usec() - start) / PARSE_ITERATIONS;
+    chdir(cwd);
+
+cleanup:
+    TOK_state_free(state);
+    PCACHE_free(cache);
+    VAR_free(vars);
+    for (int i = 0; i < PARSE_FILES; i++)
+    {
+        snprintf(file, sizeof(file), "%s/file%d.%c", dir, i, i % 2 ? 'c' : 'h');
+        unlink(file);
+    }
+    rmdir(dir);
+    return usec;
+}
+
+/*
+ * Time to tokenize, expand and parse a line that globs, every time
+ */
+static double bench_parse_line()
+{
+    return bench_parse(false);
+}
+
+/*
+ * Time to run a line that globs again, from the parse cache
+ */
+static double bench_parse_line_cached()
+{
+    return bench_parse(true);
+}
+
+/*
+ * Tokenizes and parses each command of a script, as the shell does
+ * when it runs the script from its text
+ *
+ * Returns: the number of commands parsed
+ */
+static int parse_script(const char *file)
+{
+    char line[256];
+    char errmsg[100];
+    int commands = 0;
+
+    FILE *f = fopen(file, "r");
+    TokState state = TOK_state_new();
+
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        CList tokens = TOK_tokenize_chunk(state, line, errmsg, sizeof(errmsg));
+        pipeline_t *pipeline = tokens != NULL ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+        commands += pipeline != NULL;
+        pipeline_free(pipeline);
+        CL_free(tokens);
+    }
+
+    if (f != NULL)
+        fclose(f);
+    TOK_state_free(state);
+    return commands;
+}
+
+/*
+ * Gets a script of SCRIPT_COMMANDS commands ready to run, as a cron job
+ * running it over and over does
+ *
+ * Parameters:
+ *   compiled   Whether the compiled form of an earlier run is mapped,
+ *              instead of tokenizing and parsing the script every time
+ *
+ * Returns: microseconds per script
+ */
+static double bench_script(bool compiled)
+{
+    char dir[] = "/tmp/plaid_bench_script_XXXXXX";
+    char file[64];
+    char compiled_file[64];
+
+    if (mkdtemp(dir) == NULL)
+        return -1;
+    snprintf(file, sizeof(file), "%s/job.psh", dir);
+    snprintf(compiled_file, sizeof(compiled_file), "%s/job.pshc", dir);
+
+    FILE *f = fopen(file, "w");
+    for (int i = 0; f != NULL && i < SCRIPT_COMMANDS; i++)
+        fprintf(f, "grep -c \"error %d\" /var/log/job.log | tee -a /tmp/report > /dev/null\n", i);
+    if (f != NULL)
+        fclose(f);
+
+    // the run that compiled it
+    SCR_close(SCR_open(file, NULL));
+
+    int commands = 0;
+    double start = now_usec();
+
+    for (int i = 0; i < SCRIPT_ITERATIONS && !compiled; i++)
+        commands += parse_script(file);
+
+    for (int i = 0; i < SCRIPT_ITERATIONS && compiled; i++)
+    {
+        Script script = SCR_open(file, NULL);
+        if (script == NULL)
+            break;
+        for (int j = 0; j < SCR_length(script); j++)
+            commands += SCR_pipeline(script, j) != NULL;
+        SCR_close(script);
+    }
+
+    double usec = (now_usec() - start) / SCRIPT_ITERATIONS;
+    unlink(compiled_file);
+    unlink(file);
+    rmdir(dir);
+    return commands == SCRIPT_COMMANDS * SCRIPT_ITERATIONS ? usec : -1;
+}
+
+/*
+ * Time to tokenize and parse a script, as every run did before scripts
+ * were compiled
+ */
+static double bench_script_parse()
+{
+    return bench_script(false);
+}
+
+/*
+ * Time to map the compiled form of a script
+ */
+static double bench_script_compiled()
+{
+    return bench_script(true);
+}
+
+/*
+ * Generates the words a loop runs over, as $(seq N) would
+ */
+static char *loop_seq(const char *command, void *cb_data)
+{
+    char *output = MEM_alloc(MEM_TOKENS, LOOP_ITERATIONS * 8);
+    size_t len = 0;
+
+    for (int i = 0; output != NULL && i < LOOP_ITERATIONS; i++)
+        len += sprintf(output + len, "%d\n", i);
+    return output;
+}
+
+/*
+ * Runs a builtin in the shell, as a lone builtin is run
+ */
+static bool loop_run(pipeline_t *pipeline, int *status, void *cb_data)
+{
+    const builtin_t *builtin = builtin_lookup(pipeline->head->args);
+
+    *status = builtin != NULL ? builtin->fn(NULL, pipeline->head->args, STDIN_FILENO, STDOUT_FILENO) : 127;
+    (*(int *)cb_data) += *status == 0;
+    return true;
+}
+
+/*
+ * Runs LOOP_BODY for each of LOOP_ITERATIONS words
+ *
+ * Parameters:
+ *   compound   Whether the loop is a for loop parsed once, or the body
+ *              is tokenized and parsed each time as a line that is
+ *              typed again is
+ *
+ * Returns: microseconds per iteration
+ */
+static double bench_loop(bool compound)
+{
+    char errmsg[100];
+    char value[16];
+    int passed = 0;
+    int status;
+
+    VarTable vars = VAR_new();
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, vars);
+    TOK_state_set_subst(state, loop_seq, NULL);
+
+    double start = now_usec();
+
+    if (compound)
+    {
+        CList tokens = TOK_tokenize_chunk(state, "for i in $(seq); do " LOOP_BODY "; done", errmsg, sizeof(errmsg));
+        Compound loop = tokens != NULL ? CTL_parse(tokens, errmsg, sizeof(errmsg)) : NULL;
+        if (loop != NULL)
+            CTL_run(loop, state, vars, loop_run, NULL, &passed, &status);
+        CTL_free(loop);
+    }
+
+    for (int i = 0; i < LOOP_ITERATIONS && !compound; i++)
+    {
+        snprintf(value, sizeof(value), "%d", i);
+        VAR_set(vars, "i", value);
+
+        CList tokens = TOK_tokenize_chunk(state, LOOP_BODY, errmsg, sizeof(errmsg));
+        pipeline_t *pipeline = tokens != NULL ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+        if (pipeline != NULL)
+            loop_run(pipeline, &status, &passed);
+        pipeline_free(pipeline);
+        CL_free(tokens);
+    }
+
+    double usec = (now_usec() - start) / LOOP_ITERATIONS;
+    TOK_state_free(state);
+    VAR_free(vars);
+    return passed == LOOP_ITERATIONS ? usec : -1;
+}
+
+/*
+ * Time to tokenize, parse and run a loop body, as before compound
+ * commands
+ */
+static double bench_loop_reparse()
+{
+    return bench_loop(false);
+}
+
+/*
+ * Time to run a loop body from a for loop that was parsed once
+ */
+static double bench_loop_compound()
+{
+    return bench_loop(true);
+}
+
+/*
+ * Defines a function in a table
+ */
+static void function_define(const char *name, Compound body, void *cb_data)
+{
+    FUNC_define((FuncTable)cb_data, name, body);
+}
+
+/*
+ * Calls a function with a frame of positional parameters, as the shell
+ * calls a lone function
+ */
+static int function_call(Compound body, TokState state, VarTable vars, char **args)
+{
+    int passed = 0;
+    int status;
+
+    VAR_push_args(vars, args);
+    CTL_run(body, state, vars, loop_run, NULL, &passed, &status);
+    VAR_pop_args(vars);
+
+    return passed == 1 ? 0 : 1;
+}
+
+/*
+ * Calls the function of FUNCTION_DEF FUNCTION_ITERATIONS times
+ *
+ * Parameters:
+ *   in_child   Whether each call runs in a forked child, as a function
+ *              in a pipeline does and a wrapper script at least would,
+ *              or in this process
+ *
+ * Returns: microseconds per call
+ */
+static double bench_function(bool in_child)
+{
+    char errmsg[100];
+    char *args[] = {"wrap", "a", "b", NULL};
+    int failed = 0;
+    int status;
+
+    VarTable vars = VAR_new();
+    FuncTable funcs = FUNC_new();
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, vars);
+
+    // the definition is parsed once
+    CList tokens = TOK_tokenize_chunk(state, FUNCTION_DEF, errmsg, sizeof(errmsg));
+    Compound def = tokens != NULL ? CTL_parse(tokens, errmsg, sizeof(errmsg)) : NULL;
+    if (def != NULL)
+        CTL_run(def, state, vars, loop_run, function_define, funcs, &status);
+    CTL_free(def);
+
+    Compound body = FUNC_lookup(funcs, "wrap");
+    double start = now_usec();
+
+    for (int i = 0; i < FUNCTION_ITERATIONS && body != NULL; i++)
+    {
+        if (!in_child)
+        {
+            failed += function_call(body, state, vars, args);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(function_call(body, state, vars, args));
+
+        failed += waitpid(pid, &status, 0) != pid || status != 0;
+    }
+
+    double usec = (now_usec() - start) / FUNCTION_ITERATIONS;
+    TOK_state_free(state);
+    FUNC_free(funcs);
+    VAR_free(vars);
+    return body != NULL && failed == 0 ? usec : -1;
+}
+
+/*
+ * Time to call a function in the shell process
+ */
+static double bench_function_call()
+{
+    return bench_function(false);
+}
+
+/*
+ * Time to call a function in a forked child
+ */
+static double bench_function_fork()
+{
+    return bench_function(true);
+}
+
+/*
+ * Increments a counter ARITH_ITERATIONS times
+ *
+ * Parameters:
+ *   in_shell   Whether the counter is incremented by tokenizing a word
+ *              with $((...)), or by running expr and reading its output
+ *              into the variable, as scripts did before
+ *
+ * Returns: microseconds per increment
+ */
+static double bench_arith(bool in_shell)
+{
+    char errmsg[100];
+    char output[32];
+    int fds[2];
+
+    VarTable vars = VAR_new();
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, vars);
+    VAR_set(vars, "i", "0");
+
+    double start = now_usec();
+
+    for (int i = 0; i < ARITH_ITERATIONS; i++)
+    {
+        if (in_shell)
+        {
+            CL_free(TOK_tokenize_chunk(state, "echo $((i += 1))", errmsg, sizeof(errmsg)));
+            continue;
+        }
+
+        char *argv[] = {"/usr/bin/expr", (char *)VAR_get(vars, "i"), "+", "1", NULL};
+        if (pipe(fds) < 0)
+            break;
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            dup2(fds[1], STDOUT_FILENO);
+            execve(argv[0], argv, environ);
+            _exit(127);
+        }
+
+        close(fds[1]);
+        ssize_t n = read(fds[0], output, sizeof(output) - 1);
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+
+        output[n > 0 ? n - 1 : 0] = '\0';
+        VAR_set(vars, "i", output);
+    }
+
+    double usec = (now_usec() - start) / ARITH_ITERATIONS;
+    bool counted = atoi(VAR_get(vars, "i")) == ARITH_ITERATIONS;
+
+    TOK_state_free(state);
+    VAR_free(vars);
+    return counted ? usec : -1;
+}
+
+/*
+ * Time to increment a counter with $((...))
+ */
+static double bench_arith_expand()
+{
+    return bench_arith(true);
+}
+
+/*
+ * Time to increment a counter by running expr
+ */
+static double bench_arith_expr()
+{
+    return bench_arith(false);
+}
+
+/*
+ * Reads READ_LINES lines with the read builtin, as a while read loop
+ * does, from a file or from a pipe fed by a child
+ *
+ * Parameters:
+ *   from_pipe    Whether the lines come through a pipe
+ *   read_ahead   Whether the pipe may be read in blocks, as in a loop
+ *                that nothing else reads the input of
+ *
+ * Returns: microseconds per line
+ */
+static double bench_read(bool from_pipe, bool read_ahead)
+{
+    char path[] = "/tmp/plaid_bench_read.XXXXXX";
+    char *args[] = {"read", "line", NULL};
+    char data[65536];
+    int lines = 0;
+    int fds[2];
+
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    unlink(path);
+
+    FILE *f = fdopen(fd, "w+");
+    for (int i = 0; i < READ_LINES; i++)
+        fprintf(f, "%d,a typical field,another field\n", i);
+    fflush(f);
+    lseek(fd, 0, SEEK_SET);
+
+    shell_t sh = {VAR_new(), 0};
+    sh.readbuf = RB_new();
+    sh.read_ahead = read_ahead;
+    const builtin_t *read_builtin = builtin_lookup(args);
+    int in_fd = fd;
+    pid_t pid = -1;
+
+    if (from_pipe && pipe(fds) == 0)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            ssize_t n;
+            while ((n = read(fd, data, sizeof(data))) > 0)
+                if (write(fds[1], data, n) != n)
+                    _exit(1);
+            _exit(0);
+        }
+        close(fds[1]);
+        in_fd = fds[0];
+    }
+
+    double start = now_usec();
+
+    while (read_builtin->fn(&sh, args, in_fd, STDOUT_FILENO) == 0)
+        lines++;
+
+    double usec = (now_usec() - start) / READ_LINES;
+
+    if (pid > 0)
+    {
+        close(in_fd);
+        waitpid(pid, NULL, 0);
+    }
+    fclose(f);
+    RB_free(sh.readbuf);
+    VAR_free(sh.vars);
+    return lines == READ_LINES ? usec : -1;
+}
+
+/*
+ * Time to read a line of a file
+ */
+static double bench_read_file()
+{
+    return bench_read(false, false);
+}
+
+/*
+ * Time to read a line of a pipe that a while read loop owns
+ */
+static double bench_read_pipe()
+{
+    return bench_read(true, true);
+}
+
+/*
+ * Time to read a line of a pipe a byte at a time, as when other
+ * commands read the pipe too
+ */
+static double bench_read_pipe_bytes()
+{
+    return bench_read(true, false);
+}
+
+/*
+ * Runs SERVE_ITERATIONS command lines with the plaid binary, each in a
+ * shell started for it or all by one serving shell. The command is found
+ * after the STARTUP_DIRS directories at the front of the PATH, so a new
+ * shell has to search them again each time.
+ *
+ * Parameters:
+ *   warm   Whether the command lines go to a shell started with --serve
+ *
+ * Returns: microseconds per command line, or -1 if ./plaid is missing
+ */
+static double bench_serve(bool warm)
+{
+    char root[] = "/tmp/plaid_bench_serve_XXXXXX";
+    char path[STARTUP_DIRS * 64 + 32];
+    char script[64], sock[64], path_var[sizeof(path) + 32], home_var[64];
+    int devnull = open("/dev/null", O_RDWR);
+
+    if (access("./plaid", X_OK) != 0 || devnull < 0 || !make_startup_path(root, path, sizeof(path) - 32))
+    {
+        if (devnull >= 0)
+            close(devnull);
+        return -1;
+    }
+
+    // a PATH, and no snapshot or history, as on a build machine
+    snprintf(path_var, sizeof(path_var), "PATH=%s:/usr/bin:/bin", path);
+    snprintf(home_var, sizeof(home_var), "HOME=%s", root);
+    char *envp[] = {path_var, home_var, NULL};
+
+    snprintf(script, sizeof(script), "%s/run.psh", root);
+    snprintf(sock, sizeof(sock), "%s/sock", root);
+    FILE *f = fopen(script, "w");
+    if (f != NULL)
+    {
+        fprintf(f, "true\n");
+        fclose(f);
+    }
+
+    pid_t server = -1;
+    if (warm)
+    {
+        server = fork();
+        if (server == 0)
+        {
+            char *argv[] = {"./plaid", "--serve", sock, NULL};
+            dup2(devnull, STDOUT_FILENO);
+            execve(argv[0], argv, envp);
+            _exit(127);
+        }
+
+        // it is ready once its socket is there
+        for (int i = 0; i < 500 && access(sock, F_OK) != 0; i++)
+            usleep(10000);
+    }
+
+    int failed = 0;
+    double start = now_usec();
+
+    for (int i = 0; i < SERVE_ITERATIONS; i++)
+    {
+        int status = -1;
+        if (warm)
+        {
+            if (SRV_request(sock, "true", &status) != 0)
+                status = -1;
+        }
+        else
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                char *argv[] = {"./plaid", script, NULL};
+                dup2(devnull, STDOUT_FILENO);
+                execve(argv[0], argv, envp);
+                _exit(127);
+            }
+            waitpid(pid, &status, 0);
+        }
+        failed += status != 0;
+    }
+
+    double usec = (now_usec() - start) / SERVE_ITERATIONS;
+
+    if (server > 0)
+    {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    unlink(script);
+    unlink(sock);
+    remove_startup_path(root);
+    close(devnull);
+    return failed == 0 ? usec : -1;
+}
+
+/*
+ * Time to run a command line in a new shell
+ */
+static double bench_serve_cold()
+{
+    return bench_serve(false);
+}
+
+/*
+ * Time to run a command line on a serving shell
+ */
+static double bench_serve_warm()
+{
+    return bench_serve(true);
+}
+
+/*
+ * Runs EMBED_ITERATIONS command lines as a job runner would, each with
+ * a /bin/sh started for it or all parsed once and run by the library
+ * in this process
+ *
+ * Parameters:
+ *   embedded   Whether the command lines are run by the library
+ *
+ * Returns: microseconds per command line, or -1 if one failed
+ */
+static double bench_embed(bool embedded)
+{
+    char errmsg[100];
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    Plaid plaid = PLAID_new(environ);
+    PlaidJob job = PLAID_parse(EMBED_LINE, errmsg, sizeof(errmsg));
+
+    int failed = devnull < 0 || job == NULL;
+    double start = now_usec();
+
+    for (int i = 0; i < EMBED_ITERATIONS && !failed; i++)
+    {
+        int status = -1;
+        if (embedded)
+            status = PLAID_run(plaid, job, STDIN_FILENO, devnull, STDERR_FILENO);
+        else
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                char *argv[] = {"/bin/sh", "-c", EMBED_LINE, NULL};
+                dup2(devnull, STDOUT_FILENO);
+                execve(argv[0], argv, environ);
+                _exit(127);
+            }
+            waitpid(pid, &status, 0);
+        }
+        failed += status != 0;
+    }
+
+    double usec = (now_usec() - start) / EMBED_ITERATIONS;
+
+    PLAID_job_free(job);
+    PLAID_free(plaid);
+    if (devnull >= 0)
+        close(devnull);
+    return failed == 0 ? usec : -1;
+}
+
+/*
+ * Time to run a command line with /bin/sh -c
+ */
+static double bench_embed_sh()
+{
+    return bench_embed(false);
+}
+
+/*
+ * Time to run a parsed command line with the library
+ */
+static double bench_embed_run()
+{
+    return bench_embed(true);
+}
+
+/*
+ * Gets a pipeline as an executor given the command line would: by
+ * tokenizing and parsing it, or by decoding the encoding of it
+ *
+ * Parameters:
+ *   decode   Whether the pipeline is decoded from its flat encoding
+ *
+ * Returns: microseconds per pipeline, or -1 if one failed
+ */
+static double bench_flat(bool decode)
+{
+    char errmsg[100];
+    size_t len = 0;
+    void *buf = NULL;
+    int failed = 0;
+
+    CList tokens = TOK_tokenize_input(FLAT_LINE, errmsg, sizeof(errmsg));
+    pipeline_t *pipeline = tokens != NULL ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+    if (pipeline == NULL)
+    {
+        CL_free(tokens);
+        return -1;
+    }
+    buf = FP_encode(pipeline, &len);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    double start = now_usec();
+
+    for (int i = 0; i < FLAT_ITERATIONS; i++)
+    {
+        tokens = NULL;
+        if (decode)
+            pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+        else
+        {
+            tokens = TOK_tokenize_input(FLAT_LINE, errmsg, sizeof(errmsg));
+            pipeline = tokens != NULL ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+        }
+
+        failed += pipeline == NULL;
+        pipeline_free(pipeline);
+        CL_free(tokens);
+    }
+
+    double usec = (now_usec() - start) / FLAT_ITERATIONS;
+
+    MEM_free(buf);
+    return failed == 0 ? usec : -1;
+}
+
+/*
+ * Time to tokenize and parse a command line
+ */
+static double bench_flat_parse()
+{
+    return bench_flat(false);
+}
+
+/*
+ * Time to decode the flat encoding of a pipeline
+ */
+static double bench_flat_decode()
+{
+    return bench_flat(true);
+}
+
+/*
+ * Tokenizes and parses a command line with the tokens and the pipeline
+ * allocated from an allocator
+ *
+ * Parameters:
+ *   allocator  The allocator, which is freed after
+ *
+ * Returns: microseconds per command line, or -1 if one failed
+ */
+static double bench_alloc(MemAllocator allocator)
+{
+    MEM_set_allocator(MEM_TOKENS, allocator);
+    MEM_set_allocator(MEM_PIPELINE, allocator);
+
+    double usec = bench_flat(false);
+
+    MEM_set_allocator(MEM_TOKENS, NULL);
+    MEM_set_allocator(MEM_PIPELINE, NULL);
+    MEM_allocator_free(allocator);
+    return usec;
+}
+
+/*
+ * Time to parse a command line with malloc()
+ */
+static double bench_alloc_system()
+{
+    return bench_alloc(MEM_system());
+}
+
+/*
+ * Time to parse a command line in an arena
+ */
+static double bench_alloc_arena()
+{
+    return bench_alloc(MEM_arena_new());
+}
+
+/*
+ * Time to parse a command line from a pool
+ */
+static double bench_alloc_pool()
+{
+    return bench_alloc(MEM_pool_new());
+}
+
+// the benchmarks, in the order they are run
+static const struct
+{
+    const char *name;
+    double (*fn)();
+} benchmarks[] = {
+    {"launch_fork", bench_launch_fork},
+    {"launch_zygote", bench_launch_zygote},
+    {"history_load", bench_history_load},
+    {"history_search", bench_history_search},
+    {"startup_cold", bench_startup_cold},
+    {"startup_snapshot", bench_startup_snapshot},
+    {"completion_cold", bench_completion_cold},
+    {"completion_snapshot", bench_completion_snapshot},
+    {"parse_line", bench_parse_line},
+    {"parse_line_cached", bench_parse_line_cached},
+    {"script_parse", bench_script_parse},
+    {"script_compiled", bench_script_compiled},
+    {"loop_reparse", bench_loop_reparse},
+    {"loop_compound", bench_loop_compound},
+    {"function_call", bench_function_call},
+    {"function_fork", bench_function_fork},
+    {"arith_expand", bench_arith_expand},
+    {"arith_expr", bench_arith_expr},
+    {"read_file", bench_read_file},
+    {"read_pipe", bench_read_pipe},
+    {"read_pipe_bytes", bench_read_pipe_bytes},
+    {"serve_cold", bench_serve_cold},
+    {"serve_warm", bench_serve_warm},
+    {"embed_sh", bench_embed_sh},
+    {"embed_run", bench_embed_run},
+    {"flat_parse", bench_flat_parse},
+    {"flat_decode", bench_flat_decode},
+    {"alloc_system", bench_alloc_system},
+    {"alloc_arena", bench_alloc_arena},
+    {"alloc_pool", bench_alloc_pool},
+};
+
+int main(int argc, char *argv[])
+{
+    char *heap = NULL;
+
+    zygote = ZYG_start();
+
+    for (int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (argc > 1 && strcmp(argv[1], benchmarks[i].name) != 0)
+            continue;
+
+        if (heap == NULL)
+        {
+            heap = malloc(SHELL_HEAP_SIZE);
+            if (heap != NULL)
+                memset(heap, 1, SHELL_HEAP_SIZE);
+        }
+
+        printf("%-24s %10.1f usec\n", benchmarks[i].name, benchmarks[i].fn());
+        fflush(stdout);
+    }
+
+    free(heap);
+    ZYG_stop(zygote);
+    return 0;
+}
@@ -0,0 +1,1543 @@
+/*
+ * builtins.c
+ *
+ * The builtin commands of the shell and their registry
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "builtins.h"
+#include "mem.h"
+
+#define OUTBUF_SIZE 4096
+#define INBUF_SIZE 65536
+
+// the output fd given to the first stage of a fused chain
+#define FUSED_FD -2
+
+// output of a builtin, buffered so that it takes few write() calls
+struct outbuf
+{
+    int fd;
+    struct filter *sink; // the next stage of a fused chain, or NULL to write to fd
+    size_t len;
+    bool error; // a write failed, e.g. the reader of the pipe went away
+    char data[OUTBUF_SIZE];
+};
+
+// options of the text builtins that they handle themselves
+struct wc_opts
+{
+    bool lines, words, bytes;
+};
+
+struct head_opts
+{
+    long long count;
+    bool bytes; // count bytes (-c) instead of lines (-n)
+};
+
+struct grep_opts
+{
+    const char *pattern;
+    bool invert, count, quiet;
+};
+
+// a builtin that is fed its input by the stage before it in a fused
+// chain, or by run_filter reading an fd
+struct filter
+{
+    const struct filter_ops *ops;
+    struct outbuf out;
+    bool done; // wants no more input, e.g. head has copied enough
+
+    char *partial; // an incomplete last line, held back until the rest is fed
+    size_t partial_len;
+    size_t partial_cap;
+
+    union
+    {
+        struct
+        {
+            struct wc_opts opts;
+            unsigned long long lines, words, bytes;
+            bool in_word;
+        } wc;
+        struct
+        {
+            struct head_opts opts;
+            long long remaining;
+        } head;
+        struct
+        {
+            struct grep_opts opts;
+            size_t pattern_len;
+            unsigned long long selected;
+        } grep;
+    } u;
+};
+
+struct filter_ops
+{
+    void (*start)(struct filter *f, char **args);
+    void (*feed)(struct filter *f, const char *data, size_t n);
+    int (*finish)(struct filter *f); // returns the exit status
+};
+
+// where the first stage of the fused chain run by this thread writes
+static __thread struct filter *fused_sink;
+
+// which variables a listing prints
+struct list_data
+{
+    int out_fd;
+    bool exported_only;
+};
+
+/*
+ * Write out and empty the buffer
+ *
+ * Parameters:
+ *  ob: the output buffer
+ *
+ * Returns:
+ *  0 if everything written so far reached the fd, 1 otherwise
+ */
+static int out_flush(struct outbuf *ob)
+{
+    size_t done = 0;
+
+    // in a fused chain the data goes straight to the next stage
+    if (ob->sink != NULL)
+    {
+        if (ob->sink->done)
+            ob->error = true;
+        else if (ob->len > 0)
+            ob->sink->ops->feed(ob->sink, ob->data, ob->len);
+
+        ob->len = 0;
+        return ob->error ? 1 : 0;
+    }
+
+    while (done < ob->len && !ob->error)
+    {
+        ssize_t n = write(ob->fd, ob->data + done, ob->len - done);
+        if (n < 0 && errno != EINTR)
+            ob->error = true;
+        else if (n > 0)
+            done += n;
+    }
+
+    ob->len = 0;
+    return ob->error ? 1 : 0;
+}
+
+/*
+ * Set up an empty output buffer for out_fd
+ */
+static void out_init(struct outbuf *ob, int out_fd)
+{
+    ob->fd = out_fd;
+    ob->sink = out_fd == FUSED_FD ? fused_sink : NULL;
+    ob->len = 0;
+    ob->error = false;
+}
+
+/*
+ * Add n bytes to the buffer, flushing it when it fills up
+ */
+static void out_write(struct outbuf *ob, const char *s, size_t n)
+{
+    while (n > 0)
+    {
+        if (ob->len == OUTBUF_SIZE)
+            out_flush(ob);
+
+        size_t chunk = OUTBUF_SIZE - ob->len < n ? OUTBUF_SIZE - ob->len : n;
+        memcpy(ob->data + ob->len, s, chunk);
+        ob->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static void out_putc(struct outbuf *ob, char c)
+{
+    out_write(ob, &c, 1);
+}
+
+static void out_puts(struct outbuf *ob, const char *s)
+{
+    out_write(ob, s, strlen(s));
+}
+
+/*
+ * Format into the buffer, as printf
+ */
+static void out_printf(struct outbuf *ob, const char *fmt, ...)
+{
+    va_list ap;
+    char small[256];
+
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+        return;
+
+    if (n < sizeof(small))
+    {
+        out_write(ob, small, n);
+        return;
+    }
+
+    // too long for the stack buffer, e.g. a wide field
+    char *big = MEM_alloc(MEM_IO, n + 1);
+    if (big == NULL)
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(big, n + 1, fmt, ap);
+    va_end(ap);
+
+    out_write(ob, big, n);
+    MEM_free(big);
+}
+
+/*
+ * Write the character for the backslash escape at s (\n, \t, \0NNN...)
+ *
+ * Parameters:
+ *  ob: the output buffer
+ *  s: points to the backslash
+ *  stop: set to true for \c, which ends the output
+ *
+ * Returns:
+ *  a pointer to the last character of the escape
+ */
+static const char *out_escape(struct outbuf *ob, const char *s, bool *stop)
+{
+    switch (s[1])
+    {
+    case 'n':
+        out_putc(ob, '\n');
+        return s + 1;
+    case 't':
+        out_putc(ob, '\t');
+        return s + 1;
+    case 'r':
+        out_putc(ob, '\r');
+        return s + 1;
+    case 'a':
+        out_putc(ob, '\a');
+        return s + 1;
+    case 'b':
+        out_putc(ob, '\b');
+        return s + 1;
+    case 'f':
+        out_putc(ob, '\f');
+        return s + 1;
+    case 'v':
+        out_putc(ob, '\v');
+        return s + 1;
+    case '\\':
+        out_putc(ob, '\\');
+        return s + 1;
+    case 'c':
+        *stop = true;
+        return s + 1;
+    case '0':
+    {
+        // up to three octal digits after the 0
+        int value = 0, i;
+        for (i = 2; i < 5 && s[i] >= '0' && s[i] <= '7'; i++)
+            value = value * 8 + (s[i] - '0');
+        out_putc(ob, (char)value);
+        return s + i - 1;
+    }
+    case '\0':
+        out_putc(ob, '\\');
+        return s;
+    default:
+        out_putc(ob, '\\');
+        out_putc(ob, s[1]);
+        return s + 1;
+    }
+}
+
+/*
+ * Create a filter and parse its arguments
+ *
+ * Parameters:
+ *  ops: what the filter does
+ *  args: the command and its arguments
+ *  out_fd: where the filter writes
+ *  sink: the next stage of a fused chain, or NULL to write to out_fd
+ *
+ * Returns:
+ *  the new filter
+ */
+static struct filter *filter_new(const struct filter_ops *ops, char **args, int out_fd, struct filter *sink)
+{
+    struct filter *f = MEM_calloc(MEM_IO, 1, sizeof(struct filter));
+    assert(f != NULL);
+
+    f->ops = ops;
+    out_init(&f->out, out_fd);
+    if (sink != NULL)
+        f->out.sink = sink;
+
+    ops->start(f, args);
+    return f;
+}
+
+/*
+ * Tell a filter its input has ended, flush its output and free it
+ *
+ * Returns:
+ *  the exit status of the filter
+ */
+static int filter_finish(struct filter *f)
+{
+    int status = f->ops->finish(f);
+
+    if (out_flush(&f->out) != 0 && status == 0)
+        status = 1;
+
+    MEM_free(f->partial);
+    MEM_free(f);
+    return status;
+}
+
+/*
+ * Append to the incomplete line a filter is holding back
+ */
+static void filter_hold(struct filter *f, const char *data, size_t n)
+{
+    if (f->partial_len + n > f->partial_cap)
+    {
+        f->partial_cap = (f->partial_len + n) * 2;
+        f->partial = MEM_realloc(MEM_IO, f->partial, f->partial_cap);
+        assert(f->partial != NULL);
+    }
+
+    memcpy(f->partial + f->partial_len, data, n);
+    f->partial_len += n;
+}
+
+/*
+ * Pass the complete lines of a block to fn, holding back an incomplete
+ * last line until the rest of it is fed
+ *
+ * Parameters:
+ *  f: the filter
+ *  data: the block
+ *  n: the size of the block
+ *  fn: called with runs of one or more whole lines
+ */
+static void filter_lines(struct filter *f, const char *data, size_t n,
+                         void (*fn)(struct filter *f, const char *lines, size_t n))
+{
+    const char *last_nl = memrchr(data, '\n', n);
+
+    if (last_nl == NULL)
+    {
+        filter_hold(f, data, n);
+        return;
+    }
+
+    // complete the held back line with the start of this block
+    if (f->partial_len > 0)
+    {
+        const char *nl = memchr(data, '\n', n);
+        filter_hold(f, data, nl + 1 - data);
+        fn(f, f->partial, f->partial_len);
+        f->partial_len = 0;
+
+        n -= nl + 1 - data;
+        data = nl + 1;
+    }
+
+    size_t complete = last_nl + 1 - data;
+    if (complete > 0 && !f->done)
+        fn(f, data, complete);
+
+    filter_hold(f, data + complete, n - complete);
+}
+
+/*
+ * Run a filter on the input read from in_fd, stopping early once it
+ * wants no more, so that the writer of a pipe gets SIGPIPE
+ *
+ * Returns:
+ *  the exit status of the filter
+ */
+static int run_filter(const struct filter_ops *ops, char **args, int in_fd, int out_fd)
+{
+    struct filter *f = filter_new(ops, args, out_fd, NULL);
+    char *block = MEM_alloc(MEM_IO, INBUF_SIZE);
+    assert(block != NULL);
+
+    while (!f->done)
+    {
+        ssize_t n = read(in_fd, block, INBUF_SIZE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        f->ops->feed(f, block, n);
+    }
+
+    MEM_free(block);
+    return filter_finish(f);
+}
+
+/*
+ * Count the newlines in n bytes, 64 bytes at a time with SSE2 compares
+ * and a popcount of the resulting bit mask
+ */
+static size_t count_newlines(const char *s, size_t n)
+{
+    size_t count = 0, i = 0;
+
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    for (; i + 64 <= n; i += 64)
+    {
+        uint64_t mask = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(s + i + 16 * j));
+            mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, nl)) << (16 * j);
+        }
+        count += __builtin_popcountll(mask);
+    }
+#endif
+
+    for (; i < n; i++)
+        count += s[i] == '\n';
+
+    return count;
+}
+
+/*
+ * Parse a non-negative decimal count, as for head -n
+ *
+ * Returns:
+ *  true if s is all digits, false otherwise
+ */
+static bool parse_count(const char *s, long long *count)
+{
+    if (s == NULL || *s == '\0' || strspn(s, "0123456789") != strlen(s))
+        return false;
+
+    *count = strtoll(s, NULL, 10);
+    return true;
+}
+
+/*
+ * Parse the options of wc. Only -l, -w and -c reading the standard
+ * input are handled; anything else is left to the external wc.
+ *
+ * Returns:
+ *  true if the builtin handles these arguments
+ */
+static bool wc_options(char **args, struct wc_opts *opts)
+{
+    *opts = (struct wc_opts){false, false, false};
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        if (args[i][0] != '-' || args[i][1] == '\0' || strspn(args[i] + 1, "lwc") != strlen(args[i] + 1))
+            return false;
+
+        opts->lines |= strchr(args[i], 'l') != NULL;
+        opts->words |= strchr(args[i], 'w') != NULL;
+        opts->bytes |= strchr(args[i], 'c') != NULL;
+    }
+
+    // with no options, wc prints all three counts
+    if (!opts->lines && !opts->words && !opts->bytes)
+        *opts = (struct wc_opts){true, true, true};
+
+    return true;
+}
+
+/*
+ * Parse the options of head: -n N, -nN, -N or -c N, reading the
+ * standard input
+ *
+ * Returns:
+ *  true if the builtin handles these arguments
+ */
+static bool head_options(char **args, struct head_opts *opts)
+{
+    *opts = (struct head_opts){10, false};
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        const char *arg = args[i];
+
+        if (arg[0] != '-')
+            return false;
+
+        if (arg[1] == 'n' || arg[1] == 'c')
+        {
+            opts->bytes = arg[1] == 'c';
+            const char *value = arg[2] != '\0' ? arg + 2 : args[++i];
+            if (!parse_count(value, &opts->count))
+                return false;
+        }
+        else if (!parse_count(arg + 1, &opts->count))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Parse the options of grep. Only a fixed string (given with -F, or a
+ * pattern without regular expression characters) of one line, read
+ * from the standard input, is handled, with the options -F, -v, -c and
+ * -q.
+ *
+ * Returns:
+ *  true if the builtin handles these arguments
+ */
+static bool grep_options(char **args, struct grep_opts *opts)
+{
+    bool fixed = false;
+    int i;
+
+    *opts = (struct grep_opts){NULL, false, false, false};
+
+    for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strspn(args[i] + 1, "Fvcq") != strlen(args[i] + 1))
+            return false;
+
+        fixed |= strchr(args[i], 'F') != NULL;
+        opts->invert |= strchr(args[i], 'v') != NULL;
+        opts->count |= strchr(args[i], 'c') != NULL;
+        opts->quiet |= strchr(args[i], 'q') != NULL;
+    }
+
+    // exactly one pattern and no files
+    if (args[i] == NULL || args[i + 1] != NULL)
+        return false;
+
+    opts->pattern = args[i];
+
+    // a newline makes several patterns, and the search must not match
+    // across the end of a line
+    if (strchr(opts->pattern, '\n') != NULL)
+        return false;
+
+    return fixed || strpbrk(opts->pattern, "\\.[]*^$") == NULL;
+}
+
+/*
+ * Print one variable for set (NAME=value) or export (export NAME=value)
+ */
+static void list_var(const char *name, const char *value, bool exported, void *cb_data)
+{
+    struct list_data *ld = (struct list_data *)cb_data;
+
+    // skip special parameters such as $?
+    if (!VAR_valid_name(name, strlen(name)))
+        return;
+
+    if (ld->exported_only && exported)
+        dprintf(ld->out_fd, "export %s=%s\n", name, value);
+    else if (!ld->exported_only)
+        dprintf(ld->out_fd, "%s=%s\n", name, value);
+}
+
+/*
+ * Print an error message for errno to the shell's standard error, as
+ * perror() does to the process's
+ */
+static void builtin_perror(shell_t *sh, const char *what)
+{
+    dprintf(sh->err_fd, "%s: %s\n", what, strerror(errno));
+}
+
+/*
+ * Set a variable from a NAME=VALUE argument
+ *
+ * Parameters:
+ *  sh: the shell
+ *  cmd: the name of the builtin, for error messages
+ *  arg: the argument, either NAME=VALUE or NAME
+ *  name_len: return space for the length of NAME
+ *
+ * Returns:
+ *  0 on success, 1 if NAME is not a valid variable name
+ */
+static int assign_var(shell_t *sh, const char *cmd, const char *arg, int *name_len)
+{
+    const char *eq = strchr(arg, '=');
+    int len = eq ? eq - arg : strlen(arg);
+
+    if (!VAR_valid_name(arg, len))
+    {
+        dprintf(sh->err_fd, "%s: '%s': not a valid identifier\n", cmd, arg);
+        return 1;
+    }
+
+    if (eq != NULL)
+    {
+        char *name = MEM_strndup(MEM_VARS, arg, len);
+        VAR_set(sh->vars, name, eq + 1);
+        MEM_free(name);
+    }
+
+    *name_len = len;
+    return 0;
+}
+
+static int builtin_author(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    struct outbuf ob;
+
+    out_init(&ob, out_fd);
+    out_puts(&ob, "Niyomwungeri Parmenide ISHIMWE\n");
+    return out_flush(&ob);
+}
+
+static int builtin_pwd(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL)
+    {
+        builtin_perror(sh, "pwd");
+        return 1;
+    }
+
+    struct outbuf ob;
+    out_init(&ob, out_fd);
+    out_puts(&ob, cwd);
+    out_putc(&ob, '\n');
+    free(cwd);
+    return out_flush(&ob);
+}
+
+static int builtin_cd(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    const char *dir = args[1] != NULL ? args[1] : VAR_get(sh->vars, "HOME");
+
+    if (dir == NULL)
+    {
+        dprintf(sh->err_fd, "cd: HOME not set\n");
+        return 1;
+    }
+
+    if (chdir(dir) != 0)
+    {
+        builtin_perror(sh, dir);
+        return 1;
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd != NULL)
+    {
+        VAR_set(sh->vars, "PWD", cwd);
+        free(cwd);
+    }
+
+    return 0;
+}
+
+static int builtin_hash(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    int status = 0;
+
+    if (sh->pathcache == NULL)
+        return 0;
+
+    // "hash -r" forgets every command, "hash NAME..." finds them now
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        if (strcmp(args[i], "-r") == 0)
+        {
+            PC_clear(sh->pathcache);
+            continue;
+        }
+
+        char *file = PC_lookup(sh->pathcache, VAR_get(sh->vars, "PATH"), args[i]);
+        if (file == NULL)
+        {
+            dprintf(sh->err_fd, "hash: %s: not found\n", args[i]);
+            status = 1;
+        }
+        MEM_free(file);
+    }
+
+    return status;
+}
+
+static int builtin_stats(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    struct outbuf ob;
+    out_init(&ob, out_fd);
+
+    if (sh->parsecache != NULL)
+    {
+        struct pcache_stats st;
+        PCACHE_stats(sh->parsecache, &st);
+
+        unsigned long lookups = st.hits + st.misses;
+        out_printf(&ob, "parse cache: %lu hits, %lu misses (%.1f%% hit rate), %lu stale, %lu uncacheable, %d/%d entries\n",
+                   st.hits, st.misses, lookups > 0 ? 100.0 * st.hits / lookups : 0.0,
+                   st.stale, st.uncacheable, st.entries, st.capacity);
+    }
+
+    return out_flush(&ob);
+}
+
+/*
+ * Find the allocator memstats names for a tag, creating an arena or a
+ * pool for the tag the first time one is asked for. They are kept for
+ * as long as the shell runs, since blocks from them may still be live.
+ *
+ * Returns: The allocator, or NULL if the name is not one
+ */
+static MemAllocator memstats_allocator(MemTag tag, const char *name)
+{
+    static MemAllocator arenas[MEM_NUM_TAGS];
+    static MemAllocator pools[MEM_NUM_TAGS];
+
+    if (strcmp(name, "system") == 0)
+        return MEM_system();
+
+    if (strcmp(name, "arena") == 0)
+    {
+        if (arenas[tag] == NULL)
+            arenas[tag] = MEM_arena_new();
+        return arenas[tag];
+    }
+
+    if (strcmp(name, "pool") == 0)
+    {
+        if (pools[tag] == NULL)
+            pools[tag] = MEM_pool_new();
+        return pools[tag];
+    }
+
+    return NULL;
+}
+
+static int builtin_memstats(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    // "memstats TAG ALLOCATOR" changes where a tag gets its memory from
+    if (args[1] != NULL)
+    {
+        MemTag tag;
+        MemAllocator allocator;
+
+        if (args[2] == NULL || args[3] != NULL)
+        {
+            dprintf(sh->err_fd, "memstats: usage: memstats [TAG system|arena|pool]\n");
+            return 2;
+        }
+        if (!MEM_find_tag(args[1], &tag))
+        {
+            dprintf(sh->err_fd, "memstats: %s: no such tag\n", args[1]);
+            return 1;
+        }
+        if ((allocator = memstats_allocator(tag, args[2])) == NULL)
+        {
+            dprintf(sh->err_fd, "memstats: %s: no such allocator\n", args[2]);
+            return 1;
+        }
+
+        MEM_set_allocator(tag, allocator);
+        return 0;
+    }
+
+    struct outbuf ob;
+    out_init(&ob, out_fd);
+
+    out_printf(&ob, "%-10s %-10s %12s %10s %12s %12s\n", "tag", "allocator", "bytes", "blocks", "peak", "allocs");
+    for (int i = 0; i < MEM_NUM_TAGS; i++)
+    {
+        struct mem_stats st;
+        MEM_stats(i, &st);
+        out_printf(&ob, "%-10s %-10s %12zu %10zu %12zu %12lu\n", MEM_tag_name(i),
+                   MEM_allocator_name(MEM_get_allocator(i)), st.bytes, st.blocks, st.peak_bytes, st.allocs);
+    }
+
+    return out_flush(&ob);
+}
+
+static int builtin_export(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    int status = 0;
+
+    // with no arguments, list the exported variables
+    if (args[1] == NULL)
+    {
+        struct list_data ld = {out_fd, true};
+        VAR_foreach(sh->vars, list_var, &ld);
+        return 0;
+    }
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        int len;
+        if (assign_var(sh, "export", args[i], &len) != 0)
+        {
+            status = 1;
+            continue;
+        }
+
+        char *name = MEM_strndup(MEM_VARS, args[i], len);
+        VAR_export(sh->vars, name);
+        MEM_free(name);
+    }
+
+    return status;
+}
+
+static int builtin_unset(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    for (int i = 1; args[i] != NULL; i++)
+        VAR_unset(sh->vars, args[i]);
+
+    return 0;
+}
+
+static int builtin_set(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    int status = 0;
+
+    // with no arguments, list all the variables
+    if (args[1] == NULL)
+    {
+        struct list_data ld = {out_fd, false};
+        VAR_foreach(sh->vars, list_var, &ld);
+        return 0;
+    }
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        int len;
+        if (strchr(args[i], '=') == NULL)
+        {
+            dprintf(sh->err_fd, "set: '%s': expected NAME=VALUE\n", args[i]);
+            status = 1;
+        }
+        else if (assign_var(sh, "set", args[i], &len) != 0)
+            status = 1;
+    }
+
+    return status;
+}
+
+static int builtin_true(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    return 0;
+}
+
+static int builtin_false(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    return 1;
+}
+
+static int builtin_echo(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    struct outbuf ob;
+    bool newline = true, escapes = false, stop = false;
+    int i = 1;
+
+    out_init(&ob, out_fd);
+
+    // leading -n, -e and -ne options
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0' && strspn(args[i] + 1, "ne") == strlen(args[i] + 1); i++)
+    {
+        if (strchr(args[i], 'n') != NULL)
+            newline = false;
+        if (strchr(args[i], 'e') != NULL)
+            escapes = true;
+    }
+
+    for (int first = i; args[i] != NULL && !stop; i++)
+    {
+        if (i > first)
+            out_putc(&ob, ' ');
+
+        if (!escapes)
+            out_puts(&ob, args[i]);
+        else
+        {
+            for (const char *c = args[i]; *c != '\0' && !stop; c++)
+            {
+                if (*c == '\\')
+                    c = out_escape(&ob, c, &stop);
+                else
+                    out_putc(&ob, *c);
+            }
+        }
+    }
+
+    if (newline && !stop)
+        out_putc(&ob, '\n');
+
+    return out_flush(&ob);
+}
+
+static int builtin_printf(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    struct outbuf ob;
+    bool stop = false;
+
+    out_init(&ob, out_fd);
+
+    if (args[1] == NULL)
+    {
+        dprintf(sh->err_fd, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    // the format is reused for as long as arguments remain
+    char **arg = &args[2];
+    bool consumed;
+    do
+    {
+        consumed = false;
+
+        for (const char *f = args[1]; *f != '\0' && !stop; f++)
+        {
+            if (*f == '\\')
+            {
+                f = out_escape(&ob, f, &stop);
+                continue;
+            }
+
+            if (*f != '%')
+            {
+                out_putc(&ob, *f);
+                continue;
+            }
+
+            if (*(f + 1) == '%')
+            {
+                out_putc(&ob, '%');
+                f++;
+                continue;
+            }
+
+            // copy the flags, width and precision of the conversion
+            char spec[40] = "%";
+            int n = 1;
+            for (f++; *f != '\0' && strchr("-+ #0", *f) != NULL && n < 8; f++)
+                spec[n++] = *f;
+            for (; isdigit(*f) && n < 16; f++)
+                spec[n++] = *f;
+            if (*f == '.')
+                for (spec[n++] = *f++; isdigit(*f) && n < 24; f++)
+                    spec[n++] = *f;
+
+            if (*f == '\0')
+                break;
+
+            const char *value = *arg != NULL ? *arg++ : NULL;
+            if (value != NULL)
+                consumed = true;
+
+            switch (*f)
+            {
+            case 'd':
+            case 'i':
+                strcpy(spec + n, "lld");
+                out_printf(&ob, spec, value ? strtoll(value, NULL, 0) : 0LL);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                sprintf(spec + n, "ll%c", *f);
+                out_printf(&ob, spec, value ? strtoull(value, NULL, 0) : 0ULL);
+                break;
+            case 'f':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                sprintf(spec + n, "%c", *f);
+                out_printf(&ob, spec, value ? strtod(value, NULL) : 0.0);
+                break;
+            case 'c':
+                strcpy(spec + n, "c");
+                out_printf(&ob, spec, value && *value ? *value : '\0');
+                break;
+            case 's':
+                strcpy(spec + n, "s");
+                out_printf(&ob, spec, value ? value : "");
+                break;
+            case 'b':
+                for (const char *c = value ? value : ""; *c != '\0' && !stop; c++)
+                {
+                    if (*c == '\\')
+                        c = out_escape(&ob, c, &stop);
+                    else
+                        out_putc(&ob, *c);
+                }
+                break;
+            default:
+                out_flush(&ob);
+                dprintf(sh->err_fd, "printf: %%%c: invalid directive\n", *f);
+                return 1;
+            }
+        }
+    } while (*arg != NULL && consumed && !stop);
+
+    return out_flush(&ob);
+}
+
+/*
+ * Parse an integer operand of test
+ *
+ * Returns:
+ *  true if s is an integer, false otherwise
+ */
+static bool test_integer(const char *s, long long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    if (errno != 0 || end == s)
+        return false;
+
+    while (isspace(*end))
+        end++;
+
+    return *end == '\0';
+}
+
+/*
+ * Evaluate a test expression of up to four arguments
+ *
+ * Parameters:
+ *  err_fd: where errors are reported
+ *  argv: the arguments of the expression
+ *  argc: the number of arguments
+ *
+ * Returns:
+ *  0 if the expression is true, 1 if it is false, 2 on error
+ */
+static int test_eval(int err_fd, char **argv, int argc)
+{
+    struct stat st;
+
+    if (argc == 0)
+        return 1;
+
+    if (argc == 1)
+        return argv[0][0] != '\0' ? 0 : 1;
+
+    // ! negates the rest of the expression
+    if (strcmp(argv[0], "!") == 0 && argc <= 4)
+    {
+        int status = test_eval(err_fd, argv + 1, argc - 1);
+        return status == 2 ? 2 : !status;
+    }
+
+    if (argc == 2)
+    {
+        const char *op = argv[0], *arg = argv[1];
+
+        if (strcmp(op, "-n") == 0)
+            return arg[0] != '\0' ? 0 : 1;
+        if (strcmp(op, "-z") == 0)
+            return arg[0] == '\0' ? 0 : 1;
+
+        if (strcmp(op, "-L") == 0 || strcmp(op, "-h") == 0)
+            return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode) ? 0 : 1;
+        if (strcmp(op, "-r") == 0)
+            return access(arg, R_OK) == 0 ? 0 : 1;
+        if (strcmp(op, "-w") == 0)
+            return access(arg, W_OK) == 0 ? 0 : 1;
+        if (strcmp(op, "-x") == 0)
+            return access(arg, X_OK) == 0 ? 0 : 1;
+
+        if (strlen(op) == 2 && op[0] == '-' && strchr("efdsp", op[1]) != NULL)
+        {
+            if (stat(arg, &st) != 0)
+                return 1;
+
+            switch (op[1])
+            {
+            case 'f':
+                return S_ISREG(st.st_mode) ? 0 : 1;
+            case 'd':
+                return S_ISDIR(st.st_mode) ? 0 : 1;
+            case 's':
+                return st.st_size > 0 ? 0 : 1;
+            case 'p':
+                return S_ISFIFO(st.st_mode) ? 0 : 1;
+            default:
+                return 0;
+            }
+        }
+
+        dprintf(err_fd, "test: %s: unary operator expected\n", op);
+        return 2;
+    }
+
+    if (argc == 3)
+    {
+        const char *left = argv[0], *op = argv[1], *right = argv[2];
+        long long l, r;
+
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+            return strcmp(left, right) == 0 ? 0 : 1;
+        if (strcmp(op, "!=") == 0)
+            return strcmp(left, right) != 0 ? 0 : 1;
+
+        const char *int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < 6; i++)
+        {
+            if (strcmp(op, int_ops[i]) != 0)
+                continue;
+
+            if (!test_integer(left, &l) || !test_integer(right, &r))
+            {
+                dprintf(err_fd, "test: integer expression expected\n");
+                return 2;
+            }
+
+            bool result[] = {l == r, l != r, l < r, l <= r, l > r, l >= r};
+            return result[i] ? 0 : 1;
+        }
+
+        dprintf(err_fd, "test: %s: binary operator expected\n", op);
+        return 2;
+    }
+
+    dprintf(err_fd, "test: too many arguments\n");
+    return 2;
+}
+
+static int builtin_test(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    int argc = 0;
+    while (args[argc + 1] != NULL)
+        argc++;
+
+    // [ ... ] needs its closing bracket
+    if (strcmp(args[0], "[") == 0)
+    {
+        if (argc == 0 || strcmp(args[argc], "]") != 0)
+        {
+            dprintf(sh->err_fd, "[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    return test_eval(sh->err_fd, args + 1, argc);
+}
+
+/*
+ * Read a line for read, joining the lines that end in a backslash
+ * unless raw
+ *
+ * Parameters:
+ *  rb: the buffer to read through
+ *  in_fd: the input
+ *  read_ahead: whether a pipe may be read in blocks
+ *  raw: whether backslashes are kept as read
+ *
+ * Returns:
+ *  the line, which the caller must free, or NULL at the end of the input
+ */
+static char *read_logical_line(ReadBuf rb, int in_fd, bool read_ahead, bool raw)
+{
+    char *joined = NULL;
+    size_t joined_len = 0;
+    size_t len;
+    char *line;
+
+    while ((line = RB_read_line(rb, in_fd, read_ahead, &len)) != NULL)
+    {
+        // an odd number of backslashes at the end continues the line
+        size_t slashes = 0;
+        while (!raw && slashes < len && line[len - 1 - slashes] == '\\')
+            slashes++;
+        bool more = slashes % 2 == 1;
+
+        joined = MEM_realloc(MEM_IO, joined, joined_len + len + 1);
+        assert(joined != NULL);
+        memcpy(joined + joined_len, line, len - more);
+        joined_len += len - more;
+        joined[joined_len] = '\0';
+
+        if (!more)
+            break;
+    }
+
+    return joined;
+}
+
+static int builtin_read(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    static char *reply[] = {"REPLY", NULL};
+    bool raw = args[1] != NULL && strcmp(args[1], "-r") == 0;
+    char **names = args[raw ? 2 : 1] != NULL ? args + (raw ? 2 : 1) : reply;
+
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        if (!VAR_valid_name(names[i], strlen(names[i])))
+        {
+            dprintf(sh->err_fd, "read: '%s': not a valid identifier\n", names[i]);
+            return 1;
+        }
+    }
+
+    // a shell with no buffer of its own reads nothing ahead that it would lose
+    ReadBuf rb = sh->readbuf != NULL ? sh->readbuf : RB_new();
+    char *line = read_logical_line(rb, in_fd, sh->readbuf != NULL && sh->read_ahead, raw);
+    if (rb != sh->readbuf)
+        RB_free(rb);
+
+    const char *ifs = VAR_get(sh->vars, "IFS");
+    if (ifs == NULL)
+        ifs = " \t\n";
+
+    // each name gets a field and the last one the rest of the line; a
+    // backslash keeps the next character, separator or not, unless raw
+    char *p = line != NULL ? line : "";
+    char *field = MEM_alloc(MEM_IO, strlen(p) + 1);
+    assert(field != NULL);
+
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        bool last = names[i + 1] == NULL;
+        size_t len = 0, keep = 0;
+
+        while (*p != '\0' && strchr(ifs, *p) != NULL)
+            p++;
+
+        while (*p != '\0')
+        {
+            if (!raw && *p == '\\' && *(p + 1) != '\0')
+            {
+                field[len++] = *(p + 1);
+                keep = len;
+                p += 2;
+                continue;
+            }
+
+            bool separator = strchr(ifs, *p) != NULL;
+            if (separator && !last)
+                break;
+
+            field[len++] = *p++;
+            if (!separator)
+                keep = len;
+        }
+
+        // the rest of the line is kept without its trailing separators
+        field[keep] = '\0';
+        VAR_set(sh->vars, names[i], field);
+    }
+
+    int status = line != NULL ? 0 : 1;
+    MEM_free(field);
+    MEM_free(line);
+    return status;
+}
+
+static void wc_start(struct filter *f, char **args)
+{
+    wc_options(args, &f->u.wc.opts);
+}
+
+static void wc_feed(struct filter *f, const char *data, size_t n)
+{
+    f->u.wc.lines += count_newlines(data, n);
+    f->u.wc.bytes += n;
+
+    if (!f->u.wc.opts.words)
+        return;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        bool space = isspace((unsigned char)data[i]);
+        if (!space && !f->u.wc.in_word)
+            f->u.wc.words++;
+        f->u.wc.in_word = !space;
+    }
+}
+
+static int wc_finish(struct filter *f)
+{
+    struct wc_opts *opts = &f->u.wc.opts;
+
+    // a single count is printed bare, several are aligned as by wc
+    unsigned long long counts[] = {f->u.wc.lines, f->u.wc.words, f->u.wc.bytes};
+    bool wanted[] = {opts->lines, opts->words, opts->bytes};
+    int num_wanted = opts->lines + opts->words + opts->bytes;
+
+    for (int i = 0, printed = 0; i < 3; i++)
+    {
+        if (!wanted[i])
+            continue;
+
+        if (num_wanted == 1)
+            out_printf(&f->out, "%llu", counts[i]);
+        else
+            out_printf(&f->out, "%s%7llu", printed++ ? " " : "", counts[i]);
+    }
+    out_putc(&f->out, '\n');
+
+    return 0;
+}
+
+static const struct filter_ops wc_filter = {wc_start, wc_feed, wc_finish};
+
+static bool wc_accepts(char **args)
+{
+    struct wc_opts opts;
+    return wc_options(args, &opts);
+}
+
+static int builtin_wc(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    return run_filter(&wc_filter, args, in_fd, out_fd);
+}
+
+static void head_start(struct filter *f, char **args)
+{
+    head_options(args, &f->u.head.opts);
+    f->u.head.remaining = f->u.head.opts.count;
+    f->done = f->u.head.remaining == 0;
+}
+
+static void head_feed(struct filter *f, const char *data, size_t n)
+{
+    long long *remaining = &f->u.head.remaining;
+
+    if (f->u.head.opts.bytes)
+    {
+        if (n > *remaining)
+            n = *remaining;
+        *remaining -= n;
+    }
+    else
+    {
+        const char *end = data, *nl;
+        while (*remaining > 0 && (nl = memchr(end, '\n', data + n - end)) != NULL)
+        {
+            end = nl + 1;
+            (*remaining)--;
+        }
+        if (*remaining > 0)
+            end = data + n;
+        n = end - data;
+    }
+
+    out_write(&f->out, data, n);
+
+    // stop taking input as soon as enough has been copied
+    f->done = *remaining == 0 || f->out.error;
+}
+
+static int head_finish(struct filter *f)
+{
+    return 0;
+}
+
+static const struct filter_ops head_filter = {head_start, head_feed, head_finish};
+
+static bool head_accepts(char **args)
+{
+    struct head_opts opts;
+    return head_options(args, &opts);
+}
+
+static int builtin_head(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    return run_filter(&head_filter, args, in_fd, out_fd);
+}
+
+static void grep_start(struct filter *f, char **args)
+{
+    grep_options(args, &f->u.grep.opts);
+    f->u.grep.pattern_len = strlen(f->u.grep.opts.pattern);
+}
+
+/*
+ * Select the matching lines of a run of whole lines. The last line may
+ * lack its newline at the end of the input.
+ */
+static void grep_lines(struct filter *f, const char *region, size_t n)
+{
+    struct grep_opts *opts = &f->u.grep.opts;
+    const char *region_end = region + n;
+
+    for (const char *line = region; line < region_end && !f->done;)
+    {
+        const char *match, *line_end;
+
+        if (!opts->invert)
+        {
+            // search the whole run at once, then find the line around the match
+            match = memmem(line, region_end - line, opts->pattern, f->u.grep.pattern_len);
+            if (match == NULL)
+                break;
+
+            while (match > line && *(match - 1) != '\n')
+                match--;
+            line = match;
+        }
+
+        line_end = memchr(line, '\n', region_end - line);
+        if (line_end == NULL)
+            line_end = region_end;
+
+        if (opts->invert && memmem(line, line_end - line, opts->pattern, f->u.grep.pattern_len) != NULL)
+        {
+            line = line_end + 1;
+            continue;
+        }
+
+        f->u.grep.selected++;
+
+        if (!opts->count && !opts->quiet)
+        {
+            out_write(&f->out, line, line_end - line);
+            out_putc(&f->out, '\n');
+        }
+        line = line_end + 1;
+
+        // -q is answered by the first match
+        f->done = opts->quiet || f->out.error;
+    }
+}
+
+static void grep_feed(struct filter *f, const char *data, size_t n)
+{
+    filter_lines(f, data, n, grep_lines);
+}
+
+static int grep_finish(struct filter *f)
+{
+    // the last line need not end with a newline
+    if (f->partial_len > 0 && !f->done)
+        grep_lines(f, f->partial, f->partial_len);
+
+    if (f->u.grep.opts.count && !f->u.grep.opts.quiet)
+        out_printf(&f->out, "%llu\n", f->u.grep.selected);
+
+    return f->u.grep.selected > 0 ? 0 : 1;
+}
+
+static const struct filter_ops grep_filter = {grep_start, grep_feed, grep_finish};
+
+static bool grep_accepts(char **args)
+{
+    struct grep_opts opts;
+    return grep_options(args, &opts);
+}
+
+static int builtin_grep(shell_t *sh, char **args, int in_fd, int out_fd)
+{
+    return run_filter(&grep_filter, args, in_fd, out_fd);
+}
+
+// the builtin registry
+static const builtin_t builtins[] = {
+    {"author", builtin_author, true, NULL, NULL},
+    {"pwd", builtin_pwd, true, NULL, NULL},
+    {"cd", builtin_cd, false, NULL, NULL},
+    {"hash", builtin_hash, false, NULL, NULL},
+    {"stats", builtin_stats, true, NULL, NULL},
+    {"memstats", builtin_memstats, false, NULL, NULL},
+    {"export", builtin_export, false, NULL, NULL},
+    {"unset", builtin_unset, false, NULL, NULL},
+    {"set", builtin_set, false, NULL, NULL},
+    {"echo", builtin_echo, true, NULL, NULL},
+    {"printf", builtin_printf, true, NULL, NULL},
+    {"true", builtin_true, true, NULL, NULL},
+    {"false", builtin_false, true, NULL, NULL},
+    {"test", builtin_test, true, NULL, NULL},
+    {"[", builtin_test, true, NULL, NULL},
+    {"read", builtin_read, false, NULL, NULL},
+    {"wc", builtin_wc, true, wc_accepts, &wc_filter},
+    {"head", builtin_head, true, head_accepts, &head_filter},
+    {"grep", builtin_grep, true, grep_accepts, &grep_filter},
+};
+
+// Documented in .h file
+const builtin_t *builtin_lookup(char **args)
+{
+    if (args == NULL || args[0] == NULL)
+        return NULL;
+
+    for (int i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+    {
+        if (strcmp(builtins[i].name, args[0]) != 0)
+            continue;
+
+        // the external command handles the options the builtin does not
+        if (builtins[i].accepts != NULL && !builtins[i].accepts(args))
+            return NULL;
+
+        return &builtins[i];
+    }
+
+    return NULL;
+}
+
+// Documented in .h file
+const char *builtin_name(int index)
+{
+    if (index < 0 || index >= sizeof(builtins) / sizeof(builtins[0]))
+        return NULL;
+
+    return builtins[index].name;
+}
+
+// Documented in .h file
+void builtin_run_chain(shell_t *sh, const builtin_t **stages, char ***argvs, int count,
+                       int in_fd, int out_fd, int *statuses)
+{
+    struct filter **filters = MEM_alloc(MEM_IO, count * sizeof(struct filter *));
+    assert(filters != NULL);
+
+    // create the stages from the last, so each knows the one it feeds
+    for (int i = count - 1; i > 0; i--)
+        filters[i] = filter_new(stages[i]->filter, argvs[i], i == count - 1 ? out_fd : FUSED_FD,
+                                i == count - 1 ? NULL : filters[i + 1]);
+
+    // the first stage runs as usual, writing into the second
+    fused_sink = count > 1 ? filters[1] : NULL;
+    statuses[0] = stages[0]->fn(sh, argvs[0], in_fd, count > 1 ? FUSED_FD : out_fd);
+    fused_sink = NULL;
+
+    // then the end of the input passes down the chain
+    for (int i = 1; i < count; i++)
+        statuses[i] = filter_finish(filters[i]);
+
+    MEM_free(filters);
+}
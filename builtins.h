@@ -0,0 +1,81 @@
+/*
+ * builtins.h
+ *
+ * Commands that are run by the shell itself instead of by execve
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+#include "shell.h"
+
+/*
+ * A builtin command. It reads from in_fd, writes to out_fd and
+ * returns its exit status; it must not exit the process.
+ */
+typedef int (*builtin_fn)(shell_t *sh, char **args, int in_fd, int out_fd);
+
+/*
+ * Decides whether a builtin handles the given arguments; if not, the
+ * external command of the same name is run instead.
+ */
+typedef bool (*builtin_accepts_fn)(char **args);
+
+// a builtin that can be fed its input in memory, defined in builtins.c
+struct filter_ops;
+
+// an entry in the builtin registry
+typedef struct
+{
+    const char *name;
+    builtin_fn fn;
+    bool threadable; // uses only its arguments and fds, so it may run on a helper thread
+    builtin_accepts_fn accepts; // NULL if the builtin handles any arguments
+    const struct filter_ops *filter; // NULL unless it can run fused after another builtin
+} builtin_t;
+
+/*
+ * Look up the builtin that runs a command
+ *
+ * Parameters:
+ *  args: the command and its arguments
+ *
+ * Returns:
+ *  the builtin, or NULL if args[0] is not a builtin or the builtin
+ *  does not handle these arguments
+ */
+const builtin_t *builtin_lookup(char **args);
+
+/*
+ * Get the name of a builtin by its position in the registry, e.g. to
+ * list them all for completion
+ *
+ * Parameters:
+ *  index: the position, from 0
+ *
+ * Returns:
+ *  the name, or NULL if index is past the last builtin
+ */
+const char *builtin_name(int index);
+
+/*
+ * Run adjacent builtin stages of a pipeline as one fused chain in the
+ * calling thread. The output of each stage is passed to the next in
+ * memory, with no pipe, fork or context switch between them.
+ *
+ * Parameters:
+ *  sh: the shell
+ *  stages: the builtin of each stage; all but the first need a filter
+ *  argvs: the arguments of each stage
+ *  count: the number of stages
+ *  in_fd: the input of the first stage
+ *  out_fd: the output of the last stage
+ *  statuses: return space for the exit status of each stage
+ *
+ * Returns: None
+ */
+void builtin_run_chain(shell_t *sh, const builtin_t **stages, char ***argvs, int count,
+                       int in_fd, int out_fd, int *statuses);
+
+#endif /* _BUILTINS_H_ */
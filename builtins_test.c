@@ -0,0 +1,309 @@
+/**
+ * builtins_test.c
+ *
+ * This file contains the test cases for builtins.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "builtins.h"
+#include "vars.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Runs a builtin with the given input and returns its output
+ *
+ * Parameters:
+ *   args     The command, NULL-terminated
+ *   input    The standard input of the command
+ *   output   Return space for the output, at least 256 bytes
+ *   status   Return space for the exit status
+ *
+ * Returns: true if args is run by a builtin, false otherwise
+ */
+static bool run_builtin(char **args, const char *input, char *output, int *status)
+{
+    const builtin_t *builtin = builtin_lookup(args);
+    if (builtin == NULL)
+        return false;
+
+    shell_t sh = {VAR_new(), 0};
+    int in_fd = memfd_create("input", 0);
+    int out_fd = memfd_create("output", 0);
+
+    write(in_fd, input, strlen(input));
+    lseek(in_fd, 0, SEEK_SET);
+
+    *status = builtin->fn(&sh, args, in_fd, out_fd);
+
+    lseek(out_fd, 0, SEEK_SET);
+    ssize_t n = read(out_fd, output, 255);
+    output[n > 0 ? n : 0] = '\0';
+
+    close(in_fd);
+    close(out_fd);
+    VAR_free(sh.vars);
+    return true;
+}
+
+/*
+ * Tests that wc, head and grep are only run as builtins for the
+ * options they handle
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_dispatch()
+{
+    test_assert(builtin_lookup((char *[]){"wc", "-l", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"wc", "-lwc", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"wc", "-m", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"wc", "file", NULL}) == NULL);
+
+    test_assert(builtin_lookup((char *[]){"head", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"head", "-5", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"head", "-n", "5", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"head", "-n", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"head", "-n", "-5", NULL}) == NULL);
+
+    test_assert(builtin_lookup((char *[]){"grep", "-F", "a.c", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"grep", "-vc", "key", NULL}) != NULL);
+    test_assert(builtin_lookup((char *[]){"grep", "a.c", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"grep", "-i", "key", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"grep", "-F", "one\ntwo", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"grep", "key", "file", NULL}) == NULL);
+    test_assert(builtin_lookup((char *[]){"grep", NULL}) == NULL);
+
+    test_assert(builtin_lookup((char *[]){"ls", NULL}) == NULL);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+/*
+ * Tests the output of the text processing builtins
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_text_builtins()
+{
+    char output[256];
+    int status;
+    const char *input = "one abc\ntwo\nthree abc\nfour";
+
+    // long enough to use the vectorized newline count
+    char lines[201];
+    for (int i = 0; i < 200; i++)
+        lines[i] = i % 3 == 0 ? '\n' : 'x';
+    lines[200] = '\0';
+
+    test_assert(run_builtin((char *[]){"wc", "-l", NULL}, lines, output, &status));
+    test_assert(strcmp(output, "67\n") == 0);
+    test_assert(run_builtin((char *[]){"wc", NULL}, input, output, &status));
+    test_assert(strcmp(output, "      3       6      26\n") == 0);
+    test_assert(run_builtin((char *[]){"wc", "-w", NULL}, "", output, &status));
+    test_assert(strcmp(output, "0\n") == 0);
+
+    test_assert(run_builtin((char *[]){"head", "-2", NULL}, input, output, &status));
+    test_assert(strcmp(output, "one abc\ntwo\n") == 0);
+    test_assert(run_builtin((char *[]){"head", "-c", "5", NULL}, input, output, &status));
+    test_assert(strcmp(output, "one a") == 0);
+    test_assert(run_builtin((char *[]){"head", NULL}, input, output, &status));
+    test_assert(strcmp(output, input) == 0);
+
+    test_assert(run_builtin((char *[]){"grep", "abc", NULL}, input, output, &status));
+    test_assert(strcmp(output, "one abc\nthree abc\n") == 0 && status == 0);
+    test_assert(run_builtin((char *[]){"grep", "-F", "fou", NULL}, input, output, &status));
+    test_assert(strcmp(output, "four\n") == 0 && status == 0);
+    test_assert(run_builtin((char *[]){"grep", "-v", "abc", NULL}, input, output, &status));
+    test_assert(strcmp(output, "two\nfour\n") == 0);
+    test_assert(run_builtin((char *[]){"grep", "-c", "o", NULL}, input, output, &status));
+    test_assert(strcmp(output, "3\n") == 0);
+    test_assert(run_builtin((char *[]){"grep", "-q", "abc", NULL}, input, output, &status));
+    test_assert(strcmp(output, "") == 0 && status == 0);
+    test_assert(run_builtin((char *[]){"grep", "zzz", NULL}, input, output, &status));
+    test_assert(strcmp(output, "") == 0 && status == 1);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+/*
+ * Tests string tests of test and [, with empty arguments
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_test_builtin()
+{
+    char output[256];
+    int status;
+
+    test_assert(run_builtin((char *[]){"[", "-n", "", "]", NULL}, "", output, &status) && status == 1);
+    test_assert(run_builtin((char *[]){"[", "-z", "", "]", NULL}, "", output, &status) && status == 0);
+    test_assert(run_builtin((char *[]){"test", "-n", "", NULL}, "", output, &status) && status == 1);
+    test_assert(run_builtin((char *[]){"test", "-z", "", NULL}, "", output, &status) && status == 0);
+    test_assert(run_builtin((char *[]){"test", "", NULL}, "", output, &status) && status == 1);
+    test_assert(run_builtin((char *[]){"[", "", "=", "", "]", NULL}, "", output, &status) && status == 0);
+    test_assert(run_builtin((char *[]){"test", "-n", "x", NULL}, "", output, &status) && status == 0);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+/*
+ * Tests running adjacent builtins as a fused chain
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_fused_chain()
+{
+    char *printf_args[] = {"printf", "%s\\n", "one", "two", "three", "four", NULL};
+    char *grep_args[] = {"grep", "-v", "two", NULL};
+    char *head_args[] = {"head", "-2", NULL};
+    char *wc_args[] = {"wc", "-lc", NULL};
+    char **argvs[] = {printf_args, grep_args, head_args, wc_args};
+    const builtin_t *stages[4];
+    int statuses[4];
+    char output[256];
+
+    shell_t sh = {VAR_new(), 0};
+    int out_fd = memfd_create("output", 0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        stages[i] = builtin_lookup(argvs[i]);
+        test_assert(stages[i] != NULL);
+        test_assert(i == 0 || stages[i]->filter != NULL);
+    }
+    test_assert(stages[0]->filter == NULL);
+
+    builtin_run_chain(&sh, stages, argvs, 4, STDIN_FILENO, out_fd, statuses);
+
+    lseek(out_fd, 0, SEEK_SET);
+    ssize_t n = read(out_fd, output, sizeof(output) - 1);
+    output[n > 0 ? n : 0] = '\0';
+    test_assert(strcmp(output, "      2      10\n") == 0);
+    test_assert(statuses[1] == 0 && statuses[3] == 0);
+
+    // head passes on only the first of the lines it is fed
+    char *yes_args[] = {"printf", "y\\n%.0s", "1", "2", "3", "4", NULL};
+    char *head1_args[] = {"head", "-n", "1", NULL};
+    char **argvs2[] = {yes_args, head1_args, wc_args};
+    for (int i = 0; i < 3; i++)
+        stages[i] = builtin_lookup(argvs2[i]);
+
+    ftruncate(out_fd, 0);
+    lseek(out_fd, 0, SEEK_SET);
+    builtin_run_chain(&sh, stages, argvs2, 3, STDIN_FILENO, out_fd, statuses);
+
+    lseek(out_fd, 0, SEEK_SET);
+    n = read(out_fd, output, sizeof(output) - 1);
+    output[n > 0 ? n : 0] = '\0';
+    test_assert(strcmp(output, "      1       2\n") == 0);
+
+    close(out_fd);
+    VAR_free(sh.vars);
+    return 1;
+
+test_error:
+    close(out_fd);
+    VAR_free(sh.vars);
+    return 0;
+}
+
+/*
+ * Tests the read builtin: field splitting, backslashes and the end of
+ * the input
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_read()
+{
+    char *read_ab[] = {"read", "a", "b", NULL};
+    char *read_raw[] = {"read", "-r", "a", NULL};
+    char *read_reply[] = {"read", NULL};
+    char *read_bad[] = {"read", "a-b", NULL};
+    const char *input = "  alpha  beta gamma  \nx\\ y\\\nz w\n\\t\\\\\n  kept  \n";
+
+    shell_t sh = {VAR_new(), 0};
+    sh.readbuf = RB_new();
+    int in_fd = memfd_create("input", 0);
+    const builtin_t *read = builtin_lookup(read_ab);
+
+    test_assert(read != NULL && !read->threadable);
+    test_assert(write(in_fd, input, strlen(input)) == strlen(input));
+    lseek(in_fd, 0, SEEK_SET);
+
+    // the last name gets the rest of the line
+    test_assert(read->fn(&sh, read_ab, in_fd, STDOUT_FILENO) == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "a"), "alpha") == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "b"), "beta gamma") == 0);
+
+    // a backslash keeps a separator, and one at the end joins the next line
+    test_assert(read->fn(&sh, read_ab, in_fd, STDOUT_FILENO) == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "a"), "x yz") == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "b"), "w") == 0);
+
+    test_assert(read->fn(&sh, read_raw, in_fd, STDOUT_FILENO) == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "a"), "\\t\\\\") == 0);
+
+    test_assert(read->fn(&sh, read_reply, in_fd, STDOUT_FILENO) == 0);
+    test_assert(strcmp(VAR_get(sh.vars, "REPLY"), "kept") == 0);
+
+    // at the end of the input, the names are emptied
+    test_assert(read->fn(&sh, read_ab, in_fd, STDOUT_FILENO) == 1);
+    test_assert(strcmp(VAR_get(sh.vars, "a"), "") == 0);
+    test_assert(read->fn(&sh, read_bad, in_fd, STDOUT_FILENO) == 1);
+
+    close(in_fd);
+    RB_free(sh.readbuf);
+    VAR_free(sh.vars);
+    return 1;
+
+test_error:
+    close(in_fd);
+    RB_free(sh.readbuf);
+    VAR_free(sh.vars);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_dispatch();
+    num_tests++;
+    passed += test_text_builtins();
+    num_tests++;
+    passed += test_test_builtin();
+    num_tests++;
+    passed += test_fused_chain();
+    num_tests++;
+    passed += test_read();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -12,20 +12,21 @@
 #include <ctype.h>
 
 #include "clist.h"
+#include "mem.h"
 
 #define DEBUG
 
 /*
- * Create (malloc) a new _cl_node and populate it with the supplied values
+ * Create (allocate) a new _cl_node and populate it with the supplied values
  *
  * Parameters:
  *   element, next  The values for the node to be created
  *
- * Returns: The newly-malloc'd node, or NULL in case of error
+ * Returns: The newly-allocated node, or NULL in case of error
  */
 static struct _cl_node *_CL_new_node(Token tok, struct _cl_node *next)
 {
-  struct _cl_node *new = (struct _cl_node *)malloc(sizeof(struct _cl_node));
+  struct _cl_node *new = (struct _cl_node *)MEM_alloc(MEM_TOKENS, sizeof(struct _cl_node));
   assert(new);
 
   new->tok_elt = tok;
@@ -37,10 +38,11 @@ static struct _cl_node *_CL_new_node(Token tok, struct _cl_node *next)
 // Documented in .h file
 CList CL_new()
 {
-  CList list = (CList)malloc(sizeof(struct _clist));
+  CList list = (CList)MEM_alloc(MEM_TOKENS, sizeof(struct _clist));
   assert(list != NULL);
 
   list->head = NULL;
+  list->tail = NULL;
   list->length = 0;
 
   return list;
@@ -57,7 +59,7 @@ void CL_free(CList list)
 
   if (this_node == NULL)
   {
-    free(list);
+    MEM_free(list);
     list = NULL;
     return;
   }
@@ -69,17 +71,17 @@ void CL_free(CList list)
     struct _cl_node *next_node = this_node->next;
 
     // deallocate the element of the current node if exists
-    if (this_node->tok_elt.type == TOK_WORD || this_node->tok_elt.type == TOK_QUOTED_WORD)
+    if (this_node->tok_elt.type != TOK_LESSTHAN && this_node->tok_elt.type != TOK_GREATERTHAN && this_node->tok_elt.type != TOK_PIPE && this_node->tok_elt.type != TOK_HERESTRING)
     {
       if (this_node->tok_elt.text != NULL)
       {
-        free(this_node->tok_elt.text);
+        MEM_free(this_node->tok_elt.text);
         this_node->tok_elt.text = NULL;
       }
     }
 
     // deallocate the current node
-    free(this_node);
+    MEM_free(this_node);
     this_node = NULL;
 
     // move on to the next node
@@ -87,7 +89,7 @@ void CL_free(CList list)
   }
 
   // deallocate the list structure itself
-  free(list);
+  MEM_free(list);
   list = NULL;
 }
 
@@ -131,6 +133,12 @@ void CL_append(CList list, Token tok)
   if ((tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD) && non_space == 0)
     return;
 
+  CL_append_any(list, tok);
+}
+
+// Documented in .h file
+void CL_append_any(CList list, Token tok)
+{
   if (list == NULL)
     return;
 
@@ -141,16 +149,11 @@ void CL_append(CList list, Token tok)
   if (list->head == NULL)
     list->head = new_node;
 
+  // otherwise, it follows the last node
   else
-  {
-    // otherwise, traverse the list until we find the last node
-    struct _cl_node *this_node = list->head;
-    while (this_node->next != NULL)
-      this_node = this_node->next;
+    list->tail->next = new_node;
 
-    // then append the new node to the end of the list
-    this_node->next = new_node;
-  }
+  list->tail = new_node;
 
   // increment the length of the list
   list->length++;
@@ -224,6 +227,8 @@ Token CL_remove(CList list, int pos)
   {
     // remove the node at position pos-1 - point current node to the node after the one we are removing
     this_node->next = rm_node->next;
+    if (list->tail == rm_node)
+      list->tail = this_node;
 
     // Save the element to return
     Token rm_element = rm_node->tok_elt;
@@ -232,7 +237,7 @@ Token CL_remove(CList list, int pos)
     list->length--;
 
     // deallocate the node we are removing
-    free(rm_node);
+    MEM_free(rm_node);
 
     return rm_element;
   }
@@ -253,7 +258,9 @@ Token CL_pop(CList list)
 
   // unlink previous head node, then free it
   list->head = popped_node->next;
-  free(popped_node);
+  if (list->head == NULL)
+    list->tail = NULL;
+  MEM_free(popped_node);
 
   list->length--;
 
@@ -21,6 +21,7 @@ struct _cl_node
 struct _clist
 {
     struct _cl_node *head;
+    struct _cl_node *tail; // the last node, so that appending does not walk the list
     int length;
 };
 
@@ -41,7 +42,8 @@ typedef struct _clist *CList;
 CList CL_new();
 
 /*
- * Destroy a list, calling free() on all malloc'd memory.
+ * Destroy a list, calling MEM_free() on the text of its tokens, which
+ * must come from MEM_alloc().
  *
  * Parameters:
  *   list   The list
@@ -71,6 +73,18 @@ int CL_length(CList list);
  */
 void CL_append(CList list, Token element);
 
+/*
+ * Append the specified element to the tail of the list, even if it is
+ * an empty or all-space word, which CL_append drops
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The element to append
+ *
+ * Returns: None
+ */
+void CL_append_any(CList list, Token element);
+
 /*
  * Return the Nth element, without modifying the list
  *
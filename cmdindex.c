@@ -0,0 +1,643 @@
+/*
+ * cmdindex.c
+ *
+ * The command name index: one sorted list of executables per PATH
+ * directory, which is rescanned when inotify reports a change in it,
+ * merged with the extra names into one sorted array for lookups
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include "cmdindex.h"
+#include "mem.h"
+
+#define CI_DEFAULT_PATH "/usr/bin:/bin"
+
+// the changes to a PATH directory that can add or remove a command
+#define CI_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                       IN_DELETE_SELF | IN_MOVE_SELF)
+
+// how long to wait for more events after one arrives, so that e.g. a
+// package install causes one rescan instead of hundreds
+#define CI_SETTLE_MS 50
+
+// a directory changed this recently may change again within the same
+// mtime tick, so what was read from it is not trusted in a snapshot
+#define CI_RACY_SECONDS 2
+
+// the commands in one PATH directory, changed only by the helper thread
+struct _ci_dir
+{
+    char *dir;
+    int wd;         // the inotify watch, or -1
+    char **names;
+    int count;
+    bool dirty;     // changed since it was scanned
+    struct stat st; // the directory when it was scanned, or zeroes
+    time_t scanned; // when it was scanned
+};
+
+struct _cmdindex
+{
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int inotify_fd;
+    int wake_fd; // an eventfd that wakes the helper thread
+    bool started;
+
+    char *path;       // the PATH wanted
+    char *built_path; // the PATH names was built from, or NULL
+    bool stop;
+
+    char **extra;
+    int num_extra;
+
+    // the helper thread's view of the PATH, locked while it changes
+    pthread_mutex_t dirs_lock;
+    struct _ci_dir *dirs;
+    int num_dirs;
+
+    // the snapshot given to CI_new(), until the helper thread reads it, and
+    // the directories it read from it, used by the first scan
+    SnapReader snap;
+    struct _ci_dir *seeds;
+    int num_seeds;
+
+    // all the names, sorted and without duplicates
+    char **names;
+    int count;
+};
+
+/*
+ * qsort() comparison of two strings
+ */
+static int _CI_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Free an array of count strings and the array itself
+ */
+static void _CI_free_names(char **names, int count)
+{
+    for (int i = 0; i < count; i++)
+        MEM_free(names[i]);
+    MEM_free(names);
+}
+
+/*
+ * Read the names of the executables in a directory. A directory that
+ * cannot be read has none.
+ */
+static void _CI_scan(struct _ci_dir *d)
+{
+    _CI_free_names(d->names, d->count);
+    d->names = NULL;
+    d->count = 0;
+    d->dirty = false;
+    d->scanned = time(NULL);
+    memset(&d->st, 0, sizeof(d->st));
+
+    DIR *dir = opendir(d->dir);
+    if (dir == NULL)
+        return;
+
+    // stat()ed before reading, so that a change while reading shows later
+    if (fstat(dirfd(dir), &d->st) != 0)
+        memset(&d->st, 0, sizeof(d->st));
+
+    int cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        // only regular files, or links to them, can be commands
+        if (ent->d_name[0] == '.' || (ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN))
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), ent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) || (st.st_mode & 0111) == 0)
+            continue;
+
+        if (d->count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            d->names = MEM_realloc(MEM_CACHES, d->names, cap * sizeof(char *));
+        }
+        d->names[d->count++] = MEM_strdup(MEM_CACHES, ent->d_name);
+    }
+
+    closedir(dir);
+}
+
+/*
+ * Whether two stat()s are of the same version of the same directory
+ */
+static bool _CI_same_dir(const struct stat *a, const struct stat *b)
+{
+    return a->st_ino != 0 && a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * Take the names of a directory from the snapshot instead of scanning
+ * it, if it has not changed since
+ *
+ * Returns: true if the names were taken
+ */
+static bool _CI_take_seed(CommandIndex ci, struct _ci_dir *d)
+{
+    struct stat st;
+    if (stat(d->dir, &st) != 0)
+        return false;
+
+    for (int i = 0; i < ci->num_seeds; i++)
+    {
+        struct _ci_dir *seed = &ci->seeds[i];
+        if (seed->names == NULL || strcmp(seed->dir, d->dir) != 0 || !_CI_same_dir(&seed->st, &st))
+            continue;
+
+        d->names = seed->names;
+        d->count = seed->count;
+        d->st = seed->st;
+        d->scanned = seed->scanned;
+        d->dirty = false;
+        seed->names = NULL;
+        seed->count = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Free the directories loaded from a snapshot
+ */
+static void _CI_free_seeds(CommandIndex ci)
+{
+    for (int i = 0; i < ci->num_seeds; i++)
+    {
+        MEM_free(ci->seeds[i].dir);
+        _CI_free_names(ci->seeds[i].names, ci->seeds[i].count);
+    }
+    MEM_free(ci->seeds);
+    ci->seeds = NULL;
+    ci->num_seeds = 0;
+}
+
+/*
+ * Read the directories saved by CI_save() whose status still matches,
+ * as seeds for the first scan
+ */
+static void _CI_load_seeds(CommandIndex ci, SnapReader snap)
+{
+    uint64_t num_dirs;
+    if (!SNAP_seek(snap, "cmdindex") || !SNAP_get_u64(snap, &num_dirs))
+        return;
+
+    for (uint64_t i = 0; i < num_dirs; i++)
+    {
+        const char *dir = SNAP_get_str(snap);
+        if (dir == NULL)
+            return;
+
+        struct stat st;
+        if (stat(dir, &st) != 0)
+            memset(&st, 0, sizeof(st));
+        bool valid = SNAP_check_stat(snap, &st) && st.st_ino != 0;
+
+        uint64_t scanned, count;
+        if (!SNAP_get_u64(snap, &scanned) || !SNAP_get_u64(snap, &count))
+            return;
+
+        // a directory that changed is skipped over
+        char **names = valid ? MEM_alloc(MEM_CACHES, (count > 0 ? count : 1) * sizeof(char *)) : NULL;
+        for (uint64_t j = 0; j < count; j++)
+        {
+            const char *name = SNAP_get_str(snap);
+            if (name == NULL)
+            {
+                _CI_free_names(names, valid ? j : 0);
+                return;
+            }
+            if (valid)
+                names[j] = MEM_strdup(MEM_CACHES, name);
+        }
+
+        if (valid)
+        {
+            ci->seeds = MEM_realloc(MEM_CACHES, ci->seeds, (ci->num_seeds + 1) * sizeof(struct _ci_dir));
+
+            struct _ci_dir *seed = &ci->seeds[ci->num_seeds++];
+            seed->dir = MEM_strdup(MEM_CACHES, dir);
+            seed->wd = -1;
+            seed->names = names;
+            seed->count = count;
+            seed->dirty = false;
+            seed->st = st;
+            seed->scanned = scanned;
+        }
+    }
+}
+
+/*
+ * Drop the directories and watches of the old PATH, then scan the
+ * directories of a new one, or take them from the snapshot
+ */
+static void _CI_load_path(CommandIndex ci, const char *path)
+{
+    for (int i = 0; i < ci->num_dirs; i++)
+    {
+        if (ci->dirs[i].wd >= 0)
+            inotify_rm_watch(ci->inotify_fd, ci->dirs[i].wd);
+        MEM_free(ci->dirs[i].dir);
+        _CI_free_names(ci->dirs[i].names, ci->dirs[i].count);
+    }
+    MEM_free(ci->dirs);
+    ci->dirs = NULL;
+    ci->num_dirs = 0;
+
+    for (const char *p = path; *p != '\0';)
+    {
+        const char *end = strchrnul(p, ':');
+
+        ci->dirs = MEM_realloc(MEM_CACHES, ci->dirs, (ci->num_dirs + 1) * sizeof(struct _ci_dir));
+
+        // an empty PATH element means the current directory
+        struct _ci_dir *d = &ci->dirs[ci->num_dirs++];
+        d->dir = end > p ? MEM_strndup(MEM_CACHES, p, end - p) : MEM_strdup(MEM_CACHES, ".");
+        d->names = NULL;
+        d->count = 0;
+        d->wd = -1;
+
+        if (!_CI_take_seed(ci, d))
+            _CI_scan(d);
+
+        p = *end ? end + 1 : end;
+    }
+
+    // the seeds are of the PATH the shell started with only
+    _CI_free_seeds(ci);
+}
+
+/*
+ * Watch the directories of the PATH, which is done after the index is
+ * first published since adding watches is slow. A directory that changed
+ * before it was watched is scanned again.
+ *
+ * Returns: true if any directory was scanned again
+ */
+static bool _CI_watch(CommandIndex ci)
+{
+    bool rescanned = false;
+
+    for (int i = 0; i < ci->num_dirs; i++)
+    {
+        struct _ci_dir *d = &ci->dirs[i];
+
+        // a directory listed twice gets the same watch, so events mark both
+        d->wd = inotify_add_watch(ci->inotify_fd, d->dir, CI_WATCH_MASK);
+
+        struct stat st;
+        if (stat(d->dir, &st) != 0)
+            memset(&st, 0, sizeof(st));
+        if (!_CI_same_dir(&d->st, &st) && (d->st.st_ino != 0 || st.st_ino != 0))
+        {
+            _CI_scan(d);
+            rescanned = true;
+        }
+    }
+
+    return rescanned;
+}
+
+/*
+ * Merge the names of every directory and the extra names into a new
+ * sorted index, and replace the old one with it
+ */
+static void _CI_publish(CommandIndex ci, const char *path)
+{
+    int total = ci->num_extra;
+    for (int i = 0; i < ci->num_dirs; i++)
+        total += ci->dirs[i].count;
+
+    char **names = MEM_alloc(MEM_CACHES, (total > 0 ? total : 1) * sizeof(char *));
+
+    int count = 0;
+    for (int i = 0; i < ci->num_extra; i++)
+        names[count++] = ci->extra[i];
+    for (int i = 0; i < ci->num_dirs; i++)
+    {
+        for (int j = 0; j < ci->dirs[i].count; j++)
+            names[count++] = ci->dirs[i].names[j];
+    }
+
+    qsort(names, count, sizeof(char *), _CI_compare);
+
+    // the same name in several directories is one command
+    int unique = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0)
+            names[unique++] = MEM_strdup(MEM_CACHES, names[i]);
+    }
+
+    pthread_mutex_lock(&ci->lock);
+    _CI_free_names(ci->names, ci->count);
+    ci->names = names;
+    ci->count = unique;
+    MEM_free(ci->built_path);
+    ci->built_path = MEM_strdup(MEM_CACHES, path);
+    pthread_cond_broadcast(&ci->cond);
+    pthread_mutex_unlock(&ci->lock);
+}
+
+/*
+ * Read the pending inotify events and mark the directories they are
+ * about as dirty
+ *
+ * Returns: true if any directory was marked
+ */
+static bool _CI_read_events(CommandIndex ci)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool marked = false;
+    ssize_t n;
+
+    while ((n = read(ci->inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + n;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            // after an overflow, the lost events could be about any directory
+            for (int i = 0; i < ci->num_dirs; i++)
+            {
+                if (ev->mask & IN_Q_OVERFLOW || ci->dirs[i].wd == ev->wd)
+                    ci->dirs[i].dirty = marked = true;
+            }
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return marked;
+}
+
+/*
+ * The helper thread: build the index for the wanted PATH, then rescan
+ * directories as inotify reports changes in them, until stopped
+ */
+static void *_CI_thread(void *arg)
+{
+    CommandIndex ci = (CommandIndex)arg;
+
+    pthread_mutex_lock(&ci->lock);
+    while (!ci->stop)
+    {
+        if (ci->built_path == NULL || strcmp(ci->built_path, ci->path) != 0)
+        {
+            char *path = MEM_strdup(MEM_CACHES, ci->path);
+            pthread_mutex_unlock(&ci->lock);
+
+            pthread_mutex_lock(&ci->dirs_lock);
+            if (ci->snap != NULL)
+            {
+                _CI_load_seeds(ci, ci->snap);
+                SNAP_close(ci->snap);
+                ci->snap = NULL;
+            }
+
+            _CI_load_path(ci, path);
+            _CI_publish(ci, path);
+            if (_CI_watch(ci))
+                _CI_publish(ci, path);
+            pthread_mutex_unlock(&ci->dirs_lock);
+            MEM_free(path);
+
+            pthread_mutex_lock(&ci->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ci->lock);
+
+        struct pollfd pfds[2] = {{ci->inotify_fd, POLLIN, 0}, {ci->wake_fd, POLLIN, 0}};
+        if (poll(pfds, 2, -1) > 0)
+        {
+            uint64_t wakes;
+            if (pfds[1].revents & POLLIN)
+                read(ci->wake_fd, &wakes, sizeof(wakes));
+
+            if (pfds[0].revents & POLLIN && _CI_read_events(ci))
+            {
+                // let a burst of changes settle before rescanning
+                while (poll(pfds, 1, CI_SETTLE_MS) > 0)
+                    _CI_read_events(ci);
+
+                pthread_mutex_lock(&ci->dirs_lock);
+                for (int i = 0; i < ci->num_dirs; i++)
+                {
+                    if (ci->dirs[i].dirty)
+                        _CI_scan(&ci->dirs[i]);
+                }
+
+                pthread_mutex_lock(&ci->lock);
+                char *path = MEM_strdup(MEM_CACHES, ci->built_path);
+                pthread_mutex_unlock(&ci->lock);
+                _CI_publish(ci, path);
+                pthread_mutex_unlock(&ci->dirs_lock);
+                MEM_free(path);
+            }
+        }
+
+        pthread_mutex_lock(&ci->lock);
+    }
+    pthread_mutex_unlock(&ci->lock);
+
+    return NULL;
+}
+
+/*
+ * Wake the helper thread from poll()
+ */
+static void _CI_wake(CommandIndex ci)
+{
+    uint64_t one = 1;
+    write(ci->wake_fd, &one, sizeof(one));
+}
+
+// Documented in .h file
+CommandIndex CI_new(const char *path, const char *const *extra, SnapReader snap)
+{
+    CommandIndex ci = MEM_calloc(MEM_CACHES, 1, sizeof(struct _cmdindex));
+
+    ci->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    ci->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ci->inotify_fd < 0 || ci->wake_fd < 0)
+    {
+        SNAP_close(snap);
+        if (ci->inotify_fd >= 0)
+            close(ci->inotify_fd);
+        if (ci->wake_fd >= 0)
+            close(ci->wake_fd);
+        MEM_free(ci);
+        return NULL;
+    }
+
+    ci->path = MEM_strdup(MEM_CACHES, path != NULL ? path : CI_DEFAULT_PATH);
+    while (extra != NULL && extra[ci->num_extra] != NULL)
+        ci->num_extra++;
+    ci->extra = MEM_alloc(MEM_CACHES, (ci->num_extra + 1) * sizeof(char *));
+    for (int i = 0; i < ci->num_extra; i++)
+        ci->extra[i] = MEM_strdup(MEM_CACHES, extra[i]);
+
+    // read on the helper thread, since it takes as long as the PATH is big
+    ci->snap = snap;
+
+    pthread_mutex_init(&ci->lock, NULL);
+    pthread_mutex_init(&ci->dirs_lock, NULL);
+    pthread_cond_init(&ci->cond, NULL);
+
+    ci->started = pthread_create(&ci->tid, NULL, _CI_thread, ci) == 0;
+    if (!ci->started)
+    {
+        CI_free(ci);
+        return NULL;
+    }
+
+    return ci;
+}
+
+// Documented in .h file
+void CI_free(CommandIndex ci)
+{
+    if (ci == NULL)
+        return;
+
+    if (ci->started)
+    {
+        pthread_mutex_lock(&ci->lock);
+        ci->stop = true;
+        pthread_mutex_unlock(&ci->lock);
+        _CI_wake(ci);
+        pthread_join(ci->tid, NULL);
+    }
+
+    for (int i = 0; i < ci->num_dirs; i++)
+    {
+        MEM_free(ci->dirs[i].dir);
+        _CI_free_names(ci->dirs[i].names, ci->dirs[i].count);
+    }
+    MEM_free(ci->dirs);
+    _CI_free_seeds(ci);
+    SNAP_close(ci->snap);
+
+    close(ci->inotify_fd);
+    close(ci->wake_fd);
+    _CI_free_names(ci->extra, ci->num_extra);
+    _CI_free_names(ci->names, ci->count);
+    MEM_free(ci->path);
+    MEM_free(ci->built_path);
+    pthread_cond_destroy(&ci->cond);
+    pthread_mutex_destroy(&ci->dirs_lock);
+    pthread_mutex_destroy(&ci->lock);
+    MEM_free(ci);
+}
+
+// Documented in .h file
+char **CI_complete(CommandIndex ci, const char *path, const char *prefix)
+{
+    assert(ci != NULL);
+
+    if (path == NULL)
+        path = CI_DEFAULT_PATH;
+
+    pthread_mutex_lock(&ci->lock);
+
+    if (strcmp(ci->path, path) != 0)
+    {
+        MEM_free(ci->path);
+        ci->path = MEM_strdup(MEM_CACHES, path);
+        _CI_wake(ci);
+    }
+
+    while (ci->built_path == NULL || strcmp(ci->built_path, ci->path) != 0)
+        pthread_cond_wait(&ci->cond, &ci->lock);
+
+    // binary search for the first name not before the prefix
+    size_t len = strlen(prefix);
+    int lo = 0, hi = ci->count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (strcmp(ci->names[mid], prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int end = lo;
+    while (end < ci->count && strncmp(ci->names[end], prefix, len) == 0)
+        end++;
+
+    char **matches = NULL;
+    if (end > lo)
+    {
+        matches = malloc((end - lo + 1) * sizeof(char *));
+        assert(matches != NULL);
+        for (int i = lo; i < end; i++)
+            matches[i - lo] = strdup(ci->names[i]);
+        matches[end - lo] = NULL;
+    }
+
+    pthread_mutex_unlock(&ci->lock);
+    return matches;
+}
+
+// Documented in .h file
+void CI_save(CommandIndex ci, SnapWriter w)
+{
+    assert(ci != NULL);
+
+    // a shell that exits at once still saves the whole PATH
+    pthread_mutex_lock(&ci->lock);
+    while (ci->built_path == NULL)
+        pthread_cond_wait(&ci->cond, &ci->lock);
+    pthread_mutex_unlock(&ci->lock);
+
+    pthread_mutex_lock(&ci->dirs_lock);
+
+    SNAP_section(w, "cmdindex");
+    SNAP_put_u64(w, ci->num_dirs);
+
+    for (int i = 0; i < ci->num_dirs; i++)
+    {
+        struct _ci_dir *d = &ci->dirs[i];
+        struct stat none = {0};
+
+        SNAP_put_str(w, d->dir);
+        SNAP_put_stat(w, d->st.st_mtim.tv_sec > d->scanned - CI_RACY_SECONDS ? &none : &d->st);
+        SNAP_put_u64(w, d->scanned);
+        SNAP_put_u64(w, d->count);
+        for (int j = 0; j < d->count; j++)
+            SNAP_put_str(w, d->names[j]);
+    }
+
+    pthread_mutex_unlock(&ci->dirs_lock);
+}
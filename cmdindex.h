@@ -0,0 +1,69 @@
+/*
+ * cmdindex.h
+ *
+ * A sorted index of the command names in the PATH, for completion. It
+ * is built on a helper thread and kept current with inotify watches on
+ * the PATH directories.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _CMDINDEX_H_
+#define _CMDINDEX_H_
+
+#include "snapshot.h"
+
+// struct _cmdindex to be used in the .c as CommandIndex
+typedef struct _cmdindex *CommandIndex;
+
+/*
+ * Create an index and start the helper thread, which scans the PATH
+ * directories in the background. A directory that has not changed
+ * since it was saved in the snapshot is not scanned again.
+ *
+ * Parameters:
+ *   path     The value of PATH, or NULL for the default
+ *   extra    Names to include that are not in the PATH, such as the
+ *            builtins, NULL-terminated
+ *   snap     A snapshot saved by CI_save(), or NULL; the index reads
+ *            it on the helper thread and closes it, even on failure
+ *
+ * Returns: The index, or NULL if the helper thread could not be started
+ */
+CommandIndex CI_new(const char *path, const char *const *extra, SnapReader snap);
+
+/*
+ * Stop the helper thread and free the index
+ *
+ * Parameters:
+ *   ci       The index, or NULL
+ *
+ * Returns: None
+ */
+void CI_free(CommandIndex ci);
+
+/*
+ * Find the command names that start with a prefix. Waits for the index
+ * if it has not been built yet, or was built for a different PATH.
+ *
+ * Parameters:
+ *   ci       The index
+ *   path     The value of PATH, or NULL for the default
+ *   prefix   The start of the name
+ *
+ * Returns: The names in sorted order, as a malloc'd, NULL-terminated
+ *   array of malloc'd strings, or NULL if no name matches
+ */
+char **CI_complete(CommandIndex ci, const char *path, const char *prefix);
+
+/*
+ * Save the names found in each PATH directory in a snapshot
+ *
+ * Parameters:
+ *   ci       The index
+ *   w        The snapshot
+ *
+ * Returns: None
+ */
+void CI_save(CommandIndex ci, SnapWriter w);
+
+#endif /* _CMDINDEX_H_ */
@@ -0,0 +1,181 @@
+/**
+ * cmdindex_test.c
+ *
+ * This file contains the test cases for cmdindex.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "cmdindex.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Creates an empty file with the given mode
+ */
+static void touch(const char *file, mode_t mode)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd >= 0)
+        close(fd);
+    chmod(file, mode);
+}
+
+/*
+ * Frees an array returned by CI_complete
+ */
+static void free_matches(char **matches)
+{
+    for (int i = 0; matches != NULL && matches[i] != NULL; i++)
+        free(matches[i]);
+    free(matches);
+}
+
+/*
+ * Returns the number of names in an array returned by CI_complete
+ */
+static int count_matches(char **matches)
+{
+    int count = 0;
+    while (matches != NULL && matches[count] != NULL)
+        count++;
+    return count;
+}
+
+/*
+ * Completes a prefix until the number of matches is the expected one,
+ * giving the helper thread up to two seconds to see a change
+ *
+ * Returns: true if the expected number of matches was seen
+ */
+static bool wait_for_count(CommandIndex ci, const char *path, const char *prefix, int expected)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        char **matches = CI_complete(ci, path, prefix);
+        int count = count_matches(matches);
+        free_matches(matches);
+
+        if (count == expected)
+            return true;
+        usleep(10000);
+    }
+
+    return false;
+}
+
+/*
+ * Tests completing command names from the PATH and the extra names,
+ * and that the index follows changes to the PATH directories
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_complete()
+{
+    char dir1[] = "/tmp/plaid_ci1_XXXXXX";
+    char dir2[] = "/tmp/plaid_ci2_XXXXXX";
+    char path[128], file[160];
+    const char *extra[] = {"plaidbuiltin", "zz-extra", NULL};
+    char **matches = NULL;
+    CommandIndex ci = NULL;
+
+    test_assert(mkdtemp(dir1) != NULL && mkdtemp(dir2) != NULL);
+    snprintf(path, sizeof(path), "%s:%s", dir1, dir2);
+
+    const char *tools[] = {"plaidb", "plaida", "plaidc", NULL};
+    for (int i = 0; tools[i] != NULL; i++)
+    {
+        snprintf(file, sizeof(file), "%s/%s", dir1, tools[i]);
+        touch(file, 0755);
+    }
+
+    // the same command in two directories, and a file that is not executable
+    snprintf(file, sizeof(file), "%s/plaida", dir2);
+    touch(file, 0755);
+    snprintf(file, sizeof(file), "%s/plaidnote", dir2);
+    touch(file, 0644);
+
+    ci = CI_new(path, extra, NULL);
+    test_assert(ci != NULL);
+
+    matches = CI_complete(ci, path, "plaid");
+    test_assert(count_matches(matches) == 4);
+    test_assert(strcmp(matches[0], "plaida") == 0 && strcmp(matches[1], "plaidb") == 0);
+    test_assert(strcmp(matches[2], "plaidbuiltin") == 0 && strcmp(matches[3], "plaidc") == 0);
+    free_matches(matches);
+    matches = NULL;
+
+    test_assert(CI_complete(ci, path, "nothing-starts-like-this") == NULL);
+    test_assert(wait_for_count(ci, path, "zz-", 1));
+
+    // new, changed and removed commands are noticed without asking
+    snprintf(file, sizeof(file), "%s/plaidd", dir2);
+    touch(file, 0755);
+    test_assert(wait_for_count(ci, path, "plaid", 5));
+
+    snprintf(file, sizeof(file), "%s/plaidnote", dir2);
+    chmod(file, 0755);
+    test_assert(wait_for_count(ci, path, "plaid", 6));
+
+    snprintf(file, sizeof(file), "%s/plaidb", dir1);
+    unlink(file);
+    test_assert(wait_for_count(ci, path, "plaid", 5));
+
+    // the command is still in the other directory
+    snprintf(file, sizeof(file), "%s/plaida", dir1);
+    unlink(file);
+    test_assert(wait_for_count(ci, path, "plaida", 1));
+
+    // a different PATH is indexed before completing
+    test_assert(wait_for_count(ci, dir1, "plaid", 2));
+
+    const char *left[] = {"plaidc", NULL};
+    for (int i = 0; left[i] != NULL; i++)
+    {
+        snprintf(file, sizeof(file), "%s/%s", dir1, left[i]);
+        unlink(file);
+    }
+    const char *left2[] = {"plaida", "plaidd", "plaidnote", NULL};
+    for (int i = 0; left2[i] != NULL; i++)
+    {
+        snprintf(file, sizeof(file), "%s/%s", dir2, left2[i]);
+        unlink(file);
+    }
+    rmdir(dir1);
+    rmdir(dir2);
+    CI_free(ci);
+    return 1;
+
+test_error:
+    free_matches(matches);
+    CI_free(ci);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_complete();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,776 @@
+/*
+ * control.c
+ *
+ * Compound commands, parsed into a tree of lists of commands whose
+ * leaves are pipelines with their deferred words unexpanded
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "control.h"
+#include "parser.h"
+#include "mem.h"
+
+typedef enum
+{
+    CTL_SIMPLE, // a pipeline
+    CTL_FOR,    // for NAME in WORD...; do BODY; done
+    CTL_WHILE,  // while COND; do BODY; done
+    CTL_IF,     // if COND; then BODY; else OTHERWISE; fi
+    CTL_FUNCTION // NAME() { BODY; }
+} CtlType;
+
+// a command, on a list of commands
+struct _compound
+{
+    CtlType type;
+    CList tokens;         // the tokens of a pipeline, or the words of a for loop
+    pipeline_t *pipeline; // the pipeline, pointing into tokens
+    bool deferred;        // the pipeline has words to expand each time it runs
+    char *name;           // the variable a for loop sets, or the function defined
+    Compound cond;        // the condition of a while or if
+    Compound body;        // the loop body, or the commands run if the condition is true
+    Compound otherwise;   // the commands run if it is false: an elif or the else part
+    Compound next;        // the next command on the list
+    int holds;            // the CTL_holds of the list this command starts, not yet freed
+};
+
+// what every command of a compound command is run with
+struct _ctl_run
+{
+    TokState state;
+    VarTable vars;
+    CTL_run_callback run;
+    CTL_define_callback define;
+    void *cb_data;
+};
+
+static bool _CTL_parse_list(CList tokens, const char **ends, Compound *list, char *errmsg, size_t errmsg_sz);
+static bool _CTL_run_list(Compound list, struct _ctl_run *ctx, int *status);
+
+/*
+ * Create a command
+ */
+static Compound _CTL_new(CtlType type)
+{
+    Compound cmd = MEM_calloc(MEM_PIPELINE, 1, sizeof(struct _compound));
+    assert(cmd != NULL);
+
+    cmd->type = type;
+    return cmd;
+}
+
+/*
+ * Whether the next token is the keyword word
+ */
+static bool _CTL_is_keyword(CList tokens, const char *word)
+{
+    return tokens->length > 0 && TOK_next_type(tokens) == TOK_KEYWORD && strcmp(TOK_next(tokens).text, word) == 0;
+}
+
+/*
+ * Discard the next token
+ */
+static void _CTL_drop(CList tokens)
+{
+    Token tok = CL_pop(tokens);
+    MEM_free(tok.text);
+}
+
+/*
+ * Consume the keyword that has to come next
+ *
+ * Returns: true if it was next, false with an error message otherwise
+ */
+static bool _CTL_expect(CList tokens, const char *keyword, char *errmsg, size_t errmsg_sz)
+{
+    if (!_CTL_is_keyword(tokens, keyword))
+    {
+        snprintf(errmsg, errmsg_sz, "Expect '%s'", keyword);
+        return false;
+    }
+
+    _CTL_drop(tokens);
+    return true;
+}
+
+/*
+ * Parse a list that has to have at least one command
+ *
+ * Parameters:
+ *   tokens     The tokens
+ *   after      The keyword the list follows, for the error message
+ *   ends       The keywords that can end the list, NULL-terminated
+ *   list       Return space for the list
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false on a syntax error
+ */
+static bool _CTL_parse_body(CList tokens, const char *after, const char **ends, Compound *list, char *errmsg, size_t errmsg_sz)
+{
+    if (!_CTL_parse_list(tokens, ends, list, errmsg, errmsg_sz))
+        return false;
+
+    if (*list == NULL)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect command after '%s'", after);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Parse the rest of a for loop, after the for
+ */
+static bool _CTL_parse_for(CList tokens, Compound cmd, char *errmsg, size_t errmsg_sz)
+{
+    static const char *ends[] = {"done", NULL};
+    Token tok = TOK_next(tokens);
+
+    if (tokens->length == 0 || tok.type != TOK_WORD || !VAR_valid_name(tok.text, strlen(tok.text)))
+    {
+        snprintf(errmsg, errmsg_sz, "Expect variable name after 'for'");
+        return false;
+    }
+    cmd->name = CL_pop(tokens).text;
+
+    tok = TOK_next(tokens);
+    if (tokens->length == 0 || tok.type != TOK_WORD || strcmp(tok.text, "in") != 0)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect 'in' after 'for %s'", cmd->name);
+        return false;
+    }
+    _CTL_drop(tokens);
+
+    // the words are expanded when the loop starts
+    cmd->tokens = CL_new();
+    while (tokens->length > 0 && (TOK_next_type(tokens) == TOK_WORD || TOK_next_type(tokens) == TOK_QUOTED_WORD ||
+                                  TOK_next_type(tokens) == TOK_DEFERRED))
+        CL_append_any(cmd->tokens, CL_pop(tokens));
+
+    while (tokens->length > 0 && TOK_next_type(tokens) == TOK_SEMI)
+        _CTL_drop(tokens);
+
+    return _CTL_expect(tokens, "do", errmsg, errmsg_sz) &&
+           _CTL_parse_body(tokens, "do", ends, &cmd->body, errmsg, errmsg_sz) &&
+           _CTL_expect(tokens, "done", errmsg, errmsg_sz);
+}
+
+/*
+ * Whether a pipeline leaves the input it shares with the loop it is in
+ * alone: it has its own, or it starts with one of the builtins that
+ * read none, or with read, which reads from the same buffer
+ */
+static bool _CTL_leaves_input(pipeline_t *pipeline)
+{
+    static const char *no_input[] = {"echo", "printf", "test", "[", "true", "false", "set", "export",
+                                     "unset", "cd", "pwd", "hash", "stats", "author", "read", NULL};
+    pipeline_cmd_t *first = NULL;
+
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        if (node->type != TOK_WORD && node->type != TOK_QUOTED_WORD)
+            continue;
+
+        // a process substitution's command may read it too
+        if (node->num_procsubs > 0)
+            return false;
+        if (first == NULL)
+            first = node;
+    }
+
+    if (pipeline->input != NULL || pipeline->input_data != NULL)
+        return true;
+
+    if (first == NULL || first->args[0] == NULL || first->arg_types[0] == TOK_DEFERRED)
+        return false;
+
+    for (int i = 0; no_input[i] != NULL; i++)
+        if (strcmp(first->args[0], no_input[i]) == 0)
+            return true;
+
+    return false;
+}
+
+/*
+ * Whether every pipeline of a list, however deeply nested, leaves the
+ * input of the loop it is in alone
+ */
+static bool _CTL_list_leaves_input(Compound list)
+{
+    for (Compound cmd = list; cmd != NULL; cmd = cmd->next)
+    {
+        if (cmd->type == CTL_SIMPLE && !_CTL_leaves_input(cmd->pipeline))
+            return false;
+
+        // a function's body runs only when it is called
+        if (cmd->type != CTL_SIMPLE && cmd->type != CTL_FUNCTION &&
+            (!_CTL_list_leaves_input(cmd->cond) || !_CTL_list_leaves_input(cmd->body) ||
+             !_CTL_list_leaves_input(cmd->otherwise)))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Parse the rest of a while loop, after the while. The read of a
+ * "while read" loop may read ahead of the line it needs when nothing
+ * else in the loop reads its input, which is only left over once the
+ * read reaches the end of it.
+ */
+static bool _CTL_parse_while(CList tokens, Compound cmd, char *errmsg, size_t errmsg_sz)
+{
+    static const char *cond_ends[] = {"do", NULL};
+    static const char *body_ends[] = {"done", NULL};
+
+    if (!_CTL_parse_body(tokens, "while", cond_ends, &cmd->cond, errmsg, errmsg_sz) ||
+        !_CTL_expect(tokens, "do", errmsg, errmsg_sz) ||
+        !_CTL_parse_body(tokens, "do", body_ends, &cmd->body, errmsg, errmsg_sz) ||
+        !_CTL_expect(tokens, "done", errmsg, errmsg_sz))
+        return false;
+
+    // a read with its own input opens it again on each iteration
+    Compound cond = cmd->cond;
+    if (cond != NULL && cond->next == NULL && cond->type == CTL_SIMPLE && cond->pipeline->length == 1 &&
+        cond->pipeline->input == NULL && cond->pipeline->input_data == NULL && _CTL_leaves_input(cond->pipeline) &&
+        strcmp(cond->pipeline->head->args[0], "read") == 0)
+        cond->pipeline->read_ahead = _CTL_list_leaves_input(cmd->body);
+
+    return true;
+}
+
+/*
+ * Parse the rest of an if, after the if or elif, up to and including
+ * the fi. An elif is parsed as an if in the else part.
+ */
+static bool _CTL_parse_if(CList tokens, Compound cmd, const char *keyword, char *errmsg, size_t errmsg_sz)
+{
+    static const char *cond_ends[] = {"then", NULL};
+    static const char *body_ends[] = {"elif", "else", "fi", NULL};
+    static const char *else_ends[] = {"fi", NULL};
+
+    if (!_CTL_parse_body(tokens, keyword, cond_ends, &cmd->cond, errmsg, errmsg_sz) ||
+        !_CTL_expect(tokens, "then", errmsg, errmsg_sz) ||
+        !_CTL_parse_body(tokens, "then", body_ends, &cmd->body, errmsg, errmsg_sz))
+        return false;
+
+    if (_CTL_is_keyword(tokens, "elif"))
+    {
+        _CTL_drop(tokens);
+        cmd->otherwise = _CTL_new(CTL_IF);
+        return _CTL_parse_if(tokens, cmd->otherwise, "elif", errmsg, errmsg_sz);
+    }
+
+    if (_CTL_is_keyword(tokens, "else"))
+    {
+        _CTL_drop(tokens);
+        if (!_CTL_parse_body(tokens, "else", else_ends, &cmd->otherwise, errmsg, errmsg_sz))
+            return false;
+    }
+
+    return _CTL_expect(tokens, "fi", errmsg, errmsg_sz);
+}
+
+/*
+ * Parse the rest of a function definition, after the NAME()
+ */
+static bool _CTL_parse_function(CList tokens, Compound cmd, const char *keyword, char *errmsg, size_t errmsg_sz)
+{
+    static const char *ends[] = {"}", NULL};
+
+    cmd->name = MEM_strndup(MEM_TOKENS, keyword, strlen(keyword) - strlen("()"));
+
+    // the { may be on the next line
+    while (tokens->length > 0 && TOK_next_type(tokens) == TOK_SEMI)
+        _CTL_drop(tokens);
+
+    return _CTL_expect(tokens, "{", errmsg, errmsg_sz) &&
+           _CTL_parse_body(tokens, "{", ends, &cmd->body, errmsg, errmsg_sz) &&
+           _CTL_expect(tokens, "}", errmsg, errmsg_sz);
+}
+
+/*
+ * Whether a pipeline has words or redirections to expand when it runs
+ */
+static bool _CTL_has_deferred(pipeline_t *pipeline)
+{
+    if (pipeline->deferred != 0)
+        return true;
+
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        if (node->type != TOK_WORD && node->type != TOK_QUOTED_WORD)
+            continue;
+
+        for (int i = 0; node->args[i] != NULL; i++)
+            if (node->arg_types[i] == TOK_DEFERRED)
+                return true;
+    }
+
+    return false;
+}
+
+/*
+ * Parse the next command of a list, and add it to the list
+ *
+ * Parameters:
+ *   tokens     The tokens, starting with the command
+ *   cmd        Return space for the command
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false on a syntax error
+ */
+static bool _CTL_parse_command(CList tokens, Compound *cmd, char *errmsg, size_t errmsg_sz)
+{
+    Token tok = TOK_next(tokens);
+
+    if (tok.type != TOK_KEYWORD)
+    {
+        // a pipeline runs to the end of the line or a ';'
+        *cmd = _CTL_new(CTL_SIMPLE);
+        (*cmd)->tokens = CL_new();
+        while (tokens->length > 0 && TOK_next_type(tokens) != TOK_SEMI && TOK_next_type(tokens) != TOK_KEYWORD)
+            CL_append_any((*cmd)->tokens, CL_pop(tokens));
+
+        (*cmd)->pipeline = parse_tokens((*cmd)->tokens, errmsg, errmsg_sz);
+        if ((*cmd)->pipeline == NULL)
+            return false;
+
+        (*cmd)->deferred = _CTL_has_deferred((*cmd)->pipeline);
+        return true;
+    }
+
+    bool ok;
+    char *keyword = CL_pop(tokens).text;
+
+    if (strcmp(keyword, "for") == 0)
+        ok = _CTL_parse_for(tokens, *cmd = _CTL_new(CTL_FOR), errmsg, errmsg_sz);
+    else if (strcmp(keyword, "while") == 0)
+        ok = _CTL_parse_while(tokens, *cmd = _CTL_new(CTL_WHILE), errmsg, errmsg_sz);
+    else if (strcmp(keyword, "if") == 0)
+        ok = _CTL_parse_if(tokens, *cmd = _CTL_new(CTL_IF), "if", errmsg, errmsg_sz);
+    else if (strlen(keyword) > 2 && strcmp(keyword + strlen(keyword) - 2, "()") == 0)
+        ok = _CTL_parse_function(tokens, *cmd = _CTL_new(CTL_FUNCTION), keyword, errmsg, errmsg_sz);
+    else
+    {
+        snprintf(errmsg, errmsg_sz, "Unexpected '%s'", keyword);
+        ok = false;
+    }
+    MEM_free(keyword);
+
+    // only a ';', a newline or a keyword can follow the done, fi or }
+    if (ok && tokens->length > 0 && TOK_next_type(tokens) != TOK_SEMI && TOK_next_type(tokens) != TOK_KEYWORD)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect ';' after '%s'",
+                 (*cmd)->type == CTL_IF ? "fi" : (*cmd)->type == CTL_FUNCTION ? "}" : "done");
+        ok = false;
+    }
+
+    return ok;
+}
+
+/*
+ * Parse a list of commands, up to one of the keywords that end it or
+ * the end of the tokens
+ *
+ * Parameters:
+ *   tokens     The tokens
+ *   ends       The keywords that can end the list, NULL-terminated
+ *   list       Return space for the list, NULL if it has no commands
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false on a syntax error
+ */
+static bool _CTL_parse_list(CList tokens, const char **ends, Compound *list, char *errmsg, size_t errmsg_sz)
+{
+    *list = NULL;
+
+    while (true)
+    {
+        // blank lines and empty commands are skipped
+        while (tokens->length > 0 && TOK_next_type(tokens) == TOK_SEMI)
+            _CTL_drop(tokens);
+
+        if (tokens->length == 0)
+            return true;
+
+        for (int i = 0; ends[i] != NULL; i++)
+            if (_CTL_is_keyword(tokens, ends[i]))
+                return true;
+
+        // each command is on the list before it is parsed, to be freed with it
+        if (!_CTL_parse_command(tokens, list, errmsg, errmsg_sz))
+            return false;
+
+        list = &(*list)->next;
+    }
+}
+
+// Documented in .h file
+bool CTL_is_compound(CList tokens)
+{
+    return tokens != NULL && tokens->length > 0 && TOK_next_type(tokens) == TOK_KEYWORD;
+}
+
+// Documented in .h file
+Compound CTL_parse(CList tokens, char *errmsg, size_t errmsg_sz)
+{
+    static const char *ends[] = {NULL};
+    Compound compound = NULL;
+
+    // clear the error message
+    errmsg[0] = '\0';
+
+    bool ok = _CTL_parse_list(tokens, ends, &compound, errmsg, errmsg_sz);
+    CL_free(tokens);
+
+    if (!ok)
+    {
+        CTL_free(compound);
+        return NULL;
+    }
+
+    return compound;
+}
+
+// Documented in .h file
+Compound CTL_hold(Compound compound)
+{
+    assert(compound != NULL);
+
+    // a parsed command may be run by shells on several threads at once
+    __atomic_fetch_add(&compound->holds, 1, __ATOMIC_RELAXED);
+    return compound;
+}
+
+// Documented in .h file
+void CTL_free(Compound compound)
+{
+    // a held list is freed by the last of its owners
+    if (compound != NULL && __atomic_fetch_sub(&compound->holds, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    while (compound != NULL)
+    {
+        Compound next = compound->next;
+
+        pipeline_free(compound->pipeline);
+        CL_free(compound->tokens);
+        MEM_free(compound->name);
+        CTL_free(compound->cond);
+        CTL_free(compound->body);
+        CTL_free(compound->otherwise);
+        MEM_free(compound);
+
+        compound = next;
+    }
+}
+
+/*
+ * Expand the source of a redirection's file name, which has to be one
+ * word
+ *
+ * Parameters:
+ *   state      The tokenizer state to expand with
+ *   source     The source of the word
+ *   words      The list that takes over the expanded word
+ *   word       Return space for the word
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false on error
+ */
+static bool _CTL_expand_file(TokState state, const char *source, CList words, char **word, char *errmsg, size_t errmsg_sz)
+{
+    CList expanded = TOK_expand(state, source, errmsg, errmsg_sz);
+    if (expanded == NULL)
+        return false;
+
+    if (expanded->length != 1)
+    {
+        snprintf(errmsg, errmsg_sz, "Ambiguous redirect");
+        CL_free(expanded);
+        return false;
+    }
+
+    Token tok = CL_pop(expanded);
+    CL_append(words, tok);
+    *word = tok.text;
+
+    CL_free(expanded);
+    return true;
+}
+
+/*
+ * Expand a here-string from the source of its word: the words it
+ * expands to, separated by spaces, followed by a newline
+ *
+ * Returns: The data, from MEM_alloc, or NULL with an error message in
+ *   errmsg
+ */
+static char *_CTL_expand_herestring(TokState state, const char *source, char *errmsg, size_t errmsg_sz)
+{
+    CList expanded = TOK_expand(state, source, errmsg, errmsg_sz);
+    if (expanded == NULL)
+        return NULL;
+
+    size_t len = 1;
+    for (struct _cl_node *node = expanded->head; node != NULL; node = node->next)
+        len += strlen(node->tok_elt.text) + 1;
+
+    char *data = MEM_alloc(MEM_PIPELINE, len + 1);
+    assert(data != NULL);
+    data[0] = '\0';
+
+    for (struct _cl_node *node = expanded->head; node != NULL; node = node->next)
+    {
+        if (node != expanded->head)
+            strcat(data, " ");
+        strcat(data, node->tok_elt.text);
+    }
+    strcat(data, "\n");
+
+    CL_free(expanded);
+    return data;
+}
+
+/*
+ * Build the pipeline to run from a pipeline with deferred words,
+ * expanding them. The words that are not deferred are shared with it.
+ *
+ * Parameters:
+ *   tmpl       The pipeline with deferred words
+ *   state      The tokenizer state to expand with
+ *   words      The list that takes over the expanded words
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The new pipeline, pointing into words, or NULL on error
+ */
+static pipeline_t *_CTL_expand(pipeline_t *tmpl, TokState state, CList words, char *errmsg, size_t errmsg_sz)
+{
+    pipeline_t *pipeline = pipeline_new();
+
+    for (pipeline_cmd_t *node = tmpl->head; node != NULL; node = node->next)
+    {
+        pipeline_cmd_t *cmd = pipeline_cmd_new(node->type);
+        pipeline_add_command(pipeline, cmd);
+
+        if (node->type != TOK_WORD && node->type != TOK_QUOTED_WORD)
+            continue;
+
+        for (int i = 0; node->args[i] != NULL; i++)
+        {
+            if (node->arg_types[i] == TOK_PROCSUB_IN || node->arg_types[i] == TOK_PROCSUB_OUT)
+                pipeline_cmd_add_procsub(cmd, node->arg_types[i], node->args[i]);
+            else if (node->arg_types[i] != TOK_DEFERRED)
+                pipeline_cmd_add_arg(cmd, node->args[i]);
+            else
+            {
+                CList expanded = TOK_expand_arg(state, cmd->args[0], node->args[i], errmsg, errmsg_sz);
+                if (expanded == NULL)
+                    goto error;
+
+                while (expanded->length > 0)
+                {
+                    Token tok = CL_pop(expanded);
+                    CL_append_any(words, tok);
+                    pipeline_cmd_add_arg(cmd, tok.text);
+                }
+
+                CL_free(expanded);
+            }
+        }
+
+        if (cmd->num_args == 0)
+        {
+            snprintf(errmsg, errmsg_sz, "No command specified");
+            goto error;
+        }
+    }
+
+    pipeline->input = tmpl->input;
+    pipeline->output = tmpl->output;
+    pipeline->read_ahead = tmpl->read_ahead;
+
+    if ((tmpl->deferred & PIPELINE_INPUT_DEFERRED) &&
+        !_CTL_expand_file(state, tmpl->input, words, &pipeline->input, errmsg, errmsg_sz))
+        goto error;
+
+    if ((tmpl->deferred & PIPELINE_OUTPUT_DEFERRED) &&
+        !_CTL_expand_file(state, tmpl->output, words, &pipeline->output, errmsg, errmsg_sz))
+        goto error;
+
+    if (tmpl->deferred & PIPELINE_HEREDOC_DEFERRED)
+        pipeline->input_data = TOK_expand_heredoc(state, tmpl->input_data, errmsg, errmsg_sz);
+    else if (tmpl->deferred & PIPELINE_HERESTRING_DEFERRED)
+        pipeline->input_data = _CTL_expand_herestring(state, tmpl->input_data, errmsg, errmsg_sz);
+    else
+        pipeline_set_input_data(pipeline, tmpl->input_data);
+
+    if (tmpl->input_data != NULL && pipeline->input_data == NULL)
+        goto error;
+
+    return pipeline;
+
+error:
+    pipeline_free(pipeline);
+    return NULL;
+}
+
+/*
+ * Run a pipeline of a compound command, expanding its deferred words
+ */
+static bool _CTL_run_pipeline(Compound cmd, struct _ctl_run *ctx, int *status)
+{
+    // a pipeline that expands nothing is run as it was parsed
+    if (!cmd->deferred)
+        return ctx->run(cmd->pipeline, status, ctx->cb_data);
+
+    char errmsg[100];
+    bool go_on = true;
+    CList words = CL_new();
+
+    pipeline_t *pipeline = _CTL_expand(cmd->pipeline, ctx->state, words, errmsg, sizeof(errmsg));
+    if (pipeline != NULL)
+        go_on = ctx->run(pipeline, status, ctx->cb_data);
+    else
+    {
+        fprintf(stderr, "%s\n", errmsg);
+        *status = 1;
+    }
+
+    pipeline_free(pipeline);
+    CL_free(words);
+    return go_on;
+}
+
+/*
+ * Run a for loop
+ */
+static bool _CTL_run_for(Compound cmd, struct _ctl_run *ctx, int *status)
+{
+    char errmsg[100];
+    CList words = CL_new();
+
+    for (struct _cl_node *node = cmd->tokens->head; node != NULL; node = node->next)
+    {
+        Token tok = node->tok_elt;
+        if (tok.type != TOK_DEFERRED)
+        {
+            CL_append_any(words, (Token){tok.type, MEM_strdup(MEM_TOKENS, tok.text)});
+            continue;
+        }
+
+        CList expanded = TOK_expand(ctx->state, tok.text, errmsg, sizeof(errmsg));
+        if (expanded == NULL)
+        {
+            fprintf(stderr, "%s\n", errmsg);
+            CL_free(words);
+            *status = 1;
+            return true;
+        }
+
+        while (expanded->length > 0)
+            CL_append(words, CL_pop(expanded));
+        CL_free(expanded);
+    }
+
+    bool go_on = true;
+    *status = 0;
+
+    for (struct _cl_node *node = words->head; node != NULL && go_on; node = node->next)
+    {
+        VAR_set(ctx->vars, cmd->name, node->tok_elt.text);
+        go_on = _CTL_run_list(cmd->body, ctx, status);
+    }
+
+    CL_free(words);
+    return go_on;
+}
+
+/*
+ * Run a command of a compound command
+ */
+static bool _CTL_run_command(Compound cmd, struct _ctl_run *ctx, int *status)
+{
+    int body_status = 0;
+
+    switch (cmd->type)
+    {
+    case CTL_SIMPLE:
+        return _CTL_run_pipeline(cmd, ctx, status);
+
+    case CTL_FOR:
+        return _CTL_run_for(cmd, ctx, status);
+
+    case CTL_WHILE:
+        while (true)
+        {
+            if (!_CTL_run_list(cmd->cond, ctx, status))
+                return false;
+
+            if (*status != 0)
+                break;
+
+            if (!_CTL_run_list(cmd->body, ctx, &body_status))
+            {
+                *status = body_status;
+                return false;
+            }
+        }
+
+        // the status of the last run of the body, or 0 if it never ran
+        *status = body_status;
+        return true;
+
+    case CTL_IF:
+        if (!_CTL_run_list(cmd->cond, ctx, status))
+            return false;
+
+        return _CTL_run_list(*status == 0 ? cmd->body : cmd->otherwise, ctx, status);
+
+    case CTL_FUNCTION:
+        if (ctx->define != NULL)
+            ctx->define(cmd->name, cmd->body, ctx->cb_data);
+        *status = 0;
+        return true;
+    }
+    __builtin_unreachable();
+}
+
+/*
+ * Run a list of commands
+ *
+ * Returns: false if a command was stopped, true otherwise
+ */
+static bool _CTL_run_list(Compound list, struct _ctl_run *ctx, int *status)
+{
+    *status = 0;
+
+    for (Compound cmd = list; cmd != NULL; cmd = cmd->next)
+        if (!_CTL_run_command(cmd, ctx, status))
+            return false;
+
+    return true;
+}
+
+// Documented in .h file
+bool CTL_run(Compound compound, TokState state, VarTable vars, CTL_run_callback run, CTL_define_callback define,
+             void *cb_data, int *status)
+{
+    assert(compound != NULL && state != NULL && run != NULL);
+
+    struct _ctl_run ctx = {state, vars, run, define, cb_data};
+    return _CTL_run_list(compound, &ctx, status);
+}
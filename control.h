@@ -0,0 +1,126 @@
+/*
+ * control.h
+ *
+ * Compound commands: for, while, if and function definitions. A
+ * compound command is parsed once into a tree of pipelines, which is
+ * run without tokenizing it again; each time a pipeline runs, only its
+ * deferred words are expanded.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "clist.h"
+#include "pipeline.h"
+#include "tokenize.h"
+#include "vars.h"
+
+// struct _compound to be used in the .c as Compound
+typedef struct _compound *Compound;
+
+/*
+ * Runs a pipeline of a compound command.
+ *
+ * Parameters:
+ *   pipeline   The pipeline, with its words expanded
+ *   status     Return space for the exit status of the pipeline
+ *   cb_data    Caller data passed to CTL_run
+ *
+ * Returns: true to go on, false to stop running the compound command,
+ *   as for the exit command
+ */
+typedef bool (*CTL_run_callback)(pipeline_t *pipeline, int *status, void *cb_data);
+
+/*
+ * Defines a function of a compound command.
+ *
+ * Parameters:
+ *   name       The name of the function
+ *   body       The commands of the function, which stay the compound
+ *              command's; CTL_hold them to keep them
+ *   cb_data    Caller data passed to CTL_run
+ *
+ * Returns: None
+ */
+typedef void (*CTL_define_callback)(const char *name, Compound body, void *cb_data);
+
+/*
+ * Check whether a list of tokens is a compound command
+ *
+ * Parameters:
+ *   tokens     The tokens of a command, from TOK_tokenize_chunk
+ *
+ * Returns: true if the command starts with for, while, if or NAME()
+ */
+bool CTL_is_compound(CList tokens);
+
+/*
+ * Parse the tokens of a compound command:
+ *
+ *   for NAME in WORD...; do LIST; done
+ *   while LIST; do LIST; done
+ *   if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+ *   NAME() { LIST; }
+ *
+ * where a LIST is commands separated by ';' or newlines. A compound
+ * command can be followed by more commands after a ';'.
+ *
+ * Parameters:
+ *   tokens     The tokens, which the compound command takes over
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The compound command, which the caller must CTL_free; or
+ *   NULL with an error message in errmsg, having freed the tokens
+ */
+Compound CTL_parse(CList tokens, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Keep a compound command, e.g. a function body, until a matching
+ * CTL_free, even if whatever it came from is freed first
+ *
+ * Parameters:
+ *   compound   The compound command
+ *
+ * Returns: The compound command
+ */
+Compound CTL_hold(Compound compound);
+
+/*
+ * Free a compound command, with its pipelines and tokens, unless it is
+ * still held by a CTL_hold without a CTL_free
+ *
+ * Parameters:
+ *   compound   The compound command, or NULL
+ *
+ * Returns: None
+ */
+void CTL_free(Compound compound);
+
+/*
+ * Run a compound command. A condition is true when the exit status of
+ * its last command is 0. A pipeline whose words cannot be expanded is
+ * not run, and has the status 1 after its error is printed. Running a
+ * function definition only defines it, with the status 0.
+ *
+ * Parameters:
+ *   compound   The compound command
+ *   state      The tokenizer state to expand deferred words with
+ *   vars       The variables the for loops set
+ *   run        The function that runs each pipeline
+ *   define     The function that defines each function, or NULL to
+ *              ignore the definitions
+ *   cb_data    Caller data to pass to run and define
+ *   status     Return space for the exit status of the last pipeline,
+ *              or 0 if none ran
+ *
+ * Returns: false if run stopped the compound command, true otherwise
+ */
+bool CTL_run(Compound compound, TokState state, VarTable vars, CTL_run_callback run, CTL_define_callback define,
+             void *cb_data, int *status);
+
+#endif /* _CONTROL_H_ */
@@ -0,0 +1,465 @@
+/**
+ * control_test.c
+ *
+ * This file contains the test cases for control.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "control.h"
+#include "functions.h"
+#include "mem.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+// what the fake commands did
+struct runs
+{
+    VarTable vars;
+    char log[512];      // the echo commands and redirections, each followed by ';'
+    int calls;          // the pipelines run
+    int count;          // the times count ran
+    int limit;          // the count at which count fails
+    pipeline_t *tested; // the last test pipeline run
+    int tested_again;   // the times the same test pipeline ran again
+    FuncTable funcs;    // the functions defined
+    int read_ahead;     // the times read ran allowed to read ahead
+};
+
+/*
+ * Runs a pipeline with fake commands: count, and read, succeed until
+ * they have run limit times, setting $N; false and exit do as the
+ * builtins; echo and cat are logged with their redirections; anything
+ * else succeeds.
+ */
+static bool fake_run(pipeline_t *pipeline, int *status, void *cb_data)
+{
+    struct runs *runs = (struct runs *)cb_data;
+    char **args = pipeline->head->args;
+    char n[16];
+
+    runs->calls++;
+    *status = 0;
+
+    if (strcmp(args[0], "exit") == 0)
+        return false;
+
+    if (strcmp(args[0], "false") == 0)
+        *status = 1;
+
+    else if (strcmp(args[0], "count") == 0 || strcmp(args[0], "read") == 0)
+    {
+        runs->read_ahead += pipeline->read_ahead;
+        *status = ++runs->count > runs->limit;
+        snprintf(n, sizeof(n), "%d", runs->count);
+        VAR_set(runs->vars, "N", n);
+    }
+
+    else if (strcmp(args[0], "test") == 0)
+    {
+        runs->tested_again += pipeline == runs->tested;
+        runs->tested = pipeline;
+    }
+
+    else if (strcmp(args[0], "echo") == 0 || strcmp(args[0], "cat") == 0)
+    {
+        for (int i = 0; args[i] != NULL; i++)
+        {
+            strcat(runs->log, i > 0 ? " " : "");
+            strcat(runs->log, args[i]);
+        }
+
+        if (pipeline->input != NULL)
+            strcat(strcat(runs->log, " <"), pipeline->input);
+        if (pipeline->output != NULL)
+            strcat(strcat(runs->log, " >"), pipeline->output);
+        if (pipeline->input_data != NULL)
+            strcat(strcat(runs->log, " <<"), pipeline->input_data);
+        strcat(runs->log, ";");
+    }
+
+    return true;
+}
+
+/*
+ * Defines a function in the fake commands' table
+ */
+static void fake_define(const char *name, Compound body, void *cb_data)
+{
+    struct runs *runs = (struct runs *)cb_data;
+    FUNC_define(runs->funcs, name, body);
+}
+
+/*
+ * A glob callback that expands a pattern starting with "two" to two
+ * words, and leaves the others as they are
+ */
+static char **fake_glob(const char *pattern, void *cb_data)
+{
+    if (strncmp(pattern, "two", 3) != 0)
+        return NULL;
+
+    char **matches = MEM_alloc(MEM_GLOB, 3 * sizeof(char *));
+    matches[0] = MEM_strdup(MEM_GLOB, "two1");
+    matches[1] = MEM_strdup(MEM_GLOB, "two2");
+    matches[2] = NULL;
+    return matches;
+}
+
+/*
+ * Tokenizes, parses and runs the lines of a compound command with the
+ * fake commands
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   lines    The lines, NULL-terminated
+ *   runs     The fake commands' record
+ *   status   Return space for the exit status
+ *
+ * Returns: The value CTL_run returned, or false if the command did not
+ *   parse
+ */
+static bool run_lines(TokState state, const char **lines, struct runs *runs, int *status)
+{
+    char errmsg[128];
+    CList tokens = NULL;
+
+    for (int i = 0; lines[i] != NULL && tokens == NULL; i++)
+        tokens = TOK_tokenize_chunk(state, lines[i], errmsg, sizeof(errmsg));
+
+    if (!CTL_is_compound(tokens))
+    {
+        CL_free(tokens);
+        return false;
+    }
+
+    Compound compound = CTL_parse(tokens, errmsg, sizeof(errmsg));
+    if (compound == NULL)
+        return false;
+
+    bool go_on = CTL_run(compound, state, runs->vars, fake_run, fake_define, runs, status);
+    CTL_free(compound);
+
+    return go_on;
+}
+
+/*
+ * Tests that syntax errors are reported
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parse_errors()
+{
+    char errmsg[128];
+    const char *cases[][2] = {
+        {"for 1 in a; do echo; done", "Expect variable name after 'for'"},
+        {"for i a; do echo; done", "Expect 'in' after 'for i'"},
+        {"for i in a; echo; done", "Expect 'do'"},
+        {"while true; done", "Unexpected 'done'"},
+        {"while do echo; done", "Expect command after 'while'"},
+        {"if true; then fi", "Expect command after 'then'"},
+        {"if true; then echo; done", "Unexpected 'done'"},
+        {"if true; then echo; fi > out", "Expect ';' after 'fi'"},
+        {"if true; then echo | | wc; fi", "No command specified"},
+        {"f() echo; }", "Expect '{'"},
+        {"f() { }", "Expect command after '{'"},
+        {"f() { echo; } > out", "Expect ';' after '}'"},
+    };
+
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        CList tokens = TOK_tokenize_input(cases[i][0], errmsg, sizeof(errmsg));
+        test_assert(CTL_is_compound(tokens));
+        test_assert(CTL_parse(tokens, errmsg, sizeof(errmsg)) == NULL);
+        test_assert(strcmp(errmsg, cases[i][1]) == 0);
+    }
+
+    // a command that does not start with a keyword is not compound
+    CList tokens = TOK_tokenize_input("echo if; fi", errmsg, sizeof(errmsg));
+    test_assert(!CTL_is_compound(tokens));
+    CL_free(tokens);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+/*
+ * Tests for loops, with their words and body expanded each time
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_for()
+{
+    struct runs runs = {.vars = VAR_new()};
+    TokState state = TOK_state_new();
+    int status = -1;
+
+    VAR_set(runs.vars, "X", "d");
+    TOK_state_set_vars(state, runs.vars);
+
+    const char *loop[] = {"for i in a \"b c\" $X; do echo x$i; test $i; done", NULL};
+    test_assert(run_lines(state, loop, &runs, &status));
+    test_assert(strcmp(runs.log, "echo xa;echo xb c;echo xd;") == 0);
+    test_assert(strcmp(VAR_get(runs.vars, "i"), "d") == 0);
+    test_assert(status == 0 && runs.calls == 6);
+
+    // a loop over nothing runs nothing, and a nested loop runs each time
+    runs.log[0] = '\0';
+    const char *nested[] = {"for i in; do echo never; done", "for i in 1 2", "do for j in x y; do", "echo $i$j",
+                            "done; false; done", NULL};
+    test_assert(run_lines(state, nested, &runs, &status));
+    test_assert(run_lines(state, nested + 1, &runs, &status));
+    test_assert(strcmp(runs.log, "echo 1x;echo 1y;echo 2x;echo 2y;") == 0);
+    test_assert(status == 1);
+
+    // exit stops all of it
+    runs.log[0] = '\0';
+    const char *stop[] = {"for i in a b; do echo $i; exit; done; echo after", NULL};
+    test_assert(!run_lines(state, stop, &runs, &status));
+    test_assert(strcmp(runs.log, "echo a;") == 0);
+
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 1;
+
+test_error:
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 0;
+}
+
+/*
+ * Tests while loops and if, and that a loop body is parsed once however
+ * many times it runs
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_while_if()
+{
+    struct runs runs = {.vars = VAR_new(), .limit = 3};
+    TokState state = TOK_state_new();
+    int status = -1;
+
+    TOK_state_set_vars(state, runs.vars);
+
+    const char *loop[] = {"while count", "do", "  if false; then echo no; elif true; then echo n$N",
+                          "  else echo no; fi", "done", NULL};
+    test_assert(run_lines(state, loop, &runs, &status));
+    test_assert(strcmp(runs.log, "echo n1;echo n2;echo n3;") == 0);
+    test_assert(status == 0);
+
+    // an if without a true branch has status 0
+    const char *no_else[] = {"if false; then echo no; fi", NULL};
+    test_assert(run_lines(state, no_else, &runs, &status));
+    test_assert(status == 0);
+
+    // the test in the body is the same pipeline every time
+    runs.count = 0;
+    runs.calls = 0;
+    runs.limit = 100000;
+    const char *many[] = {"while count; do test -n x; done", NULL};
+    test_assert(run_lines(state, many, &runs, &status));
+    test_assert(runs.calls == 200001);
+    test_assert(runs.tested_again == 99999);
+
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 1;
+
+test_error:
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 0;
+}
+
+/*
+ * Tests which while read loops may read ahead: those where nothing else
+ * reads the loop's input
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_read_ahead()
+{
+    struct runs runs = {.vars = VAR_new()};
+    TokState state = TOK_state_new();
+    int status = -1;
+
+    TOK_state_set_vars(state, runs.vars);
+    VAR_set(runs.vars, "NAME", "line");
+
+    const char *owned[] = {"while read $NAME; do",
+                           "  echo $line; cat <file; if test -n x; then printf x | cat; fi",
+                           "done", NULL};
+    const char *not_owned[] = {"while read line; do if true; then cat; fi; done", NULL};
+    const char *redirected[] = {"while read line <file; do echo; done", NULL};
+    const char *not_alone[] = {"while true; read line; do echo; done", NULL};
+
+    runs.limit = 3;
+    test_assert(run_lines(state, owned, &runs, &status));
+    test_assert(runs.count == 4 && runs.read_ahead == 4);
+
+    runs.count = 0;
+    runs.read_ahead = 0;
+    test_assert(run_lines(state, not_owned, &runs, &status));
+    test_assert(runs.count == 4 && runs.read_ahead == 0);
+
+    runs.count = 0;
+    test_assert(run_lines(state, redirected, &runs, &status));
+    test_assert(runs.count == 4 && runs.read_ahead == 0);
+
+    runs.count = 0;
+    test_assert(run_lines(state, not_alone, &runs, &status));
+    test_assert(runs.count == 4 && runs.read_ahead == 0);
+
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 1;
+
+test_error:
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 0;
+}
+
+/*
+ * Tests redirections that are expanded each time they run
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_redirections()
+{
+    struct runs runs = {.vars = VAR_new()};
+    TokState state = TOK_state_new();
+    int status = -1;
+
+    TOK_state_set_vars(state, runs.vars);
+    TOK_state_set_glob(state, fake_glob, NULL);
+
+    const char *loop[] = {"for f in a b; do cat < $f.in > \"$f out\"; cat <<< $f", "cat <<END", "[$f]", "END",
+                          "done", NULL};
+    test_assert(run_lines(state, loop, &runs, &status));
+    test_assert(strcmp(runs.log, "cat <a.in >a out;cat <<a\n;cat <<[a]\n;"
+                                 "cat <b.in >b out;cat <<b\n;cat <<[b]\n;") == 0);
+
+    // a file name has to be one word
+    runs.log[0] = '\0';
+    const char *ambiguous[] = {"for f in a; do echo > two*; echo $f; done", NULL};
+    test_assert(run_lines(state, ambiguous, &runs, &status));
+    test_assert(strcmp(runs.log, "echo a;") == 0);
+
+    // a glob is expanded when the loop runs
+    runs.log[0] = '\0';
+    const char *glob[] = {"if true; then echo two*; fi", NULL};
+    test_assert(run_lines(state, glob, &runs, &status));
+    test_assert(strcmp(runs.log, "echo two1 two2;") == 0);
+
+    // however many words there are to expand
+    char line[256] = "for w in x; do echo", expected[256] = "echo";
+    for (int i = 0; i < 60; i++)
+    {
+        strcat(line, " $w");
+        strcat(expected, " x");
+    }
+    strcat(line, "; done");
+    strcat(expected, ";");
+    runs.log[0] = '\0';
+    const char *many[] = {line, NULL};
+    test_assert(run_lines(state, many, &runs, &status));
+    test_assert(strcmp(runs.log, expected) == 0);
+
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 1;
+
+test_error:
+    TOK_state_free(state);
+    VAR_free(runs.vars);
+    return 0;
+}
+
+/*
+ * Tests function definitions, whose bodies outlive the command that
+ * defined them and run with the positional parameters of each call
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_functions()
+{
+    struct runs runs = {.vars = VAR_new(), .funcs = FUNC_new()};
+    TokState state = TOK_state_new();
+    int status = -1;
+    char *args[] = {"greet", "a", "b", NULL};
+
+    TOK_state_set_vars(state, runs.vars);
+
+    // defining a function runs none of it
+    const char *define[] = {"greet() {", "  for w in \"$@\"; do echo x$w; done", "  echo $#", "}; echo defined", NULL};
+    test_assert(run_lines(state, define, &runs, &status));
+    test_assert(strcmp(runs.log, "echo defined;") == 0);
+    test_assert(FUNC_count(runs.funcs) == 1);
+
+    // the body is parsed once and runs with each call's parameters
+    Compound body = FUNC_lookup(runs.funcs, "greet");
+    test_assert(body != NULL);
+    VAR_push_args(runs.vars, args);
+    test_assert(CTL_run(body, state, runs.vars, fake_run, fake_define, &runs, &status));
+    VAR_pop_args(runs.vars);
+    test_assert(strcmp(runs.log, "echo defined;echo xa;echo xb;echo 2;") == 0);
+
+    // a body that is held outlives its redefinition
+    CTL_hold(body);
+    const char *redefine[] = {"greet() { echo again; }", NULL};
+    test_assert(run_lines(state, redefine, &runs, &status));
+    test_assert(FUNC_lookup(runs.funcs, "greet") != body);
+    runs.log[0] = '\0';
+    test_assert(CTL_run(body, state, runs.vars, fake_run, fake_define, &runs, &status));
+    CTL_free(body);
+    test_assert(strcmp(runs.log, "echo 0;") == 0);
+
+    TOK_state_free(state);
+    FUNC_free(runs.funcs);
+    VAR_free(runs.vars);
+    return 1;
+
+test_error:
+    TOK_state_free(state);
+    FUNC_free(runs.funcs);
+    VAR_free(runs.vars);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_parse_errors();
+    num_tests++;
+    passed += test_for();
+    num_tests++;
+    passed += test_while_if();
+    num_tests++;
+    passed += test_read_ahead();
+    num_tests++;
+    passed += test_redirections();
+    num_tests++;
+    passed += test_functions();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,944 @@
+/*
+ * exec.c
+ *
+ * The executor: runs pipelines, with pipes, redirections, process
+ * substitutions, builtin stages on helper threads and function calls
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "builtins.h"
+#include "control.h"
+#include "exec.h"
+#include "flatpipe.h"
+#include "mem.h"
+
+// the most function calls inside one another
+#define MAX_CALL_DEPTH 1000
+
+/*
+ * Replaces the current process with an external command, searching
+ * PATH from the shell variables when the name has no slash. Returns
+ * only if the command could not be executed.
+ *
+ * Parameters:
+ *   sh         The shell
+ *   file       The executable found in the path cache, tried before
+ *              searching the PATH, or NULL
+ *   args       The command and its arguments
+ *   envp       The environment for the command
+ *
+ * Returns:
+ *   None
+ */
+static void exec_command(shell_t *sh, const char *file, char **args, char **envp)
+{
+    if (file != NULL)
+        execve(file, args, envp);
+
+    if (strchr(args[0], '/') != NULL)
+    {
+        execve(args[0], args, envp);
+        return;
+    }
+
+    const char *path = VAR_get(sh->vars, "PATH");
+    if (path == NULL)
+        path = "/usr/bin:/bin";
+
+    size_t name_len = strlen(args[0]);
+    int saved_errno = ENOENT;
+
+    while (*path != '\0')
+    {
+        const char *end = strchrnul(path, ':');
+        size_t dir_len = end - path;
+        char *candidate = MEM_alloc(MEM_IO, dir_len + name_len + 2);
+        assert(candidate != NULL);
+
+        // an empty PATH element means the current directory
+        if (dir_len == 0)
+            strcpy(candidate, args[0]);
+        else
+            sprintf(candidate, "%.*s/%s", (int)dir_len, path, args[0]);
+
+        execve(candidate, args, envp);
+        MEM_free(candidate);
+
+        // keep a more useful error than "not found" from a later element
+        if (errno != ENOENT && errno != ENOTDIR)
+            saved_errno = errno;
+
+        path = *end ? end + 1 : end;
+    }
+
+    errno = saved_errno;
+}
+
+static int call_function(shell_t *sh, Compound body, char **args, int in_fd, int out_fd);
+
+/*
+ * Prints an error message for errno to the shell's standard error, as
+ * perror() does to the process's
+ */
+static void shell_perror(shell_t *sh, const char *what)
+{
+    dprintf(sh->err_fd, "%s: %s\n", what, strerror(errno));
+}
+
+/*
+ * Opens a pidfd, which becomes readable when the process exits
+ */
+static int pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/*
+ * Sends a signal to the process a pidfd refers to
+ */
+static int pidfd_send_signal(int pidfd, int sig)
+{
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+/*
+ * Tokenizes and parses a command given as a string, as for a $(...)
+ * or <(...) substitution
+ *
+ * Parameters:
+ *   sh         The shell
+ *   command    The command text
+ *   tokens     Return space for the token list, which the pipeline
+ *              points into; the caller must CL_free it
+ *
+ * Returns:
+ *   The pipeline, or NULL after printing an error message
+ */
+static pipeline_t *parse_command_string(shell_t *sh, const char *command, CList *tokens)
+{
+    char errmsg[100];
+
+    // substitutions may nest, so the inner command gets its own lexer state
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, sh->vars);
+    TOK_state_set_subst(state, EXEC_command_substitution, sh);
+
+    *tokens = TOK_tokenize_chunk(state, command, errmsg, sizeof(errmsg));
+    if (*tokens == NULL && TOK_state_incomplete(state))
+        snprintf(errmsg, sizeof(errmsg), "Unterminated quote");
+    TOK_state_free(state);
+
+    if (*tokens == NULL)
+    {
+        dprintf(sh->err_fd, "%s\n", errmsg);
+        return NULL;
+    }
+
+    pipeline_t *pipeline = parse_tokens(*tokens, errmsg, sizeof(errmsg));
+    if (pipeline == NULL)
+    {
+        dprintf(sh->err_fd, "%s\n", errmsg);
+        CL_free(*tokens);
+        *tokens = NULL;
+    }
+
+    return pipeline;
+}
+
+// Documented in .h file
+char *EXEC_command_substitution(const char *command, void *cb_data)
+{
+    shell_t *sh = (shell_t *)cb_data;
+    char *output = NULL;
+    CList tokens;
+
+    // the output may differ each time, so the line has to be expanded again
+    if (sh->parsecache != NULL)
+        PCACHE_note_uncacheable(sh->parsecache);
+
+    pipeline_t *pipeline = parse_command_string(sh, command, &tokens);
+    if (pipeline == NULL)
+        return NULL;
+
+    // a memory file never blocks the writer, even for a builtin in this process
+    int fd = memfd_create("plaid-subst", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        shell_perror(sh, "memfd_create");
+        pipeline_free(pipeline);
+        CL_free(tokens);
+        return NULL;
+    }
+
+    EXEC_pipeline(sh, pipeline, fd);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    // read back everything that was written
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        output = MEM_alloc(MEM_TOKENS, st.st_size + 1);
+        assert(output != NULL);
+
+        ssize_t n = pread(fd, output, st.st_size, 0);
+        output[n > 0 ? n : 0] = '\0';
+    }
+
+    close(fd);
+    return output;
+}
+
+// the process substitutions started for one command
+struct procsubs
+{
+    int count;
+    int *fds;          // the shell's end of each pipe
+    pid_t *pids;       // the children running the inner commands
+    char (*paths)[24]; // the /dev/fd path of each pipe
+    char **argv;       // the arguments with the paths filled in
+};
+
+/*
+ * Starts the process substitutions of a command, each in a child that
+ * runs concurrently with the command and is connected to it by a pipe.
+ * The pipes are close-on-exec until inherit_procsubs is called.
+ *
+ * Parameters:
+ *   sh         The shell
+ *   cmd        The command
+ *   ps         Return space for the started substitutions
+ *
+ * Returns:
+ *   The arguments to run the command with: cmd->args if it has no
+ *   process substitutions, or ps->argv with /dev/fd/N in their place.
+ *   NULL after printing an error if one could not be started; those
+ *   started are in ps, to be closed and waited for.
+ */
+static char **start_procsubs(shell_t *sh, pipeline_cmd_t *cmd, struct procsubs *ps)
+{
+    *ps = (struct procsubs){0, NULL, NULL, NULL, NULL};
+    if (cmd->num_procsubs == 0)
+        return cmd->args;
+
+    ps->fds = MEM_alloc(MEM_IO, cmd->num_procsubs * sizeof(int));
+    ps->pids = MEM_alloc(MEM_IO, cmd->num_procsubs * sizeof(pid_t));
+    ps->paths = MEM_alloc(MEM_IO, cmd->num_procsubs * sizeof(ps->paths[0]));
+    ps->argv = MEM_alloc(MEM_IO, (cmd->num_args + 1) * sizeof(char *));
+    assert(ps->fds != NULL && ps->pids != NULL && ps->paths != NULL && ps->argv != NULL);
+
+    int i;
+    for (i = 0; cmd->args[i] != NULL; i++)
+    {
+        ps->argv[i] = cmd->args[i];
+        if (cmd->arg_types[i] != TOK_PROCSUB_IN && cmd->arg_types[i] != TOK_PROCSUB_OUT)
+            continue;
+
+        // for <(...) the command reads what the inner command writes, for >(...) the reverse
+        bool reads = cmd->arg_types[i] == TOK_PROCSUB_IN;
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1)
+        {
+            shell_perror(sh, "pipe");
+            return NULL;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            signal(SIGPIPE, SIG_DFL);
+
+            // the zygote's socket belongs to the shell, and the path cache's
+            // lock may have been held by the speculation thread
+            sh->zygote = NULL;
+            sh->pathcache = NULL;
+
+            // the inner command must not hold open the other substitutions,
+            // nor the pipes that builtin stages on helper threads still own
+            int in = reads ? sh->in_fd : pipefd[0];
+            int out = reads ? pipefd[1] : sh->out_fd;
+            if (in != STDIN_FILENO)
+                dup2(in, STDIN_FILENO);
+            if (out != STDOUT_FILENO)
+                dup2(out, STDOUT_FILENO);
+            if (sh->err_fd != STDERR_FILENO)
+                dup2(sh->err_fd, STDERR_FILENO);
+            close_range(3, ~0U, 0);
+            sh->in_fd = STDIN_FILENO;
+            sh->out_fd = STDOUT_FILENO;
+            sh->err_fd = STDERR_FILENO;
+
+            CList tokens;
+            pipeline_t *pipeline = parse_command_string(sh, cmd->args[i], &tokens);
+            _exit(pipeline != NULL ? EXEC_pipeline(sh, pipeline, STDOUT_FILENO) : 2);
+        }
+        else if (pid < 0)
+        {
+            shell_perror(sh, "fork");
+            close(pipefd[0]);
+            close(pipefd[1]);
+            return NULL;
+        }
+
+        close(reads ? pipefd[1] : pipefd[0]);
+
+        ps->fds[ps->count] = reads ? pipefd[0] : pipefd[1];
+        ps->pids[ps->count] = pid;
+        snprintf(ps->paths[ps->count], sizeof(ps->paths[0]), "/dev/fd/%d", ps->fds[ps->count]);
+        ps->argv[i] = ps->paths[ps->count];
+        ps->count++;
+    }
+    ps->argv[i] = NULL;
+
+    return ps->argv;
+}
+
+/*
+ * In the child about to run a command, let the command inherit the
+ * pipes of its process substitutions
+ */
+static void inherit_procsubs(struct procsubs *ps)
+{
+    for (int i = 0; i < ps->count; i++)
+        fcntl(ps->fds[i], F_SETFD, 0);
+}
+
+/*
+ * In the shell, close the pipes of process substitutions once the
+ * command has been started
+ */
+static void close_procsubs(struct procsubs *ps)
+{
+    for (int i = 0; i < ps->count; i++)
+        close(ps->fds[i]);
+}
+
+/*
+ * Wait for the inner commands of process substitutions to finish, and
+ * free what start_procsubs allocated for them
+ */
+static void wait_procsubs(struct procsubs *ps)
+{
+    for (int i = 0; i < ps->count; i++)
+        waitpid(ps->pids[i], NULL, 0);
+
+    MEM_free(ps->fds);
+    MEM_free(ps->pids);
+    MEM_free(ps->paths);
+    MEM_free(ps->argv);
+    *ps = (struct procsubs){0, NULL, NULL, NULL, NULL};
+}
+
+// a run of builtin pipeline stages, fused into one chain, that runs on a
+// helper thread instead of in children
+struct stage_thread
+{
+    pthread_t tid;
+    shell_t *sh;
+    int count; // the number of stages in the run, 0 if none starts here
+    const builtin_t **builtins;
+    char ***argvs;
+    int *statuses;
+    int in_fd;
+    int out_fd;
+    int default_in;
+    int default_out;
+    bool closed; // its ends of the pipes are closed, set under stage_fds_lock
+};
+
+// held while a stage thread closes its pipe ends and while the shell
+// forks, so that a child knows which ends the threads still have open
+static pthread_mutex_t stage_fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Runs a chain of builtin stages, then closes its ends of the pipes as a
+ * child's exit would. The shell ignores SIGPIPE, so writing to a pipe
+ * whose reader has gone fails with EPIPE instead of killing the shell.
+ *
+ * Parameters:
+ *   arg   The stage_thread
+ *
+ * Returns:
+ *   NULL
+ */
+static void *run_stage_thread(void *arg)
+{
+    struct stage_thread *st = (struct stage_thread *)arg;
+
+    builtin_run_chain(st->sh, st->builtins, st->argvs, st->count, st->in_fd, st->out_fd, st->statuses);
+
+    pthread_mutex_lock(&stage_fds_lock);
+    if (st->in_fd != st->default_in)
+        close(st->in_fd);
+    if (st->out_fd != st->default_out)
+        close(st->out_fd);
+    st->closed = true;
+    pthread_mutex_unlock(&stage_fds_lock);
+
+    return NULL;
+}
+
+/*
+ * Opens the pipeline's input and output redirections. Here-document
+ * data is written to an anonymous memory file, so no disk I/O and no
+ * extra process is needed to feed it.
+ *
+ * Parameters:
+ *   sh            The shell, whose standard input is read if there is no
+ *                 input redirection
+ *   pipeline      The pipeline
+ *   default_out   The output fd to use if there is no output redirection
+ *   in_fd         Return space for the input fd, sh->in_fd if none
+ *   out_fd        Return space for the output fd, default_out if none
+ *
+ * Returns:
+ *   0 on success, or 1 if a file could not be opened
+ */
+static int open_redirections(shell_t *sh, pipeline_t *pipeline, int default_out, int *in_fd, int *out_fd)
+{
+    *in_fd = sh->in_fd;
+    *out_fd = default_out;
+
+    if (pipeline_get_input_data(pipeline) != NULL)
+    {
+        // Feed a here-document or here-string from an anonymous memory file
+        const char *data = pipeline_get_input_data(pipeline);
+        size_t len = strlen(data);
+
+        *in_fd = memfd_create("plaid-heredoc", MFD_CLOEXEC);
+        if (*in_fd == -1 || write(*in_fd, data, len) != len || lseek(*in_fd, 0, SEEK_SET) == -1)
+        {
+            shell_perror(sh, "here-document");
+            if (*in_fd != -1)
+                close(*in_fd);
+            return 1;
+        }
+    }
+
+    else if (pipeline_get_input(pipeline) != NULL)
+    {
+        // Open the input file for reading
+        *in_fd = open(pipeline_get_input(pipeline), O_RDONLY | O_CLOEXEC);
+        if (*in_fd == -1)
+        {
+            shell_perror(sh, pipeline_get_input(pipeline));
+            return 1;
+        }
+    }
+
+    if (pipeline_get_output(pipeline) != NULL)
+    {
+        // Open the output file for writing
+        *out_fd = open(pipeline_get_output(pipeline), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (*out_fd == -1)
+        {
+            shell_perror(sh, pipeline_get_output(pipeline));
+            if (*in_fd != sh->in_fd)
+                close(*in_fd);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Documented in .h file
+int EXEC_pipeline(shell_t *sh, pipeline_t *pipeline, int default_out)
+{
+    int in_fd, out_fd;
+    int status = 0;
+
+    // the operator nodes only mark where the pipes and redirections were
+    int num_commands = 0;
+    pipeline_cmd_t **commands = MEM_alloc(MEM_IO, pipeline->length * sizeof(pipeline_cmd_t *));
+    assert(commands != NULL);
+
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        if ((node->type == TOK_WORD || node->type == TOK_QUOTED_WORD) && node->args[0] != NULL)
+            commands[num_commands++] = node;
+    }
+
+    if (num_commands == 0 || open_redirections(sh, pipeline, default_out, &in_fd, &out_fd) != 0)
+    {
+        MEM_free(commands);
+        return num_commands == 0 ? 0 : 1;
+    }
+
+    // a lone builtin or function call runs in the shell itself
+    Compound body = FUNC_lookup(sh->funcs, commands[0]->args[0]);
+    const builtin_t *builtin = body == NULL ? builtin_lookup(commands[0]->args) : NULL;
+    if (num_commands == 1 && (body != NULL || builtin != NULL))
+    {
+        struct procsubs ps;
+        char **argv = start_procsubs(sh, commands[0], &ps);
+
+        if (argv == NULL)
+            status = 1;
+        else if (body != NULL)
+            status = call_function(sh, body, argv, in_fd, out_fd);
+        else
+        {
+            sh->read_ahead = pipeline->read_ahead;
+            status = builtin->fn(sh, argv, in_fd, out_fd);
+            sh->read_ahead = false;
+        }
+
+        close_procsubs(&ps);
+        wait_procsubs(&ps);
+
+        if (in_fd != sh->in_fd)
+            close(in_fd);
+        if (out_fd != default_out)
+            close(out_fd);
+
+        MEM_free(commands);
+        return status;
+    }
+
+    // the environment is only rebuilt if it changed since the last command
+    char **envp = VAR_environ(sh->vars);
+    fflush(stdout);
+    pid_t *pids = MEM_calloc(MEM_IO, num_commands, sizeof(pid_t));
+    assert(pids != NULL);
+    struct procsubs *ps = MEM_calloc(MEM_IO, num_commands, sizeof(struct procsubs));
+    assert(ps != NULL);
+    struct stage_thread *threads = MEM_calloc(MEM_IO, num_commands, sizeof(struct stage_thread));
+    assert(threads != NULL);
+    const builtin_t **stage_builtins = MEM_alloc(MEM_IO, num_commands * sizeof(builtin_t *));
+    assert(stage_builtins != NULL);
+    char ***stage_argvs = MEM_alloc(MEM_IO, num_commands * sizeof(char **));
+    assert(stage_argvs != NULL);
+    int *statuses = MEM_alloc(MEM_IO, num_commands * sizeof(int));
+    assert(statuses != NULL);
+    int *pidfds = MEM_alloc(MEM_IO, num_commands * sizeof(int));
+    assert(pidfds != NULL);
+    bool *spawned = MEM_calloc(MEM_IO, num_commands, sizeof(bool));
+    assert(spawned != NULL);
+
+    // Execute each command in the pipeline; if one cannot be started, the
+    // ones before it are still waited for, and the pipeline fails
+    int started = 0;
+    int stage_in = in_fd;
+    for (int i = 0; i < num_commands; i++)
+    {
+        int pipefd[2] = {-1, -1};
+        int stage_out = out_fd;
+        bool failed = false;
+
+        // builtins run on a thread that owns the stage's pipe ends, and a
+        // run of them that can pass their data in memory is fused into one
+        int run = 0;
+        while (i + run < num_commands && commands[i + run]->num_procsubs == 0)
+        {
+            builtin = FUNC_lookup(sh->funcs, commands[i + run]->args[0]) == NULL ? builtin_lookup(commands[i + run]->args) : NULL;
+            if (builtin == NULL || !builtin->threadable || (run > 0 && builtin->filter == NULL))
+                break;
+
+            stage_builtins[i + run] = builtin;
+            stage_argvs[i + run] = commands[i + run]->args;
+            run++;
+        }
+        int last = run > 0 ? i + run - 1 : i;
+
+        // Create the pipe to the next command
+        if (last < num_commands - 1)
+        {
+            if (pipe2(pipefd, O_CLOEXEC) == -1)
+            {
+                shell_perror(sh, "pipe");
+                failed = true;
+            }
+            stage_out = pipefd[1];
+        }
+
+        if (!failed && run > 0)
+        {
+            threads[i] = (struct stage_thread){.sh = sh, .count = run, .builtins = &stage_builtins[i],
+                                               .argvs = &stage_argvs[i], .statuses = &statuses[i],
+                                               .in_fd = stage_in, .out_fd = stage_out,
+                                               .default_in = sh->in_fd, .default_out = default_out};
+            if (pthread_create(&threads[i].tid, NULL, run_stage_thread, &threads[i]) == 0)
+            {
+                for (int j = i; j <= last; j++)
+                    pidfds[j] = -1;
+
+                started = last + 1;
+                stage_in = pipefd[0];
+                i = last;
+                continue;
+            }
+
+            shell_perror(sh, "pthread_create");
+            threads[i].count = 0;
+            failed = true;
+        }
+
+        // Start the process substitutions, so they run alongside the command
+        char **argv = NULL;
+        if (!failed && (argv = start_procsubs(sh, commands[i], &ps[i])) == NULL)
+            failed = true;
+
+        if (failed)
+        {
+            close_procsubs(&ps[i]);
+            wait_procsubs(&ps[i]);
+            if (stage_in != sh->in_fd)
+                close(stage_in);
+            if (pipefd[0] != -1)
+                close(pipefd[0]);
+            if (stage_out != default_out && stage_out != -1)
+                close(stage_out);
+            if (stage_out != out_fd && out_fd != default_out)
+                close(out_fd);
+            status = 1;
+            break;
+        }
+
+        body = FUNC_lookup(sh->funcs, argv[0]);
+        builtin = body == NULL ? builtin_lookup(argv) : NULL;
+        bool external = body == NULL && builtin == NULL;
+
+        // the path cache usually already has the command, found while it was typed
+        char *file = NULL;
+        if (sh->pathcache != NULL && external && strchr(argv[0], '/') == NULL)
+            file = PC_lookup(sh->pathcache, VAR_get(sh->vars, "PATH"), argv[0]);
+
+        // an external command is launched by the zygote, if there is one,
+        // so the shell itself is not forked
+        pidfds[i] = -1;
+        if (sh->zygote != NULL && external && ps[i].count == 0)
+            pidfds[i] = ZYG_spawn(sh->zygote, file, argv, envp, stage_in, stage_out, sh->err_fd, &pids[i]);
+        spawned[i] = pidfds[i] >= 0;
+
+        if (!spawned[i])
+        {
+            // Fork a new process for the current command
+            pthread_mutex_lock(&stage_fds_lock);
+            pids[i] = fork();
+            if (pids[i] != 0)
+                pthread_mutex_unlock(&stage_fds_lock);
+            else
+                pthread_mutex_init(&stage_fds_lock, NULL);
+
+            if (pids[i] == 0)
+            {
+                // Child process that runs the command, killed by a write to a closed pipe
+                signal(SIGPIPE, SIG_DFL);
+
+                if (stage_in != STDIN_FILENO)
+                    dup2(stage_in, STDIN_FILENO);
+                if (stage_out != STDOUT_FILENO)
+                    dup2(stage_out, STDOUT_FILENO);
+                if (sh->err_fd != STDERR_FILENO)
+                    dup2(sh->err_fd, STDERR_FILENO);
+                inherit_procsubs(&ps[i]);
+
+                // keep no other pipe ends, even if the command is a builtin and
+                // never execs, so the stages around it see EOF and EPIPE promptly
+                if (pipefd[0] != -1)
+                    close(pipefd[0]);
+                if (stage_in != STDIN_FILENO)
+                    close(stage_in);
+                if (stage_out != STDOUT_FILENO)
+                    close(stage_out);
+
+                // nor the ends of the builtin stages still running on threads
+                for (int j = 0; j < i; j++)
+                {
+                    if (threads[j].count == 0 || threads[j].closed)
+                        continue;
+                    if (threads[j].in_fd != threads[j].default_in)
+                        close(threads[j].in_fd);
+                    if (threads[j].out_fd != threads[j].default_out)
+                        close(threads[j].out_fd);
+                }
+
+                // a builtin or function run here uses the standard fds it was given
+                sh->in_fd = STDIN_FILENO;
+                sh->out_fd = STDOUT_FILENO;
+                sh->err_fd = STDERR_FILENO;
+
+                if (builtin != NULL)
+                    _exit(builtin->fn(sh, argv, STDIN_FILENO, STDOUT_FILENO));
+
+                // a function in a pipeline runs in this child, like a subshell
+                if (body != NULL)
+                    _exit(call_function(sh, body, argv, STDIN_FILENO, STDOUT_FILENO));
+
+                // Execute the command if it is not a built-in command
+                exec_command(sh, file, argv, envp);
+
+                ZYG_exec_failed(argv[0]);
+                _exit(2);
+            }
+
+            if (pids[i] > 0 && (pidfds[i] = pidfd_open(pids[i])) < 0)
+            {
+                shell_perror(sh, "pidfd_open");
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
+            }
+            else if (pids[i] < 0)
+                shell_perror(sh, "fork");
+            failed = pidfds[i] < 0;
+        }
+
+        // Parent process: the child has its own copies of these ends
+        MEM_free(file);
+        close_procsubs(&ps[i]);
+        if (stage_in != sh->in_fd)
+            close(stage_in);
+        if (stage_out != default_out)
+            close(stage_out);
+
+        if (failed)
+        {
+            wait_procsubs(&ps[i]);
+            if (pipefd[0] != -1)
+                close(pipefd[0]);
+            if (stage_out != out_fd && out_fd != default_out)
+                close(out_fd);
+            status = 1;
+            break;
+        }
+
+        started = i + 1;
+        stage_in = pipefd[0];
+    }
+
+    // with PLAID_KILL_UPSTREAM set, a stage that exits takes the stages
+    // feeding it down too, instead of leaving them to run until they write
+    const char *kill_opt = VAR_get(sh->vars, "PLAID_KILL_UPSTREAM");
+    bool kill_upstream = kill_opt != NULL && *kill_opt != '\0' && strcmp(kill_opt, "0") != 0;
+
+    // Wait for the child processes in the order they finish, watching
+    // their pidfds since the zygote's children cannot be waited for directly
+    struct pollfd *pfds = MEM_alloc(MEM_IO, num_commands * sizeof(struct pollfd));
+    assert(pfds != NULL);
+    int *stage_of = MEM_alloc(MEM_IO, num_commands * sizeof(int));
+    assert(stage_of != NULL);
+
+    while (true)
+    {
+        int n = 0;
+        for (int i = 0; i < started; i++)
+        {
+            if (pidfds[i] >= 0)
+            {
+                pfds[n] = (struct pollfd){pidfds[i], POLLIN, 0};
+                stage_of[n++] = i;
+            }
+        }
+
+        if (n == 0)
+            break;
+
+        if (poll(pfds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            shell_perror(sh, "poll");
+            break;
+        }
+
+        for (int k = 0; k < n; k++)
+        {
+            if (pfds[k].revents == 0)
+                continue;
+
+            int i = stage_of[k];
+            int child_status;
+
+            if (spawned[i])
+                child_status = ZYG_wait(sh->zygote, pids[i]);
+            else if (waitpid(pids[i], &child_status, 0) == -1)
+                child_status = -1;
+
+            close(pidfds[i]);
+            pidfds[i] = -1;
+
+            if (child_status == -1)
+                continue;
+
+            if (WIFEXITED(child_status))
+                child_status = WEXITSTATUS(child_status);
+            else if (WIFSIGNALED(child_status))
+                child_status = 128 + WTERMSIG(child_status);
+
+            // a stage cut short by a closed pipe is the normal end of e.g. "yes | head"
+            if (child_status != 0 && child_status != 128 + SIGPIPE)
+                dprintf(sh->err_fd, "Child %d exited with status %d\n", pids[i], child_status);
+
+            // the pipeline's status is that of its last command
+            if (i == num_commands - 1)
+                status = child_status;
+
+            for (int j = 0; kill_upstream && j < i; j++)
+            {
+                if (pidfds[j] >= 0)
+                    pidfd_send_signal(pidfds[j], SIGPIPE);
+            }
+        }
+    }
+
+    MEM_free(stage_of);
+    MEM_free(pfds);
+
+    // the builtin stages finish once their pipes are drained or closed
+    for (int i = 0; i < started; i++)
+    {
+        if (threads[i].count > 0)
+            pthread_join(threads[i].tid, NULL);
+        if (pids[i] == 0 && i == num_commands - 1)
+            status = statuses[i];
+    }
+
+    // the substitutions finish once the commands have closed their ends
+    for (int i = 0; i < started; i++)
+        wait_procsubs(&ps[i]);
+
+    MEM_free(spawned);
+    MEM_free(pidfds);
+    MEM_free(statuses);
+    MEM_free(stage_argvs);
+    MEM_free(stage_builtins);
+    MEM_free(threads);
+    MEM_free(ps);
+    MEM_free(pids);
+    MEM_free(commands);
+
+    return status;
+}
+
+// Documented in .h file
+int EXEC_run_pipeline(shell_t *sh, pipeline_t *pipeline)
+{
+    char status_str[16];
+
+    sh->status = EXEC_pipeline(sh, pipeline, sh->out_fd);
+    snprintf(status_str, sizeof(status_str), "%d", sh->status);
+    VAR_set(sh->vars, "?", status_str);
+
+    return sh->status;
+}
+
+// Documented in .h file
+int EXEC_run_encoded(shell_t *sh, const void *buf, size_t len)
+{
+    char errmsg[100];
+
+    // the pipeline's strings are left in buf
+    pipeline_t *pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+    if (pipeline == NULL)
+    {
+        dprintf(sh->err_fd, "%s\n", errmsg);
+        sh->status = 2;
+        return sh->status;
+    }
+
+    EXEC_run_pipeline(sh, pipeline);
+    pipeline_free(pipeline);
+    return sh->status;
+}
+
+// Documented in .h file
+bool EXEC_is_exit(pipeline_t *pipeline)
+{
+    pipeline_cmd_t *cmd = pipeline->head;
+
+    // only command nodes have arguments
+    if (cmd->type != TOK_WORD && cmd->type != TOK_QUOTED_WORD)
+        return false;
+
+    return cmd->args[0] != NULL && (strcmp(cmd->args[0], "exit") == 0 || strcmp(cmd->args[0], "quit") == 0);
+}
+
+// Documented in .h file
+bool EXEC_run_compound_pipeline(pipeline_t *pipeline, int *status, void *cb_data)
+{
+    shell_t *sh = (shell_t *)cb_data;
+
+    if (EXEC_is_exit(pipeline))
+    {
+        *status = 0;
+        return false;
+    }
+
+    *status = EXEC_run_pipeline(sh, pipeline);
+    return !sh->exiting;
+}
+
+// Documented in .h file
+void EXEC_define_function(const char *name, Compound body, void *cb_data)
+{
+    shell_t *sh = (shell_t *)cb_data;
+    FUNC_define(sh->funcs, name, body);
+}
+
+/*
+ * Calls a function in the shell process, with its arguments as the
+ * positional parameters. While it runs, the shell's input and output
+ * are in_fd and out_fd, so that its commands read and write them. Exit
+ * or quit in the function makes the shell stop.
+ *
+ * Parameters:
+ *   sh         The shell
+ *   body       The commands of the function
+ *   args       The name of the function and its arguments
+ *   in_fd      The input of the call
+ *   out_fd     The output of the call
+ *
+ * Returns:
+ *   The exit status of the last command of the function
+ */
+static int call_function(shell_t *sh, Compound body, char **args, int in_fd, int out_fd)
+{
+    int saved_in = sh->in_fd, saved_out = sh->out_fd;
+    int status = 0;
+
+    // each call takes a little of the C stack
+    if (sh->call_depth >= MAX_CALL_DEPTH)
+    {
+        dprintf(sh->err_fd, "%s: Function calls nested too deeply\n", args[0]);
+        return 1;
+    }
+
+    // the body is kept even if the function redefines itself
+    sh->call_depth++;
+    sh->in_fd = in_fd;
+    sh->out_fd = out_fd;
+    CTL_hold(body);
+    VAR_push_args(sh->vars, args);
+
+    if (!CTL_run(body, sh->tok_state, sh->vars, EXEC_run_compound_pipeline, EXEC_define_function, sh, &status))
+        sh->exiting = true;
+
+    VAR_pop_args(sh->vars);
+    CTL_free(body);
+    sh->in_fd = saved_in;
+    sh->out_fd = saved_out;
+    sh->call_depth--;
+
+    return status;
+}
@@ -0,0 +1,121 @@
+/*
+ * exec.h
+ *
+ * The executor: runs the pipelines of a shell, each command in a child
+ * process, or a lone builtin or function call in the shell itself. The
+ * pipelines read, write and report errors on the shell's in_fd, out_fd
+ * and err_fd, so shells that use different fds can run in one process.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _EXEC_H_
+#define _EXEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+#include "control.h"
+#include "shell.h"
+
+/*
+ * Executes a pipeline of commands. A pipeline that is a single builtin
+ * or function call runs in the shell process, so that it can change the
+ * shell's state; every other command runs in its own child process. A
+ * function is found before a builtin of the same name. A pipeline whose
+ * commands cannot all be started fails with status 1, once those that
+ * were started have finished.
+ *
+ * Parameters:
+ *   sh            The shell
+ *   pipeline      The pipeline to execute
+ *   default_out   Where the last command writes, unless the pipeline
+ *                 redirects its output
+ *
+ * Returns:
+ *   The exit status of the last command in the pipeline
+ */
+int EXEC_pipeline(shell_t *sh, pipeline_t *pipeline, int default_out);
+
+/*
+ * Runs a pipeline on the shell's output, and remembers its exit status
+ * for $?
+ *
+ * Parameters:
+ *   sh         The shell
+ *   pipeline   The pipeline
+ *
+ * Returns:
+ *   The exit status of the pipeline
+ */
+int EXEC_run_pipeline(shell_t *sh, pipeline_t *pipeline);
+
+/*
+ * Runs a pipeline encoded by FP_encode as EXEC_run_pipeline does, e.g.
+ * one parsed by another process, without tokenizing or parsing it
+ * again. An encoding that is malformed is reported on the shell's
+ * err_fd, with exit status 2.
+ *
+ * Parameters:
+ *   sh         The shell
+ *   buf        The encoding
+ *   len        The length of buf
+ *
+ * Returns:
+ *   The exit status of the pipeline
+ */
+int EXEC_run_encoded(shell_t *sh, const void *buf, size_t len);
+
+/*
+ * Whether a pipeline is the exit or quit command
+ *
+ * Parameters:
+ *   pipeline   The pipeline
+ *
+ * Returns:
+ *   true if the pipeline is exit or quit, false otherwise
+ */
+bool EXEC_is_exit(pipeline_t *pipeline);
+
+/*
+ * Runs a pipeline of a compound command, which stops at exit or quit.
+ * A CTL_run_callback.
+ *
+ * Parameters:
+ *   pipeline   The pipeline
+ *   status     Return space for the exit status of the pipeline
+ *   cb_data    The shell
+ *
+ * Returns:
+ *   false if the pipeline was exit or quit, true otherwise
+ */
+bool EXEC_run_compound_pipeline(pipeline_t *pipeline, int *status, void *cb_data);
+
+/*
+ * Defines a function of a compound command in the shell's table. A
+ * CTL_define_callback.
+ *
+ * Parameters:
+ *   name       The name of the function
+ *   body       The commands of the function
+ *   cb_data    The shell
+ *
+ * Returns: None
+ */
+void EXEC_define_function(const char *name, Compound body, void *cb_data);
+
+/*
+ * Runs the command of a $(...) substitution and captures its output. A
+ * TOK_subst_callback.
+ *
+ * Parameters:
+ *   command    The command text
+ *   cb_data    The shell
+ *
+ * Returns:
+ *   The output, to be freed with MEM_free, or NULL if the
+ *   command could not be run
+ */
+char *EXEC_command_substitution(const char *command, void *cb_data);
+
+#endif /* _EXEC_H_ */
@@ -0,0 +1,336 @@
+/*
+ * flatpipe.c
+ *
+ * The flat encoding of a pipeline: a header, then a node record for
+ * each node of the pipeline, an argument record for each argument of
+ * its commands, and the strings, NUL-terminated. Every field is a
+ * uint32_t, so the records need no padding, and each string is found
+ * by its offset from the start of the encoding.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "flatpipe.h"
+#include "mem.h"
+
+// the first four bytes of an encoding, "PLP1" in ASCII
+#define FP_MAGIC 0x31504c50
+
+// the offset of a string the pipeline does not have
+#define FP_NONE UINT32_MAX
+
+// the most bytes an encoding may have
+#define FP_MAX_SIZE (64 * 1024 * 1024)
+
+struct fp_header
+{
+    uint32_t magic;
+    uint32_t size;       // the length of the whole encoding
+    uint32_t num_nodes;  // the node records that follow the header
+    uint32_t num_args;   // the argument records that follow the nodes
+    uint32_t input;      // the offset of the input file name, or FP_NONE
+    uint32_t output;     // the offset of the output file name, or FP_NONE
+    uint32_t input_data; // the offset of the here-document data, or FP_NONE
+    uint32_t deferred;   // the pipeline's PIPELINE_*_DEFERRED
+    uint32_t read_ahead;
+};
+
+struct fp_node
+{
+    uint32_t type;
+    uint32_t first_arg; // the node's arguments in the argument records
+    uint32_t num_args;
+};
+
+struct fp_arg
+{
+    uint32_t type;
+    uint32_t text; // the offset of the argument
+};
+
+// an encoding being built
+struct fp_writer
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/*
+ * Append bytes to an encoding being built
+ *
+ * Returns: The offset they were put at
+ */
+static uint32_t _FP_put(struct fp_writer *w, const void *data, size_t len)
+{
+    if (w->len + len > w->cap)
+    {
+        while (w->len + len > w->cap)
+            w->cap = w->cap > 0 ? w->cap * 2 : 256;
+        w->buf = MEM_realloc(MEM_PIPELINE, w->buf, w->cap);
+        assert(w->buf != NULL);
+    }
+
+    uint32_t offset = w->len;
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+
+    return offset;
+}
+
+/*
+ * Append a string to an encoding being built
+ *
+ * Returns: The offset it was put at, or FP_NONE for NULL
+ */
+static uint32_t _FP_put_str(struct fp_writer *w, const char *s)
+{
+    return s != NULL ? _FP_put(w, s, strlen(s) + 1) : FP_NONE;
+}
+
+/*
+ * Whether a node has arguments: only command nodes do
+ */
+static bool _FP_has_args(uint32_t type)
+{
+    return type == TOK_WORD || type == TOK_QUOTED_WORD;
+}
+
+// Documented in .h file
+void *FP_encode(pipeline_t *pipeline, size_t *len)
+{
+    assert(pipeline != NULL && len != NULL);
+
+    struct fp_header header = {FP_MAGIC, 0, 0, 0, FP_NONE, FP_NONE, FP_NONE, pipeline->deferred,
+                               pipeline->read_ahead};
+
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        header.num_nodes++;
+        if (_FP_has_args(node->type))
+            header.num_args += node->num_args;
+    }
+
+    // the records are filled in once the offsets of the strings are known
+    struct fp_writer w = {NULL, 0, 0};
+    size_t records = sizeof(header) + header.num_nodes * sizeof(struct fp_node) +
+                     header.num_args * sizeof(struct fp_arg);
+    w.cap = records + 256;
+    w.buf = MEM_calloc(MEM_PIPELINE, 1, w.cap);
+    assert(w.buf != NULL);
+    w.len = records;
+
+    header.input = _FP_put_str(&w, pipeline->input);
+    header.output = _FP_put_str(&w, pipeline->output);
+    header.input_data = _FP_put_str(&w, pipeline->input_data);
+
+    size_t node_at = sizeof(header);
+    size_t arg_at = node_at + header.num_nodes * sizeof(struct fp_node);
+    uint32_t num_args = 0;
+
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        struct fp_node rec = {node->type, num_args, 0};
+
+        for (int i = 0; _FP_has_args(node->type) && i < node->num_args; i++)
+        {
+            struct fp_arg arg = {node->arg_types[i], _FP_put_str(&w, node->args[i])};
+            memcpy(w.buf + arg_at + num_args++ * sizeof(arg), &arg, sizeof(arg));
+            rec.num_args++;
+        }
+
+        memcpy(w.buf + node_at, &rec, sizeof(rec));
+        node_at += sizeof(rec);
+    }
+
+    header.size = w.len;
+    memcpy(w.buf, &header, sizeof(header));
+
+    *len = w.len;
+    return w.buf;
+}
+
+/*
+ * Get the string at an offset of an encoding, if it is one that ends
+ * inside it
+ *
+ * Returns: The string, or NULL if the offset is FP_NONE or bad
+ */
+static char *_FP_get_str(const char *buf, size_t len, uint32_t offset, bool *ok)
+{
+    if (offset == FP_NONE)
+        return NULL;
+
+    if (offset >= len || memchr(buf + offset, '\0', len - offset) == NULL)
+    {
+        *ok = false;
+        return NULL;
+    }
+
+    return (char *)buf + offset;
+}
+
+// Documented in .h file
+pipeline_t *FP_decode(const void *buf, size_t len, char *errmsg, size_t errmsg_sz)
+{
+    assert(buf != NULL);
+
+    const char *p = (const char *)buf;
+    struct fp_header header;
+
+    // the records are copied out, since buf may not be aligned for them
+    if (len < sizeof(header))
+    {
+        snprintf(errmsg, errmsg_sz, "Truncated pipeline");
+        return NULL;
+    }
+    memcpy(&header, p, sizeof(header));
+
+    uint64_t records = sizeof(header) + (uint64_t)header.num_nodes * sizeof(struct fp_node) +
+                       (uint64_t)header.num_args * sizeof(struct fp_arg);
+    if (header.magic != FP_MAGIC || header.size != len || records > len || header.num_nodes == 0)
+    {
+        snprintf(errmsg, errmsg_sz, "Malformed pipeline");
+        return NULL;
+    }
+
+    bool ok = true;
+    pipeline_t *pipeline = pipeline_new();
+    pipeline_set_input(pipeline, _FP_get_str(p, len, header.input, &ok));
+    pipeline_set_output(pipeline, _FP_get_str(p, len, header.output, &ok));
+    pipeline_set_input_data(pipeline, _FP_get_str(p, len, header.input_data, &ok));
+    pipeline->deferred = header.deferred;
+    pipeline->read_ahead = header.read_ahead != 0;
+
+    const char *node_at = p + sizeof(header);
+    const char *arg_at = node_at + header.num_nodes * sizeof(struct fp_node);
+
+    for (uint32_t i = 0; i < header.num_nodes && ok; i++)
+    {
+        struct fp_node rec;
+        memcpy(&rec, node_at + i * sizeof(rec), sizeof(rec));
+
+        if (rec.type > TOK_DEFERRED_HEREDOC || rec.first_arg > header.num_args ||
+            rec.num_args > header.num_args - rec.first_arg || (!_FP_has_args(rec.type) && rec.num_args > 0))
+        {
+            ok = false;
+            break;
+        }
+
+        pipeline_cmd_t *node = pipeline_cmd_new(rec.type);
+        pipeline_add_command(pipeline, node);
+
+        for (uint32_t j = 0; j < rec.num_args && ok; j++)
+        {
+            struct fp_arg arg;
+            memcpy(&arg, arg_at + (rec.first_arg + j) * sizeof(arg), sizeof(arg));
+
+            char *text = _FP_get_str(p, len, arg.text, &ok);
+            ok = ok && text != NULL && arg.type <= TOK_DEFERRED;
+            if (!ok)
+                break;
+
+            if (arg.type == TOK_PROCSUB_IN || arg.type == TOK_PROCSUB_OUT)
+                pipeline_cmd_add_procsub(node, arg.type, text);
+            else if (arg.type == TOK_DEFERRED)
+                pipeline_cmd_add_deferred(node, text);
+            else
+                pipeline_cmd_add_arg(node, text);
+        }
+    }
+
+    if (!ok)
+    {
+        snprintf(errmsg, errmsg_sz, "Malformed pipeline");
+        pipeline_free(pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+// Documented in .h file
+bool FP_write(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/*
+ * Read exactly len bytes, unless the input ends first
+ *
+ * Returns: The number of bytes read, or -1 with errno set on error
+ */
+static ssize_t _FP_read_full(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+
+        got += n;
+    }
+
+    return got;
+}
+
+// Documented in .h file
+void *FP_read(int fd, size_t *len)
+{
+    struct fp_header header;
+
+    errno = 0;
+    ssize_t n = _FP_read_full(fd, (char *)&header, sizeof(header));
+    if (n <= 0)
+        return NULL;
+
+    if (n < sizeof(header) || header.size < sizeof(header) || header.size > FP_MAX_SIZE)
+    {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    char *buf = MEM_alloc(MEM_PIPELINE, header.size);
+    assert(buf != NULL);
+    memcpy(buf, &header, sizeof(header));
+
+    n = _FP_read_full(fd, buf + sizeof(header), header.size - sizeof(header));
+    if (n != header.size - sizeof(header))
+    {
+        if (n >= 0)
+            errno = EPROTO;
+        MEM_free(buf);
+        return NULL;
+    }
+
+    *len = header.size;
+    return buf;
+}
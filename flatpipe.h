@@ -0,0 +1,79 @@
+/*
+ * flatpipe.h
+ *
+ * A flat encoding of a parsed pipeline, for handing it to another
+ * process, e.g. an executor forked ahead of time, which runs it without
+ * tokenizing or parsing it again. The encoding is one block of memory
+ * holding no pointers: a header, the array of the pipeline's nodes, the
+ * array of their arguments, and the strings, all found by their offsets
+ * from the start of the block, so that it can be copied, written to a
+ * pipe, socket or file, and used wherever it is read into. It has no
+ * limit on the number of arguments of a command. Its numbers are in the
+ * byte order of the machine, since it is meant for processes on one.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _FLATPIPE_H_
+#define _FLATPIPE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pipeline.h"
+
+/*
+ * Encode a pipeline
+ *
+ * Parameters:
+ *   pipeline   The pipeline
+ *   len        Return space for the length of the encoding
+ *
+ * Returns: The encoding, to be freed with MEM_free
+ */
+void *FP_encode(pipeline_t *pipeline, size_t *len);
+
+/*
+ * Decode a pipeline, checking that the encoding is well formed. The
+ * strings of the pipeline are not copied: its arguments, input and
+ * output point into buf, which must not be freed or changed before the
+ * pipeline is.
+ *
+ * Parameters:
+ *   buf        The encoding
+ *   len        The length of buf
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The pipeline, which the caller must pipeline_free, or NULL
+ *   with an error message in errmsg if the encoding is malformed
+ */
+pipeline_t *FP_decode(const void *buf, size_t len, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Write an encoding to a pipe, a stream socket or a file, retrying
+ * short writes
+ *
+ * Parameters:
+ *   fd         Where to write
+ *   buf        The encoding, from FP_encode
+ *   len        The length of buf
+ *
+ * Returns: true on success, false with errno set on error
+ */
+bool FP_write(int fd, const void *buf, size_t len);
+
+/*
+ * Read the next encoding written by FP_write. Only its length is
+ * checked; FP_decode checks the rest.
+ *
+ * Parameters:
+ *   fd         Where to read
+ *   len        Return space for the length of the encoding
+ *
+ * Returns: The encoding, to be freed with MEM_free; or NULL
+ *   with errno 0 at the end of the input, or with errno set on an error
+ *   or an encoding cut short
+ */
+void *FP_read(int fd, size_t *len);
+
+#endif /* _FLATPIPE_H_ */
@@ -0,0 +1,310 @@
+/**
+ * flatpipe_test.c
+ *
+ * This file contains the test cases for flatpipe.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "shell.h"
+#include "exec.h"
+#include "flatpipe.h"
+#include "mem.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Returns the encoding of a command line, or NULL if it does not parse
+ */
+static void *encode_line(const char *line, size_t *len)
+{
+    char errmsg[100];
+    CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    pipeline_t *pipeline = tokens != NULL ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+    void *buf = pipeline != NULL ? FP_encode(pipeline, len) : NULL;
+
+    pipeline_free(pipeline);
+    CL_free(tokens);
+    return buf;
+}
+
+/*
+ * Tests that a decoded pipeline is the one encoded, wherever the
+ * encoding is moved to
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_round_trip()
+{
+    char errmsg[100];
+    size_t len;
+    char *moved = NULL;
+    pipeline_t *pipeline = NULL;
+    void *buf = encode_line("grep -n \"a b\" <(sort x) < in.txt | wc -l > out.txt", &len);
+
+    test_assert(buf != NULL);
+
+    // decoded from an odd address, after the original is gone
+    moved = malloc(len + 1);
+    memcpy(moved + 1, buf, len);
+    MEM_free(buf);
+    buf = NULL;
+
+    pipeline = FP_decode(moved + 1, len, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->length == 5);
+    test_assert(strcmp(pipeline_get_input(pipeline), "in.txt") == 0);
+    test_assert(strcmp(pipeline_get_output(pipeline), "out.txt") == 0);
+    test_assert(pipeline_get_input_data(pipeline) == NULL);
+
+    pipeline_cmd_t *node = pipeline->head;
+    test_assert(node->type == TOK_WORD);
+    test_assert(strcmp(node->args[0], "grep") == 0);
+    test_assert(strcmp(node->args[2], "a b") == 0);
+    test_assert(node->arg_types[3] == TOK_PROCSUB_IN);
+    test_assert(strcmp(node->args[3], "sort x") == 0);
+    test_assert(node->args[4] == NULL);
+    test_assert(node->num_procsubs == 1);
+    test_assert(node->next->type == TOK_LESSTHAN);
+    test_assert(node->next->next->type == TOK_PIPE);
+    node = node->next->next->next;
+    test_assert(strcmp(node->args[0], "wc") == 0 && strcmp(node->args[1], "-l") == 0);
+    test_assert(node->args[2] == NULL);
+    test_assert(node->next->type == TOK_GREATERTHAN && node->next->next == NULL);
+    pipeline_free(pipeline);
+    free(moved);
+    moved = NULL;
+
+    // the here-string data and the flags of a compound command's pipeline
+    buf = encode_line("cat <<< hello", &len);
+    test_assert(buf != NULL);
+    pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(strcmp(pipeline_get_input_data(pipeline), "hello\n") == 0);
+
+    pipeline->deferred = PIPELINE_OUTPUT_DEFERRED;
+    pipeline->read_ahead = true;
+    pipeline_cmd_add_deferred(pipeline->head, "$X");
+    pipeline_set_output(pipeline, "$HOME/out");
+    void *old = buf;
+    buf = FP_encode(pipeline, &len);
+    pipeline_free(pipeline);
+    MEM_free(old);
+
+    pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->deferred == PIPELINE_OUTPUT_DEFERRED && pipeline->read_ahead);
+    test_assert(pipeline->head->arg_types[1] == TOK_DEFERRED);
+    test_assert(strcmp(pipeline->head->args[1], "$X") == 0);
+    test_assert(strcmp(pipeline_get_output(pipeline), "$HOME/out") == 0);
+    pipeline_free(pipeline);
+    MEM_free(buf);
+
+    // however many arguments a command has
+    char line[256] = "echo";
+    for (int i = 0; i < 60; i++)
+        strcat(line, " w");
+    buf = encode_line(line, &len);
+    test_assert(buf != NULL);
+    pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->head->num_args == 61);
+    test_assert(strcmp(pipeline->head->args[60], "w") == 0);
+    test_assert(pipeline->head->args[61] == NULL);
+
+    pipeline_free(pipeline);
+    MEM_free(buf);
+    return 1;
+
+test_error:
+    pipeline_free(pipeline);
+    free(moved);
+    MEM_free(buf);
+    return 0;
+}
+
+/*
+ * Tests that damaged encodings are refused
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_malformed()
+{
+    char errmsg[100];
+    size_t len;
+    uint32_t word;
+    char *buf = encode_line("echo one two", &len);
+
+    test_assert(buf != NULL);
+    test_assert(FP_decode(buf, len - 1, errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strcmp(errmsg, "Malformed pipeline") == 0);
+    test_assert(FP_decode(buf, 8, errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strcmp(errmsg, "Truncated pipeline") == 0);
+
+    // a string that runs off the end
+    buf[len - 1] = 'x';
+    test_assert(FP_decode(buf, len, errmsg, sizeof(errmsg)) == NULL);
+    buf[len - 1] = '\0';
+
+    // more nodes than there is room for
+    memcpy(&word, buf + 8, sizeof(word));
+    word += 1000;
+    memcpy(buf + 8, &word, sizeof(word));
+    test_assert(FP_decode(buf, len, errmsg, sizeof(errmsg)) == NULL);
+    word -= 1000;
+    memcpy(buf + 8, &word, sizeof(word));
+
+    // a bad magic number
+    buf[0] ^= 1;
+    test_assert(FP_decode(buf, len, errmsg, sizeof(errmsg)) == NULL);
+    buf[0] ^= 1;
+
+    pipeline_t *pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    pipeline_free(pipeline);
+
+    MEM_free(buf);
+    return 1;
+
+test_error:
+    MEM_free(buf);
+    return 0;
+}
+
+/*
+ * Runs the pipelines read from fd with their output on out_fd, as an
+ * executor started ahead of time would
+ *
+ * Returns: 0 once the input ends, 1 on an error
+ */
+static int run_encoded(int fd, int out_fd)
+{
+    char errmsg[100];
+    size_t len;
+    void *buf;
+    shell_t sh = {VAR_new(), 0};
+
+    VAR_set(sh.vars, "PATH", "/usr/bin:/bin");
+    sh.in_fd = STDIN_FILENO;
+    sh.out_fd = out_fd;
+    sh.err_fd = STDERR_FILENO;
+
+    while ((buf = FP_read(fd, &len)) != NULL)
+    {
+        pipeline_t *pipeline = FP_decode(buf, len, errmsg, sizeof(errmsg));
+        if (pipeline == NULL)
+            return 1;
+
+        EXEC_pipeline(&sh, pipeline, out_fd);
+        pipeline_free(pipeline);
+        MEM_free(buf);
+    }
+
+    VAR_free(sh.vars);
+    return errno != 0;
+}
+
+/*
+ * Tests handing pipelines to another process through a pipe
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_other_process()
+{
+    int work[2] = {-1, -1}, out[2] = {-1, -1};
+    char output[64] = {0};
+    size_t len1, len2;
+    int status;
+    void *buf1 = encode_line("echo from a builtin | wc -w", &len1);
+    void *buf2 = encode_line("printf %s-%s\\\\n external command", &len2);
+
+    test_assert(buf1 != NULL && buf2 != NULL);
+    test_assert(pipe(work) == 0 && pipe(out) == 0);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(work[1]);
+        close(out[0]);
+        _exit(run_encoded(work[0], out[1]));
+    }
+    close(work[0]);
+    close(out[1]);
+    work[0] = out[1] = -1;
+
+    test_assert(FP_write(work[1], buf1, len1));
+    test_assert(FP_write(work[1], buf2, len2));
+    close(work[1]);
+    work[1] = -1;
+
+    size_t got = 0;
+    ssize_t n;
+    while ((n = read(out[0], output + got, sizeof(output) - 1 - got)) > 0)
+        got += n;
+
+    test_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    test_assert(strcmp(output, "3\nexternal-command\n") == 0);
+
+    // a stream cut short is an error
+    test_assert(pipe(work) == 0);
+    test_assert(FP_write(work[1], buf1, len1 - 1));
+    close(work[1]);
+    work[1] = -1;
+    test_assert(FP_read(work[0], &len1) == NULL && errno == EPROTO);
+    test_assert(FP_read(work[0], &len1) == NULL && errno == 0);
+
+    close(work[0]);
+    close(out[0]);
+    MEM_free(buf1);
+    MEM_free(buf2);
+    return 1;
+
+test_error:
+    for (int i = 0; i < 2; i++)
+    {
+        if (work[i] != -1)
+            close(work[i]);
+        if (out[i] != -1)
+            close(out[i]);
+    }
+    MEM_free(buf1);
+    MEM_free(buf2);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_round_trip();
+    num_tests++;
+    passed += test_malformed();
+    num_tests++;
+    passed += test_other_process();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * functions.c
+ *
+ * An open-addressing hash table of shell functions. Functions are
+ * only ever defined or redefined, so the table needs no tombstones.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "functions.h"
+#include "mem.h"
+
+#define FUNC_INITIAL_SLOTS 16
+
+struct _func_slot
+{
+    char *name; // NULL for an empty slot
+    Compound body;
+    uint32_t hash;
+};
+
+struct _functable
+{
+    struct _func_slot *slots;
+    int capacity; // always a power of two
+    int count;
+};
+
+/*
+ * FNV-1a hash of a name
+ */
+static uint32_t _FUNC_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name != '\0'; name++)
+    {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * Find the slot holding name, or the empty slot where it should be
+ * inserted
+ */
+static struct _func_slot *_FUNC_probe(FuncTable funcs, const char *name, uint32_t hash)
+{
+    uint32_t mask = funcs->capacity - 1;
+
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct _func_slot *slot = &funcs->slots[i];
+
+        if (slot->name == NULL || (slot->hash == hash && strcmp(slot->name, name) == 0))
+            return slot;
+    }
+}
+
+/*
+ * Double the table once it is three quarters full
+ */
+static void _FUNC_grow(FuncTable funcs)
+{
+    if ((funcs->count + 1) * 4 < funcs->capacity * 3)
+        return;
+
+    struct _func_slot *old = funcs->slots;
+    int old_capacity = funcs->capacity;
+
+    funcs->capacity *= 2;
+    funcs->slots = MEM_calloc(MEM_VARS, funcs->capacity, sizeof(struct _func_slot));
+    assert(funcs->slots != NULL);
+
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (old[i].name != NULL)
+            *_FUNC_probe(funcs, old[i].name, old[i].hash) = old[i];
+    }
+
+    MEM_free(old);
+}
+
+// Documented in .h file
+FuncTable FUNC_new()
+{
+    FuncTable funcs = (FuncTable)MEM_alloc(MEM_VARS, sizeof(struct _functable));
+    assert(funcs != NULL);
+
+    funcs->capacity = FUNC_INITIAL_SLOTS;
+    funcs->slots = MEM_calloc(MEM_VARS, funcs->capacity, sizeof(struct _func_slot));
+    assert(funcs->slots != NULL);
+    funcs->count = 0;
+
+    return funcs;
+}
+
+// Documented in .h file
+void FUNC_free(FuncTable funcs)
+{
+    if (funcs == NULL)
+        return;
+
+    for (int i = 0; i < funcs->capacity; i++)
+    {
+        if (funcs->slots[i].name != NULL)
+        {
+            MEM_free(funcs->slots[i].name);
+            CTL_free(funcs->slots[i].body);
+        }
+    }
+
+    MEM_free(funcs->slots);
+    MEM_free(funcs);
+}
+
+// Documented in .h file
+void FUNC_define(FuncTable funcs, const char *name, Compound body)
+{
+    assert(funcs != NULL && name != NULL && body != NULL);
+
+    uint32_t hash = _FUNC_hash(name);
+
+    _FUNC_grow(funcs);
+
+    struct _func_slot *slot = _FUNC_probe(funcs, name, hash);
+    CTL_hold(body);
+
+    if (slot->name != NULL)
+    {
+        CTL_free(slot->body);
+        slot->body = body;
+        return;
+    }
+
+    slot->name = MEM_strdup(MEM_VARS, name);
+    slot->body = body;
+    slot->hash = hash;
+    funcs->count++;
+}
+
+// Documented in .h file
+Compound FUNC_lookup(FuncTable funcs, const char *name)
+{
+    if (funcs == NULL || name == NULL || funcs->count == 0)
+        return NULL;
+
+    struct _func_slot *slot = _FUNC_probe(funcs, name, _FUNC_hash(name));
+    return slot->body;
+}
+
+// Documented in .h file
+int FUNC_count(FuncTable funcs)
+{
+    if (funcs == NULL)
+        return 0;
+
+    return funcs->count;
+}
@@ -0,0 +1,72 @@
+/*
+ * functions.h
+ *
+ * A hashed table of the shell functions, from their names to their
+ * bodies, which were parsed once when they were defined
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _FUNCTIONS_H_
+#define _FUNCTIONS_H_
+
+#include "control.h"
+
+// struct _functable to be used in the .c as FuncTable
+typedef struct _functable *FuncTable;
+
+/*
+ * Create a new, empty function table
+ *
+ * Parameters: None
+ *
+ * Returns: The new table
+ */
+FuncTable FUNC_new();
+
+/*
+ * Destroy a function table, with the bodies it holds
+ *
+ * Parameters:
+ *   funcs    The table, or NULL
+ *
+ * Returns: None
+ */
+void FUNC_free(FuncTable funcs);
+
+/*
+ * Define a function, replacing any earlier definition of the name. The
+ * body is held with CTL_hold, and the body it replaces is freed with
+ * CTL_free, so a call that is still running keeps its own.
+ *
+ * Parameters:
+ *   funcs    The table
+ *   name     The name of the function, which is copied
+ *   body     The commands of the function
+ *
+ * Returns: None
+ */
+void FUNC_define(FuncTable funcs, const char *name, Compound body);
+
+/*
+ * Look up a function
+ *
+ * Parameters:
+ *   funcs    The table, or NULL
+ *   name     The name of the function
+ *
+ * Returns: The body, valid until the function is defined again, or NULL
+ *   if there is no such function
+ */
+Compound FUNC_lookup(FuncTable funcs, const char *name);
+
+/*
+ * Return the number of functions in the table
+ *
+ * Parameters:
+ *   funcs    The table
+ *
+ * Returns: The number of functions
+ */
+int FUNC_count(FuncTable funcs);
+
+#endif /* _FUNCTIONS_H_ */
@@ -0,0 +1,97 @@
+/**
+ * functions_test.c
+ *
+ * This file contains the test cases for functions.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "functions.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Parses a compound command to use as a function body
+ */
+static Compound parse(const char *command)
+{
+    char errmsg[128];
+    CList tokens = TOK_tokenize_input(command, errmsg, sizeof(errmsg));
+    return tokens != NULL ? CTL_parse(tokens, errmsg, sizeof(errmsg)) : NULL;
+}
+
+/*
+ * Tests FUNC_define and FUNC_lookup, including growing the table and
+ * redefining functions
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_define_lookup()
+{
+    FuncTable funcs = FUNC_new();
+    Compound bodies[100] = {NULL};
+    char name[32];
+
+    test_assert(FUNC_lookup(funcs, "f") == NULL);
+    test_assert(FUNC_lookup(NULL, "f") == NULL);
+
+    // enough functions to grow the table several times
+    for (int i = 0; i < 100; i++)
+    {
+        bodies[i] = parse("while true; do echo; done");
+        test_assert(bodies[i] != NULL);
+
+        snprintf(name, sizeof(name), "f%d", i);
+        FUNC_define(funcs, name, bodies[i]);
+    }
+    test_assert(FUNC_count(funcs) == 100);
+
+    for (int i = 0; i < 100; i++)
+    {
+        snprintf(name, sizeof(name), "f%d", i);
+        test_assert(FUNC_lookup(funcs, name) == bodies[i]);
+    }
+    test_assert(FUNC_lookup(funcs, "f100") == NULL);
+
+    // the table holds each body, so the parsed commands can be freed
+    for (int i = 0; i < 100; i++)
+        CTL_free(bodies[i]);
+
+    // a redefinition replaces the body, freeing the old one
+    Compound body = parse("if true; then echo; fi");
+    FUNC_define(funcs, "f7", body);
+    CTL_free(body);
+    test_assert(FUNC_lookup(funcs, "f7") == body);
+    test_assert(FUNC_count(funcs) == 100);
+
+    FUNC_free(funcs);
+    return 1;
+
+test_error:
+    FUNC_free(funcs);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_define_lookup();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
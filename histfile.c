@@ -0,0 +1,364 @@
+/*
+ * histfile.c
+ *
+ * The history file: a header, a fixed-size index of records and a data
+ * area, all mapped into memory. Shells append by reserving index and
+ * data space with atomic adds on the shared header, so they never wait
+ * for each other; a shared flock() only keeps them out while the file
+ * is being compacted.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "histfile.h"
+#include "mem.h"
+
+#define HIST_MAGIC "PLAIDHST"
+#define HIST_VERSION 1
+
+// the capacity of the file, which is created at its full (sparse) size
+#define HIST_MAX_RECORDS 8192
+#define HIST_DATA_SIZE (1024 * 1024)
+#define HIST_MAX_LINE (HIST_DATA_SIZE / 16)
+
+#define HIST_HEADER_SIZE 4096
+#define HIST_DATA_OFFSET (HIST_HEADER_SIZE + HIST_MAX_RECORDS * sizeof(struct hist_record))
+#define HIST_FILE_SIZE (HIST_DATA_OFFSET + HIST_DATA_SIZE)
+
+// the start of the file
+struct hist_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t replaced; // set once a compacted file has been renamed over this one
+    uint32_t count;    // records reserved, which may be more than fit
+    uint32_t data_end; // data bytes reserved, which may be more than fit
+};
+
+// an entry of the index; len is stored last, so a record is complete once it is not 0
+struct hist_record
+{
+    uint32_t offset;
+    uint32_t len;
+};
+
+struct _history
+{
+    char *file;
+    int fd;    // -1 while the file is not mapped
+    char *map;
+};
+
+static struct hist_header *_HIST_header(char *map)
+{
+    return (struct hist_header *)map;
+}
+
+static struct hist_record *_HIST_records(char *map)
+{
+    return (struct hist_record *)(map + HIST_HEADER_SIZE);
+}
+
+static char *_HIST_data(char *map)
+{
+    return map + HIST_DATA_OFFSET;
+}
+
+/*
+ * Get the length of a complete record whose offset and length are
+ * within the data area, so that a damaged file cannot be read past its end
+ *
+ * Returns: The length, or 0 if the record is not complete or not valid
+ */
+static uint32_t _HIST_record_len(char *map, uint32_t i)
+{
+    struct hist_record *rec = &_HIST_records(map)[i];
+    uint32_t len = __atomic_load_n(&rec->len, __ATOMIC_ACQUIRE);
+
+    if (len == 0 || rec->offset > HIST_DATA_SIZE || len > HIST_DATA_SIZE - rec->offset)
+        return 0;
+
+    return len;
+}
+
+/*
+ * Get the number of records that may have been written
+ */
+static uint32_t _HIST_count(char *map)
+{
+    uint32_t count = __atomic_load_n(&_HIST_header(map)->count, __ATOMIC_ACQUIRE);
+    return count < HIST_MAX_RECORDS ? count : HIST_MAX_RECORDS;
+}
+
+/*
+ * Open and map the history file, creating it with an empty header if it
+ * does not exist yet
+ *
+ * Returns: true if the file is mapped, false if it cannot be used
+ */
+static bool _HIST_map(History hist)
+{
+    hist->fd = open(hist->file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (hist->fd < 0)
+        return false;
+
+    // shells started at the same time must not both create the header
+    flock(hist->fd, LOCK_EX);
+
+    struct stat st;
+    bool created = fstat(hist->fd, &st) == 0 && st.st_size == 0 && ftruncate(hist->fd, HIST_FILE_SIZE) == 0;
+    if (created || (fstat(hist->fd, &st) == 0 && st.st_size == HIST_FILE_SIZE))
+        hist->map = mmap(NULL, HIST_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, hist->fd, 0);
+
+    if (hist->map == MAP_FAILED)
+        hist->map = NULL;
+
+    if (hist->map != NULL && created)
+    {
+        memcpy(_HIST_header(hist->map)->magic, HIST_MAGIC, 8);
+        _HIST_header(hist->map)->version = HIST_VERSION;
+    }
+
+    // a file that is not a history file is left alone
+    if (hist->map != NULL && (memcmp(_HIST_header(hist->map)->magic, HIST_MAGIC, 8) != 0 ||
+                              _HIST_header(hist->map)->version != HIST_VERSION))
+    {
+        munmap(hist->map, HIST_FILE_SIZE);
+        hist->map = NULL;
+    }
+
+    flock(hist->fd, LOCK_UN);
+
+    if (hist->map == NULL)
+    {
+        close(hist->fd);
+        hist->fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Unmap and close the history file
+ */
+static void _HIST_unmap(History hist)
+{
+    if (hist->map != NULL)
+        munmap(hist->map, HIST_FILE_SIZE);
+    if (hist->fd >= 0)
+        close(hist->fd);
+
+    hist->map = NULL;
+    hist->fd = -1;
+}
+
+/*
+ * Map the file and take a shared lock on it, so that it is not
+ * compacted while it is used. If another shell has already replaced the
+ * mapped file with a compacted one, the new file is mapped instead.
+ *
+ * Returns: true if the file is mapped and locked
+ */
+static bool _HIST_lock(History hist)
+{
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        if (hist->map == NULL && !_HIST_map(hist))
+            return false;
+
+        flock(hist->fd, LOCK_SH);
+        if (!__atomic_load_n(&_HIST_header(hist->map)->replaced, __ATOMIC_ACQUIRE))
+            return true;
+
+        _HIST_unmap(hist);
+    }
+
+    return false;
+}
+
+/*
+ * Replace a full history file with one holding its newest records, up
+ * to half of each capacity. The new file is written under a temporary
+ * name and renamed over the old one, which is then marked as replaced
+ * for the shells that still have it mapped.
+ */
+static void _HIST_compact(History hist)
+{
+    if (hist->map == NULL && !_HIST_map(hist))
+        return;
+
+    flock(hist->fd, LOCK_EX);
+
+    // another shell may have compacted it while this one waited
+    char *old = hist->map;
+    if (__atomic_load_n(&_HIST_header(old)->replaced, __ATOMIC_ACQUIRE))
+    {
+        _HIST_unmap(hist);
+        return;
+    }
+
+    uint32_t count = _HIST_count(old);
+    uint32_t first = count;
+    size_t bytes = 0;
+    while (first > 0 && count - first < HIST_MAX_RECORDS / 2)
+    {
+        uint32_t len = _HIST_record_len(old, first - 1);
+        if (bytes + len > HIST_DATA_SIZE / 2)
+            break;
+        bytes += len;
+        first--;
+    }
+
+    size_t name_len = strlen(hist->file) + 8;
+    char tmp[name_len];
+    snprintf(tmp, name_len, "%s.XXXXXX", hist->file);
+
+    int fd = mkstemp(tmp);
+    char *map = MAP_FAILED;
+    if (fd >= 0 && fchmod(fd, 0600) == 0 && ftruncate(fd, HIST_FILE_SIZE) == 0)
+        map = mmap(NULL, HIST_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map != MAP_FAILED)
+    {
+        struct hist_header *hdr = _HIST_header(map);
+        memcpy(hdr->magic, HIST_MAGIC, 8);
+        hdr->version = HIST_VERSION;
+
+        for (uint32_t i = first; i < count; i++)
+        {
+            uint32_t len = _HIST_record_len(old, i);
+            if (len == 0)
+                continue;
+
+            memcpy(_HIST_data(map) + hdr->data_end, _HIST_data(old) + _HIST_records(old)[i].offset, len);
+            _HIST_records(map)[hdr->count] = (struct hist_record){hdr->data_end, len};
+            hdr->data_end += len;
+            hdr->count++;
+        }
+
+        munmap(map, HIST_FILE_SIZE);
+
+        if (rename(tmp, hist->file) == 0)
+            __atomic_store_n(&_HIST_header(old)->replaced, 1, __ATOMIC_RELEASE);
+        else
+            unlink(tmp);
+    }
+    else if (fd >= 0)
+        unlink(tmp);
+
+    if (fd >= 0)
+        close(fd);
+
+    // the next use maps the compacted file
+    flock(hist->fd, LOCK_UN);
+    _HIST_unmap(hist);
+}
+
+// Documented in .h file
+History HIST_open(const char *file)
+{
+    History hist = MEM_alloc(MEM_HISTORY, sizeof(struct _history));
+
+    hist->file = MEM_strdup(MEM_HISTORY, file);
+    hist->fd = -1;
+    hist->map = NULL;
+
+    if (!_HIST_map(hist))
+    {
+        MEM_free(hist->file);
+        MEM_free(hist);
+        return NULL;
+    }
+
+    return hist;
+}
+
+// Documented in .h file
+void HIST_close(History hist)
+{
+    if (hist == NULL)
+        return;
+
+    _HIST_unmap(hist);
+    MEM_free(hist->file);
+    MEM_free(hist);
+}
+
+// Documented in .h file
+bool HIST_append(History hist, const char *line)
+{
+    assert(hist != NULL);
+
+    size_t len = strlen(line);
+    if (len == 0 || len > HIST_MAX_LINE)
+        return false;
+
+    // after a compaction, there is room on the second attempt
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (!_HIST_lock(hist))
+            return false;
+
+        struct hist_header *hdr = _HIST_header(hist->map);
+        uint32_t offset = __atomic_fetch_add(&hdr->data_end, len, __ATOMIC_RELAXED);
+        uint32_t i = HIST_MAX_RECORDS;
+        if (offset <= HIST_DATA_SIZE - len)
+            i = __atomic_fetch_add(&hdr->count, 1, __ATOMIC_RELAXED);
+
+        if (i < HIST_MAX_RECORDS)
+        {
+            struct hist_record *rec = &_HIST_records(hist->map)[i];
+            memcpy(_HIST_data(hist->map) + offset, line, len);
+            rec->offset = offset;
+            __atomic_store_n(&rec->len, len, __ATOMIC_RELEASE);
+
+            flock(hist->fd, LOCK_UN);
+            return true;
+        }
+
+        flock(hist->fd, LOCK_UN);
+        _HIST_compact(hist);
+    }
+
+    return false;
+}
+
+// Documented in .h file
+int HIST_load_tail(History hist, int max, HIST_callback fn, void *cb_data)
+{
+    assert(hist != NULL);
+
+    if (!_HIST_lock(hist))
+        return 0;
+
+    // only the pages of the newest records are read
+    uint32_t count = _HIST_count(hist->map);
+    uint32_t first = count > max ? count - max : 0;
+    int loaded = 0;
+
+    for (uint32_t i = first; i < count; i++)
+    {
+        uint32_t len = _HIST_record_len(hist->map, i);
+        if (len == 0)
+            continue;
+
+        fn(_HIST_data(hist->map) + _HIST_records(hist->map)[i].offset, len, cb_data);
+        loaded++;
+    }
+
+    flock(hist->fd, LOCK_UN);
+    return loaded;
+}
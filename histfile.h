@@ -0,0 +1,78 @@
+/*
+ * histfile.h
+ *
+ * A history file shared by all running shells. Commands are appended
+ * to a memory-mapped file with a fixed-size index of records, which
+ * any number of shells can append to at once. When the file is full,
+ * the oldest half of it is dropped.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _HISTFILE_H_
+#define _HISTFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// struct _history to be used in the .c as History
+typedef struct _history *History;
+
+/*
+ * Called for each command loaded from the history
+ *
+ * Parameters:
+ *   line     The command, not NUL-terminated
+ *   len      The length of the command
+ *   cb_data  Caller data
+ */
+typedef void (*HIST_callback)(const char *line, size_t len, void *cb_data);
+
+/*
+ * Open a history file, creating it if it does not exist. Only the
+ * header is read; the records are read when they are loaded.
+ *
+ * Parameters:
+ *   file     The path of the file
+ *
+ * Returns: The history, or NULL if the file cannot be used, e.g. it
+ *   is not a history file
+ */
+History HIST_open(const char *file);
+
+/*
+ * Close a history, unmapping its file
+ *
+ * Parameters:
+ *   hist     The history, or NULL
+ *
+ * Returns: None
+ */
+void HIST_close(History hist);
+
+/*
+ * Append a command to the history. This is safe while other shells
+ * append to the same file.
+ *
+ * Parameters:
+ *   hist     The history
+ *   line     The command
+ *
+ * Returns: true if the command was stored, false if it could not be,
+ *   e.g. it is too long
+ */
+bool HIST_append(History hist, const char *line);
+
+/*
+ * Call a function for each of the newest commands, oldest first
+ *
+ * Parameters:
+ *   hist     The history
+ *   max      The most commands to load
+ *   fn       The function to call
+ *   cb_data  Caller data to pass to fn
+ *
+ * Returns: The number of commands loaded
+ */
+int HIST_load_tail(History hist, int max, HIST_callback fn, void *cb_data);
+
+#endif /* _HISTFILE_H_ */
@@ -0,0 +1,198 @@
+/**
+ * histfile_test.c
+ *
+ * This file contains the test cases for histfile.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "histfile.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+// the commands loaded by collect
+struct loaded
+{
+    int count;
+    char last[64];
+    int next[4]; // for each writer, the number of its next command, or 0 before its first
+    bool in_order;
+};
+
+/*
+ * HIST_callback that counts the commands and remembers the last one
+ */
+static void collect(const char *line, size_t len, void *cb_data)
+{
+    struct loaded *ld = (struct loaded *)cb_data;
+
+    ld->count++;
+    snprintf(ld->last, sizeof(ld->last), "%.*s", (int)len, line);
+
+    // commands from writer w are "w:n"; the oldest may have been dropped,
+    // but the rest must be seen in order with none missing
+    int w, n;
+    if (sscanf(ld->last, "%d:%d", &w, &n) == 2 && w >= 0 && w < 4)
+    {
+        if (ld->next[w] != 0 && n != ld->next[w])
+            ld->in_order = false;
+        ld->next[w] = n + 1;
+    }
+}
+
+/*
+ * Makes a name for a history file that does not exist yet
+ */
+static void temp_file(char *file, size_t size)
+{
+    snprintf(file, size, "/tmp/plaid_hist_%d_XXXXXX", getpid());
+    int fd = mkstemp(file);
+    close(fd);
+    unlink(file);
+}
+
+/*
+ * Tests storing commands and loading them in a later session
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_append_load()
+{
+    char file[64];
+    struct loaded ld = {0};
+    History hist = NULL;
+
+    temp_file(file, sizeof(file));
+    hist = HIST_open(file);
+    test_assert(hist != NULL);
+    test_assert(HIST_append(hist, "ls -l"));
+    test_assert(HIST_append(hist, "echo one\necho two"));
+    test_assert(HIST_append(hist, "pwd"));
+    test_assert(!HIST_append(hist, ""));
+    HIST_close(hist);
+
+    hist = HIST_open(file);
+    test_assert(hist != NULL);
+    test_assert(HIST_load_tail(hist, 2, collect, &ld) == 2);
+    test_assert(ld.count == 2 && strcmp(ld.last, "pwd") == 0);
+    HIST_close(hist);
+    hist = NULL;
+
+    // a file that is not a history file is not used, nor changed
+    int fd = open(file, O_WRONLY | O_TRUNC);
+    write(fd, "not history\n", 12);
+    close(fd);
+    test_assert(HIST_open(file) == NULL);
+
+    struct stat st;
+    test_assert(stat(file, &st) == 0 && st.st_size == 12);
+
+    unlink(file);
+    return 1;
+
+test_error:
+    HIST_close(hist);
+    unlink(file);
+    return 0;
+}
+
+/*
+ * Tests several processes appending to the same file at once, and the
+ * file being compacted when it is full
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_concurrent_compaction()
+{
+    char file[64];
+    struct loaded ld = {.in_order = true};
+    History hist = NULL;
+    struct stat st_before, st_after;
+
+    temp_file(file, sizeof(file));
+    hist = HIST_open(file);
+    test_assert(hist != NULL);
+    test_assert(stat(file, &st_before) == 0);
+
+    // more commands than fit, so the writers compact it as they go
+    const int per_writer = 5000;
+    for (int w = 0; w < 4; w++)
+    {
+        if (fork() == 0)
+        {
+            History child = HIST_open(file);
+            char line[32];
+            for (int n = 0; child != NULL && n < per_writer; n++)
+            {
+                snprintf(line, sizeof(line), "%d:%d", w, n);
+                if (!HIST_append(child, line))
+                    _exit(1);
+            }
+            HIST_close(child);
+            _exit(child != NULL ? 0 : 1);
+        }
+    }
+
+    int failures = 0;
+    for (int w = 0; w < 4; w++)
+    {
+        int status;
+        wait(&status);
+        failures += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    test_assert(failures == 0);
+
+    // this handle still has the first file mapped, and moves to the new one
+    test_assert(HIST_append(hist, "3:5000"));
+    test_assert(HIST_load_tail(hist, 100000, collect, &ld) > 0);
+    test_assert(strcmp(ld.last, "3:5000") == 0);
+    test_assert(ld.count <= 8192 && ld.count >= 4096);
+
+    // the newest commands survive, in the order each writer wrote them; a
+    // writer that finished early may have had all of its dropped
+    test_assert(ld.in_order);
+    for (int w = 0; w < 3; w++)
+        test_assert(ld.next[w] == per_writer || ld.next[w] == 0);
+
+    test_assert(stat(file, &st_after) == 0 && st_after.st_size == st_before.st_size);
+
+    HIST_close(hist);
+    unlink(file);
+    return 1;
+
+test_error:
+    HIST_close(hist);
+    unlink(file);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_append_load();
+    num_tests++;
+    passed += test_concurrent_compaction();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+ * histindex.c
+ *
+ * The history index: the distinct commands, a hash table to find a
+ * command again when it is rerun, and a hash table from each trigram
+ * to the sorted list of commands containing it
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "histindex.h"
+#include "mem.h"
+
+// the most trigrams of a query that are looked up
+#define HI_MAX_QUERY_TRIGRAMS 64
+
+// a distinct command
+struct _hi_entry
+{
+    char *line;
+    uint32_t folded; // where the line is in the folded arena
+    uint32_t len;
+    uint32_t freq;  // how many times it was run
+    uint32_t last;  // when it was last run, counting commands
+    double weight;  // the part of the score that comes from freq
+};
+
+// the commands containing a trigram, in the order they were first run
+struct _hi_posting
+{
+    uint32_t trigram; // 0 for an empty slot
+    uint32_t len;
+    uint32_t cap;
+    uint32_t *ids;
+};
+
+struct _histindex
+{
+    struct _hi_entry *entries;
+    uint32_t count;
+    uint32_t cap;
+
+    // open addressing table of entry IDs + 1, 0 for an empty slot
+    uint32_t *lines;
+    uint32_t lines_cap;
+
+    // open addressing table of postings
+    struct _hi_posting *postings;
+    uint32_t num_postings;
+    uint32_t postings_cap;
+
+    uint32_t seq; // the number of commands added
+
+    // every line in lower case, in the order they were added and each
+    // followed by a NUL, so that one memmem() can search them all
+    char *folded;
+    uint32_t folded_len;
+    uint32_t folded_cap;
+
+    // scratch space for searching, with room for every entry
+    uint16_t *counts;
+    uint32_t *touched;
+};
+
+/*
+ * FNV-1a hash of a command
+ */
+static uint32_t _HI_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * The trigram starting at s, ignoring case. It is never 0, since
+ * commands contain no NUL characters.
+ */
+static uint32_t _HI_trigram(const char *s)
+{
+    return (uint32_t)tolower((unsigned char)s[0]) << 16 |
+           (uint32_t)tolower((unsigned char)s[1]) << 8 |
+           (uint32_t)tolower((unsigned char)s[2]);
+}
+
+/*
+ * Spread the bits of a trigram for the posting table
+ */
+static uint32_t _HI_trigram_hash(uint32_t trigram)
+{
+    return trigram * 2654435761u;
+}
+
+/*
+ * Find the posting of a trigram
+ *
+ * Returns: The posting, or NULL if no command contains the trigram
+ */
+static struct _hi_posting *_HI_find_posting(HistIndex hi, uint32_t trigram)
+{
+    uint32_t mask = hi->postings_cap - 1;
+
+    for (uint32_t i = _HI_trigram_hash(trigram) & mask;; i = (i + 1) & mask)
+    {
+        if (hi->postings[i].trigram == trigram)
+            return &hi->postings[i];
+        if (hi->postings[i].trigram == 0)
+            return NULL;
+    }
+}
+
+/*
+ * Find the posting of a trigram, adding an empty one if there is none
+ *
+ * Returns: The posting
+ */
+static struct _hi_posting *_HI_add_posting(HistIndex hi, uint32_t trigram)
+{
+    // keep the table at most half full
+    if (2 * (hi->num_postings + 1) > hi->postings_cap)
+    {
+        struct _hi_posting *old = hi->postings;
+        uint32_t old_cap = hi->postings_cap;
+
+        hi->postings_cap *= 2;
+        hi->postings = MEM_calloc(MEM_HISTORY, hi->postings_cap, sizeof(struct _hi_posting));
+
+        for (uint32_t i = 0; i < old_cap; i++)
+        {
+            if (old[i].trigram == 0)
+                continue;
+
+            uint32_t mask = hi->postings_cap - 1;
+            uint32_t j = _HI_trigram_hash(old[i].trigram) & mask;
+            while (hi->postings[j].trigram != 0)
+                j = (j + 1) & mask;
+            hi->postings[j] = old[i];
+        }
+
+        MEM_free(old);
+    }
+
+    uint32_t mask = hi->postings_cap - 1;
+    uint32_t i = _HI_trigram_hash(trigram) & mask;
+    while (hi->postings[i].trigram != 0 && hi->postings[i].trigram != trigram)
+        i = (i + 1) & mask;
+
+    if (hi->postings[i].trigram == 0)
+    {
+        hi->postings[i].trigram = trigram;
+        hi->num_postings++;
+    }
+
+    return &hi->postings[i];
+}
+
+/*
+ * Add an entry ID to the line table, which has room for it
+ */
+static void _HI_insert_line(HistIndex hi, uint32_t id)
+{
+    uint32_t mask = hi->lines_cap - 1;
+    uint32_t i = _HI_hash(hi->entries[id].line, hi->entries[id].len) & mask;
+
+    while (hi->lines[i] != 0)
+        i = (i + 1) & mask;
+    hi->lines[i] = id + 1;
+}
+
+// Documented in .h file
+HistIndex HI_new()
+{
+    HistIndex hi = MEM_calloc(MEM_HISTORY, 1, sizeof(struct _histindex));
+
+    hi->cap = 64;
+    hi->entries = MEM_alloc(MEM_HISTORY, hi->cap * sizeof(struct _hi_entry));
+    hi->counts = MEM_calloc(MEM_HISTORY, hi->cap, sizeof(uint16_t));
+    hi->touched = MEM_alloc(MEM_HISTORY, hi->cap * sizeof(uint32_t));
+    hi->lines_cap = 2 * hi->cap;
+    hi->lines = MEM_calloc(MEM_HISTORY, hi->lines_cap, sizeof(uint32_t));
+    hi->postings_cap = 256;
+    hi->postings = MEM_calloc(MEM_HISTORY, hi->postings_cap, sizeof(struct _hi_posting));
+    assert(hi->lines != NULL && hi->postings != NULL);
+
+    return hi;
+}
+
+// Documented in .h file
+void HI_free(HistIndex hi)
+{
+    if (hi == NULL)
+        return;
+
+    for (uint32_t i = 0; i < hi->count; i++)
+        MEM_free(hi->entries[i].line);
+    for (uint32_t i = 0; i < hi->postings_cap; i++)
+        MEM_free(hi->postings[i].ids);
+
+    MEM_free(hi->entries);
+    MEM_free(hi->folded);
+    MEM_free(hi->lines);
+    MEM_free(hi->postings);
+    MEM_free(hi->counts);
+    MEM_free(hi->touched);
+    MEM_free(hi);
+}
+
+// Documented in .h file
+void HI_add(HistIndex hi, const char *line, size_t len)
+{
+    assert(hi != NULL);
+
+    if (len == 0)
+        return;
+
+    hi->seq++;
+
+    // a command run before only becomes more recent and more frequent
+    uint32_t mask = hi->lines_cap - 1;
+    for (uint32_t i = _HI_hash(line, len) & mask; hi->lines[i] != 0; i = (i + 1) & mask)
+    {
+        struct _hi_entry *entry = &hi->entries[hi->lines[i] - 1];
+        if (entry->len == len && memcmp(entry->line, line, len) == 0)
+        {
+            entry->freq++;
+            entry->last = hi->seq;
+            entry->weight = log2(1 + entry->freq) / 4;
+            return;
+        }
+    }
+
+    if (hi->count == hi->cap)
+    {
+        hi->cap *= 2;
+        hi->entries = MEM_realloc(MEM_HISTORY, hi->entries, hi->cap * sizeof(struct _hi_entry));
+        MEM_free(hi->counts);
+        hi->counts = MEM_calloc(MEM_HISTORY, hi->cap, sizeof(uint16_t));
+        hi->touched = MEM_realloc(MEM_HISTORY, hi->touched, hi->cap * sizeof(uint32_t));
+
+        MEM_free(hi->lines);
+        hi->lines_cap = 2 * hi->cap;
+        hi->lines = MEM_calloc(MEM_HISTORY, hi->lines_cap, sizeof(uint32_t));
+        for (uint32_t i = 0; i < hi->count; i++)
+            _HI_insert_line(hi, i);
+    }
+
+    uint32_t id = hi->count++;
+    while (hi->folded_len + len + 1 > hi->folded_cap)
+    {
+        hi->folded_cap = hi->folded_cap ? hi->folded_cap * 2 : 4096;
+        hi->folded = MEM_realloc(MEM_HISTORY, hi->folded, hi->folded_cap);
+    }
+
+    hi->entries[id] = (struct _hi_entry){MEM_strndup(MEM_HISTORY, line, len), hi->folded_len, len, 1, hi->seq, 0.25};
+    for (size_t i = 0; i < len; i++)
+        hi->folded[hi->folded_len++] = tolower((unsigned char)line[i]);
+    hi->folded[hi->folded_len++] = '\0';
+    _HI_insert_line(hi, id);
+
+    for (size_t i = 0; i + 3 <= len; i++)
+    {
+        struct _hi_posting *posting = _HI_add_posting(hi, _HI_trigram(line + i));
+
+        // a trigram that occurs twice in the command is listed once
+        if (posting->len > 0 && posting->ids[posting->len - 1] == id)
+            continue;
+
+        if (posting->len == posting->cap)
+        {
+            posting->cap = posting->cap ? posting->cap * 2 : 4;
+            posting->ids = MEM_realloc(MEM_HISTORY, posting->ids, posting->cap * sizeof(uint32_t));
+        }
+        posting->ids[posting->len++] = id;
+    }
+}
+
+// Documented in .h file
+int HI_count(HistIndex hi)
+{
+    assert(hi != NULL);
+    return hi->count;
+}
+
+/*
+ * Rank a command that matched a query. How much of the query matched
+ * counts most, then whether the query is a substring of it, then how
+ * recently and how often it was run.
+ *
+ * Parameters:
+ *   hi       The index
+ *   id       The command
+ *   matched  The fraction of the query's trigrams it contains
+ *   exact    Whether the query is a substring of it
+ *
+ * Returns: The score; higher is better
+ */
+static double _HI_score(HistIndex hi, uint32_t id, double matched, bool exact)
+{
+    struct _hi_entry *entry = &hi->entries[id];
+    return 4 * matched + (exact ? 2 : 0) + entry->weight + (double)entry->last / hi->seq;
+}
+
+/*
+ * Returns true if a command contains the query, which is in lower case
+ */
+static bool _HI_contains(HistIndex hi, uint32_t id, const char *folded, size_t len)
+{
+    return memmem(hi->folded + hi->entries[id].folded, hi->entries[id].len, folded, len) != NULL;
+}
+
+/*
+ * Find the first place where a query of one or two characters occurs.
+ * memmem() handles such short needles a byte at a time, so pairs are
+ * compared sixteen positions at once with SSE2.
+ *
+ * Parameters:
+ *   p        Where to start
+ *   end      Where to stop
+ *   query    The query, in lower case
+ *   len      The length of the query, 1 or 2
+ *
+ * Returns: The first occurrence, or NULL if there is none
+ */
+static const char *_HI_find_short(const char *p, const char *end, const char *query, size_t len)
+{
+    if (len == 1)
+        return memchr(p, query[0], end - p);
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(query[0]);
+    const __m128i second = _mm_set1_epi8(query[1]);
+
+    for (; end - p >= 17; p += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), second);
+        int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; end - p >= 2; p++)
+    {
+        if (p[0] == query[0] && p[1] == query[1])
+            return p;
+    }
+
+    return NULL;
+}
+
+/*
+ * Keep a result if it is among the best max so far
+ *
+ * Parameters:
+ *   ids      The best results so far, best first
+ *   scores   Their scores
+ *   n        The number of results so far
+ *   max      The most results to keep
+ *   id       The new result
+ *   score    Its score
+ *
+ * Returns: The new number of results
+ */
+static int _HI_keep(uint32_t *ids, double *scores, int n, int max, uint32_t id, double score)
+{
+    if (n == max && score <= scores[n - 1])
+        return n;
+
+    int i = n < max ? n++ : n - 1;
+    while (i > 0 && scores[i - 1] < score)
+    {
+        ids[i] = ids[i - 1];
+        scores[i] = scores[i - 1];
+        i--;
+    }
+    ids[i] = id;
+    scores[i] = score;
+
+    return n;
+}
+
+// Documented in .h file
+int HI_search(HistIndex hi, const char *query, const char **results, int max)
+{
+    assert(hi != NULL);
+
+    size_t qlen = strlen(query);
+    if (qlen == 0 || max <= 0 || hi->count == 0)
+        return 0;
+
+    uint32_t ids[max];
+    double scores[max];
+    int n = 0;
+
+    char folded[qlen];
+    for (size_t i = 0; i < qlen; i++)
+        folded[i] = tolower((unsigned char)query[i]);
+
+    // too short for a trigram: search all the lines at once, and go on
+    // from the next line after each match
+    if (qlen < 3)
+    {
+        const char *p = hi->folded;
+        const char *end = hi->folded + hi->folded_len;
+        uint32_t id = 0;
+        while ((p = _HI_find_short(p, end, folded, qlen)) != NULL)
+        {
+            // the lines are in ID order, so the matching one is found by walking forward
+            while (hi->folded + hi->entries[id].folded + hi->entries[id].len < p)
+                id++;
+
+            n = _HI_keep(ids, scores, n, max, id, _HI_score(hi, id, 1, true));
+            p = hi->folded + hi->entries[id].folded + hi->entries[id].len + 1;
+        }
+    }
+    else
+    {
+        // the distinct trigrams of the query
+        uint32_t trigrams[HI_MAX_QUERY_TRIGRAMS];
+        int num_trigrams = 0;
+        for (size_t i = 0; i + 3 <= qlen && num_trigrams < HI_MAX_QUERY_TRIGRAMS; i++)
+        {
+            uint32_t t = _HI_trigram(query + i);
+            bool seen = false;
+            for (int j = 0; j < num_trigrams && !seen; j++)
+                seen = trigrams[j] == t;
+            if (!seen)
+                trigrams[num_trigrams++] = t;
+        }
+
+        // count the query's trigrams in each command that has any
+        uint32_t num_touched = 0;
+        for (int i = 0; i < num_trigrams; i++)
+        {
+            struct _hi_posting *posting = _HI_find_posting(hi, trigrams[i]);
+            for (uint32_t j = 0; posting != NULL && j < posting->len; j++)
+            {
+                uint32_t id = posting->ids[j];
+                if (hi->counts[id]++ == 0)
+                    hi->touched[num_touched++] = id;
+            }
+        }
+
+        // a typo spoils up to three trigrams, so half of them is enough
+        int needed = num_trigrams <= 2 ? num_trigrams : (num_trigrams + 1) / 2;
+
+        for (uint32_t i = 0; i < num_touched; i++)
+        {
+            uint32_t id = hi->touched[i];
+            if (hi->counts[id] >= needed)
+            {
+                double matched = (double)hi->counts[id] / num_trigrams;
+                bool exact = hi->counts[id] == num_trigrams && _HI_contains(hi, id, folded, qlen);
+                n = _HI_keep(ids, scores, n, max, id, _HI_score(hi, id, matched, exact));
+            }
+            hi->counts[id] = 0;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+        results[i] = hi->entries[ids[i]].line;
+
+    return n;
+}
@@ -0,0 +1,77 @@
+/*
+ * histindex.h
+ *
+ * An index of the commands in the history for fuzzy searching. Each
+ * distinct command is indexed by the trigrams (three-character
+ * substrings) it contains, and results are ranked by how well they
+ * match, how recently they were run and how often.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _HISTINDEX_H_
+#define _HISTINDEX_H_
+
+#include <stddef.h>
+
+// struct _histindex to be used in the .c as HistIndex
+typedef struct _histindex *HistIndex;
+
+/*
+ * Create a new, empty index
+ *
+ * Parameters: None
+ *
+ * Returns: The new index
+ */
+HistIndex HI_new();
+
+/*
+ * Destroy an index and the memory it holds
+ *
+ * Parameters:
+ *   hi       The index
+ *
+ * Returns: None
+ */
+void HI_free(HistIndex hi);
+
+/*
+ * Add a command that was run, as the newest in the history. A command
+ * that is already in the index becomes the newest and counts once more.
+ *
+ * Parameters:
+ *   hi       The index
+ *   line     The command, not necessarily NUL-terminated
+ *   len      The length of the command
+ *
+ * Returns: None
+ */
+void HI_add(HistIndex hi, const char *line, size_t len);
+
+/*
+ * Get the number of distinct commands in the index
+ *
+ * Parameters:
+ *   hi       The index
+ *
+ * Returns: The number of commands
+ */
+int HI_count(HistIndex hi);
+
+/*
+ * Find the commands that best match a query, ignoring case. A command
+ * matches if it contains most of the query's trigrams, so small typos
+ * are forgiven; queries shorter than a trigram match as substrings.
+ *
+ * Parameters:
+ *   hi       The index
+ *   query    The text to look for
+ *   results  Return space for the matching commands, best first; they
+ *            are valid until the next HI_add or HI_free
+ *   max      The size of results
+ *
+ * Returns: The number of results
+ */
+int HI_search(HistIndex hi, const char *query, const char **results, int max);
+
+#endif /* _HISTINDEX_H_ */
@@ -0,0 +1,133 @@
+/**
+ * histindex_test.c
+ *
+ * This file contains the test cases for histindex.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "histindex.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Adds a NUL-terminated command to an index
+ */
+static void add(HistIndex hi, const char *line)
+{
+    HI_add(hi, line, strlen(line));
+}
+
+/*
+ * Tests finding commands by substrings, with typos and in any case
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_search()
+{
+    const char *results[8];
+    HistIndex hi = HI_new();
+
+    add(hi, "git status");
+    add(hi, "make clean && make");
+    add(hi, "grep -rn TODO src");
+    add(hi, "git commit -m 'fix parser'");
+    add(hi, "git status");
+    test_assert(HI_count(hi) == 4);
+
+    test_assert(HI_search(hi, "commit", results, 8) == 1);
+    test_assert(strcmp(results[0], "git commit -m 'fix parser'") == 0);
+
+    test_assert(HI_search(hi, "todo", results, 8) == 1);
+    test_assert(strcmp(results[0], "grep -rn TODO src") == 0);
+
+    // a typo still finds the command
+    test_assert(HI_search(hi, "make claen", results, 8) >= 1);
+    test_assert(strcmp(results[0], "make clean && make") == 0);
+
+    // too short for a trigram
+    test_assert(HI_search(hi, "rn", results, 8) == 1);
+    test_assert(HI_search(hi, "zq", results, 8) == 0);
+    test_assert(HI_search(hi, "&", results, 8) == 1);
+
+    // a match never spans two commands
+    test_assert(HI_search(hi, "eg", results, 8) == 0);
+    test_assert(HI_search(hi, "nothing like it", results, 8) == 0);
+    test_assert(HI_search(hi, "", results, 8) == 0);
+
+    HI_free(hi);
+    return 1;
+
+test_error:
+    HI_free(hi);
+    return 0;
+}
+
+/*
+ * Tests that equally good matches are ranked by frequency and recency
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_ranking()
+{
+    const char *results[2];
+    char line[32];
+    HistIndex hi = HI_new();
+
+    // enough commands to grow every table
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(line, sizeof(line), "echo %d", i);
+        add(hi, line);
+    }
+    test_assert(HI_count(hi) == 1000);
+
+    add(hi, "ssh build-server");
+    add(hi, "ssh backup-server");
+    test_assert(HI_search(hi, "ssh", results, 2) == 2);
+    test_assert(strcmp(results[0], "ssh backup-server") == 0);
+
+    // run more often, and again most recently
+    add(hi, "ssh build-server");
+    add(hi, "ssh build-server");
+    test_assert(HI_search(hi, "ssh", results, 2) == 2);
+    test_assert(strcmp(results[0], "ssh build-server") == 0);
+
+    // only the best are returned
+    test_assert(HI_search(hi, "echo 99", results, 1) == 1);
+    test_assert(strncmp(results[0], "echo 99", 7) == 0);
+
+    HI_free(hi);
+    return 1;
+
+test_error:
+    HI_free(hi);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_search();
+    num_tests++;
+    passed += test_ranking();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * libplaid.c
+ *
+ * The shell as a library: shells with their own state and fds, and jobs
+ * parsed once that any of them can run
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "control.h"
+#include "shell.h"
+#include "exec.h"
+#include "libplaid.h"
+#include "mem.h"
+
+struct _plaid
+{
+    shell_t sh; // the state of the shell, with the fds of the running job
+
+    // the job started with PLAID_start
+    bool started;
+    pthread_t thread;
+    PlaidJob job;
+    int fds[3];
+    PLAID_done_callback done;
+    void *cb_data;
+    int status;
+};
+
+struct _plaid_job
+{
+    Compound *commands; // the complete commands, in the order they run
+    int count;
+};
+
+// Documented in .h file
+Plaid PLAID_new(char **envp)
+{
+    Plaid plaid = (Plaid)MEM_calloc(MEM_VARS, 1, sizeof(struct _plaid));
+    assert(plaid != NULL);
+
+    shell_t *sh = &plaid->sh;
+    sh->vars = VAR_new();
+    sh->funcs = FUNC_new();
+    sh->pathcache = PC_new();
+    sh->readbuf = RB_new();
+    sh->tok_state = TOK_state_new();
+    TOK_state_set_vars(sh->tok_state, sh->vars);
+    TOK_state_set_subst(sh->tok_state, EXEC_command_substitution, sh);
+
+    if (envp != NULL)
+        VAR_import(sh->vars, envp);
+    VAR_set(sh->vars, "?", "0");
+
+    return plaid;
+}
+
+// Documented in .h file
+void PLAID_free(Plaid plaid)
+{
+    if (plaid == NULL)
+        return;
+
+    PLAID_wait(plaid);
+
+    TOK_state_free(plaid->sh.tok_state);
+    FUNC_free(plaid->sh.funcs);
+    PC_free(plaid->sh.pathcache);
+    RB_free(plaid->sh.readbuf);
+    VAR_free(plaid->sh.vars);
+    MEM_free(plaid);
+}
+
+// Documented in .h file
+void PLAID_export(Plaid plaid, const char *name, const char *value)
+{
+    assert(plaid != NULL && name != NULL && value != NULL);
+
+    VAR_set(plaid->sh.vars, name, value);
+    VAR_export(plaid->sh.vars, name);
+}
+
+// Documented in .h file
+const char *PLAID_get(Plaid plaid, const char *name)
+{
+    assert(plaid != NULL && name != NULL);
+    return VAR_get(plaid->sh.vars, name);
+}
+
+// Documented in .h file
+PlaidJob PLAID_parse(const char *text, char *errmsg, size_t errmsg_sz)
+{
+    assert(text != NULL);
+
+    PlaidJob job = (PlaidJob)MEM_calloc(MEM_PIPELINE, 1, sizeof(struct _plaid_job));
+    assert(job != NULL);
+
+    // each call has its own lexer, which needs no variables since
+    // every expansion is left for when the job runs
+    TokState state = TOK_state_new();
+    TOK_state_set_deferred(state, true);
+
+    int line_no = 0;
+    int cap = 0;
+    const char *p = text;
+    while (*p != '\0')
+    {
+        const char *nl = strchrnul(p, '\n');
+        char *line = MEM_strndup(MEM_TOKENS, p, nl - p);
+        assert(line != NULL);
+        p = *nl != '\0' ? nl + 1 : nl;
+        line_no++;
+
+        const char *c = line;
+        while (*c != '\0' && isspace(*c))
+            c++;
+
+        if (*c == '\0' && !TOK_state_incomplete(state))
+        {
+            MEM_free(line);
+            continue;
+        }
+
+        char msg[100];
+        CList tokens = TOK_tokenize_chunk(state, line, msg, sizeof(msg));
+        MEM_free(line);
+
+        if (tokens == NULL && TOK_state_incomplete(state))
+            continue;
+
+        Compound command = tokens != NULL ? CTL_parse(tokens, msg, sizeof(msg)) : NULL;
+        if (command == NULL)
+        {
+            snprintf(errmsg, errmsg_sz, "line %d: %s", line_no, msg);
+            goto error;
+        }
+
+        if (job->count == cap)
+        {
+            cap = cap > 0 ? cap * 2 : 4;
+            job->commands = MEM_realloc(MEM_PIPELINE, job->commands, cap * sizeof(Compound));
+            assert(job->commands != NULL);
+        }
+        job->commands[job->count++] = command;
+    }
+
+    // there are no more lines to come
+    if (TOK_state_incomplete(state))
+    {
+        snprintf(errmsg, errmsg_sz, "line %d: Unexpected end of input", line_no);
+        goto error;
+    }
+
+    TOK_state_free(state);
+    return job;
+
+error:
+    TOK_state_free(state);
+    PLAID_job_free(job);
+    return NULL;
+}
+
+// Documented in .h file
+void PLAID_job_free(PlaidJob job)
+{
+    if (job == NULL)
+        return;
+
+    for (int i = 0; i < job->count; i++)
+        CTL_free(job->commands[i]);
+
+    MEM_free(job->commands);
+    MEM_free(job);
+}
+
+// Documented in .h file
+int PLAID_run(Plaid plaid, PlaidJob job, int in_fd, int out_fd, int err_fd)
+{
+    assert(plaid != NULL && job != NULL);
+
+    shell_t *sh = &plaid->sh;
+    sh->in_fd = in_fd;
+    sh->out_fd = out_fd;
+    sh->err_fd = err_fd;
+    sh->exiting = false;
+    sh->status = 0;
+
+    for (int i = 0; i < job->count; i++)
+    {
+        if (!CTL_run(job->commands[i], sh->tok_state, sh->vars, EXEC_run_compound_pipeline, EXEC_define_function,
+                     sh, &sh->status) || sh->exiting)
+            break;
+    }
+
+    return sh->status;
+}
+
+/*
+ * Runs the job started on a shell, on its own thread
+ *
+ * Parameters:
+ *   arg        The shell
+ *
+ * Returns:
+ *   NULL
+ */
+static void *_PLAID_job_thread(void *arg)
+{
+    Plaid plaid = (Plaid)arg;
+
+    plaid->status = PLAID_run(plaid, plaid->job, plaid->fds[0], plaid->fds[1], plaid->fds[2]);
+    if (plaid->done != NULL)
+        plaid->done(plaid, plaid->status, plaid->cb_data);
+
+    return NULL;
+}
+
+// Documented in .h file
+bool PLAID_start(Plaid plaid, PlaidJob job, int in_fd, int out_fd, int err_fd, PLAID_done_callback done,
+                 void *cb_data)
+{
+    assert(plaid != NULL && job != NULL && !plaid->started);
+
+    plaid->job = job;
+    plaid->fds[0] = in_fd;
+    plaid->fds[1] = out_fd;
+    plaid->fds[2] = err_fd;
+    plaid->done = done;
+    plaid->cb_data = cb_data;
+
+    plaid->started = pthread_create(&plaid->thread, NULL, _PLAID_job_thread, plaid) == 0;
+    return plaid->started;
+}
+
+// Documented in .h file
+int PLAID_wait(Plaid plaid)
+{
+    assert(plaid != NULL);
+
+    if (!plaid->started)
+        return -1;
+
+    pthread_join(plaid->thread, NULL);
+    plaid->started = false;
+    return plaid->status;
+}
@@ -0,0 +1,158 @@
+/*
+ * libplaid.h
+ *
+ * The shell as a library, for programs that run command lines without
+ * starting /bin/sh for each. A command line is parsed once into a job,
+ * which any number of shells can run; each shell has its own variables,
+ * functions and caches, and runs its jobs on the fds it is given.
+ *
+ * Parsing needs no shell and may be done on many threads at once. A
+ * shell runs one job at a time, but shells on different threads run
+ * their jobs concurrently. Some state is still the process's: cd
+ * changes the working directory of every shell, and SIGPIPE has to be
+ * ignored, as a builtin stage writing to a closed pipe would otherwise
+ * kill the process. The fds given to a shell should be close-on-exec,
+ * so that the commands of other shells do not hold them open.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _LIBPLAID_H_
+#define _LIBPLAID_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// struct _plaid to be used in the .c as Plaid
+typedef struct _plaid *Plaid;
+
+// struct _plaid_job to be used in the .c as PlaidJob
+typedef struct _plaid_job *PlaidJob;
+
+/*
+ * Called on the job's thread when a job started with PLAID_start
+ * finishes.
+ *
+ * Parameters:
+ *   plaid      The shell that ran the job
+ *   status     The exit status of the job
+ *   cb_data    Caller data passed to PLAID_start
+ *
+ * Returns: None
+ */
+typedef void (*PLAID_done_callback)(Plaid plaid, int status, void *cb_data);
+
+/*
+ * Create a shell, with the variables of an environment
+ *
+ * Parameters:
+ *   envp       The environment, NAME=VALUE strings ending with NULL, or
+ *              NULL to start with no variables
+ *
+ * Returns: The new shell, which the caller must PLAID_free
+ */
+Plaid PLAID_new(char **envp);
+
+/*
+ * Free a shell, waiting first for a job it is running
+ *
+ * Parameters:
+ *   plaid      The shell, or NULL
+ *
+ * Returns: None
+ */
+void PLAID_free(Plaid plaid);
+
+/*
+ * Set a variable of a shell and export it to the commands it runs
+ *
+ * Parameters:
+ *   plaid      The shell
+ *   name       The name of the variable
+ *   value      The value
+ *
+ * Returns: None
+ */
+void PLAID_export(Plaid plaid, const char *name, const char *value);
+
+/*
+ * Get a variable of a shell, e.g. one a job set
+ *
+ * Parameters:
+ *   plaid      The shell
+ *   name       The name of the variable
+ *
+ * Returns: The value, which the shell owns until the variable changes,
+ *   or NULL if it is not set
+ */
+const char *PLAID_get(Plaid plaid, const char *name);
+
+/*
+ * Parse command lines into a job. The expansions of the commands are
+ * kept, to be done with a shell's variables each time the job runs.
+ * This can be called on several threads at once.
+ *
+ * Parameters:
+ *   text       The command lines, separated by newlines or ';'
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The job, which the caller must PLAID_job_free, or NULL with
+ *   an error message in errmsg
+ */
+PlaidJob PLAID_parse(const char *text, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Free a job. It must not be running.
+ *
+ * Parameters:
+ *   job        The job, or NULL
+ *
+ * Returns: None
+ */
+void PLAID_job_free(PlaidJob job);
+
+/*
+ * Run a job on a shell, and wait for it to finish. The job stops at
+ * exit or quit.
+ *
+ * Parameters:
+ *   plaid      The shell, which is not running another job
+ *   job        The job
+ *   in_fd      The standard input of the job
+ *   out_fd     The standard output of the job
+ *   err_fd     The standard error of the job
+ *
+ * Returns: The exit status of the last command the job ran
+ */
+int PLAID_run(Plaid plaid, PlaidJob job, int in_fd, int out_fd, int err_fd);
+
+/*
+ * Start a job on a shell, on a thread of its own. The job and the fds
+ * must stay open until it has finished.
+ *
+ * Parameters:
+ *   plaid      The shell, which is not running another job
+ *   job        The job
+ *   in_fd      The standard input of the job
+ *   out_fd     The standard output of the job
+ *   err_fd     The standard error of the job
+ *   done       The function to call when the job finishes, or NULL
+ *   cb_data    Caller data to pass to done
+ *
+ * Returns: true if the job was started, false if its thread could not
+ *   be created
+ */
+bool PLAID_start(Plaid plaid, PlaidJob job, int in_fd, int out_fd, int err_fd, PLAID_done_callback done,
+                 void *cb_data);
+
+/*
+ * Wait for the job started on a shell with PLAID_start to finish
+ *
+ * Parameters:
+ *   plaid      The shell
+ *
+ * Returns: The exit status of the job, or -1 if none was started
+ */
+int PLAID_wait(Plaid plaid);
+
+#endif /* _LIBPLAID_H_ */
@@ -0,0 +1,284 @@
+/**
+ * libplaid_test.c
+ *
+ * This file contains the test cases for libplaid.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "libplaid.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+// the jobs run on each thread of test_threads
+#define THREAD_JOBS 20
+
+/*
+ * Returns true if what was written to the memory file fd is expected,
+ * and empties it for the next job
+ */
+static bool output_is(int fd, const char *expected)
+{
+    char buf[256];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+
+    if (n < 0 || ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+        return false;
+
+    buf[n] = '\0';
+    return strcmp(buf, expected) == 0;
+}
+
+/*
+ * Returns the status of a job run with PLAID_run, or -2 if it does not parse
+ */
+static int run(Plaid plaid, const char *text, int in_fd, int out_fd, int err_fd)
+{
+    char errmsg[100];
+    PlaidJob job = PLAID_parse(text, errmsg, sizeof(errmsg));
+
+    if (job == NULL)
+        return -2;
+
+    int status = PLAID_run(plaid, job, in_fd, out_fd, err_fd);
+    PLAID_job_free(job);
+    return status;
+}
+
+/*
+ * Tests running jobs on the fds given, with the state each shell keeps
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_run()
+{
+    char *envp[] = {"PATH=/usr/bin:/bin", "X=one", NULL};
+    char errmsg[100];
+    int in[2] = {-1, -1};
+    int out = memfd_create("out", MFD_CLOEXEC);
+    int err = memfd_create("err", MFD_CLOEXEC);
+    Plaid a = PLAID_new(envp);
+    Plaid b = PLAID_new(envp);
+    PlaidJob job = PLAID_parse("echo $X two | cat\n"
+                               "false",
+                               errmsg, sizeof(errmsg));
+
+    test_assert(job != NULL);
+
+    // a job is expanded with the variables of the shell that runs it
+    PLAID_export(b, "X", "uno");
+    test_assert(PLAID_run(a, job, STDIN_FILENO, out, err) == 1);
+    test_assert(output_is(out, "one two\n"));
+    test_assert(PLAID_run(b, job, STDIN_FILENO, out, err) == 1);
+    test_assert(output_is(out, "uno two\n"));
+    test_assert(strcmp(PLAID_get(b, "?"), "1") == 0);
+
+    // the variables and functions a job defines are kept for the next
+    test_assert(run(a, "export Y=why\n"
+                       "f() { echo f $1 $Y; }",
+                    STDIN_FILENO, out, err) == 0);
+    test_assert(run(a, "f 1; f 2 | tr a-z A-Z", STDIN_FILENO, out, err) == 0);
+    test_assert(output_is(out, "f 1 why\nF 2 WHY\n"));
+    test_assert(PLAID_get(b, "Y") == NULL);
+
+    // the job reads its own input, and stops at exit
+    test_assert(pipe2(in, O_CLOEXEC) == 0);
+    test_assert(write(in[1], "x\ny\n", 4) == 4);
+    close(in[1]);
+    in[1] = -1;
+    test_assert(run(a, "while read L; do echo got $L; done\n"
+                       "exit\n"
+                       "echo after",
+                    in[0], out, err) == 0);
+    test_assert(output_is(out, "got x\ngot y\n"));
+
+    // errors go to the job's standard error
+    test_assert(run(a, "cat /no/such/file", STDIN_FILENO, out, err) == 1);
+    test_assert(output_is(out, ""));
+    test_assert(!output_is(err, ""));
+    test_assert(run(a, "cd /no/such/dir", STDIN_FILENO, out, err) == 1);
+    test_assert(output_is(err, "/no/such/dir: No such file or directory\n"));
+    test_assert(run(a, "[ 1 -lt x ] | cat", STDIN_FILENO, out, err) == 0);
+    test_assert(output_is(err, "test: integer expression expected\n"));
+    test_assert(run(a, "echo $(( 6 * 7 )) $(echo sub)", STDIN_FILENO, out, err) == 0);
+    test_assert(output_is(out, "42 sub\n"));
+
+    PLAID_job_free(job);
+    PLAID_free(a);
+    PLAID_free(b);
+    close(in[0]);
+    close(out);
+    close(err);
+    return 1;
+
+test_error:
+    PLAID_job_free(job);
+    PLAID_free(a);
+    PLAID_free(b);
+    close(in[0]);
+    close(in[1]);
+    close(out);
+    close(err);
+    return 0;
+}
+
+/*
+ * Tests the errors found when parsing
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parse_errors()
+{
+    char errmsg[100];
+
+    test_assert(PLAID_parse("echo \"open", errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strcmp(errmsg, "line 1: Unexpected end of input") == 0);
+    test_assert(PLAID_parse("true\nif true; then\necho yes", errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strcmp(errmsg, "line 3: Unexpected end of input") == 0);
+    test_assert(PLAID_parse("echo a\necho b |", errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strncmp(errmsg, "line 2: ", 8) == 0);
+
+    PlaidJob job = PLAID_parse("\n  \n", errmsg, sizeof(errmsg));
+    test_assert(job != NULL);
+    PLAID_job_free(job);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+// the work of one thread of test_threads
+struct worker
+{
+    PlaidJob shared; // the job all the threads run
+    int id;
+    bool ok;
+};
+
+/*
+ * Parses and runs jobs on a shell of the thread's own, on a thread
+ * started by PLAID_start
+ */
+static void *worker_thread(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    char errmsg[100], id[16], expected[64], loop_out[64];
+    int out = memfd_create("out", MFD_CLOEXEC);
+    Plaid plaid = PLAID_new(NULL);
+
+    snprintf(id, sizeof(id), "%d", w->id);
+    snprintf(loop_out, sizeof(loop_out), "%d a\n%d b\n", w->id, w->id);
+    PLAID_export(plaid, "PATH", "/usr/bin:/bin");
+    PLAID_export(plaid, "ID", id);
+    w->ok = out >= 0;
+
+    for (int i = 0; i < THREAD_JOBS && w->ok; i++)
+    {
+        PlaidJob job = PLAID_parse("for N in a b; do echo $ID $N | cat; done", errmsg, sizeof(errmsg));
+
+        w->ok = job != NULL && PLAID_start(plaid, job, STDIN_FILENO, out, STDERR_FILENO, NULL, NULL) &&
+                PLAID_wait(plaid) == 0 && output_is(out, loop_out);
+
+        snprintf(expected, sizeof(expected), "thread %s\n", id);
+        w->ok = w->ok && PLAID_run(plaid, w->shared, STDIN_FILENO, out, STDERR_FILENO) == 0 &&
+                output_is(out, expected);
+
+        PLAID_job_free(job);
+    }
+
+    PLAID_free(plaid);
+    close(out);
+    return NULL;
+}
+
+/*
+ * Called when a job started with PLAID_start finishes
+ */
+static void job_done(Plaid plaid, int status, void *cb_data)
+{
+    *(int *)cb_data = status;
+}
+
+/*
+ * Tests parsing and running jobs on many threads at once
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_threads()
+{
+    char errmsg[100];
+    pthread_t threads[8];
+    struct worker workers[8];
+    int done_status = -1;
+    Plaid plaid = PLAID_new(NULL);
+    PlaidJob shared = PLAID_parse("echo thread $ID", errmsg, sizeof(errmsg));
+
+    test_assert(shared != NULL);
+
+    for (int i = 0; i < 8; i++)
+    {
+        workers[i] = (struct worker){shared, i, false};
+        test_assert(pthread_create(&threads[i], NULL, worker_thread, &workers[i]) == 0);
+    }
+
+    for (int i = 0; i < 8; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < 8; i++)
+        test_assert(workers[i].ok);
+
+    // the done callback has the status the wait returns
+    PlaidJob job = PLAID_parse("false", errmsg, sizeof(errmsg));
+    test_assert(PLAID_start(plaid, job, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, job_done, &done_status));
+    test_assert(PLAID_wait(plaid) == 1);
+    test_assert(done_status == 1);
+    test_assert(PLAID_wait(plaid) == -1);
+    PLAID_job_free(job);
+
+    PLAID_job_free(shared);
+    PLAID_free(plaid);
+    return 1;
+
+test_error:
+    PLAID_job_free(shared);
+    PLAID_free(plaid);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    // a builtin stage writing to a closed pipe must not end the process
+    signal(SIGPIPE, SIG_IGN);
+
+    num_tests++;
+    passed += test_run();
+    num_tests++;
+    passed += test_parse_errors();
+    num_tests++;
+    passed += test_threads();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,669 @@
+/*
+ * mem.c
+ *
+ * Tagged allocations, counted per tag, and the system, arena and pool
+ * allocators they come from. Each block is preceded by a header naming
+ * its tag, its size and the allocator that owns it.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "mem.h"
+
+// marks the header of a block from MEM_alloc
+#define MEM_MAGIC 0x4d454d31
+
+// how many allocations, or bytes either way, a thread counts before adding them to the totals
+#define MEM_FLUSH_OPS 256
+#define MEM_FLUSH_BYTES 16384
+
+// the size of the chunks an arena hands its blocks out of
+#define MEM_ARENA_CHUNK 65536
+
+// a pool's smallest block, its number of sizes, and the slabs it cuts them from
+#define MEM_POOL_MIN 32
+#define MEM_POOL_CLASSES 7
+#define MEM_POOL_SLAB 65536
+
+struct _mem_allocator
+{
+    const char *name;
+    mem_alloc_fn alloc;
+    mem_free_fn free;
+    void *data;
+    void (*destroy)(void *data); // frees data, or NULL
+    pthread_mutex_t *lock;       // held while alloc or free runs, or NULL
+    MemAllocator next_locked;    // the next allocator with a lock
+};
+
+// what precedes each block, padded to keep the block aligned for any type
+union mem_header
+{
+    struct
+    {
+        MemAllocator owner;
+        size_t size; // as asked for, without the header
+        uint32_t tag;
+        uint32_t magic;
+    } h;
+    max_align_t align;
+};
+
+#define MEM_HEADER sizeof(union mem_header)
+
+static const char *tag_names[MEM_NUM_TAGS] = {"tokens", "glob", "pipeline", "history", "caches", "vars", "io"};
+
+// the allocator of each tag, NULL for the system's
+static MemAllocator allocators[MEM_NUM_TAGS];
+
+// the totals of each tag, from the counts the threads have flushed
+static struct mem_stats stats[MEM_NUM_TAGS];
+
+// what a thread has counted for a tag and not yet added to the totals
+struct mem_pending
+{
+    long bytes;
+    long blocks;
+    unsigned long allocs;
+    int ops;
+};
+
+static __thread struct mem_pending pending[MEM_NUM_TAGS];
+static __thread bool registered;
+static pthread_key_t flush_key;
+static pthread_once_t flush_once = PTHREAD_ONCE_INIT;
+
+// the allocators with a lock, all of which are held across fork() so
+// that a child never inherits one locked by another thread mid-update
+static MemAllocator locked;
+static pthread_mutex_t locked_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The system allocator's functions
+ */
+static void *_MEM_system_alloc(void *data, size_t size)
+{
+    return malloc(size);
+}
+
+static void _MEM_system_free(void *data, void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+static struct _mem_allocator system_allocator = {"system", _MEM_system_alloc, _MEM_system_free, NULL, NULL, NULL, NULL};
+
+/*
+ * Round a size up to a multiple of the alignment of any type
+ */
+static size_t _MEM_align(size_t size)
+{
+    return (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+}
+
+/*
+ * Raise the high-water mark of a tag to the bytes live, unless another
+ * thread raised it higher
+ */
+static void _MEM_raise_peak(struct mem_stats *st, long bytes)
+{
+    size_t peak = __atomic_load_n(&st->peak_bytes, __ATOMIC_RELAXED);
+
+    while (bytes > (long)peak &&
+           !__atomic_compare_exchange_n(&st->peak_bytes, &peak, bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Add what a thread has counted for a tag to the totals
+ */
+static void _MEM_flush(MemTag tag)
+{
+    struct mem_pending *p = &pending[tag];
+    struct mem_stats *st = &stats[tag];
+
+    // a total can dip below zero while a thread that freed blocks
+    // another thread allocated is counted first, so it is compared signed
+    long bytes = (long)__atomic_add_fetch(&st->bytes, (size_t)p->bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->blocks, (size_t)p->blocks, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->allocs, p->allocs, __ATOMIC_RELAXED);
+
+    _MEM_raise_peak(st, bytes);
+    *p = (struct mem_pending){0, 0, 0, 0};
+}
+
+/*
+ * Add everything a thread has counted to the totals, when it exits
+ */
+static void _MEM_flush_all(void *unused)
+{
+    for (int i = 0; i < MEM_NUM_TAGS; i++)
+        _MEM_flush(i);
+}
+
+static void _MEM_make_key()
+{
+    pthread_key_create(&flush_key, _MEM_flush_all);
+}
+
+/*
+ * Count a block allocated or freed for a tag, in the thread's counts
+ * first. They are added to the totals every so often, since atomic
+ * adds to counters shared by all threads on each allocation would cost
+ * about as much as the allocation.
+ */
+static void _MEM_count(MemTag tag, long bytes, long blocks)
+{
+    struct mem_pending *p = &pending[tag];
+
+    if (!registered)
+    {
+        // the key's destructor flushes the counts when the thread exits
+        pthread_once(&flush_once, _MEM_make_key);
+        pthread_setspecific(flush_key, pending);
+        registered = true;
+    }
+
+    p->bytes += bytes;
+    p->blocks += blocks;
+    p->allocs += blocks > 0;
+
+    if (++p->ops >= MEM_FLUSH_OPS || p->bytes >= MEM_FLUSH_BYTES || p->bytes <= -MEM_FLUSH_BYTES)
+        _MEM_flush(tag);
+    else if (bytes > 0)
+    {
+        // the totals with this thread's counts, which leaves out only
+        // what other threads have not yet flushed
+        long live = (long)__atomic_load_n(&stats[tag].bytes, __ATOMIC_RELAXED) + p->bytes;
+        if (live > (long)__atomic_load_n(&stats[tag].peak_bytes, __ATOMIC_RELAXED))
+            _MEM_raise_peak(&stats[tag], live);
+    }
+}
+
+/*
+ * Get the header of a block, checking that it came from MEM_alloc
+ */
+static union mem_header *_MEM_header(void *ptr)
+{
+    union mem_header *hdr = (union mem_header *)((char *)ptr - MEM_HEADER);
+    assert(hdr->h.magic == MEM_MAGIC);
+    return hdr;
+}
+
+// Documented in .h file
+void *MEM_alloc(MemTag tag, size_t size)
+{
+    assert(tag >= 0 && tag < MEM_NUM_TAGS);
+
+    // the system's allocator is called directly, as most blocks come from it
+    MemAllocator allocator = MEM_get_allocator(tag);
+    union mem_header *hdr = allocator == &system_allocator ? malloc(MEM_HEADER + size)
+                                                           : allocator->alloc(allocator->data, MEM_HEADER + size);
+    assert(hdr != NULL);
+
+    hdr->h.owner = allocator;
+    hdr->h.size = size;
+    hdr->h.tag = tag;
+    hdr->h.magic = MEM_MAGIC;
+    _MEM_count(tag, size, 1);
+
+    return hdr + 1;
+}
+
+// Documented in .h file
+void *MEM_calloc(MemTag tag, size_t n, size_t size)
+{
+    assert(size == 0 || n <= SIZE_MAX / size);
+
+    void *ptr = MEM_alloc(tag, n * size);
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+// Documented in .h file
+void *MEM_realloc(MemTag tag, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return MEM_alloc(tag, size);
+
+    union mem_header *hdr = _MEM_header(ptr);
+    size_t old_size = hdr->h.size;
+
+    // a malloc'd block that stays malloc'd can grow in place
+    if (hdr->h.owner == &system_allocator && MEM_get_allocator(tag) == &system_allocator)
+    {
+        _MEM_count(hdr->h.tag, -(long)old_size, -1);
+
+        hdr = realloc(hdr, MEM_HEADER + size);
+        assert(hdr != NULL);
+
+        hdr->h.size = size;
+        hdr->h.tag = tag;
+        _MEM_count(tag, size, 1);
+        return hdr + 1;
+    }
+
+    void *new = MEM_alloc(tag, size);
+    memcpy(new, ptr, old_size < size ? old_size : size);
+    MEM_free(ptr);
+    return new;
+}
+
+// Documented in .h file
+char *MEM_strdup(MemTag tag, const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = MEM_alloc(tag, len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+// Documented in .h file
+char *MEM_strndup(MemTag tag, const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *copy = MEM_alloc(tag, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// Documented in .h file
+void MEM_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    union mem_header *hdr = _MEM_header(ptr);
+    MemAllocator owner = hdr->h.owner;
+    size_t size = hdr->h.size;
+
+    _MEM_count(hdr->h.tag, -(long)size, -1);
+    hdr->h.magic = 0;
+    if (owner == &system_allocator)
+        free(hdr);
+    else
+        owner->free(owner->data, hdr, MEM_HEADER + size);
+}
+
+// Documented in .h file
+void MEM_stats(MemTag tag, struct mem_stats *st)
+{
+    assert(tag >= 0 && tag < MEM_NUM_TAGS && st != NULL);
+
+    // the calling thread's counts are up to date; other running threads
+    // may have a few allocations not yet counted
+    _MEM_flush(tag);
+
+    long bytes = (long)__atomic_load_n(&stats[tag].bytes, __ATOMIC_RELAXED);
+    long blocks = (long)__atomic_load_n(&stats[tag].blocks, __ATOMIC_RELAXED);
+    st->bytes = bytes > 0 ? bytes : 0;
+    st->blocks = blocks > 0 ? blocks : 0;
+    st->peak_bytes = __atomic_load_n(&stats[tag].peak_bytes, __ATOMIC_RELAXED);
+    st->allocs = __atomic_load_n(&stats[tag].allocs, __ATOMIC_RELAXED);
+}
+
+// Documented in .h file
+const char *MEM_tag_name(MemTag tag)
+{
+    assert(tag >= 0 && tag < MEM_NUM_TAGS);
+    return tag_names[tag];
+}
+
+// Documented in .h file
+bool MEM_find_tag(const char *name, MemTag *tag)
+{
+    for (int i = 0; i < MEM_NUM_TAGS; i++)
+    {
+        if (strcmp(tag_names[i], name) == 0)
+        {
+            *tag = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Documented in .h file
+MemAllocator MEM_set_allocator(MemTag tag, MemAllocator allocator)
+{
+    assert(tag >= 0 && tag < MEM_NUM_TAGS);
+
+    MemAllocator old = __atomic_exchange_n(&allocators[tag], allocator, __ATOMIC_ACQ_REL);
+    return old != NULL ? old : &system_allocator;
+}
+
+// Documented in .h file
+MemAllocator MEM_get_allocator(MemTag tag)
+{
+    assert(tag >= 0 && tag < MEM_NUM_TAGS);
+
+    MemAllocator allocator = __atomic_load_n(&allocators[tag], __ATOMIC_ACQUIRE);
+    return allocator != NULL ? allocator : &system_allocator;
+}
+
+// Documented in .h file
+MemAllocator MEM_system()
+{
+    return &system_allocator;
+}
+
+// Documented in .h file
+MemAllocator MEM_allocator_new(const char *name, mem_alloc_fn alloc, mem_free_fn free, void *data)
+{
+    assert(name != NULL && alloc != NULL && free != NULL);
+
+    MemAllocator allocator = (MemAllocator)malloc(sizeof(struct _mem_allocator));
+    assert(allocator != NULL);
+
+    *allocator = (struct _mem_allocator){name, alloc, free, data, NULL, NULL, NULL};
+    return allocator;
+}
+
+// Documented in .h file
+const char *MEM_allocator_name(MemAllocator allocator)
+{
+    assert(allocator != NULL);
+    return allocator->name;
+}
+
+// Documented in .h file
+void MEM_allocator_free(MemAllocator allocator)
+{
+    if (allocator == NULL || allocator == &system_allocator)
+        return;
+
+    if (allocator->lock != NULL)
+    {
+        pthread_mutex_lock(&locked_lock);
+        MemAllocator *link = &locked;
+        while (*link != allocator)
+            link = &(*link)->next_locked;
+        *link = allocator->next_locked;
+        pthread_mutex_unlock(&locked_lock);
+    }
+
+    if (allocator->destroy != NULL)
+        allocator->destroy(allocator->data);
+    free(allocator);
+}
+
+/*
+ * Take the locks of all the allocators before fork(), and let them go
+ * in the parent and the child after it
+ */
+static void _MEM_lock_all()
+{
+    pthread_mutex_lock(&locked_lock);
+    for (MemAllocator a = locked; a != NULL; a = a->next_locked)
+        pthread_mutex_lock(a->lock);
+}
+
+static void _MEM_unlock_all()
+{
+    for (MemAllocator a = locked; a != NULL; a = a->next_locked)
+        pthread_mutex_unlock(a->lock);
+    pthread_mutex_unlock(&locked_lock);
+}
+
+static void _MEM_register_atfork()
+{
+    pthread_atfork(_MEM_lock_all, _MEM_unlock_all, _MEM_unlock_all);
+}
+
+/*
+ * Make an allocator whose functions take a lock, which is held across
+ * fork()
+ */
+static MemAllocator _MEM_locked_new(const char *name, mem_alloc_fn alloc, mem_free_fn free, void *data,
+                                    void (*destroy)(void *data), pthread_mutex_t *lock)
+{
+    pthread_once(&atfork_once, _MEM_register_atfork);
+
+    MemAllocator allocator = MEM_allocator_new(name, alloc, free, data);
+    allocator->destroy = destroy;
+    allocator->lock = lock;
+
+    pthread_mutex_lock(&locked_lock);
+    allocator->next_locked = locked;
+    locked = allocator;
+    pthread_mutex_unlock(&locked_lock);
+
+    return allocator;
+}
+
+// a chunk of an arena, followed by the blocks cut from it
+struct mem_chunk
+{
+    struct mem_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+#define MEM_CHUNK_HEADER _MEM_align(sizeof(struct mem_chunk))
+
+struct mem_arena
+{
+    pthread_mutex_t lock;
+    struct mem_chunk *chunks; // the chunk blocks are cut from, then the older ones
+    size_t live;              // the blocks not yet freed
+};
+
+/*
+ * Cut a block from the arena's newest chunk, or from a new chunk if it
+ * does not fit
+ */
+static void *_MEM_arena_alloc(void *data, size_t size)
+{
+    struct mem_arena *arena = data;
+    size = _MEM_align(size);
+
+    pthread_mutex_lock(&arena->lock);
+
+    struct mem_chunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = size > MEM_ARENA_CHUNK ? size : MEM_ARENA_CHUNK;
+        chunk = malloc(MEM_CHUNK_HEADER + chunk_size);
+        if (chunk == NULL)
+        {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+
+        chunk->next = arena->chunks;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+
+    void *ptr = (char *)chunk + MEM_CHUNK_HEADER + chunk->used;
+    chunk->used += size;
+    arena->live++;
+
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+/*
+ * Free the chunks of an arena from the one given on
+ */
+static void _MEM_free_chunks(struct mem_chunk *chunk)
+{
+    while (chunk != NULL)
+    {
+        struct mem_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+/*
+ * Note a block freed; when it was the last, keep the newest chunk only
+ * and start cutting from its beginning again
+ */
+static void _MEM_arena_free(void *data, void *ptr, size_t size)
+{
+    struct mem_arena *arena = data;
+
+    pthread_mutex_lock(&arena->lock);
+
+    assert(arena->live > 0);
+    if (--arena->live == 0)
+    {
+        _MEM_free_chunks(arena->chunks->next);
+        arena->chunks->next = NULL;
+        arena->chunks->used = 0;
+    }
+
+    pthread_mutex_unlock(&arena->lock);
+}
+
+static void _MEM_arena_destroy(void *data)
+{
+    struct mem_arena *arena = data;
+
+    assert(arena->live == 0);
+    _MEM_free_chunks(arena->chunks);
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+// Documented in .h file
+MemAllocator MEM_arena_new()
+{
+    struct mem_arena *arena = calloc(1, sizeof(struct mem_arena));
+    assert(arena != NULL);
+    pthread_mutex_init(&arena->lock, NULL);
+
+    return _MEM_locked_new("arena", _MEM_arena_alloc, _MEM_arena_free, arena, _MEM_arena_destroy, &arena->lock);
+}
+
+// a slab of a pool; the blocks cut from it follow
+struct mem_slab
+{
+    struct mem_slab *next;
+};
+
+#define MEM_SLAB_HEADER _MEM_align(sizeof(struct mem_slab))
+
+struct mem_pool
+{
+    pthread_mutex_t lock;
+    void *free_lists[MEM_POOL_CLASSES]; // each free block starts with the next
+    struct mem_slab *slabs;
+};
+
+/*
+ * Find the size class of a block
+ *
+ * Returns: The class, or -1 if the block is too large for the pool
+ */
+static int _MEM_pool_class(size_t size)
+{
+    size_t class_size = MEM_POOL_MIN;
+
+    for (int i = 0; i < MEM_POOL_CLASSES; i++, class_size *= 2)
+    {
+        if (size <= class_size)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * Take a block from the free list of its size, cutting a new slab into
+ * blocks of that size when the list is empty
+ */
+static void *_MEM_pool_alloc(void *data, size_t size)
+{
+    struct mem_pool *pool = data;
+
+    int class = _MEM_pool_class(size);
+    if (class < 0)
+        return malloc(size);
+
+    size_t class_size = (size_t)MEM_POOL_MIN << class;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->free_lists[class] == NULL)
+    {
+        struct mem_slab *slab = malloc(MEM_SLAB_HEADER + MEM_POOL_SLAB);
+        if (slab == NULL)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        char *block = (char *)slab + MEM_SLAB_HEADER;
+        for (size_t off = 0; off + class_size <= MEM_POOL_SLAB; off += class_size)
+        {
+            *(void **)(block + off) = pool->free_lists[class];
+            pool->free_lists[class] = block + off;
+        }
+    }
+
+    void *ptr = pool->free_lists[class];
+    pool->free_lists[class] = *(void **)ptr;
+
+    pthread_mutex_unlock(&pool->lock);
+    return ptr;
+}
+
+/*
+ * Put a block back on the free list of its size
+ */
+static void _MEM_pool_free(void *data, void *ptr, size_t size)
+{
+    struct mem_pool *pool = data;
+
+    int class = _MEM_pool_class(size);
+    if (class < 0)
+    {
+        free(ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    *(void **)ptr = pool->free_lists[class];
+    pool->free_lists[class] = ptr;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void _MEM_pool_destroy(void *data)
+{
+    struct mem_pool *pool = data;
+
+    while (pool->slabs != NULL)
+    {
+        struct mem_slab *next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+// Documented in .h file
+MemAllocator MEM_pool_new()
+{
+    struct mem_pool *pool = calloc(1, sizeof(struct mem_pool));
+    assert(pool != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return _MEM_locked_new("pool", _MEM_pool_alloc, _MEM_pool_free, pool, _MEM_pool_destroy, &pool->lock);
+}
@@ -0,0 +1,255 @@
+/*
+ * mem.h
+ *
+ * Allocations tagged by the subsystem that makes them. Each tag keeps
+ * the bytes and blocks it has live, its high-water mark and how many
+ * allocations it has made, and gets its memory from an allocator that
+ * can be changed while the shell runs: the system's malloc(), an arena
+ * or a pool. A block remembers its tag and the allocator it came from,
+ * so it is freed with MEM_free() whatever the tag uses by then.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// the subsystems memory is accounted to
+typedef enum
+{
+    MEM_TOKENS,   // command lines, the tokenizer and the token lists
+    MEM_GLOB,     // the words globs expand to
+    MEM_PIPELINE, // parsed pipelines and their here-documents
+    MEM_HISTORY,  // the history file and its index
+    MEM_CACHES,   // the path, parse and command caches, and their snapshots
+    MEM_VARS,     // variables, positional parameters, functions and libplaid's shells
+    MEM_IO,       // read buffers, and the scratch space of running pipelines
+    MEM_NUM_TAGS
+} MemTag;
+
+// the memory used by a tag
+struct mem_stats
+{
+    size_t bytes;         // the bytes live, as asked for
+    size_t blocks;        // the blocks live
+    size_t peak_bytes;    // the most bytes live at once
+    unsigned long allocs; // the allocations made, ever
+};
+
+// struct _mem_allocator to be used in the .c as MemAllocator
+typedef struct _mem_allocator *MemAllocator;
+
+/*
+ * Gets memory for an allocator made with MEM_allocator_new
+ *
+ * Returns: The memory, aligned for any type, or NULL
+ */
+typedef void *(*mem_alloc_fn)(void *data, size_t size);
+
+/*
+ * Gives back memory that an allocator made with MEM_allocator_new got
+ * from its mem_alloc_fn, with the size it was asked for
+ */
+typedef void (*mem_free_fn)(void *data, void *ptr, size_t size);
+
+/*
+ * Allocate memory for a tag
+ *
+ * Parameters:
+ *   tag      The subsystem the memory is for
+ *   size     The bytes needed
+ *
+ * Returns: The memory, to be freed with MEM_free. Asserts that there
+ *   was memory to be had.
+ */
+void *MEM_alloc(MemTag tag, size_t size);
+
+/*
+ * Allocate zeroed memory for a tag
+ *
+ * Parameters:
+ *   tag      The subsystem the memory is for
+ *   n        The number of elements
+ *   size     The size of each element
+ *
+ * Returns: The memory, to be freed with MEM_free
+ */
+void *MEM_calloc(MemTag tag, size_t n, size_t size);
+
+/*
+ * Change the size of memory from MEM_alloc, keeping what fits of it
+ *
+ * Parameters:
+ *   tag      The subsystem the memory is for from now on
+ *   ptr      The memory, or NULL to allocate new memory
+ *   size     The bytes needed
+ *
+ * Returns: The memory, which may have moved
+ */
+void *MEM_realloc(MemTag tag, void *ptr, size_t size);
+
+/*
+ * Copy a string into memory for a tag
+ *
+ * Parameters:
+ *   tag      The subsystem the copy is for
+ *   s        The string
+ *
+ * Returns: The copy, to be freed with MEM_free
+ */
+char *MEM_strdup(MemTag tag, const char *s);
+
+/*
+ * Copy at most n bytes of a string into memory for a tag, followed by
+ * a NUL
+ *
+ * Parameters:
+ *   tag      The subsystem the copy is for
+ *   s        The string
+ *   n        The most bytes copied
+ *
+ * Returns: The copy, to be freed with MEM_free
+ */
+char *MEM_strndup(MemTag tag, const char *s, size_t n);
+
+/*
+ * Free memory from MEM_alloc and the others, with the allocator it came
+ * from. Never free() it.
+ *
+ * Parameters:
+ *   ptr      The memory, or NULL
+ *
+ * Returns: None
+ */
+void MEM_free(void *ptr);
+
+/*
+ * Get the memory used by a tag. The calling thread's allocations are
+ * all counted; other threads that are still running count theirs in
+ * batches, so a few of theirs may be missing.
+ *
+ * Parameters:
+ *   tag      The tag
+ *   st       Return space for its numbers
+ *
+ * Returns: None
+ */
+void MEM_stats(MemTag tag, struct mem_stats *st);
+
+/*
+ * Get the name of a tag, as memstats prints it
+ *
+ * Parameters:
+ *   tag      The tag
+ *
+ * Returns: The name, e.g. "tokens"
+ */
+const char *MEM_tag_name(MemTag tag);
+
+/*
+ * Find a tag by its name
+ *
+ * Parameters:
+ *   name     The name, e.g. "glob"
+ *   tag      Return space for the tag
+ *
+ * Returns: true if there is a tag of that name
+ */
+bool MEM_find_tag(const char *name, MemTag *tag);
+
+/*
+ * Change the allocator a tag gets its memory from. Blocks allocated
+ * before are still freed by the allocator they came from.
+ *
+ * Parameters:
+ *   tag        The tag
+ *   allocator  The allocator, or NULL for the system's
+ *
+ * Returns: The allocator the tag used before
+ */
+MemAllocator MEM_set_allocator(MemTag tag, MemAllocator allocator);
+
+/*
+ * Get the allocator a tag gets its memory from
+ *
+ * Parameters:
+ *   tag      The tag
+ *
+ * Returns: The allocator
+ */
+MemAllocator MEM_get_allocator(MemTag tag);
+
+/*
+ * Get the allocator that calls malloc() and free(), which every tag
+ * uses to begin with. It is never freed.
+ *
+ * Parameters: None
+ *
+ * Returns: The allocator
+ */
+MemAllocator MEM_system();
+
+/*
+ * Create an arena: memory is handed out from large chunks, freeing a
+ * block frees nothing, and once every block is freed the arena keeps
+ * one chunk and starts again at its beginning. It suits memory that
+ * lives for one command line. Its lock is held across fork(), so a
+ * child can use it even if another thread was using it.
+ *
+ * Parameters: None
+ *
+ * Returns: The new allocator, safe to use from several threads
+ */
+MemAllocator MEM_arena_new();
+
+/*
+ * Create a pool: blocks are rounded up to a power of two, cut from
+ * slabs, and kept on a list for their size when freed, to be handed out
+ * again. Blocks over 2 KB are malloc'd. It suits many small blocks of
+ * a few sizes that come and go. Its lock is held across fork(), as an
+ * arena's is.
+ *
+ * Parameters: None
+ *
+ * Returns: The new allocator, safe to use from several threads
+ */
+MemAllocator MEM_pool_new();
+
+/*
+ * Create an allocator that gets its memory from functions of the
+ * caller's
+ *
+ * Parameters:
+ *   name     Its name, as memstats prints it; not copied
+ *   alloc    Gets memory
+ *   free     Gives it back
+ *   data     Passed to alloc and free
+ *
+ * Returns: The new allocator
+ */
+MemAllocator MEM_allocator_new(const char *name, mem_alloc_fn alloc, mem_free_fn free, void *data);
+
+/*
+ * Get the name of an allocator
+ *
+ * Parameters:
+ *   allocator  The allocator
+ *
+ * Returns: "system", "arena", "pool", or the name it was created with
+ */
+const char *MEM_allocator_name(MemAllocator allocator);
+
+/*
+ * Destroy an allocator and the memory it holds. No tag may use it and
+ * none of its blocks may be live. The system's allocator is not freed.
+ *
+ * Parameters:
+ *   allocator  The allocator, or NULL
+ *
+ * Returns: None
+ */
+void MEM_allocator_free(MemAllocator allocator);
+
+#endif /* _MEM_H_ */
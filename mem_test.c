@@ -0,0 +1,404 @@
+/**
+ * mem_test.c
+ *
+ * This file contains the test cases for mem.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mem.h"
+#include "tokenize.h"
+#include "parser.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+#define NUM_THREADS 4
+#define THREAD_ALLOCS 20000
+
+/*
+ * Returns true if the memory is aligned for any type
+ */
+static bool aligned(void *ptr)
+{
+    return (uintptr_t)ptr % _Alignof(max_align_t) == 0;
+}
+
+/*
+ * Tests the bytes, blocks, high-water mark and allocations of a tag as
+ * memory is allocated, resized and freed
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_accounting()
+{
+    struct mem_stats before, st;
+    MEM_stats(MEM_HISTORY, &before);
+
+    char *a = MEM_alloc(MEM_HISTORY, 100);
+    char *b = MEM_strdup(MEM_HISTORY, "hello");
+    int *c = MEM_calloc(MEM_HISTORY, 10, sizeof(int));
+
+    MEM_stats(MEM_HISTORY, &st);
+    test_assert(st.bytes == before.bytes + 100 + 6 + 10 * sizeof(int));
+    test_assert(st.blocks == before.blocks + 3);
+    test_assert(st.allocs == before.allocs + 3);
+    test_assert(aligned(a) && aligned(b) && aligned(c));
+    test_assert(strcmp(b, "hello") == 0 && c[0] == 0 && c[9] == 0);
+
+    // a resized block keeps its contents and is counted at its new size
+    memset(a, 'x', 100);
+    a = MEM_realloc(MEM_HISTORY, a, 1000);
+    test_assert(a[0] == 'x' && a[99] == 'x');
+    MEM_stats(MEM_HISTORY, &st);
+    test_assert(st.bytes == before.bytes + 1000 + 6 + 10 * sizeof(int));
+    test_assert(st.blocks == before.blocks + 3);
+
+    size_t peak = st.bytes;
+    MEM_free(a);
+    MEM_free(c);
+
+    // a block moved to another tag is counted there
+    struct mem_stats glob_before, glob;
+    MEM_stats(MEM_GLOB, &glob_before);
+    b = MEM_realloc(MEM_GLOB, b, 6);
+    MEM_stats(MEM_GLOB, &glob);
+    test_assert(glob.bytes == glob_before.bytes + 6 && glob.blocks == glob_before.blocks + 1);
+
+    MEM_stats(MEM_HISTORY, &st);
+    test_assert(st.bytes == before.bytes && st.blocks == before.blocks);
+    test_assert(st.peak_bytes >= peak);
+
+    char *prefix = MEM_strndup(MEM_GLOB, b, 3);
+    test_assert(strcmp(prefix, "hel") == 0);
+    MEM_free(prefix);
+    MEM_free(b);
+
+    // names are found both ways
+    MemTag tag;
+    test_assert(MEM_find_tag("caches", &tag) && tag == MEM_CACHES);
+    test_assert(strcmp(MEM_tag_name(MEM_PIPELINE), "pipeline") == 0);
+    test_assert(!MEM_find_tag("nothing", &tag));
+    MEM_free(NULL);
+
+    return 1;
+
+test_error:
+    return 0;
+}
+
+/*
+ * Tests that an arena hands out blocks from its chunks and starts again
+ * once they are all freed, and that blocks allocated before a tag is
+ * given the arena are still freed by the system
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_arena()
+{
+    char *blocks[1000];
+    MemAllocator arena = MEM_arena_new();
+    test_assert(strcmp(MEM_allocator_name(arena), "arena") == 0);
+
+    char *old = MEM_strdup(MEM_TOKENS, "from malloc");
+    test_assert(MEM_set_allocator(MEM_TOKENS, arena) == MEM_system());
+    test_assert(MEM_get_allocator(MEM_TOKENS) == arena);
+
+    // more than a chunk's worth, each block separate and aligned
+    for (int i = 0; i < 1000; i++)
+    {
+        blocks[i] = MEM_alloc(MEM_TOKENS, 100 + i % 7);
+        test_assert(aligned(blocks[i]));
+        memset(blocks[i], i % 256, 100);
+    }
+    for (int i = 0; i < 1000; i++)
+        test_assert(blocks[i][0] == (char)(i % 256) && blocks[i][99] == (char)(i % 256));
+
+    // a block grown moves into the arena
+    old = MEM_realloc(MEM_TOKENS, old, 4000);
+    test_assert(strcmp(old, "from malloc") == 0);
+
+    for (int i = 0; i < 1000; i++)
+        MEM_free(blocks[i]);
+    MEM_free(old);
+
+    // with every block freed, the arena starts again
+    char *again = MEM_alloc(MEM_TOKENS, 10);
+    char *next = MEM_alloc(MEM_TOKENS, 10);
+    MEM_free(again);
+    MEM_free(next);
+    test_assert(MEM_alloc(MEM_TOKENS, 10) == again);
+    MEM_free(again);
+
+    test_assert(MEM_set_allocator(MEM_TOKENS, NULL) == arena);
+    MEM_allocator_free(arena);
+    return 1;
+
+test_error:
+    MEM_set_allocator(MEM_TOKENS, NULL);
+    return 0;
+}
+
+/*
+ * Tests that a pool hands freed blocks out again for the same size, and
+ * that a large block is not taken from its slabs
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_pool()
+{
+    MemAllocator pool = MEM_pool_new();
+    MEM_set_allocator(MEM_PIPELINE, pool);
+
+    char *small = MEM_alloc(MEM_PIPELINE, 20);
+    char *other = MEM_alloc(MEM_PIPELINE, 20);
+    test_assert(small != other && aligned(small) && aligned(other));
+    MEM_free(small);
+    test_assert(MEM_alloc(MEM_PIPELINE, 24) == small);
+
+    char *large = MEM_alloc(MEM_PIPELINE, 100000);
+    memset(large, 1, 100000);
+    test_assert(aligned(large));
+
+    struct mem_stats st;
+    MEM_stats(MEM_PIPELINE, &st);
+    test_assert(st.blocks >= 3);
+
+    MEM_free(large);
+    MEM_free(small);
+    MEM_free(other);
+
+    MEM_set_allocator(MEM_PIPELINE, NULL);
+    MEM_allocator_free(pool);
+    return 1;
+
+test_error:
+    MEM_set_allocator(MEM_PIPELINE, NULL);
+    return 0;
+}
+
+// what the allocator of test_subsystems has been asked for
+struct counts
+{
+    int allocs;
+    int frees;
+};
+
+static void *counting_alloc(void *data, size_t size)
+{
+    ((struct counts *)data)->allocs++;
+    return malloc(size);
+}
+
+static void counting_free(void *data, void *ptr, size_t size)
+{
+    ((struct counts *)data)->frees++;
+    free(ptr);
+}
+
+/*
+ * Tests an allocator of the caller's, and that a command line tokenized
+ * and parsed with its tokens in an arena and its pipeline in that
+ * allocator gives all its memory back
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_subsystems()
+{
+    char errmsg[100];
+    struct counts counts = {0, 0};
+    struct mem_stats tokens_before, pipeline_before, st;
+
+    MemAllocator custom = MEM_allocator_new("counting", counting_alloc, counting_free, &counts);
+    MemAllocator arena = MEM_arena_new();
+    test_assert(strcmp(MEM_allocator_name(custom), "counting") == 0);
+
+    MEM_set_allocator(MEM_TOKENS, arena);
+    MEM_set_allocator(MEM_PIPELINE, custom);
+    MEM_stats(MEM_TOKENS, &tokens_before);
+    MEM_stats(MEM_PIPELINE, &pipeline_before);
+
+    CList tokens = TOK_tokenize_input("cat <<< \"a b\" | grep -v x > out.txt", errmsg, sizeof(errmsg));
+    test_assert(tokens != NULL);
+    pipeline_t *pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL && strcmp(pipeline->input_data, "a b\n") == 0);
+
+    MEM_stats(MEM_TOKENS, &st);
+    test_assert(st.blocks > tokens_before.blocks);
+    MEM_stats(MEM_PIPELINE, &st);
+    test_assert(st.blocks > pipeline_before.blocks && counts.allocs > 0);
+
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    MEM_stats(MEM_TOKENS, &st);
+    test_assert(st.bytes == tokens_before.bytes && st.blocks == tokens_before.blocks);
+    MEM_stats(MEM_PIPELINE, &st);
+    test_assert(st.bytes == pipeline_before.bytes && st.blocks == pipeline_before.blocks);
+    test_assert(counts.frees == counts.allocs);
+
+    MEM_set_allocator(MEM_TOKENS, NULL);
+    MEM_set_allocator(MEM_PIPELINE, NULL);
+    MEM_allocator_free(arena);
+    MEM_allocator_free(custom);
+    return 1;
+
+test_error:
+    MEM_set_allocator(MEM_TOKENS, NULL);
+    MEM_set_allocator(MEM_PIPELINE, NULL);
+    return 0;
+}
+
+/*
+ * Allocates and frees blocks of a few sizes, keeping some of them
+ * across iterations
+ */
+static void *churn(void *arg)
+{
+    char *kept[16] = {NULL};
+
+    for (int i = 0; i < THREAD_ALLOCS; i++)
+    {
+        int slot = i % 16;
+        MEM_free(kept[slot]);
+        kept[slot] = MEM_alloc(MEM_CACHES, 8 << (i % 6));
+        kept[slot][0] = (char)i;
+    }
+
+    for (int i = 0; i < 16; i++)
+        MEM_free(kept[i]);
+
+    return NULL;
+}
+
+/*
+ * Tests that the counts stay right when threads allocate from the same
+ * tag and pool at once
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_threads()
+{
+    pthread_t threads[NUM_THREADS];
+    struct mem_stats before, st;
+
+    MemAllocator pool = MEM_pool_new();
+    MEM_set_allocator(MEM_CACHES, pool);
+    MEM_stats(MEM_CACHES, &before);
+
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, churn, NULL);
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    MEM_stats(MEM_CACHES, &st);
+    test_assert(st.bytes == before.bytes && st.blocks == before.blocks);
+    test_assert(st.allocs == before.allocs + NUM_THREADS * THREAD_ALLOCS);
+    test_assert(st.peak_bytes > before.bytes);
+
+    MEM_set_allocator(MEM_CACHES, NULL);
+    MEM_allocator_free(pool);
+    return 1;
+
+test_error:
+    MEM_set_allocator(MEM_CACHES, NULL);
+    return 0;
+}
+
+/*
+ * Allocates from a tag until told to stop
+ */
+static void *churn_until(void *arg)
+{
+    volatile bool *stop = arg;
+
+    while (!*stop)
+        MEM_free(MEM_alloc(MEM_CACHES, 64));
+
+    return NULL;
+}
+
+/*
+ * Tests that children forked while other threads use a pool can use it
+ * too, rather than finding its lock held forever
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_fork()
+{
+    pthread_t threads[NUM_THREADS];
+    volatile bool stop = false;
+
+    MemAllocator pool = MEM_pool_new();
+    MEM_set_allocator(MEM_CACHES, pool);
+
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, churn_until, (void *)&stop);
+
+    bool ok = true;
+    for (int i = 0; i < 50 && ok; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // killed by the alarm if the lock was inherited held
+            alarm(5);
+            MEM_free(MEM_alloc(MEM_CACHES, 64));
+            _exit(0);
+        }
+
+        int status;
+        ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    stop = true;
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    test_assert(ok);
+
+    MEM_set_allocator(MEM_CACHES, NULL);
+    MEM_allocator_free(pool);
+    return 1;
+
+test_error:
+    MEM_set_allocator(MEM_CACHES, NULL);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_accounting();
+    num_tests++;
+    passed += test_arena();
+    num_tests++;
+    passed += test_pool();
+    num_tests++;
+    passed += test_subsystems();
+    num_tests++;
+    passed += test_threads();
+    num_tests++;
+    passed += test_fork();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
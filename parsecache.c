@@ -0,0 +1,393 @@
+/*
+ * parsecache.c
+ *
+ * The parse cache: a hash table of lines, with the entries also on a
+ * list from the most to the least recently used
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "parsecache.h"
+#include "mem.h"
+
+// a directory a glob read, as it was before the glob read it
+struct _pcache_dir
+{
+    char *dir;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+};
+
+struct _pcache_entry
+{
+    char *line;
+    uint32_t hash;
+    uint64_t vars_gen;
+    char *cwd;
+    struct _pcache_dir *dirs;
+    int num_dirs;
+
+    CList tokens;
+    pipeline_t *pipeline;
+
+    struct _pcache_entry *chain;      // the next entry in the bucket
+    struct _pcache_entry *prev, *next; // the more and less recently used
+};
+
+struct _parsecache
+{
+    struct _pcache_entry **buckets;
+    int num_buckets; // a power of two
+    int count;
+    int capacity;
+
+    // the most and least recently used entries
+    struct _pcache_entry *newest, *oldest;
+
+    // the line being tokenized, since PCACHE_begin(), and what it depends on
+    char *line;
+    uint64_t vars_gen;
+    bool cacheable;
+    char *cwd;
+    struct _pcache_dir *dirs;
+    int num_dirs;
+
+    struct pcache_stats stats;
+};
+
+/*
+ * FNV-1a hash of a line
+ */
+static uint32_t _PCACHE_hash(const char *line)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *line != '\0'; line++)
+    {
+        h ^= (unsigned char)*line;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * Free an array of directories and the array itself
+ */
+static void _PCACHE_free_dirs(struct _pcache_dir *dirs, int num_dirs)
+{
+    for (int i = 0; i < num_dirs; i++)
+        MEM_free(dirs[i].dir);
+    MEM_free(dirs);
+}
+
+/*
+ * Stat a directory, or the current one for an empty name
+ *
+ * Returns: true on success
+ */
+static bool _PCACHE_stat(const char *dir, struct stat *st)
+{
+    return stat(*dir != '\0' ? dir : ".", st) == 0;
+}
+
+/*
+ * Whether a line was expanded in the same directory, with the same
+ * variables and globbing directories that have not changed since
+ */
+static bool _PCACHE_valid(struct _pcache_entry *entry, uint64_t vars_gen)
+{
+    if (entry->vars_gen != vars_gen)
+        return false;
+
+    char *cwd = getcwd(NULL, 0);
+    bool same_cwd = cwd != NULL && strcmp(cwd, entry->cwd) == 0;
+    free(cwd);
+    if (!same_cwd)
+        return false;
+
+    for (int i = 0; i < entry->num_dirs; i++)
+    {
+        struct _pcache_dir *d = &entry->dirs[i];
+        struct stat st;
+
+        if (!_PCACHE_stat(d->dir, &st) || st.st_dev != d->dev || st.st_ino != d->ino ||
+            st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Take an entry off the recently used list
+ */
+static void _PCACHE_unlink(ParseCache cache, struct _pcache_entry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->newest = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->oldest = entry->prev;
+}
+
+/*
+ * Put an entry at the front of the recently used list
+ */
+static void _PCACHE_push(ParseCache cache, struct _pcache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->newest;
+    if (cache->newest != NULL)
+        cache->newest->prev = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+}
+
+/*
+ * Remove an entry from the cache and free it
+ */
+static void _PCACHE_remove(ParseCache cache, struct _pcache_entry *entry)
+{
+    struct _pcache_entry **link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    _PCACHE_unlink(cache, entry);
+    cache->count--;
+
+    MEM_free(entry->line);
+    MEM_free(entry->cwd);
+    _PCACHE_free_dirs(entry->dirs, entry->num_dirs);
+    pipeline_free(entry->pipeline);
+    CL_free(entry->tokens);
+    MEM_free(entry);
+}
+
+/*
+ * Find the entry of a line
+ *
+ * Returns: The entry, or NULL if the line is not cached
+ */
+static struct _pcache_entry *_PCACHE_find(ParseCache cache, const char *line, uint32_t hash)
+{
+    struct _pcache_entry *entry = cache->buckets[hash & (cache->num_buckets - 1)];
+
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->line, line) != 0))
+        entry = entry->chain;
+
+    return entry;
+}
+
+/*
+ * Forget what was recorded since PCACHE_begin()
+ */
+static void _PCACHE_end(ParseCache cache)
+{
+    MEM_free(cache->line);
+    cache->line = NULL;
+    MEM_free(cache->cwd);
+    cache->cwd = NULL;
+    _PCACHE_free_dirs(cache->dirs, cache->num_dirs);
+    cache->dirs = NULL;
+    cache->num_dirs = 0;
+}
+
+// Documented in .h file
+ParseCache PCACHE_new(int capacity)
+{
+    assert(capacity > 0);
+
+    ParseCache cache = MEM_calloc(MEM_CACHES, 1, sizeof(struct _parsecache));
+
+    // about one entry per bucket when full
+    cache->num_buckets = 1;
+    while (cache->num_buckets < capacity)
+        cache->num_buckets *= 2;
+    cache->buckets = MEM_calloc(MEM_CACHES, cache->num_buckets, sizeof(struct _pcache_entry *));
+
+    cache->capacity = capacity;
+    cache->stats.capacity = capacity;
+
+    return cache;
+}
+
+// Documented in .h file
+void PCACHE_free(ParseCache cache)
+{
+    if (cache == NULL)
+        return;
+
+    while (cache->newest != NULL)
+        _PCACHE_remove(cache, cache->newest);
+
+    _PCACHE_end(cache);
+    MEM_free(cache->buckets);
+    MEM_free(cache);
+}
+
+// Documented in .h file
+pipeline_t *PCACHE_lookup(ParseCache cache, const char *line, uint64_t vars_gen)
+{
+    assert(cache != NULL);
+
+    struct _pcache_entry *entry = _PCACHE_find(cache, line, _PCACHE_hash(line));
+
+    if (entry != NULL && !_PCACHE_valid(entry, vars_gen))
+    {
+        _PCACHE_remove(cache, entry);
+        cache->stats.stale++;
+        entry = NULL;
+    }
+
+    if (entry == NULL)
+    {
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    _PCACHE_unlink(cache, entry);
+    _PCACHE_push(cache, entry);
+    cache->stats.hits++;
+
+    return entry->pipeline;
+}
+
+// Documented in .h file
+void PCACHE_begin(ParseCache cache, const char *line, uint64_t vars_gen)
+{
+    assert(cache != NULL);
+
+    _PCACHE_end(cache);
+    char *cwd = getcwd(NULL, 0);
+    cache->line = MEM_strdup(MEM_CACHES, line);
+    cache->vars_gen = vars_gen;
+    cache->cwd = cwd != NULL ? MEM_strdup(MEM_CACHES, cwd) : NULL;
+    free(cwd);
+    cache->cacheable = cache->cwd != NULL;
+}
+
+// Documented in .h file
+void PCACHE_note_glob(ParseCache cache, const char *pattern)
+{
+    assert(cache != NULL);
+
+    if (cache->line == NULL || !cache->cacheable)
+        return;
+
+    const char *wild = strpbrk(pattern, "*?[");
+    const char *slash = strrchr(pattern, '/');
+
+    // a tilde alone expands to a home directory, whatever is in it
+    if (wild == NULL)
+        return;
+
+    // only a glob that reads one directory, known without expanding a
+    // tilde, can be checked for changes cheaply
+    if (pattern[0] == '~' || (slash != NULL && wild < slash))
+    {
+        cache->cacheable = false;
+        return;
+    }
+
+    char *dir = MEM_strndup(MEM_CACHES, pattern, slash == NULL ? 0 : slash == pattern ? 1 : slash - pattern);
+
+    for (int i = 0; i < cache->num_dirs; i++)
+    {
+        if (strcmp(cache->dirs[i].dir, dir) == 0)
+        {
+            MEM_free(dir);
+            return;
+        }
+    }
+
+    struct stat st;
+    if (!_PCACHE_stat(dir, &st))
+    {
+        // a glob in a missing directory stays unexpanded until it appears
+        cache->cacheable = false;
+        MEM_free(dir);
+        return;
+    }
+
+    cache->dirs = MEM_realloc(MEM_CACHES, cache->dirs, (cache->num_dirs + 1) * sizeof(struct _pcache_dir));
+    cache->dirs[cache->num_dirs++] = (struct _pcache_dir){dir, st.st_dev, st.st_ino, st.st_mtim};
+}
+
+// Documented in .h file
+void PCACHE_note_uncacheable(ParseCache cache)
+{
+    assert(cache != NULL);
+    cache->cacheable = false;
+}
+
+// Documented in .h file
+bool PCACHE_insert(ParseCache cache, CList tokens, pipeline_t *pipeline)
+{
+    assert(cache != NULL);
+
+    if (cache->line == NULL || !cache->cacheable)
+    {
+        if (cache->line != NULL)
+            cache->stats.uncacheable++;
+        _PCACHE_end(cache);
+        return false;
+    }
+
+    uint32_t hash = _PCACHE_hash(cache->line);
+    struct _pcache_entry *old = _PCACHE_find(cache, cache->line, hash);
+    if (old != NULL)
+        _PCACHE_remove(cache, old);
+    else if (cache->count == cache->capacity)
+        _PCACHE_remove(cache, cache->oldest);
+
+    struct _pcache_entry *entry = MEM_alloc(MEM_CACHES, sizeof(struct _pcache_entry));
+
+    // the entry takes over what was recorded
+    entry->line = cache->line;
+    entry->hash = hash;
+    entry->vars_gen = cache->vars_gen;
+    entry->cwd = cache->cwd;
+    entry->dirs = cache->dirs;
+    entry->num_dirs = cache->num_dirs;
+    entry->tokens = tokens;
+    entry->pipeline = pipeline;
+    cache->line = NULL;
+    cache->cwd = NULL;
+    cache->dirs = NULL;
+    cache->num_dirs = 0;
+    _PCACHE_end(cache);
+
+    struct _pcache_entry **bucket = &cache->buckets[hash & (cache->num_buckets - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    _PCACHE_push(cache, entry);
+    cache->count++;
+
+    return true;
+}
+
+// Documented in .h file
+void PCACHE_stats(ParseCache cache, struct pcache_stats *stats)
+{
+    assert(cache != NULL);
+
+    *stats = cache->stats;
+    stats->entries = cache->count;
+}
@@ -0,0 +1,129 @@
+/*
+ * parsecache.h
+ *
+ * An LRU cache from command lines to the pipelines they were tokenized,
+ * expanded and parsed into. An entry is reused only while what it was
+ * expanded from is unchanged: the variables, the current directory and
+ * the directories its globs read.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _PARSECACHE_H_
+#define _PARSECACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clist.h"
+#include "pipeline.h"
+
+// struct _parsecache to be used in the .c as ParseCache
+typedef struct _parsecache *ParseCache;
+
+// counts of what the cache has done
+struct pcache_stats
+{
+    unsigned long hits;
+    unsigned long misses;      // includes the stale entries
+    unsigned long stale;       // entries found but no longer valid
+    unsigned long uncacheable; // lines that could not be cached
+    int entries;
+    int capacity;
+};
+
+/*
+ * Create a new, empty cache
+ *
+ * Parameters:
+ *   capacity   The most lines to keep; the least recently used is
+ *              dropped to make room for another
+ *
+ * Returns: The new cache
+ */
+ParseCache PCACHE_new(int capacity);
+
+/*
+ * Destroy a cache, with the tokens and pipelines it holds
+ *
+ * Parameters:
+ *   cache    The cache, or NULL
+ *
+ * Returns: None
+ */
+void PCACHE_free(ParseCache cache);
+
+/*
+ * Find the pipeline of a line, if it is cached and still valid. A stale
+ * entry is dropped.
+ *
+ * Parameters:
+ *   cache      The cache
+ *   line       The command line
+ *   vars_gen   The generation of the variables, from VAR_generation()
+ *
+ * Returns: The pipeline, owned by the cache and valid until the cache
+ *   is next used, or NULL
+ */
+pipeline_t *PCACHE_lookup(ParseCache cache, const char *line, uint64_t vars_gen);
+
+/*
+ * Start recording what a line is expanded from, before tokenizing it
+ *
+ * Parameters:
+ *   cache      The cache
+ *   line       The command line
+ *   vars_gen   The generation of the variables, from VAR_generation()
+ *
+ * Returns: None
+ */
+void PCACHE_begin(ParseCache cache, const char *line, uint64_t vars_gen);
+
+/*
+ * Record that the line being tokenized expands a glob. Call before the
+ * glob reads its directory, so that a change while it does is noticed.
+ *
+ * Parameters:
+ *   cache      The cache
+ *   pattern    The glob pattern
+ *
+ * Returns: None
+ */
+void PCACHE_note_glob(ParseCache cache, const char *pattern);
+
+/*
+ * Record that the line being tokenized cannot be cached, e.g. because
+ * it ran a command substitution
+ *
+ * Parameters:
+ *   cache    The cache
+ *
+ * Returns: None
+ */
+void PCACHE_note_uncacheable(ParseCache cache);
+
+/*
+ * Cache the tokens and pipeline of the line given to PCACHE_begin(),
+ * unless it cannot be cached
+ *
+ * Parameters:
+ *   cache      The cache
+ *   tokens     The tokens, which the pipeline points into
+ *   pipeline   The pipeline
+ *
+ * Returns: true if the cache took over the tokens and pipeline, false
+ *   if the caller still has to free them
+ */
+bool PCACHE_insert(ParseCache cache, CList tokens, pipeline_t *pipeline);
+
+/*
+ * Get the counts of what the cache has done
+ *
+ * Parameters:
+ *   cache    The cache
+ *   stats    Return space for the counts
+ *
+ * Returns: None
+ */
+void PCACHE_stats(ParseCache cache, struct pcache_stats *stats);
+
+#endif /* _PARSECACHE_H_ */
@@ -0,0 +1,245 @@
+/**
+ * parsecache_test.c
+ *
+ * This file contains the test cases for parsecache.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "parsecache.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "speculate.h"
+#include "vars.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Expands a glob as the shell does, noting its directory in the cache
+ */
+static char **note_glob(const char *pattern, void *cb_data)
+{
+    PCACHE_note_glob((ParseCache)cb_data, pattern);
+    return SPEC_glob(NULL, pattern);
+}
+
+/*
+ * Looks up a line, or tokenizes, parses and caches it as the shell does
+ *
+ * Returns: The pipeline, or NULL if the line could not be parsed; if it
+ *   could not be cached either, *uncached_tokens is set and the caller
+ *   frees both
+ */
+static pipeline_t *run_line(ParseCache cache, VarTable vars, const char *line, CList *uncached_tokens)
+{
+    char errmsg[100];
+    *uncached_tokens = NULL;
+
+    pipeline_t *pipeline = PCACHE_lookup(cache, line, VAR_generation(vars));
+    if (pipeline != NULL)
+        return pipeline;
+
+    TokState state = TOK_state_new();
+    TOK_state_set_vars(state, vars);
+    TOK_state_set_glob(state, note_glob, cache);
+
+    PCACHE_begin(cache, line, VAR_generation(vars));
+    CList tokens = TOK_tokenize_chunk(state, line, errmsg, sizeof(errmsg));
+    TOK_state_free(state);
+    if (tokens == NULL)
+        return NULL;
+
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    if (pipeline == NULL)
+    {
+        CL_free(tokens);
+        return NULL;
+    }
+
+    if (!PCACHE_insert(cache, tokens, pipeline))
+        *uncached_tokens = tokens;
+    return pipeline;
+}
+
+/*
+ * Sets the modification time of a directory to some seconds ago
+ */
+static void set_age(const char *dir, int seconds)
+{
+    struct timespec times[2] = {{time(NULL) - seconds, 0}, {time(NULL) - seconds, 0}};
+    utimensat(AT_FDCWD, dir, times, 0);
+}
+
+/*
+ * Returns the number of arguments of the first command of a pipeline
+ */
+static int count_args(pipeline_t *pipeline)
+{
+    int n = 0;
+    while (pipeline->head->args[n] != NULL)
+        n++;
+    return n;
+}
+
+/*
+ * Tests that lines are reused until the variables, the current directory
+ * or a globbed directory change, and that lines that ran something
+ * while being expanded are not cached
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_invalidation()
+{
+    char dir[] = "/tmp/plaid_parsecache_XXXXXX";
+    char line[128], file[128];
+    char *cwd = getcwd(NULL, 0);
+    ParseCache cache = PCACHE_new(8);
+    VarTable vars = VAR_new();
+    struct pcache_stats st;
+    CList uncached;
+    pipeline_t *first, *again;
+
+    test_assert(mkdtemp(dir) != NULL);
+    VAR_set(vars, "GREETING", "hello");
+
+    first = run_line(cache, vars, "echo $GREETING world", &uncached);
+    test_assert(first != NULL && uncached == NULL);
+    again = run_line(cache, vars, "echo $GREETING world", &uncached);
+    test_assert(again == first && strcmp(again->head->args[1], "hello") == 0);
+
+    // setting a variable to the value it has is no change
+    VAR_set(vars, "GREETING", "hello");
+    test_assert(run_line(cache, vars, "echo $GREETING world", &uncached) == first);
+
+    VAR_set(vars, "GREETING", "bye");
+    test_assert(PCACHE_lookup(cache, "echo $GREETING world", VAR_generation(vars)) == NULL);
+    again = run_line(cache, vars, "echo $GREETING world", &uncached);
+    test_assert(again != NULL && strcmp(again->head->args[1], "bye") == 0);
+
+    PCACHE_stats(cache, &st);
+    test_assert(st.hits == 2 && st.misses == 3 && st.stale == 1 && st.entries == 1);
+
+    // a glob is expanded again once its directory changes
+    snprintf(file, sizeof(file), "%s/a.txt", dir);
+    close(open(file, O_WRONLY | O_CREAT, 0644));
+    set_age(dir, 60);
+    snprintf(line, sizeof(line), "ls %s/*.txt", dir);
+
+    first = run_line(cache, vars, line, &uncached);
+    test_assert(first != NULL && uncached == NULL && count_args(first) == 2);
+    test_assert(run_line(cache, vars, line, &uncached) == first);
+
+    snprintf(file, sizeof(file), "%s/b.txt", dir);
+    close(open(file, O_WRONLY | O_CREAT, 0644));
+    set_age(dir, 30);
+    again = run_line(cache, vars, line, &uncached);
+    test_assert(again != NULL && count_args(again) == 3);
+
+    // relative globs depend on the current directory
+    test_assert(chdir(dir) == 0);
+    first = run_line(cache, vars, "ls *.txt", &uncached);
+    test_assert(first != NULL && count_args(first) == 3);
+    test_assert(chdir("/") == 0);
+    test_assert(PCACHE_lookup(cache, "ls *.txt", VAR_generation(vars)) == NULL);
+
+    // globs over several directories are not cached
+    again = run_line(cache, vars, "ls /tmp/*/no-such-file-here*", &uncached);
+    test_assert(again != NULL && uncached != NULL);
+    pipeline_free(again);
+    CL_free(uncached);
+
+    // nor is a line whose expansion ran a command
+    PCACHE_begin(cache, "echo $(date)", VAR_generation(vars));
+    PCACHE_note_uncacheable(cache);
+    test_assert(!PCACHE_insert(cache, NULL, NULL));
+
+    PCACHE_stats(cache, &st);
+    test_assert(st.uncacheable == 2);
+
+    chdir(cwd);
+    snprintf(file, sizeof(file), "%s/a.txt", dir);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s/b.txt", dir);
+    unlink(file);
+    rmdir(dir);
+    free(cwd);
+    PCACHE_free(cache);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    chdir(cwd);
+    free(cwd);
+    PCACHE_free(cache);
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests that the least recently used line is dropped to make room
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_lru()
+{
+    ParseCache cache = PCACHE_new(2);
+    VarTable vars = VAR_new();
+    struct pcache_stats st;
+    CList uncached;
+
+    pipeline_t *a = run_line(cache, vars, "echo a", &uncached);
+    pipeline_t *b = run_line(cache, vars, "echo b", &uncached);
+    test_assert(a != NULL && b != NULL);
+
+    // using a makes b the oldest
+    test_assert(run_line(cache, vars, "echo a", &uncached) == a);
+    pipeline_t *c = run_line(cache, vars, "echo c", &uncached);
+    test_assert(c != NULL);
+
+    test_assert(PCACHE_lookup(cache, "echo b", VAR_generation(vars)) == NULL);
+    test_assert(PCACHE_lookup(cache, "echo a", VAR_generation(vars)) == a);
+    test_assert(PCACHE_lookup(cache, "echo c", VAR_generation(vars)) == c);
+
+    PCACHE_stats(cache, &st);
+    test_assert(st.entries == 2 && st.capacity == 2 && st.hits == 3);
+
+    PCACHE_free(cache);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    PCACHE_free(cache);
+    VAR_free(vars);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_invalidation();
+    num_tests++;
+    passed += test_lru();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -16,6 +16,27 @@
 #include "token.h"
 #include "clist.h"
 #include "tokenize.h"
+#include "mem.h"
+
+/*
+ * Whether a token is a word: a word or quoted word, or the source of a
+ * compound command's word that is expanded each time it runs
+ */
+static bool _is_word(TokenType type)
+{
+    return type == TOK_WORD || type == TOK_QUOTED_WORD || type == TOK_DEFERRED;
+}
+
+/*
+ * Add a word token to the arguments of a command node
+ */
+static void _add_word(pipeline_cmd_t *node, Token tok)
+{
+    if (tok.type == TOK_DEFERRED)
+        pipeline_cmd_add_deferred(node, tok.text);
+    else
+        pipeline_cmd_add_arg(node, tok.text);
+}
 
 // Documented in .h file
 pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
@@ -34,35 +55,50 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
         // get the nth token from the list
         Token tok = CL_nth(tokens, i);
 
-        if (tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD)
+        if (_is_word(tok.type))
         {
             // if the current pipeline node is NULL, create a new one
             if (node == NULL)
             {
-                node = pipeline_cmd_new(tok.type);
+                node = pipeline_cmd_new(tok.type == TOK_DEFERRED ? TOK_WORD : tok.type);
+
+                // add the new node to the pipeline
+                pipeline_add_command(pipeline, node);
 
                 // add the token to the new node
-                pipeline_cmd_add_arg(node, tok.text);
+                _add_word(node, tok);
 
                 // there are next tokens that are words add them to the args
                 while (i + 1 < tokens->length)
                 {
                     Token next_tok = CL_nth(tokens, i + 1);
-                    if (next_tok.type == TOK_WORD || next_tok.type == TOK_QUOTED_WORD)
+                    if (_is_word(next_tok.type))
                     {
-                        pipeline_cmd_add_arg(node, next_tok.text);
+                        _add_word(node, next_tok);
+                        i++;
+                    }
+
+                    // <(command) and >(command) are arguments too
+                    else if (next_tok.type == TOK_PROCSUB_IN || next_tok.type == TOK_PROCSUB_OUT)
+                    {
+                        pipeline_cmd_add_procsub(node, next_tok.type, next_tok.text);
                         i++;
                     }
 
                     else
                         break;
                 }
-
-                // add the new node to the pipeline
-                pipeline_add_command(pipeline, node);
             }
         }
 
+        else if (tok.type == TOK_PROCSUB_IN || tok.type == TOK_PROCSUB_OUT)
+        {
+            // a process substitution can only be an argument
+            snprintf(errmsg, errmsg_sz, "No command specified");
+            pipeline_free(pipeline);
+            return NULL;
+        }
+
         else if (tok.type == TOK_PIPE)
         {
             // add an empty node to the pipeline
@@ -87,7 +123,7 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
             node = pipeline_cmd_new(tok.type);
             pipeline_add_command(pipeline, node);
 
-            if (i + 1 >= tokens->length || CL_nth(tokens, i + 1).type != TOK_WORD)
+            if (i + 1 >= tokens->length || (CL_nth(tokens, i + 1).type != TOK_WORD && CL_nth(tokens, i + 1).type != TOK_DEFERRED))
             {
                 snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
                 pipeline_free(pipeline);
@@ -98,9 +134,18 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
             if (i + 1 < tokens->length)
             {
                 Token nextTok = CL_nth(tokens, i + 1);
-                if (nextTok.type == TOK_WORD || nextTok.type == TOK_QUOTED_WORD)
+                if (_is_word(nextTok.type))
                 {
+                    if (pipeline_get_input_data(pipeline) != NULL)
+                    {
+                        snprintf(errmsg, errmsg_sz, "Multiple redirection");
+                        pipeline_free(pipeline);
+                        return NULL;
+                    }
+
                     pipeline_set_input(pipeline, nextTok.text);
+                    if (nextTok.type == TOK_DEFERRED)
+                        pipeline->deferred |= PIPELINE_INPUT_DEFERRED;
 
                     // Input 'echo < file1 <file2': Expected 'Multiple redirection'
                     if (i + 2 < tokens->length)
@@ -123,13 +168,67 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
             }
         }
 
+        else if (tok.type == TOK_HEREDOC || tok.type == TOK_DEFERRED_HEREDOC || tok.type == TOK_HERESTRING)
+        {
+            node = pipeline_cmd_new(tok.type);
+            pipeline_add_command(pipeline, node);
+
+            // Input 'cat < file <<EOF': Expected 'Multiple redirection'
+            if (pipeline_get_input(pipeline) != NULL || pipeline_get_input_data(pipeline) != NULL)
+            {
+                snprintf(errmsg, errmsg_sz, "Multiple redirection");
+                pipeline_free(pipeline);
+                return NULL;
+            }
+
+            if (tok.type != TOK_HERESTRING)
+            {
+                // the tokenizer has already collected the body
+                pipeline_set_input_data(pipeline, tok.text != NULL ? tok.text : "");
+                if (tok.type == TOK_DEFERRED_HEREDOC)
+                    pipeline->deferred |= PIPELINE_HEREDOC_DEFERRED;
+            }
+            else
+            {
+                if (i + 1 >= tokens->length || !_is_word(CL_nth(tokens, i + 1).type))
+                {
+                    snprintf(errmsg, errmsg_sz, "Expect word after here-string");
+                    pipeline_free(pipeline);
+                    return NULL;
+                }
+
+                // the source of a deferred word is kept as it is, to be expanded when run
+                Token nextTok = CL_nth(tokens, i + 1);
+                if (nextTok.type == TOK_DEFERRED)
+                {
+                    pipeline_set_input_data(pipeline, nextTok.text);
+                    pipeline->deferred |= PIPELINE_HERESTRING_DEFERRED;
+                    i++;
+                    node = NULL;
+                    continue;
+                }
+
+                // a here-string is fed to stdin followed by a newline
+                char *data = MEM_alloc(MEM_PIPELINE, strlen(nextTok.text) + 2);
+                sprintf(data, "%s\n", nextTok.text);
+                pipeline_set_input_data(pipeline, data);
+                MEM_free(data);
+
+                // skip the next token since it has been processed
+                i++;
+            }
+
+            // clear the current node
+            node = NULL;
+        }
+
         else if (tok.type == TOK_GREATERTHAN)
         {
             // if the current pipeline node is NULL, create a new one
             node = pipeline_cmd_new(tok.type);
             pipeline_add_command(pipeline, node);
 
-            if (i + 1 >= tokens->length || CL_nth(tokens, i + 1).type != TOK_WORD)
+            if (i + 1 >= tokens->length || (CL_nth(tokens, i + 1).type != TOK_WORD && CL_nth(tokens, i + 1).type != TOK_DEFERRED))
             {
                 snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
                 pipeline_free(pipeline);
@@ -140,9 +239,11 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
             if (i + 1 < tokens->length)
             {
                 Token nextTok = CL_nth(tokens, i + 1);
-                if (nextTok.type == TOK_WORD || nextTok.type == TOK_QUOTED_WORD)
+                if (_is_word(nextTok.type))
                 {
                     pipeline_set_output(pipeline, nextTok.text);
+                    if (nextTok.type == TOK_DEFERRED)
+                        pipeline->deferred |= PIPELINE_OUTPUT_DEFERRED;
 
                     if (i + 2 < tokens->length)
                     {
@@ -163,6 +264,14 @@ pipeline_t *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
                 }
             }
         }
+
+        else if (tok.type == TOK_SEMI || tok.type == TOK_KEYWORD)
+        {
+            // the commands of a compound command are parsed one at a time
+            snprintf(errmsg, errmsg_sz, "Unexpected '%s'", tok.type == TOK_SEMI ? ";" : tok.text);
+            pipeline_free(pipeline);
+            return NULL;
+        }
     }
     
     return pipeline;
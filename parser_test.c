@@ -187,11 +187,127 @@ int test_parse_tokens_pipe_token()
     pipeline_free(pipeline);
     CL_free(tokens);
 
+    // echo followed by more words than a command first has room for
+    char line[256] = "echo";
+    for (int i = 0; i < 60; i++)
+        strcat(line, " w");
+    strcat(line, " | wc -w");
+    tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->head->num_args == 61);
+    test_assert(strcmp(pipeline->head->args[60], "w") == 0);
+    test_assert(pipeline->head->args[61] == NULL);
+    test_assert(strcmp(pipeline_get_command(pipeline, pipeline->length - 1)->args[0], "wc") == 0);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    return 1;
+
+test_error:
+    CL_free(tokens);
+    pipeline_free(pipeline);
+    return 0;
+}
+
+/*
+ * Test the parser function with here-documents and here-strings
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   1 if the test passed, 0 otherwise
+ */
+int test_parse_tokens_heredoc()
+{
+    char errmsg[128];
+    CList tokens = NULL;
+    pipeline_t *pipeline = NULL;
+    TokState state = TOK_state_new();
+
+    // cat <<EOF | wc -l, with a two line body
+    tokens = TOK_tokenize_chunk(state, "cat <<EOF | wc -l", errmsg, sizeof(errmsg));
+    TOK_tokenize_chunk(state, "one", errmsg, sizeof(errmsg));
+    TOK_tokenize_chunk(state, "two", errmsg, sizeof(errmsg));
+    tokens = TOK_tokenize_chunk(state, "EOF", errmsg, sizeof(errmsg));
+    test_assert(tokens != NULL);
+
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->input == NULL);
+    test_assert(strcmp(pipeline_get_input_data(pipeline), "one\ntwo\n") == 0);
+    test_assert(strcmp(pipeline->head->args[0], "cat") == 0);
+    test_assert(pipeline->head->args[1] == NULL);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    // wc -c <<< abc
+    tokens = TOK_tokenize_input("wc -c <<< abc", errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(strcmp(pipeline_get_input_data(pipeline), "abc\n") == 0);
+    test_assert(pipeline->head->args[2] == NULL);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    // cat < file <<< abc => Multiple redirection
+    tokens = TOK_tokenize_input("cat < file <<< abc", errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline == NULL);
+    test_assert(strcmp(errmsg, "Multiple redirection") == 0);
+    CL_free(tokens);
+
+    // diff <(seq 3) x >(wc) => diff with two process substitution arguments
+    tokens = TOK_tokenize_input("diff <(seq 3) x >(wc)", errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->length == 1);
+    test_assert(pipeline->head->num_procsubs == 2);
+    test_assert(strcmp(pipeline->head->args[1], "seq 3") == 0);
+    test_assert(pipeline->head->arg_types[1] == TOK_PROCSUB_IN);
+    test_assert(pipeline->head->arg_types[2] == TOK_WORD);
+    test_assert(pipeline->head->arg_types[3] == TOK_PROCSUB_OUT);
+    test_assert(pipeline->head->args[4] == NULL);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    // a process substitution after many words
+    char line[256] = "cat";
+    for (int i = 0; i < 60; i++)
+        strcat(line, " w");
+    strcat(line, " <(echo x)");
+    tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+    test_assert(pipeline->head->num_procsubs == 1);
+    test_assert(strcmp(pipeline->head->args[61], "echo x") == 0);
+    test_assert(pipeline->head->arg_types[61] == TOK_PROCSUB_IN);
+    test_assert(pipeline->head->args[62] == NULL);
+    pipeline_free(pipeline);
+    CL_free(tokens);
+
+    // <(ls) => No command specified
+    tokens = TOK_tokenize_input("<(ls)", errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline == NULL);
+    test_assert(strcmp(errmsg, "No command specified") == 0);
+    CL_free(tokens);
+
+    // cat <<< => Expect word after here-string
+    tokens = TOK_tokenize_input("cat <<<", errmsg, sizeof(errmsg));
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline == NULL);
+    test_assert(strcmp(errmsg, "Expect word after here-string") == 0);
+    CL_free(tokens);
+
+    TOK_state_free(state);
     return 1;
 
 test_error:
     CL_free(tokens);
     pipeline_free(pipeline);
+    TOK_state_free(state);
     return 0;
 }
 
@@ -202,6 +318,8 @@ int main()
 
     num_tests++;
     passed += test_parse_tokens_pipe_token();
+    num_tests++;
+    passed += test_parse_tokens_heredoc();
 
     printf("Passed %d/%d test cases\n", passed, num_tests);
     fflush(stdout);
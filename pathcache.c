@@ -0,0 +1,348 @@
+/*
+ * pathcache.c
+ *
+ * A hash table from command names to the executables found for them
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "mem.h"
+
+#define PC_BUCKETS 256
+#define PC_DEFAULT_PATH "/usr/bin:/bin"
+
+struct _pc_entry
+{
+    char *name;
+    char *file;
+    struct _pc_entry *next;
+};
+
+struct _pathcache
+{
+    pthread_mutex_t lock;
+    char *path; // the PATH the entries were found in
+    struct _pc_entry *buckets[PC_BUCKETS];
+};
+
+/*
+ * FNV-1a hash of a command name
+ */
+static uint32_t _PC_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name != '\0'; name++)
+    {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * Remove every entry. The lock must be held.
+ */
+static void _PC_clear(PathCache pc)
+{
+    for (int i = 0; i < PC_BUCKETS; i++)
+    {
+        while (pc->buckets[i] != NULL)
+        {
+            struct _pc_entry *entry = pc->buckets[i];
+            pc->buckets[i] = entry->next;
+            MEM_free(entry->name);
+            MEM_free(entry->file);
+            MEM_free(entry);
+        }
+    }
+}
+
+/*
+ * Add an entry. The lock must be held.
+ */
+static void _PC_add(PathCache pc, const char *name, const char *file)
+{
+    uint32_t bucket = _PC_hash(name) % PC_BUCKETS;
+    struct _pc_entry *entry = MEM_alloc(MEM_CACHES, sizeof(struct _pc_entry));
+
+    entry->name = MEM_strdup(MEM_CACHES, name);
+    entry->file = MEM_strdup(MEM_CACHES, file);
+    entry->next = pc->buckets[bucket];
+    pc->buckets[bucket] = entry;
+}
+
+/*
+ * Get the status of the directory of a PATH element, or all zeroes if
+ * it does not exist
+ */
+static void _PC_stat_dir(const char *dir, size_t len, struct stat *st)
+{
+    char name[len + 2];
+
+    // an empty PATH element means the current directory
+    if (len == 0)
+        strcpy(name, ".");
+    else
+        sprintf(name, "%.*s", (int)len, dir);
+
+    if (stat(name, st) != 0)
+        memset(st, 0, sizeof(*st));
+}
+
+/*
+ * Search the directories of path for an executable called name
+ *
+ * Returns: The full path, from MEM_alloc, or NULL if there is none
+ */
+static char *_PC_search(const char *path, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    while (*path != '\0')
+    {
+        const char *end = strchrnul(path, ':');
+        size_t dir_len = end - path;
+        char *file = MEM_alloc(MEM_CACHES, dir_len + name_len + 2);
+        assert(file != NULL);
+
+        // an empty PATH element means the current directory
+        if (dir_len == 0)
+            strcpy(file, name);
+        else
+            sprintf(file, "%.*s/%s", (int)dir_len, path, name);
+
+        struct stat st;
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0)
+            return file;
+
+        MEM_free(file);
+        path = *end ? end + 1 : end;
+    }
+
+    return NULL;
+}
+
+// Documented in .h file
+PathCache PC_new()
+{
+    PathCache pc = MEM_calloc(MEM_CACHES, 1, sizeof(struct _pathcache));
+
+    pthread_mutex_init(&pc->lock, NULL);
+    return pc;
+}
+
+// Documented in .h file
+void PC_free(PathCache pc)
+{
+    if (pc == NULL)
+        return;
+
+    _PC_clear(pc);
+    pthread_mutex_destroy(&pc->lock);
+    MEM_free(pc->path);
+    MEM_free(pc);
+}
+
+// Documented in .h file
+char *PC_lookup(PathCache pc, const char *path, const char *name)
+{
+    assert(pc != NULL);
+
+    if (path == NULL)
+        path = PC_DEFAULT_PATH;
+
+    uint32_t bucket = _PC_hash(name) % PC_BUCKETS;
+
+    pthread_mutex_lock(&pc->lock);
+
+    if (pc->path == NULL || strcmp(pc->path, path) != 0)
+    {
+        _PC_clear(pc);
+        MEM_free(pc->path);
+        pc->path = MEM_strdup(MEM_CACHES, path);
+    }
+
+    for (struct _pc_entry *entry = pc->buckets[bucket]; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->name, name) == 0)
+        {
+            char *file = MEM_strdup(MEM_CACHES, entry->file);
+            pthread_mutex_unlock(&pc->lock);
+
+            // one access() is much cheaper than searching every directory again
+            if (access(file, X_OK) == 0)
+                return file;
+
+            MEM_free(file);
+            PC_forget(pc, name);
+            return PC_lookup(pc, path, name);
+        }
+    }
+
+    pthread_mutex_unlock(&pc->lock);
+
+    // search without the lock, since the directories may be slow to read
+    char *file = _PC_search(path, name);
+    if (file == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&pc->lock);
+
+    // keep it only if PATH has not changed meanwhile and no other thread added it
+    bool found = pc->path == NULL || strcmp(pc->path, path) != 0;
+    for (struct _pc_entry *entry = pc->buckets[bucket]; entry != NULL && !found; entry = entry->next)
+        found = strcmp(entry->name, name) == 0;
+
+    if (!found)
+        _PC_add(pc, name, file);
+
+    pthread_mutex_unlock(&pc->lock);
+    return file;
+}
+
+// Documented in .h file
+void PC_forget(PathCache pc, const char *name)
+{
+    assert(pc != NULL);
+
+    pthread_mutex_lock(&pc->lock);
+
+    struct _pc_entry **link = &pc->buckets[_PC_hash(name) % PC_BUCKETS];
+    while (*link != NULL)
+    {
+        struct _pc_entry *entry = *link;
+        if (strcmp(entry->name, name) == 0)
+        {
+            *link = entry->next;
+            MEM_free(entry->name);
+            MEM_free(entry->file);
+            MEM_free(entry);
+            break;
+        }
+        link = &entry->next;
+    }
+
+    pthread_mutex_unlock(&pc->lock);
+}
+
+// Documented in .h file
+void PC_clear(PathCache pc)
+{
+    assert(pc != NULL);
+
+    pthread_mutex_lock(&pc->lock);
+    _PC_clear(pc);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+// Documented in .h file
+void PC_save(PathCache pc, SnapWriter w)
+{
+    assert(pc != NULL);
+
+    pthread_mutex_lock(&pc->lock);
+
+    const char *path = pc->path != NULL ? pc->path : "";
+    SNAP_section(w, "pathcache");
+    SNAP_put_str(w, path);
+
+    // every directory, since a change to any of them can change a lookup
+    uint64_t num_dirs = 0;
+    for (const char *p = path; *p != '\0'; num_dirs++)
+    {
+        const char *end = strchrnul(p, ':');
+        p = *end ? end + 1 : end;
+    }
+    SNAP_put_u64(w, num_dirs);
+
+    for (const char *p = path; *p != '\0';)
+    {
+        const char *end = strchrnul(p, ':');
+        struct stat st;
+        _PC_stat_dir(p, end - p, &st);
+        SNAP_put_stat(w, &st);
+        p = *end ? end + 1 : end;
+    }
+
+    uint64_t count = 0;
+    for (int i = 0; i < PC_BUCKETS; i++)
+    {
+        for (struct _pc_entry *entry = pc->buckets[i]; entry != NULL; entry = entry->next)
+            count++;
+    }
+    SNAP_put_u64(w, count);
+
+    for (int i = 0; i < PC_BUCKETS; i++)
+    {
+        for (struct _pc_entry *entry = pc->buckets[i]; entry != NULL; entry = entry->next)
+        {
+            SNAP_put_str(w, entry->name);
+            SNAP_put_str(w, entry->file);
+        }
+    }
+
+    pthread_mutex_unlock(&pc->lock);
+}
+
+// Documented in .h file
+int PC_load(PathCache pc, SnapReader r)
+{
+    assert(pc != NULL);
+
+    const char *path;
+    uint64_t num_dirs, count;
+
+    if (!SNAP_seek(r, "pathcache") || (path = SNAP_get_str(r)) == NULL ||
+        *path == '\0' || !SNAP_get_u64(r, &num_dirs))
+        return 0;
+
+    // the directories are stat()ed again in the order they were saved
+    uint64_t checked = 0;
+    for (const char *p = path; *p != '\0'; checked++)
+    {
+        const char *end = strchrnul(p, ':');
+        struct stat st;
+        _PC_stat_dir(p, end - p, &st);
+        if (checked == num_dirs || !SNAP_check_stat(r, &st))
+            return 0;
+
+        p = *end ? end + 1 : end;
+    }
+
+    if (checked != num_dirs || !SNAP_get_u64(r, &count))
+        return 0;
+
+    int loaded = 0;
+    pthread_mutex_lock(&pc->lock);
+
+    _PC_clear(pc);
+    MEM_free(pc->path);
+    pc->path = MEM_strdup(MEM_CACHES, path);
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const char *name = SNAP_get_str(r);
+        const char *file = SNAP_get_str(r);
+        if (name == NULL || file == NULL)
+            break;
+
+        _PC_add(pc, name, file);
+        loaded++;
+    }
+
+    pthread_mutex_unlock(&pc->lock);
+    return loaded;
+}
@@ -0,0 +1,99 @@
+/*
+ * pathcache.h
+ *
+ * A cache of where commands were found in the PATH, safe to use from
+ * more than one thread
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+#include "snapshot.h"
+
+// struct _pathcache to be used in the .c as PathCache
+typedef struct _pathcache *PathCache;
+
+/*
+ * Create a new, empty cache
+ *
+ * Parameters: None
+ *
+ * Returns: The new cache
+ */
+PathCache PC_new();
+
+/*
+ * Destroy a cache and the memory it holds
+ *
+ * Parameters:
+ *   pc       The cache
+ *
+ * Returns: None
+ */
+void PC_free(PathCache pc);
+
+/*
+ * Find a command in the PATH, searching the directories only if the
+ * command is not in the cache yet, or its cached file is no longer
+ * executable. The whole cache is dropped when the PATH differs from
+ * the one it was filled from.
+ *
+ * Parameters:
+ *   pc       The cache
+ *   path     The value of PATH, or NULL for the default
+ *   name     The command name, without a '/'
+ *
+ * Returns: The full path of the executable, from MEM_alloc, or NULL if the
+ *   command was not found
+ */
+char *PC_lookup(PathCache pc, const char *path, const char *name);
+
+/*
+ * Forget where a command was found, e.g. after the file has gone
+ *
+ * Parameters:
+ *   pc       The cache
+ *   name     The command name
+ *
+ * Returns: None
+ */
+void PC_forget(PathCache pc, const char *name);
+
+/*
+ * Forget every command, e.g. after new programs were installed earlier
+ * in the PATH
+ *
+ * Parameters:
+ *   pc       The cache
+ *
+ * Returns: None
+ */
+void PC_clear(PathCache pc);
+
+/*
+ * Save the cache in a snapshot, with the state of the PATH directories
+ * it was filled from
+ *
+ * Parameters:
+ *   pc       The cache
+ *   w        The snapshot
+ *
+ * Returns: None
+ */
+void PC_save(PathCache pc, SnapWriter w);
+
+/*
+ * Fill an empty cache from a snapshot. Nothing is loaded if any PATH
+ * directory has changed since the snapshot was saved, since a new
+ * command could now come before a cached one.
+ *
+ * Parameters:
+ *   pc       The cache
+ *   r        The snapshot
+ *
+ * Returns: The number of commands loaded
+ */
+int PC_load(PathCache pc, SnapReader r);
+
+#endif /* _PATHCACHE_H_ */
@@ -11,23 +11,34 @@
 #include <string.h>
 
 #include "pipeline.h"
+#include "mem.h"
+
+// the number of arguments a command node has room for when it is created
+#define PIPELINE_INITIAL_ARGS 8
 
 // Documented in .h file
 pipeline_cmd_t *pipeline_cmd_new(TokenType type)
 {
     // allocate a new pipeline node
-    pipeline_cmd_t *node = (pipeline_cmd_t *)malloc(sizeof(pipeline_cmd_t));
+    pipeline_cmd_t *node = (pipeline_cmd_t *)MEM_alloc(MEM_PIPELINE, sizeof(pipeline_cmd_t));
     assert(node != NULL);
 
     // initialize the pipeline node
     node->type = type;
     node->next = NULL;
+    node->num_procsubs = 0;
+    node->args = NULL;
+    node->arg_types = NULL;
+    node->num_args = 0;
+    node->max_args = 0;
 
     if (type == TOK_WORD || type == TOK_QUOTED_WORD)
     {
-        // initialize the arguments
-        for (int i = 0; i < MAX_ARGS; i++)
-            node->args[i] = NULL;
+        // initialize the arguments, with room for the NULL after them
+        node->max_args = PIPELINE_INITIAL_ARGS;
+        node->args = (char **)MEM_calloc(MEM_PIPELINE, node->max_args + 1, sizeof(char *));
+        node->arg_types = (TokenType *)MEM_calloc(MEM_PIPELINE, node->max_args + 1, sizeof(TokenType));
+        assert(node->args != NULL && node->arg_types != NULL);
     }
 
     // return the new pipeline node
@@ -38,7 +49,7 @@ pipeline_cmd_t *pipeline_cmd_new(TokenType type)
 pipeline_t *pipeline_new()
 {
     // allocate a new pipeline object
-    pipeline_t *pipeline = (pipeline_t *)malloc(sizeof(pipeline_t));
+    pipeline_t *pipeline = (pipeline_t *)MEM_alloc(MEM_PIPELINE, sizeof(pipeline_t));
     assert(pipeline != NULL);
 
     // initialize the pipeline object
@@ -46,6 +57,9 @@ pipeline_t *pipeline_new()
     pipeline->length = 0;
     pipeline->input = NULL;
     pipeline->output = NULL;
+    pipeline->input_data = NULL;
+    pipeline->deferred = 0;
+    pipeline->read_ahead = false;
 
     // return the new pipeline object
     return pipeline;
@@ -65,15 +79,18 @@ void pipeline_free(pipeline_t *pipeline)
         // save a pointer to the next node
         pipeline_cmd_t *next_node = curr_node->next;
 
-        // free the current node
-        free(curr_node);
+        // free the current node and its arguments
+        MEM_free(curr_node->args);
+        MEM_free(curr_node->arg_types);
+        MEM_free(curr_node);
 
         // move on to the next node
         curr_node = next_node;
     }
 
-    // free the pipeline object
-    free(pipeline);
+    // free the here-document data and the pipeline object
+    MEM_free(pipeline->input_data);
+    MEM_free(pipeline);
 }
 
 // Documented in .h file
@@ -90,6 +107,21 @@ void pipeline_set_output(pipeline_t *pipeline, char *output)
     pipeline->output = output;
 }
 
+// Documented in .h file
+void pipeline_set_input_data(pipeline_t *pipeline, const char *data)
+{
+    assert(pipeline != NULL);
+    MEM_free(pipeline->input_data);
+    pipeline->input_data = data != NULL ? MEM_strdup(MEM_PIPELINE, data) : NULL;
+}
+
+// Documented in .h file
+char *pipeline_get_input_data(pipeline_t *pipeline)
+{
+    assert(pipeline != NULL);
+    return pipeline->input_data;
+}
+
 // Documented in .h file
 char *pipeline_get_input(pipeline_t *pipeline)
 {
@@ -130,22 +162,60 @@ void pipeline_add_command(pipeline_t *pipeline, pipeline_cmd_t *node)
     pipeline->length++;
 }
 
+/*
+ * Add an argument of the given type after the last one of a command
+ * node, doubling the room for them when it is full
+ */
+static void _pipeline_cmd_append(pipeline_cmd_t *node, char *arg, TokenType type)
+{
+    if (node->num_args == node->max_args)
+    {
+        node->max_args *= 2;
+        node->args = (char **)MEM_realloc(MEM_PIPELINE, node->args, (node->max_args + 1) * sizeof(char *));
+        node->arg_types = (TokenType *)MEM_realloc(MEM_PIPELINE, node->arg_types,
+                                                   (node->max_args + 1) * sizeof(TokenType));
+        assert(node->args != NULL && node->arg_types != NULL);
+    }
+
+    // the argument after the last one is always NULL
+    node->args[node->num_args] = arg;
+    node->arg_types[node->num_args] = type;
+    node->num_args++;
+    node->args[node->num_args] = NULL;
+}
+
 // Documented in .h file
 void pipeline_cmd_add_arg(pipeline_cmd_t *node, char *arg)
 {
     assert(node != NULL);
     if (node->type == TOK_WORD || node->type == TOK_QUOTED_WORD)
-    {
-        // find the first NULL argument
-        int i = 0;
-        while (node->args[i] != NULL)
-            i++;
+        _pipeline_cmd_append(node, arg, TOK_WORD);
+}
 
-        // add the argument
-        node->args[i] = arg;
+// Documented in .h file
+void pipeline_cmd_add_procsub(pipeline_cmd_t *node, TokenType type, char *command)
+{
+    assert(node != NULL);
+    assert(type == TOK_PROCSUB_IN || type == TOK_PROCSUB_OUT);
+
+    if (node->type == TOK_WORD || node->type == TOK_QUOTED_WORD)
+    {
+        // add the command, marked as a process substitution
+        _pipeline_cmd_append(node, command, type);
+        node->num_procsubs++;
     }
 }
 
+// Documented in .h file
+void pipeline_cmd_add_deferred(pipeline_cmd_t *node, char *source)
+{
+    assert(node != NULL);
+
+    // add the source, marked to be expanded
+    if (node->type == TOK_WORD || node->type == TOK_QUOTED_WORD)
+        _pipeline_cmd_append(node, source, TOK_DEFERRED);
+}
+
 // Documented in .h file
 pipeline_cmd_t *pipeline_get_command(pipeline_t *pipeline, int index)
 {
@@ -187,7 +257,7 @@ void pipeline_print(pipeline_t *pipeline)
         }
 
         // print the command
-        printf("Command: %s - args: ", this_node->args != NULL ? this_node->args[0] : "NULL");
+        printf("Command: %s - args: ", this_node->args[0] != NULL ? this_node->args[0] : "NULL");
 
         // print the arguments
         int i = 1;
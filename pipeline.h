@@ -7,7 +7,8 @@
  */
 #ifndef PIPELINE_H
 #define PIPELINE_H
-#define MAX_ARGS 50
+
+#include <stdbool.h>
 
 #include "token.h"
 
@@ -15,7 +16,11 @@
 struct pipeline_node
 {
     TokenType type;
-    char *args[MAX_ARGS];
+    char **args;          // the arguments, followed by a NULL; grown as arguments are added
+    TokenType *arg_types; // TOK_PROCSUB_IN/OUT for <(...) and >(...) arguments, TOK_DEFERRED for unexpanded ones
+    int num_args;         // number of arguments
+    int max_args;         // number of arguments args has room for, besides the NULL
+    int num_procsubs;     // number of process substitution arguments
     struct pipeline_node *next;
 };
 
@@ -26,8 +31,17 @@ struct pipeline                              // pipeline is a linked list of pip
     int length;
     char *input;
     char *output;
+    char *input_data; // here-document or here-string fed to stdin, owned by the pipeline
+    int deferred;     // PIPELINE_*_DEFERRED for the redirections left unexpanded
+    bool read_ahead;  // the read of a while loop whose input nothing else reads
 };
 
+// redirections of a compound command's pipeline that are expanded each time it runs
+#define PIPELINE_INPUT_DEFERRED 0x1      // input is the source of a word
+#define PIPELINE_OUTPUT_DEFERRED 0x2     // output is the source of a word
+#define PIPELINE_HEREDOC_DEFERRED 0x4    // input_data is an unexpanded here-document body
+#define PIPELINE_HERESTRING_DEFERRED 0x8 // input_data is the source of a here-string word
+
 typedef struct pipeline pipeline_t; // pipeline_t is a pointer to a pipeline
 
 /*
@@ -95,6 +109,30 @@ void pipeline_set_input(pipeline_t *pipeline, char *input);
  */
 void pipeline_set_output(pipeline_t *pipeline, char *output);
 
+/*
+ * Set the data fed to the standard input of a pipeline object, from a
+ * here-document or here-string. The data is copied.
+ *
+ * Parameters:
+ *  pipeline: the pipeline object
+ *  data: the data to feed to the first command
+ *
+ * Returns:
+ *  None
+ */
+void pipeline_set_input_data(pipeline_t *pipeline, const char *data);
+
+/*
+ * Get the data fed to the standard input of a pipeline object.
+ *
+ * Parameters:
+ *  pipeline: the pipeline object
+ *
+ * Returns:
+ *  the here-document or here-string data, or NULL if there is none
+ */
+char *pipeline_get_input_data(pipeline_t *pipeline);
+
 /*
  * Get the input file of a pipeline object.
  *
@@ -141,6 +179,35 @@ void pipeline_add_command(pipeline_t *pipeline, pipeline_cmd_t *node);
  */
 void pipeline_cmd_add_arg(pipeline_cmd_t *node, char *arg);
 
+/*
+ * Add a process substitution argument, <(command) or >(command), to the
+ * current node in a pipeline object. The executor replaces it with the
+ * /dev/fd path of a pipe to the running command.
+ *
+ * Parameters:
+ *  node: the current node in the pipeline object
+ *  type: TOK_PROCSUB_IN or TOK_PROCSUB_OUT
+ *  command: the command to run
+ *
+ * Returns:
+ *  None
+ */
+void pipeline_cmd_add_procsub(pipeline_cmd_t *node, TokenType type, char *command);
+
+/*
+ * Add an argument that is expanded each time the pipeline runs, from
+ * the source of a word of a compound command, to the current node in a
+ * pipeline object.
+ *
+ * Parameters:
+ *  node: the current node in the pipeline object
+ *  source: the source of the word
+ *
+ * Returns:
+ *  None
+ */
+void pipeline_cmd_add_deferred(pipeline_cmd_t *node, char *source);
+
 /*
  * Get the command at the given index in a pipeline object.
  *
@@ -37,7 +37,7 @@ void run_test_cases()
     // Edge Cases
     pipeline = pipeline_new();
     char long_command[256] = "a";
-    for (int i = 0; i < MAX_ARGS; i++)
+    for (int i = 0; i < 50; i++)
     {
         strcat(long_command, "a");
         pipeline_cmd_t *node = pipeline_cmd_new(TOK_WORD);
@@ -45,10 +45,27 @@ void run_test_cases()
         pipeline_add_command(pipeline, node);
     }
 
-    assert(pipeline->length == MAX_ARGS);
+    assert(pipeline->length == 50);
     assert(pipeline_get_command(pipeline, 0) != NULL);
     pipeline_free(pipeline);
 
+    // A command with more arguments than it first has room for
+    pipeline = pipeline_new();
+    pipeline_cmd_t *seq_node = pipeline_cmd_new(TOK_WORD);
+    pipeline_add_command(pipeline, seq_node);
+    pipeline_cmd_add_arg(seq_node, "echo");
+    for (int i = 1; i < 100; i++)
+        pipeline_cmd_add_arg(seq_node, "word");
+    pipeline_cmd_add_procsub(seq_node, TOK_PROCSUB_IN, "ls");
+
+    assert(seq_node->num_args == 101);
+    assert(strcmp(seq_node->args[0], "echo") == 0);
+    assert(strcmp(seq_node->args[99], "word") == 0 && seq_node->arg_types[99] == TOK_WORD);
+    assert(strcmp(seq_node->args[100], "ls") == 0 && seq_node->arg_types[100] == TOK_PROCSUB_IN);
+    assert(seq_node->args[101] == NULL);
+    assert(seq_node->num_procsubs == 1);
+    pipeline_free(pipeline);
+
     // More commands
     pipeline = pipeline_new();
     pipeline_set_input(pipeline, "input_file.txt");
@@ -5,290 +5,835 @@
  *
  * Author: Niyomwungeri Parmenide ISHIMWE <parmenin@andrew.cmu.edu>
  */
+#define _GNU_SOURCE
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <assert.h>
-#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
 
 #include "clist.h"
 #include "tokenize.h"
 #include "token.h"
 #include "pipeline.h"
 #include "parser.h"
+#include "vars.h"
+#include "shell.h"
+#include "builtins.h"
+#include "zygote.h"
+#include "pathcache.h"
+#include "speculate.h"
+#include "cmdindex.h"
+#include "snapshot.h"
+#include "parsecache.h"
+#include "script.h"
+#include "control.h"
+#include "functions.h"
+#include "histfile.h"
+#include "histindex.h"
+#include "serve.h"
+#include "exec.h"
+#include "mem.h"
+
+// the helper threads and the variables they read PATH from, for the
+// readline hooks, which are given no shell
+static Speculator speculator;
+static CommandIndex command_index;
+static VarTable hook_vars;
+
+// the history file, and the index of it for fuzzy search, built on first use
+static History history;
+static HistIndex history_index;
 
 /*
- * Executes a pipeline of commands
+ * Called by readline while it waits for keys. When the line has changed
+ * since the last call, the speculation thread is given the new line, so
+ * it can find the command and expand the globs before Enter is pressed.
+ *
+ * Returns:
+ *   0
+ */
+static int speculate_hook()
+{
+    static char *last_line;
+
+    if (rl_line_buffer == NULL || (last_line != NULL && strcmp(last_line, rl_line_buffer) == 0))
+        return 0;
+
+    MEM_free(last_line);
+    last_line = MEM_strdup(MEM_TOKENS, rl_line_buffer);
+    SPEC_hint(speculator, rl_line_buffer, VAR_get(hook_vars, "PATH"));
+
+    return 0;
+}
+
+/*
+ * Expands the globs of the command line, reusing what the speculation
+ * thread expanded while the line was typed. The directory read is
+ * noted, so that a cached line is expanded again when it changes.
  *
  * Parameters:
- *   pipeline   The pipeline to execute
+ *   pattern    The glob pattern
+ *   cb_data    The shell
  *
  * Returns:
- *   The exit status of the last command in the pipeline
+ *   The matches, as from SPEC_glob
  */
-int execute_pipeline(pipeline_t *pipeline)
+static char **speculative_glob(const char *pattern, void *cb_data)
 {
-    int num_commands = pipeline->length;
-    int status;
-    pid_t pid;
+    shell_t *sh = (shell_t *)cb_data;
 
-    int prev_pipe[2];
-    int cur_pipe[2];
+    if (sh->parsecache != NULL)
+        PCACHE_note_glob(sh->parsecache, pattern);
 
-    pipeline_cmd_t *cur_node = pipeline->head;
+    return SPEC_glob(speculator, pattern);
+}
+
+/*
+ * Hands readline the command names that complete the word being typed,
+ * one per call, from the matches found on the first call
+ *
+ * Parameters:
+ *   text       The word being completed
+ *   state      0 on the first call for a word
+ *
+ * Returns:
+ *   The next match, malloc'd, or NULL after the last one
+ */
+static char *command_generator(const char *text, int state)
+{
+    static char **matches;
+    static int next;
 
-    // Create the pipe for the first command
-    if (pipe(prev_pipe) == -1)
+    if (state == 0)
     {
-        perror("pipe");
-        exit(1);
+        free(matches);
+        matches = CI_complete(command_index, VAR_get(hook_vars, "PATH"), text);
+        next = 0;
     }
 
-    // Execute each command in the pipeline
-    for (int i = 0; i < num_commands; i++)
+    // readline frees the names it is given
+    if (matches == NULL || matches[next] == NULL)
     {
-        // Create the pipe for the next command
-        if (i < num_commands - 1 && pipe(cur_pipe) == -1)
-        {
-            perror("pipe");
-            exit(1);
-        }
+        free(matches);
+        matches = NULL;
+        return NULL;
+    }
 
-        // Fork a new process for the current command
-        pid = fork();
+    return matches[next++];
+}
 
-        if (pid == 0)
-        {
-            // Child process that runs the command 
-            if (i > 0)
-            {
-                // if it is not the first command, read from the previous pipe
-                dup2(prev_pipe[0], STDIN_FILENO);
-                close(prev_pipe[0]);
-                close(prev_pipe[1]);
-            }
+/*
+ * Completes the first word of a command, or of a pipeline stage, from
+ * the command index. Other words are left to readline's filename
+ * completion.
+ *
+ * Parameters:
+ *   text       The word being completed
+ *   start      Where the word starts in rl_line_buffer
+ *   end        Where the word ends in rl_line_buffer
+ *
+ * Returns:
+ *   The matches, as from rl_completion_matches, or NULL for filenames
+ */
+static char **complete_command(const char *text, int start, int end)
+{
+    int i = start;
+    while (i > 0 && isspace(rl_line_buffer[i - 1]))
+        i--;
 
-            if (i < num_commands - 1)
-            {
-                // if it is not the last command, write to the next pipe
-                dup2(cur_pipe[1], STDOUT_FILENO);
-                close(cur_pipe[0]);
-                close(cur_pipe[1]);
-            }
+    // a name with a '/' is a path to a file
+    if ((i > 0 && rl_line_buffer[i - 1] != '|') || strchr(text, '/') != NULL)
+        return NULL;
 
-            // Redirect input and output if necessary 
-            if (pipeline_get_input(pipeline) != NULL)
-            {
-                // Open the input file for reading 
-                int fd = open(pipeline_get_input(pipeline), O_RDONLY);
-                if (fd == -1)
-                {
-                    perror(pipeline_get_input(pipeline));
-                    exit(1);
-                }
-
-                // Redirect stdin to the input file
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
+    // no command matching is not a reason to list files
+    rl_attempted_completion_over = 1;
+    return rl_completion_matches(text, command_generator);
+}
 
-            // Open the output file for writing
-            if (pipeline_get_output(pipeline) != NULL)
-            {
-                // Open the output file for writing
-                int fd = open(pipeline_get_output(pipeline), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                if (fd == -1)
-                {
-                    perror(pipeline_get_output(pipeline));
-                    exit(1);
-                }
-
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
+// the most commands loaded from the history file at startup
+#define HISTORY_LOAD_MAX 1000
 
-            // Execute the command 
-            if (cur_node->type == TOK_WORD)
-            {
-                // Built-in commands
-                if (strcmp(cur_node->args[0], "author") == 0)
-                {
-                    int pipefd[2];
-                    if (pipe(pipefd) == -1)
-                    {
-                        perror("pipe");
-                        exit(1);
-                    }
-
-                    pid_t next_command_pid;
-
-                    // Fork a new process for the next command after author
-                    next_command_pid = fork();
-
-                    if (next_command_pid == 0)
-                    {
-                        // Child process
-                        close(pipefd[0]);
-                        dup2(pipefd[1], STDOUT_FILENO);
-                        close(pipefd[1]);
-                    }
-                    else if (next_command_pid > 0)
-                    {
-                        // Parent process
-                        close(pipefd[1]);
-                        dup2(pipefd[0], STDIN_FILENO);
-                        close(pipefd[0]);
-
-                        // Execute the author command
-                        printf("Niyomwungeri Parmenide ISHIMWE\n");
-
-                        exit(0);
-                    }
-                    else
-                    {
-                        perror("fork");
-                        exit(1);
-                    }
-
-                    // Wait for the next command to finish
-                    pid_t terminated_pid = waitpid(next_command_pid, &status, 0);
-
-                    if (terminated_pid == -1)
-                        exit(1);
-
-                    return status;
-                }
-
-                else if (strcmp(cur_node->args[0], "pwd") == 0)
-                {
-                    char *cwd = getcwd(NULL, 0);
-                    printf("%s\n", cwd);
-                    free(cwd);
-                    return 0;
-                }
-                else if (strcmp(cur_node->args[0], "cd") == 0)
-                {
-                    if (cur_node->args[1] != NULL)
-                    {
-                        if (chdir(cur_node->args[1]) != 0)
-                        {
-                            perror("chdir");
-                            exit(1);
-                        }
-                    }
-                    else
-                        chdir(getenv("HOME"));
-                    return 0;
-                }
-
-                // Execute the command if it is not a built-in command, pipe or redirection
-                else if (execvp(cur_node->args[0], cur_node->args) == -1)
-                {
-                    printf("%s: Command not found \n", cur_node->args[0]);
-                    perror(cur_node->args[0]);
-                    fprintf(stderr, "Child %d exited with status %d \n", pid, 2);
-                    exit(1);
-                }
-            }
+// the most command lines kept tokenized and parsed
+#define PARSE_CACHE_SIZE 128
 
-            // Close file descriptors for redirection
-            if (pipeline_get_output(pipeline) != NULL)
-                close(STDOUT_FILENO);
+/*
+ * Stores a command in the history, in memory and for later sessions
+ *
+ * Parameters:
+ *   cmdline    The command
+ */
+static void remember_command(const char *cmdline)
+{
+    add_history(cmdline);
+    if (history != NULL)
+        HIST_append(history, cmdline);
+    if (history_index != NULL)
+        HI_add(history_index, cmdline, strlen(cmdline));
+}
 
-            if (pipeline_get_input(pipeline) != NULL)
-                close(STDIN_FILENO);
+/*
+ * Adds a command from the history file to readline's history
+ *
+ * Parameters:
+ *   line       The command, not NUL-terminated
+ *   len        The length of the command
+ *   cb_data    Not used
+ */
+static void load_history_line(const char *line, size_t len, void *cb_data)
+{
+    char *cmd = MEM_strndup(MEM_HISTORY, line, len);
+    add_history(cmd);
+    MEM_free(cmd);
+}
 
-            status = 0;
+/*
+ * Opens the history file shared with the other shells: $PLAID_HISTFILE,
+ * or ~/.plaid_history if that is not set. An empty PLAID_HISTFILE keeps
+ * the history in memory only.
+ *
+ * Parameters:
+ *   vars       The shell variables
+ *
+ * Returns:
+ *   The history, or NULL if there is no history file
+ */
+static History open_history(VarTable vars)
+{
+    const char *file = VAR_get(vars, "PLAID_HISTFILE");
+    const char *home = VAR_get(vars, "HOME");
+    char *default_file = NULL;
+
+    if (file == NULL && home != NULL)
+    {
+        default_file = MEM_alloc(MEM_HISTORY, strlen(home) + sizeof("/.plaid_history"));
+        sprintf(default_file, "%s/.plaid_history", home);
+        file = default_file;
+    }
+
+    History history = file != NULL && *file != '\0' ? HIST_open(file) : NULL;
+    MEM_free(default_file);
+
+    return history;
+}
+
+/*
+ * The snapshot file that carries the caches from one session to the
+ * next: $PLAID_SNAPSHOT, if it is set and not empty
+ *
+ * Parameters:
+ *   vars       The shell variables
+ *
+ * Returns:
+ *   The path of the file, or NULL if no snapshot is kept
+ */
+static const char *snapshot_file(VarTable vars)
+{
+    const char *file = VAR_get(vars, "PLAID_SNAPSHOT");
+    return file != NULL && *file != '\0' ? file : NULL;
+}
+
+/*
+ * Saves the caches in the snapshot file, if there is one
+ *
+ * Parameters:
+ *   sh         The shell
+ */
+static void save_snapshot(shell_t *sh)
+{
+    const char *file = snapshot_file(sh->vars);
+    if (file == NULL)
+        return;
+
+    SnapWriter w = SNAP_new();
+    PC_save(sh->pathcache, w);
+    if (command_index != NULL)
+        CI_save(command_index, w);
+    SNAP_write(w, file);
+    SNAP_free(w);
+}
+
+/*
+ * Parses and runs a compound command: a for, while or if. Its pipelines
+ * are parsed once, however many times they run.
+ *
+ * Parameters:
+ *   sh         The shell
+ *   tok_state  The tokenizer state, to expand the words with
+ *   tokens     The tokens of the command, which are freed
+ *
+ * Returns:
+ *   false if a command was exit or quit, true otherwise
+ */
+static bool run_compound(shell_t *sh, TokState tok_state, CList tokens)
+{
+    char errmsg[100];
+
+    Compound compound = CTL_parse(tokens, errmsg, sizeof(errmsg));
+    if (compound == NULL)
+    {
+        dprintf(sh->err_fd, "%s\n", errmsg);
+        return true;
+    }
+
+    bool go_on = CTL_run(compound, tok_state, sh->vars, EXEC_run_compound_pipeline, EXEC_define_function, sh, &sh->status);
+    CTL_free(compound);
+
+    return go_on;
+}
+
+/*
+ * Runs the commands of a script's text, a line at a time as if they
+ * were typed
+ *
+ * Parameters:
+ *   sh         The shell
+ *   tok_state  The tokenizer state, which is left complete
+ *   text       The lines, separated by newlines
+ *
+ * Returns:
+ *   false if a command was exit or quit, true otherwise
+ */
+static bool run_source(shell_t *sh, TokState tok_state, const char *text)
+{
+    char errmsg[100];
+    const char *p = text;
+
+    while (*p != '\0')
+    {
+        const char *nl = strchrnul(p, '\n');
+        char *line = MEM_strndup(MEM_TOKENS, p, nl - p);
+        p = *nl != '\0' ? nl + 1 : nl;
+
+        const char *c = line;
+        while (*c != '\0' && isspace(*c))
+            c++;
+
+        if (*c == '\0' && !TOK_state_incomplete(tok_state))
+        {
+            MEM_free(line);
+            continue;
         }
-        else if (pid > 0)
+
+        CList tokens = TOK_tokenize_chunk(tok_state, line, errmsg, sizeof(errmsg));
+        MEM_free(line);
+
+        if (tokens == NULL && TOK_state_incomplete(tok_state))
+            continue;
+
+        if (tokens == NULL)
         {
-            // Parent process
-            if (i != 0)
-            {
-                close(prev_pipe[0]);
-                close(prev_pipe[1]);
-            }
+            dprintf(sh->err_fd, "%s\n", errmsg);
+            continue;
+        }
 
-            if (i < num_commands - 1)
-            {
-                prev_pipe[0] = cur_pipe[0];
-                prev_pipe[1] = cur_pipe[1];
-            }
+        if (CTL_is_compound(tokens))
+        {
+            if (!run_compound(sh, tok_state, tokens))
+                return false;
+            continue;
         }
-        else
+
+        pipeline_t *pipeline = tokens->length > 0 ? parse_tokens(tokens, errmsg, sizeof(errmsg)) : NULL;
+
+        if (pipeline != NULL && EXEC_is_exit(pipeline))
         {
-            perror("fork");
-            exit(1);
+            CL_free(tokens);
+            pipeline_free(pipeline);
+            sh->status = 0;
+            return false;
         }
 
-        // Advance to the next node
-        cur_node = cur_node->next;
+        if (tokens->length > 0 && (pipeline == NULL || strlen(errmsg) > 0))
+            dprintf(sh->err_fd, "%s\n", errmsg);
+        else if (pipeline != NULL)
+            EXEC_run_pipeline(sh, pipeline);
+
+        CL_free(tokens);
+        pipeline_free(pipeline);
+
+        // exit in a function stops the script too
+        if (sh->exiting)
+            return false;
     }
 
-    // Close the last pipe in the parent process
-    if (pid > 0 && num_commands > 1)
+    // a script that ends in the middle of a command does not run it
+    if (TOK_state_end_input(tok_state, errmsg, sizeof(errmsg)))
     {
-        close(prev_pipe[0]);
-        close(prev_pipe[1]);
+        dprintf(sh->err_fd, "%s\n", errmsg);
+        sh->status = 2;
     }
+    return true;
+}
+
+/*
+ * The directory compiled scripts are kept in: $PLAID_SCRIPT_CACHE, if it
+ * is set and not empty, or else next to each script
+ *
+ * Parameters:
+ *   vars       The shell variables
+ *
+ * Returns:
+ *   The directory, or NULL
+ */
+static const char *script_cache_dir(VarTable vars)
+{
+    const char *dir = VAR_get(vars, "PLAID_SCRIPT_CACHE");
+    return dir != NULL && *dir != '\0' ? dir : NULL;
+}
 
-    // Wait for all the child processes to finish
-    for (int i = 0; i < num_commands; i++)
+/*
+ * Runs a script, from the compiled form saved by an earlier run if the
+ * script has not changed since
+ *
+ * Parameters:
+ *   sh         The shell
+ *   tok_state  The tokenizer state
+ *   file       The script
+ *
+ * Returns:
+ *   The exit status of the last command
+ */
+static int run_script(shell_t *sh, TokState tok_state, const char *file)
+{
+    Script script = SCR_open(file, script_cache_dir(sh->vars));
+    if (script == NULL)
     {
-        pid_t terminated_pid = waitpid(-1, &status, 0);
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return 127;
+    }
 
-        if (terminated_pid == -1)
-            exit(1);
+    for (int i = 0; i < SCR_length(script); i++)
+    {
+        pipeline_t *pipeline = SCR_pipeline(script, i);
+
+        if (pipeline != NULL && EXEC_is_exit(pipeline))
+        {
+            sh->status = 0;
+            break;
+        }
+
+        if (pipeline != NULL)
+            EXEC_run_pipeline(sh, pipeline);
+        else if (!run_source(sh, tok_state, SCR_source(script, i)))
+            break;
+
+        if (sh->exiting)
+            break;
     }
 
-    // Close the last pipe output
-    if (num_commands > 1)
+    SCR_close(script);
+    return sh->status;
+}
+
+/*
+ * Before the serving shell forks for a request, finds the request's
+ * commands in the PATH and builds the environment, so that this request
+ * and every later one are forked with both already in the caches
+ *
+ * Parameters:
+ *   command    The command line of the request
+ *   cb_data    The shell
+ */
+static void serve_warm(const char *command, void *cb_data)
+{
+    shell_t *sh = (shell_t *)cb_data;
+    char errmsg[100];
+    const char *p = command;
+
+    while (*p != '\0')
     {
-        close(prev_pipe[0]);
-        close(prev_pipe[1]);
+        const char *nl = strchrnul(p, '\n');
+        char *line = MEM_strndup(MEM_TOKENS, p, nl - p);
+        p = *nl != '\0' ? nl + 1 : nl;
+
+        // the words are only looked at, not expanded, which is left to the request
+        CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+        MEM_free(line);
+        if (tokens == NULL)
+            continue;
+
+        pipeline_t *pipeline = CTL_is_compound(tokens) ? NULL : parse_tokens(tokens, errmsg, sizeof(errmsg));
+        if (pipeline == NULL)
+        {
+            CL_free(tokens);
+            continue;
+        }
+
+        for (pipeline_cmd_t *cmd = pipeline->head; cmd != NULL; cmd = cmd->next)
+        {
+            // the operator nodes have no arguments
+            if (cmd->type != TOK_WORD && cmd->type != TOK_QUOTED_WORD)
+                continue;
+
+            char *name = cmd->args[0];
+            if (name == NULL || cmd->arg_types[0] == TOK_DEFERRED || strchr(name, '/') != NULL ||
+                FUNC_lookup(sh->funcs, name) != NULL || builtin_lookup(cmd->args) != NULL)
+                continue;
+
+            MEM_free(PC_lookup(sh->pathcache, VAR_get(sh->vars, "PATH"), name));
+        }
+
+        pipeline_free(pipeline);
+        CL_free(tokens);
     }
 
-    return status;
+    VAR_environ(sh->vars);
 }
 
-int main()
+/*
+ * In the child forked for a request, runs the command line with the
+ * client's working directory as PWD
+ *
+ * Parameters:
+ *   command    The command line of the request
+ *   cb_data    The shell
+ *
+ * Returns:
+ *   The exit status of the last command
+ */
+static int serve_run(const char *command, void *cb_data)
 {
+    shell_t *sh = (shell_t *)cb_data;
+    char cwd[PATH_MAX];
+
+    // the zygote's socket is shared by every request, so each forks its own commands
+    sh->zygote = NULL;
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        VAR_set(sh->vars, "PWD", cwd);
+
+    run_source(sh, sh->tok_state, command);
+    return sh->status;
+}
+
+/*
+ * In the child forked for a request, runs a pipeline the client has
+ * already parsed, with the client's working directory as PWD
+ *
+ * Parameters:
+ *   pipeline   The pipeline, encoded by FP_encode
+ *   len        The length of the encoding
+ *   cb_data    The shell
+ *
+ * Returns:
+ *   The exit status of the pipeline
+ */
+static int serve_run_pipeline(const void *pipeline, size_t len, void *cb_data)
+{
+    shell_t *sh = (shell_t *)cb_data;
+    char cwd[PATH_MAX];
+
+    // as in serve_run, each request forks its own commands
+    sh->zygote = NULL;
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        VAR_set(sh->vars, "PWD", cwd);
+
+    return EXEC_run_encoded(sh, pipeline, len);
+}
+
+// the number of fuzzy search results that Ctrl-R cycles through
+#define FUZZY_RESULTS 16
+
+/*
+ * Adds a command from the history file to the fuzzy search index
+ */
+static void index_history_line(const char *line, size_t len, void *cb_data)
+{
+    HI_add((HistIndex)cb_data, line, len);
+}
+
+/*
+ * A readline command for searching the history by trigrams instead of
+ * scanning it, bound to Ctrl-X r. Typing refines the query and shows
+ * the best match, ranked by how well it matches and how recently and
+ * often it was run; Ctrl-R shows the next best, Enter runs the match,
+ * Ctrl-G gives up, and any other key keeps the match for editing.
+ *
+ * Parameters:
+ *   count      Not used
+ *   key        Not used
+ *
+ * Returns:
+ *   0
+ */
+static int fuzzy_history_search(int count, int key)
+{
+    char query[256] = "";
+    size_t qlen = 0;
+    const char *results[FUZZY_RESULTS];
+    int num_results = 0, shown = 0;
+    char *saved_line = MEM_strdup(MEM_HISTORY, rl_line_buffer);
+
+    // the whole history file is indexed the first time, and each command
+    // run after that is added to the index as it is run
+    if (history_index == NULL)
+    {
+        history_index = HI_new();
+        if (history != NULL)
+            HIST_load_tail(history, INT_MAX, index_history_line, history_index);
+        else
+        {
+            for (int i = 0; i < history_length; i++)
+            {
+                HIST_ENTRY *entry = history_get(history_base + i);
+                if (entry != NULL)
+                    HI_add(history_index, entry->line, strlen(entry->line));
+            }
+        }
+    }
+
+    rl_save_prompt();
+
+    while (true)
+    {
+        const char *match = num_results > 0 ? results[shown] : "";
+        rl_message("(fuzzy-search)`%s': %s", query, match);
+
+        int c = rl_read_key();
+        if (c == CTRL('R'))
+        {
+            if (num_results > 0)
+                shown = (shown + 1) % num_results;
+            continue;
+        }
+
+        if ((c == RUBOUT || c == CTRL('H')) && qlen > 0)
+            query[--qlen] = '\0';
+        else if (isprint(c) && qlen < sizeof(query) - 1)
+            query[qlen++] = c;
+        else if (c == RUBOUT || c == CTRL('H'))
+            continue;
+        else
+        {
+            // Ctrl-G puts back the line as it was before the search
+            rl_replace_line(c == CTRL('G') || num_results == 0 ? saved_line : match, 0);
+            rl_point = rl_end;
+
+            if (c == '\r' || c == '\n')
+                rl_done = 1;
+            else if (c != CTRL('G'))
+                rl_execute_next(c);
+            break;
+        }
+
+        num_results = HI_search(history_index, query, results, FUZZY_RESULTS);
+        shown = 0;
+    }
+
+    rl_restore_prompt();
+    rl_clear_message();
+    MEM_free(saved_line);
+    return 0;
+}
+
+/*
+ * Appends a continuation line to the command line being entered
+ *
+ * Parameters:
+ *   cmdline   The command line so far, or NULL for a new command
+ *   line      The line just read
+ *
+ * Returns:
+ *   The (re)allocated command line, with lines separated by newlines
+ */
+static char *append_line(char *cmdline, const char *line)
+{
+    if (cmdline == NULL)
+        return MEM_strdup(MEM_TOKENS, line);
+
+    size_t len = strlen(cmdline);
+    cmdline = MEM_realloc(MEM_TOKENS, cmdline, len + strlen(line) + 2);
+
+    cmdline[len] = '\n';
+    strcpy(cmdline + len + 1, line);
+
+    return cmdline;
+}
+
+int main(int argc, char *argv[], char *envp[])
+{
+    shell_t shell;
     CList tokens = NULL;
+    TokState tok_state = TOK_state_new();
     pipeline_t *pipeline = NULL;
     char errmsg[100];
     char *user_input = NULL;
-    int status;
+    char *cmdline = NULL;
+    int status = 0;
+
+    // with -z, commands are launched by a zygote forked now, while the shell is small
+    int arg = 1;
+    shell.zygote = NULL;
+    if (argc > arg && strcmp(argv[arg], "-z") == 0)
+    {
+        arg++;
+        shell.zygote = ZYG_start();
+        if (shell.zygote == NULL)
+            perror("zygote");
+    }
+
+    // with --serve, command lines come from clients of a socket instead
+    const char *serve_path = NULL;
+    if (argc > arg + 1 && strcmp(argv[arg], "--serve") == 0)
+    {
+        serve_path = argv[arg + 1];
+        arg += 2;
+    }
+
+    // a script to run instead of reading commands from the terminal
+    const char *script = argc > arg ? argv[arg] : NULL;
+
+    // the variables start out as the environment the shell was given
+    shell.vars = VAR_new();
+    shell.status = 0;
+    shell.funcs = FUNC_new();
+    shell.tok_state = tok_state;
+    shell.exiting = false;
+    shell.readbuf = RB_new();
+    shell.read_ahead = false;
+    shell.in_fd = STDIN_FILENO;
+    shell.out_fd = STDOUT_FILENO;
+    shell.err_fd = STDERR_FILENO;
+    shell.call_depth = 0;
+    VAR_import(shell.vars, envp);
+    VAR_set(shell.vars, "?", "0");
+    TOK_state_set_vars(tok_state, shell.vars);
+    TOK_state_set_subst(tok_state, EXEC_command_substitution, &shell);
+
+    // the caches start from the last session's, where they are still valid
+    const char *snap_file = snapshot_file(shell.vars);
+    SnapReader snap = snap_file != NULL ? SNAP_open(snap_file) : NULL;
+
+    shell.pathcache = PC_new();
+    if (snap != NULL)
+        PC_load(shell.pathcache, snap);
+    hook_vars = shell.vars;
+
+    // lines that are run again reuse their tokens and pipeline
+    shell.parsecache = PCACHE_new(PARSE_CACHE_SIZE);
+    TOK_state_set_glob(tok_state, speculative_glob, &shell);
+
+    // a script has no prompt, history or completion, and leaves the
+    // snapshot to interactive shells
+    if (script != NULL)
+    {
+        SNAP_close(snap);
+        status = run_script(&shell, tok_state, script);
+        goto done;
+    }
+
+    // the serving shell forks for each request, so it runs no helper thread
+    // that could hold a lock in the child; it finds commands itself instead
+    if (serve_path != NULL)
+    {
+        SNAP_close(snap);
+        status = SRV_serve(serve_path, serve_warm, serve_run, serve_run_pipeline, &shell);
+        goto done;
+    }
+
+    // commands and globs are looked up on a helper thread while they are
+    // typed, which only happens on a terminal
+    if (isatty(STDIN_FILENO))
+        speculator = SPEC_new(shell.pathcache);
+    if (speculator != NULL)
+        rl_event_hook = speculate_hook;
+
+    // Ctrl-X r searches the history through a trigram index
+    rl_add_defun("fuzzy-history-search", fuzzy_history_search, -1);
+    rl_bind_keyseq("\\C-xr", fuzzy_history_search);
+
+    // the first word completes to a command name, from an index of the PATH
+    // that is built in the background and kept current with inotify
+    const char *extra[64] = {"exit", "quit"};
+    for (int i = 0; builtin_name(i) != NULL && i + 3 < 64; i++)
+        extra[i + 2] = builtin_name(i);
+    command_index = CI_new(VAR_get(shell.vars, "PATH"), extra, snap);
+    if (command_index != NULL)
+        rl_attempted_completion_function = complete_command;
+
+    // only the newest commands are read from the history file, whose pages
+    // are mapped rather than read in
+    history = open_history(shell.vars);
+    if (history != NULL)
+        HIST_load_tail(history, HISTORY_LOAD_MAX, load_history_line, NULL);
+
+    // the shell's own writes to a closed pipe fail with EPIPE; children get
+    // the default action back before running their commands
+    signal(SIGPIPE, SIG_IGN);
 
     fprintf(stdout, "Welcome to Plaid Shell!\n");
     const char *terminal = "#? ";
+    const char *continuation = "> ";
 
     while (1)
     {
-        // read the user input
-        user_input = readline(terminal);
+        // read the user input, prompting for a continuation if the last line was incomplete
+        user_input = readline(TOK_state_incomplete(tok_state) ? continuation : terminal);
+
+        // end of input, which may leave a command unfinished
+        if (user_input == NULL)
+        {
+            if (TOK_state_end_input(tok_state, errmsg, sizeof(errmsg)))
+            {
+                dprintf(shell.err_fd, "%s\n", errmsg);
+                status = 2;
+            }
+            break;
+        }
 
         // if the user entered nothing or spaces, loop again
-        while (user_input != NULL && *user_input != '\0' && isspace(*user_input))
-            user_input++;
+        char *line = user_input;
+        while (*line != '\0' && isspace(*line))
+            line++;
 
-        if (user_input == NULL || *user_input == '\0')
+        if (*line == '\0' && !TOK_state_incomplete(tok_state))
+        {
+            free(user_input);
             continue;
+        }
 
-        // store history of commands
-        add_history(user_input);
+        // a line run before is reused while nothing it was expanded from has changed
+        bool single_line = !TOK_state_incomplete(tok_state);
+        if (single_line && (pipeline = PCACHE_lookup(shell.parsecache, line, VAR_generation(shell.vars))) != NULL)
+        {
+            remember_command(line);
+            free(user_input);
+            user_input = NULL;
+            status = EXEC_run_pipeline(&shell, pipeline);
+            if (shell.exiting)
+                break;
+            continue;
+        }
 
-        // tokenize the user input
-        tokens = TOK_tokenize_input(user_input, errmsg, sizeof(errmsg));
+        // tokenize the new line, resuming from any earlier incomplete lines
+        if (single_line)
+            PCACHE_begin(shell.parsecache, line, VAR_generation(shell.vars));
+        cmdline = append_line(cmdline, single_line ? line : user_input);
+        tokens = TOK_tokenize_chunk(tok_state, user_input, errmsg, sizeof(errmsg));
+        free(user_input);
+        user_input = NULL;
+
+        // the command continues on the next line
+        if (tokens == NULL && TOK_state_incomplete(tok_state))
+            continue;
+
+        remember_command(cmdline);
+        MEM_free(cmdline);
+        cmdline = NULL;
 
         // check for errors while tokenizing
-        if (strlen(errmsg) > 0)
+        if (tokens == NULL)
         {
-            printf("%s\n", errmsg);
-            CL_free(tokens);
+            dprintf(shell.err_fd, "%s\n", errmsg);
             continue;
         }
 
@@ -299,47 +844,77 @@ int main()
             continue;
         }
 
+        // a for, while or if is parsed into a tree that runs its pipelines
+        if (CTL_is_compound(tokens))
+        {
+            bool go_on = run_compound(&shell, tok_state, tokens);
+            status = shell.status;
+            if (!go_on)
+                break;
+            continue;
+        }
+
         // build the pipeline from the list of tokens
         pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
 
         if (pipeline == NULL)
         {
-            printf("%s\n", errmsg);
+            dprintf(shell.err_fd, "%s\n", errmsg);
             CL_free(tokens);
             continue;
         }
 
-        if (pipeline->head->args[0] && (strcmp(pipeline->head->args[0], "exit") == 0 || strcmp(pipeline->head->args[0], "quit") == 0))
+        if (EXEC_is_exit(pipeline))
         {
             CL_free(tokens);
             pipeline_free(pipeline);
-            free(user_input);
-            exit(0);
+            status = 0;
+            break;
         }
 
         if (strlen(errmsg) > 0)
         {
-            printf("%s\n", errmsg);
+            dprintf(shell.err_fd, "%s\n", errmsg);
             CL_free(tokens);
             pipeline_free(pipeline);
             continue;
         }
 
         // execute the pipeline
-        status = execute_pipeline(pipeline);
+        status = EXEC_run_pipeline(&shell, pipeline);
+
+        // exit in a function stops the shell
+        if (shell.exiting)
+        {
+            CL_free(tokens);
+            pipeline_free(pipeline);
+            break;
+        }
+
+        // a command typed on one line is kept for the next time it is run
+        if (single_line && PCACHE_insert(shell.parsecache, tokens, pipeline))
+            continue;
 
         // free the memory
         CL_free(tokens);
         pipeline_free(pipeline);
-        free(user_input);
-        user_input = NULL;
     }
 
-    if (user_input != NULL)
-    {
-        free(user_input);
-        user_input = NULL;
-    }
+    save_snapshot(&shell);
+
+done:
+    MEM_free(cmdline);
+    TOK_state_free(tok_state);
+    HI_free(history_index);
+    HIST_close(history);
+    CI_free(command_index);
+    SPEC_free(speculator);
+    PCACHE_free(shell.parsecache);
+    FUNC_free(shell.funcs);
+    RB_free(shell.readbuf);
+    PC_free(shell.pathcache);
+    VAR_free(shell.vars);
+    ZYG_stop(shell.zygote);
 
     exit(status);
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+/*
+ * plaidc.c
+ *
+ * A client for a shell started with --serve: runs a command line on it
+ * with this process's working directory, standard input, output and
+ * error, and exits with the command line's status
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include "serve.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s SOCKET COMMAND...\n", argv[0]);
+        return 2;
+    }
+
+    // the words after the socket are the command line, as they would be typed
+    size_t len = 0;
+    for (int i = 2; i < argc; i++)
+        len += strlen(argv[i]) + 1;
+
+    char *command = malloc(len);
+    assert(command != NULL);
+    command[0] = '\0';
+    for (int i = 2; i < argc; i++)
+    {
+        if (i > 2)
+            strcat(command, " ");
+        strcat(command, argv[i]);
+    }
+
+    int status;
+    if (SRV_request(argv[1], command, &status) != 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+        status = 255;
+    }
+
+    free(command);
+    return status;
+}
@@ -42,7 +42,34 @@ tests = [
      "README +'best sitcoms.txt'[ \t]+'seven dwarfs.txt'[ \t]+shells.txt", 1),
     ("ls *.txt",
      "'best sitcoms.txt'[ \t]+'seven dwarfs.txt'[ \t]+shells.txt", 1),
-    ("echo $PATH", "\\$PATH", 1),
+    ("echo $PATH", "\r" + re.escape(os.getenv("PATH")), 1),
+    ("export GREETING=hello", "", 1),
+    ("echo $GREETING ${GREETING}world \"$GREETING there\" \\$GREETING",
+     "hello helloworld hello there \\$GREETING", 1),
+    ("env | grep GREETING", "GREETING=hello", 1),
+    ("unset GREETING", "", 1),
+    ("echo x${GREETING}x", "\rxx\r", 1),
+    ("echo [$(echo a   b)] \"$(seq 2 | wc -l)\"", "\\[a b\\] 2", 1),
+    ("echo $(seq 60) | wc -w", "\r60\r", 1),
+    ("echo $(author)", "\rNiyomwungeri Parmenide ISHIMWE", 1),
+    ("cat <<END | wc -l\none\ntwo\nEND", "\r2\r", 1),
+    ("tr a-z A-Z <<< \"$(author)\"", "NIYOMWUNGERI PARMENIDE ISHIMWE", 1),
+    ("diff <(seq 3) <(seq 4)", "3a4\r\n> 4", 1),
+    ("echo hi | tee >(tr a-z A-Z) > /dev/null", "\rHI\r", 1),
+    ("printf \"%3d|%-4s|%x\\n\" 7 ab 255", "  7\\|ab  \\|ff", 1),
+    ("[ -f /nonexistent ]", "", 1),
+    ("echo $?", "\r1\r", 1),
+    ("[ 1 -lt 2", "\\[: missing '\\]'", 1),
+    ("echo -n one | tr a-z A-Z", "\rONE", 1),
+    ("seq 1000 | grep -F 99 | wc -l", "\r19\r", 1),
+    ("seq 1000 | head -n 3 | wc", "      3       3       6", 1),
+    ("printf \"%s\\n\" a1 b2 a3 | grep -F a | head -1 | wc -c", "\r3\r", 1),
+    ("yes | head -2", "y\r\ny\r\n(?=[^#]*#\\? )", 1),
+    ("set PLAID_KILL_UPSTREAM=1", "", 1),
+    ("sleep 5 | /bin/true", "true\r\n(?=[^#]*#\\? )", 1),
+    ("unset PLAID_KILL_UPSTREAM", "", 1),
+    ("hash -r", "", 1),
+    ("hash no-such-command-here", "hash: no-such-command-here: not found", 1),
     ("author", "", 1),
     ("author | sed -e \"s/^/Written by /\"", "Written by ", 1),
     ("grep Happy *.txt",
@@ -76,7 +103,8 @@ tests = [
     #  "1[ \t]+1[ \t]+1[ \t]+Hello World", 2),
     ("echo \\c", "Illegal escape character '?c", 2),
     ("echo \"\\c\"", "Illegal escape character '?c", 1),
-    ("echo \"hi", "Unterminated quote", 2),
+    ("echo \"hi\nthere\"", "hi\r\nthere", 2),
+    ("echo con\\\ntinued", "continued", 1),
     ("echo \"|1|2|3|\" | sed -e \"s/[0-9]//\"", "||||", 1),
     ("printf \"=%s=\\n\" one two three four five six seven eight nine ten "
      "eleven twelve thirteen fourteen fifteen sixteen seventeen eighteen "
@@ -131,6 +159,23 @@ def run_tests(executable):
     else:
         print(f"FAIL: plaidsh exited with status {child.exitstatus}")
 
+    # input that ends in the middle of a command is an error, not dropped
+    for (inp, exp_result) in [("echo \"hi\n", "Unterminated quote"),
+                              ("echo con\\\n", "Unterminated escape")]:
+        total_pts += 1
+        eof_child = pexpect.spawn("/bin/sh", ["-c", f"printf '{inp}' | {executable}"],
+                                  encoding='utf-8', timeout=1)
+        try:
+            eof_child.expect(exp_result)
+            eof_child.expect(pexpect.EOF)
+            eof_child.close()
+            if (eof_child.exitstatus != 0):
+                score_pts += 1
+            else:
+                print(f"FAIL: Input '{inp}' at end of input: exited with status 0")
+        except (pexpect.TIMEOUT, pexpect.EOF):
+            print(f"FAIL: Input '{inp}' at end of input: Expected '{exp_result}'")
+
     # check for memory leaks
     total_pts += 5
     if (child.before.find("memory leak") < 0):
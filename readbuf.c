@@ -0,0 +1,179 @@
+/*
+ * readbuf.c
+ *
+ * A growable buffer of input that has been read but not yet returned,
+ * and the file or pipe it came from
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "readbuf.h"
+#include "mem.h"
+
+// how much is read at a time, when more than a byte may be
+#define RB_BLOCK 65536
+
+struct _readbuf
+{
+    char *data;
+    size_t cap;   // always more than len, for the NUL after a last line
+    size_t start; // the first byte not yet returned
+    size_t len;   // the bytes read into data
+
+    // where the data came from; a regular file is checked for changes
+    bool valid;
+    bool regular;
+    dev_t dev;
+    ino_t ino;
+    off_t base; // the offset in a regular file of data[0]
+    off_t size;
+    struct timespec mtime;
+};
+
+/*
+ * Forget the data, which came from a different file or pipe, and note
+ * where the next data comes from
+ */
+static void _RB_reset(ReadBuf rb, const struct stat *st, bool regular, off_t offset)
+{
+    rb->start = 0;
+    rb->len = 0;
+    rb->valid = true;
+    rb->regular = regular;
+    rb->dev = st->st_dev;
+    rb->ino = st->st_ino;
+    rb->base = offset;
+    rb->size = st->st_size;
+    rb->mtime = st->st_mtim;
+}
+
+/*
+ * Find where the next line starts in the data, keeping what is still
+ * valid of it
+ *
+ * Returns: true if the fd is a regular file, to be read with pread()
+ */
+static bool _RB_resume(ReadBuf rb, int fd, const struct stat *st)
+{
+    bool same = rb->valid && rb->dev == st->st_dev && rb->ino == st->st_ino;
+
+    if (S_ISREG(st->st_mode))
+    {
+        // the offset may have been moved by a command that read the file
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset >= 0)
+        {
+            if (same && rb->regular && rb->size == st->st_size && rb->mtime.tv_sec == st->st_mtim.tv_sec &&
+                rb->mtime.tv_nsec == st->st_mtim.tv_nsec && offset >= rb->base && offset <= rb->base + (off_t)rb->len)
+                rb->start = offset - rb->base;
+            else
+                _RB_reset(rb, st, true, offset);
+
+            return true;
+        }
+    }
+
+    // what was read ahead from a pipe comes before what is still in it
+    if (!same || rb->regular)
+        _RB_reset(rb, st, false, 0);
+
+    return false;
+}
+
+// Documented in .h file
+ReadBuf RB_new()
+{
+    ReadBuf rb = (ReadBuf)MEM_calloc(MEM_IO, 1, sizeof(struct _readbuf));
+    assert(rb != NULL);
+
+    rb->cap = RB_BLOCK + 1;
+    rb->data = MEM_alloc(MEM_IO, rb->cap);
+    assert(rb->data != NULL);
+
+    return rb;
+}
+
+// Documented in .h file
+void RB_free(ReadBuf rb)
+{
+    if (rb == NULL)
+        return;
+
+    MEM_free(rb->data);
+    MEM_free(rb);
+}
+
+// Documented in .h file
+char *RB_read_line(ReadBuf rb, int fd, bool read_ahead, size_t *len)
+{
+    struct stat st;
+
+    assert(rb != NULL && len != NULL);
+
+    if (fstat(fd, &st) != 0)
+        return NULL;
+
+    bool regular = _RB_resume(rb, fd, &st);
+    bool blocks = regular || (read_ahead && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)));
+    size_t scanned = rb->start;
+    char *newline;
+
+    while ((newline = memchr(rb->data + scanned, '\n', rb->len - scanned)) == NULL)
+    {
+        // make room at the end, first by dropping the lines returned
+        if (rb->start > 0 && rb->len + RB_BLOCK >= rb->cap)
+        {
+            memmove(rb->data, rb->data + rb->start, rb->len - rb->start);
+            rb->base += rb->start;
+            rb->len -= rb->start;
+            rb->start = 0;
+        }
+
+        if (rb->len + 1 >= rb->cap)
+        {
+            rb->cap *= 2;
+            rb->data = MEM_realloc(MEM_IO, rb->data, rb->cap);
+            assert(rb->data != NULL);
+        }
+
+        scanned = rb->len;
+        size_t want = blocks ? rb->cap - rb->len - 1 : 1;
+        ssize_t n = regular ? pread(fd, rb->data + rb->len, want, rb->base + rb->len)
+                            : read(fd, rb->data + rb->len, want);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return NULL;
+
+        // at the end of the input, the rest is the last line
+        if (n == 0)
+        {
+            if (rb->start == rb->len)
+                return NULL;
+            break;
+        }
+
+        rb->len += n;
+    }
+
+    char *line = rb->data + rb->start;
+    size_t end = newline != NULL ? newline - rb->data : rb->len;
+
+    rb->data[end] = '\0';
+    *len = end - rb->start;
+    rb->start = newline != NULL ? end + 1 : end;
+
+    // leave the file where the next command expects it
+    if (regular)
+        lseek(fd, rb->base + rb->start, SEEK_SET);
+
+    return line;
+}
@@ -0,0 +1,60 @@
+/*
+ * readbuf.h
+ *
+ * Line input for the read builtin that takes as few system calls as it
+ * can without using up input that belongs to other commands. A regular
+ * file is read in blocks, and its offset is moved back to just after
+ * the line returned; a pipe is read in blocks only when nothing else
+ * reads it, and one byte at a time otherwise.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _READBUF_H_
+#define _READBUF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// struct _readbuf to be used in the .c as ReadBuf
+typedef struct _readbuf *ReadBuf;
+
+/*
+ * Create a new, empty read buffer
+ *
+ * Parameters: None
+ *
+ * Returns: The new buffer
+ */
+ReadBuf RB_new();
+
+/*
+ * Destroy a read buffer, dropping any input it holds
+ *
+ * Parameters:
+ *   rb       The buffer, or NULL
+ *
+ * Returns: None
+ */
+void RB_free(ReadBuf rb);
+
+/*
+ * Read the next line of an fd. Input read ahead from a pipe is kept in
+ * the buffer for the next call on the same pipe, so later lines come
+ * from it first. A block read from a regular file is kept while the
+ * file is unchanged and the fd's offset is inside it, so a loop over a
+ * file takes no read() for most lines.
+ *
+ * Parameters:
+ *   rb          The buffer
+ *   fd          The fd to read
+ *   read_ahead  Whether a pipe or socket may be read in blocks, because
+ *               no other command reads it
+ *   len         Return space for the length of the line
+ *
+ * Returns: The line, without its newline and terminated by a NUL, valid
+ *   until the next call; a last line with no newline is returned as
+ *   well. NULL at the end of the input, or on an error with errno set.
+ */
+char *RB_read_line(ReadBuf rb, int fd, bool read_ahead, size_t *len);
+
+#endif /* _READBUF_H_ */
@@ -0,0 +1,165 @@
+/**
+ * readbuf_test.c
+ *
+ * This file contains the test cases for readbuf.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "readbuf.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Returns true if the next line of fd is expected
+ */
+static bool next_line(ReadBuf rb, int fd, bool read_ahead, const char *expected)
+{
+    size_t len;
+    char *line = RB_read_line(rb, fd, read_ahead, &len);
+
+    return line != NULL && len == strlen(expected) && strcmp(line, expected) == 0;
+}
+
+/*
+ * Tests reading a regular file, whose offset is left after each line
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_regular_file()
+{
+    char path[] = "/tmp/readbuf_test.XXXXXX";
+    char rest[16] = {0};
+    size_t len;
+    ReadBuf rb = RB_new();
+    int fd = mkstemp(path);
+
+    test_assert(fd != -1);
+    test_assert(write(fd, "one\n\nthree 3\nfour\nfive", 22) == 22);
+    lseek(fd, 0, SEEK_SET);
+
+    test_assert(next_line(rb, fd, false, "one"));
+    test_assert(lseek(fd, 0, SEEK_CUR) == 4);
+    test_assert(next_line(rb, fd, false, ""));
+    test_assert(next_line(rb, fd, false, "three 3"));
+
+    // another reader of the fd gets what comes after the line
+    test_assert(read(fd, rest, 5) == 5);
+    test_assert(strcmp(rest, "four\n") == 0);
+    test_assert(next_line(rb, fd, false, "five"));
+    test_assert(RB_read_line(rb, fd, false, &len) == NULL);
+
+    // a file that changed is read again
+    lseek(fd, 0, SEEK_SET);
+    test_assert(next_line(rb, fd, false, "one"));
+    test_assert(pwrite(fd, "ONE\nTWO!\n", 9, 0) == 9);
+    test_assert(ftruncate(fd, 9) == 0);
+    lseek(fd, 0, SEEK_SET);
+    test_assert(next_line(rb, fd, false, "ONE"));
+    test_assert(next_line(rb, fd, false, "TWO!"));
+    test_assert(RB_read_line(rb, fd, false, &len) == NULL);
+
+    close(fd);
+    unlink(path);
+    RB_free(rb);
+    return 1;
+
+test_error:
+    if (fd != -1)
+    {
+        close(fd);
+        unlink(path);
+    }
+    RB_free(rb);
+    return 0;
+}
+
+/*
+ * Tests reading a pipe, in blocks or a byte at a time
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_pipe()
+{
+    int fds[2] = {-1, -1};
+    char rest[16] = {0};
+    size_t len;
+    ReadBuf rb = RB_new();
+    char *long_line = malloc(200001);
+
+    test_assert(pipe(fds) == 0);
+
+    // without read ahead, the rest stays in the pipe
+    test_assert(write(fds[1], "a b\nc\n", 6) == 6);
+    test_assert(next_line(rb, fds[0], false, "a b"));
+    test_assert(read(fds[0], rest, sizeof(rest)) == 2);
+    test_assert(strcmp(rest, "c\n") == 0);
+
+    // with read ahead, what was read comes first, then the byte reads
+    test_assert(write(fds[1], "d\ne\nf\n", 6) == 6);
+    test_assert(next_line(rb, fds[0], true, "d"));
+    test_assert(write(fds[1], "g\n", 2) == 2);
+    test_assert(next_line(rb, fds[0], false, "e"));
+    test_assert(next_line(rb, fds[0], false, "f"));
+    test_assert(next_line(rb, fds[0], false, "g"));
+
+    // a line longer than a block grows the buffer
+    memset(long_line, 'x', 200000);
+    long_line[200000] = '\0';
+    if (fork() == 0)
+    {
+        close(fds[0]);
+        size_t n = 0;
+        while (n < 200000)
+            n += write(fds[1], long_line + n, 200000 - n);
+        _exit(write(fds[1], "\nlast", 5) != 5);
+    }
+    close(fds[1]);
+    fds[1] = -1;
+
+    test_assert(next_line(rb, fds[0], true, long_line));
+    test_assert(next_line(rb, fds[0], true, "last"));
+    test_assert(RB_read_line(rb, fds[0], true, &len) == NULL);
+    wait(NULL);
+
+    close(fds[0]);
+    free(long_line);
+    RB_free(rb);
+    return 1;
+
+test_error:
+    close(fds[0]);
+    close(fds[1]);
+    free(long_line);
+    RB_free(rb);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_regular_file();
+    num_tests++;
+    passed += test_pipe();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
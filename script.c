@@ -0,0 +1,581 @@
+/*
+ * script.c
+ *
+ * Compiled scripts, kept in a snapshot file with a "script" section:
+ * the version of the shell, the hash and size of the text they were
+ * compiled from, then the commands and an end marker. A command is its
+ * kind, then either its text or its pipeline: which redirections it
+ * has, the redirections, the number of nodes, and each node's type
+ * followed, for a command node, by its arguments with their types.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "script.h"
+#include "snapshot.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "control.h"
+#include "mem.h"
+
+#define SCR_SECTION "script"
+
+// what a compiled command is
+enum
+{
+    SC_END,      // there are no more commands
+    SC_SOURCE,   // text, tokenized when it is run
+    SC_PIPELINE, // a parsed pipeline
+};
+
+// the redirections a compiled pipeline has
+#define SC_INPUT 1
+#define SC_OUTPUT 2
+#define SC_INPUT_DATA 4
+
+// a command of a loaded script; the strings point into the mapped file
+struct _script_cmd
+{
+    const char *source; // the text, or NULL if the command has a pipeline
+    const char *input;
+    const char *output;
+    const char *input_data;
+    int first_node; // the command's nodes in the script's nodes
+    int num_nodes;
+};
+
+struct _script_node
+{
+    TokenType type;
+    int first_arg; // the node's arguments in the script's args
+    int num_args;
+};
+
+struct _script_arg
+{
+    TokenType type; // TOK_WORD, or TOK_PROCSUB_IN/OUT
+    const char *text;
+};
+
+struct _script
+{
+    SnapReader snap; // the compiled form, or NULL
+    char *text;      // the script, when it is run from its text
+    bool cached;     // the compiled form was saved by an earlier run
+
+    struct _script_cmd *cmds;
+    int length;
+    int cmds_cap;
+    struct _script_node *nodes;
+    int num_nodes;
+    int nodes_cap;
+    struct _script_arg *args;
+    int num_args;
+    int args_cap;
+
+    // the pipeline last asked for, which is built again for each command
+    pipeline_t *pipeline;
+};
+
+/*
+ * Read a whole script
+ *
+ * Parameters:
+ *   file     The script
+ *   size     Return space for its size
+ *
+ * Returns: The text, NUL-terminated, or NULL with errno set
+ */
+static char *_SCR_read(const char *file, size_t *size)
+{
+    struct stat st;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    char *text = NULL;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && (text = MEM_alloc(MEM_PIPELINE, st.st_size + 1)) != NULL)
+    {
+        ssize_t n;
+        while (len < st.st_size && (n = read(fd, text + len, st.st_size - len)) > 0)
+            len += n;
+        text[len] = '\0';
+    }
+
+    close(fd);
+    *size = len;
+    return text;
+}
+
+/*
+ * The file the compiled form of a script is kept in
+ *
+ * Parameters:
+ *   file       The script
+ *   cache_dir  The directory to keep it in, or NULL to keep it next to
+ *              the script
+ *   hash       The hash of the script's text
+ *
+ * Returns: The path, to be freed by the caller
+ */
+static char *_SCR_compiled_file(const char *file, const char *cache_dir, uint64_t hash)
+{
+    char *path = NULL;
+    int len = strlen(file);
+    int n;
+
+    if (cache_dir != NULL)
+        n = asprintf(&path, "%s/%016" PRIx64 ".pshc", cache_dir, hash);
+    else
+    {
+        if (len > 4 && strcmp(file + len - 4, ".psh") == 0)
+            len -= 4;
+        n = asprintf(&path, "%.*s.pshc", len, file);
+    }
+
+    assert(n > 0);
+    return path;
+}
+
+/*
+ * Make room for one more element at the end of an array
+ *
+ * Parameters:
+ *   array    The array, which may be moved
+ *   count    The number of elements in it
+ *   cap      The number it has room for, updated
+ *   size     The size of an element
+ */
+static void _SCR_grow(void **array, int count, int *cap, size_t size)
+{
+    if (count < *cap)
+        return;
+
+    *cap = *cap ? *cap * 2 : 16;
+    *array = MEM_realloc(MEM_PIPELINE, *array, *cap * size);
+    assert(*array != NULL);
+}
+
+/*
+ * Add a command to a script, with no pipeline yet
+ *
+ * Returns: The command
+ */
+static struct _script_cmd *_SCR_add(Script script, const char *source)
+{
+    _SCR_grow((void **)&script->cmds, script->length, &script->cmds_cap, sizeof(struct _script_cmd));
+
+    struct _script_cmd *cmd = &script->cmds[script->length++];
+    *cmd = (struct _script_cmd){source, NULL, NULL, NULL, script->num_nodes, 0};
+    return cmd;
+}
+
+/*
+ * Add a node to the pipeline of the last command of a script
+ *
+ * Returns: The node
+ */
+static struct _script_node *_SCR_add_node(Script script, TokenType type)
+{
+    _SCR_grow((void **)&script->nodes, script->num_nodes, &script->nodes_cap, sizeof(struct _script_node));
+    script->cmds[script->length - 1].num_nodes++;
+
+    struct _script_node *node = &script->nodes[script->num_nodes++];
+    *node = (struct _script_node){type, script->num_args, 0};
+    return node;
+}
+
+/*
+ * Add an argument to the last node of a script
+ */
+static void _SCR_add_arg(Script script, TokenType type, const char *text)
+{
+    _SCR_grow((void **)&script->args, script->num_args, &script->args_cap, sizeof(struct _script_arg));
+    script->nodes[script->num_nodes - 1].num_args++;
+    script->args[script->num_args++] = (struct _script_arg){type, text};
+}
+
+/*
+ * Remove the commands of a script
+ */
+static void _SCR_clear(Script script)
+{
+    script->length = 0;
+    script->num_nodes = 0;
+    script->num_args = 0;
+}
+
+/*
+ * A glob callback for compiling: a glob is expanded when the command is
+ * run, so the command is left as text
+ */
+static char **_SCR_note_glob(const char *pattern, void *cb_data)
+{
+    *(bool *)cb_data = true;
+    return NULL;
+}
+
+/*
+ * Add a pipeline to a compiled script
+ */
+static void _SCR_put_pipeline(SnapWriter w, pipeline_t *pipeline)
+{
+    uint64_t redirs = (pipeline->input != NULL ? SC_INPUT : 0) |
+                      (pipeline->output != NULL ? SC_OUTPUT : 0) |
+                      (pipeline->input_data != NULL ? SC_INPUT_DATA : 0);
+
+    SNAP_put_u64(w, SC_PIPELINE);
+    SNAP_put_u64(w, redirs);
+    if (pipeline->input != NULL)
+        SNAP_put_str(w, pipeline->input);
+    if (pipeline->output != NULL)
+        SNAP_put_str(w, pipeline->output);
+    if (pipeline->input_data != NULL)
+        SNAP_put_str(w, pipeline->input_data);
+
+    SNAP_put_u64(w, pipeline->length);
+    for (pipeline_cmd_t *node = pipeline->head; node != NULL; node = node->next)
+    {
+        SNAP_put_u64(w, node->type);
+        if (node->type != TOK_WORD && node->type != TOK_QUOTED_WORD)
+            continue;
+
+        SNAP_put_u64(w, node->num_args);
+        for (int i = 0; i < node->num_args; i++)
+        {
+            SNAP_put_u64(w, node->arg_types[i]);
+            SNAP_put_str(w, node->args[i]);
+        }
+    }
+}
+
+/*
+ * Add a command to a compiled script: its pipeline if it was tokenized
+ * and parsed without expanding anything, or else its text, which is
+ * tokenized again when it is run so that any error is reported then
+ *
+ * Parameters:
+ *   w          The compiled script
+ *   text       The lines of the command
+ *   len        The length of text
+ *   tokens     The tokens of the command, or NULL if it had an error
+ *   expands    Whether the command has a glob
+ */
+static void _SCR_put_command(SnapWriter w, const char *text, size_t len, CList tokens, bool expands)
+{
+    char errmsg[100] = "";
+    pipeline_t *pipeline = NULL;
+
+    // a '$' might be a variable or a command substitution, and a for, while
+    // or if is parsed into its own tree when it is run
+    if (tokens != NULL && !expands && memchr(text, '$', len) == NULL && !CTL_is_compound(tokens))
+    {
+        // a line of empty words does nothing
+        if (tokens->length == 0)
+            return;
+
+        pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    }
+
+    if (pipeline != NULL && errmsg[0] == '\0')
+        _SCR_put_pipeline(w, pipeline);
+    else
+    {
+        char *source = MEM_strndup(MEM_TOKENS, text, len);
+        SNAP_put_u64(w, SC_SOURCE);
+        SNAP_put_str(w, source);
+        MEM_free(source);
+    }
+
+    pipeline_free(pipeline);
+}
+
+/*
+ * Compile a script and save the compiled form. The script is split into
+ * commands as the shell reads them, a line at a time: blank lines are
+ * skipped, and a command continues over the lines of an open quote, an
+ * escaped newline or a here-document.
+ *
+ * Parameters:
+ *   text       The script
+ *   size       The size of the script
+ *   hash       The hash of the script
+ *   compiled   The file to save the compiled form in
+ *
+ * Returns: true if it was saved, false otherwise
+ */
+static bool _SCR_compile(const char *text, size_t size, uint64_t hash, const char *compiled)
+{
+    char errmsg[100];
+    bool expands = false;
+    const char *end = text + size;
+    const char *start = text;
+
+    SnapWriter w = SNAP_new();
+    SNAP_section(w, SCR_SECTION);
+    SNAP_put_str(w, PLAID_VERSION);
+    SNAP_put_u64(w, hash);
+    SNAP_put_u64(w, size);
+
+    // no variables or substitutions, which are left for when the command is run
+    TokState state = TOK_state_new();
+    TOK_state_set_glob(state, _SCR_note_glob, &expands);
+
+    const char *p = text;
+    while (p < end)
+    {
+        const char *line_start = p;
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl != NULL ? nl : end;
+        char *line = MEM_strndup(MEM_TOKENS, p, line_end - p);
+        p = nl != NULL ? nl + 1 : end;
+
+        if (!TOK_state_incomplete(state))
+        {
+            const char *c = line;
+            while (*c != '\0' && isspace(*c))
+                c++;
+
+            if (*c == '\0')
+            {
+                MEM_free(line);
+                continue;
+            }
+
+            start = line_start;
+            expands = false;
+        }
+
+        CList tokens = TOK_tokenize_chunk(state, line, errmsg, sizeof(errmsg));
+        MEM_free(line);
+
+        if (tokens == NULL && TOK_state_incomplete(state))
+            continue;
+
+        _SCR_put_command(w, start, line_end - start, tokens, expands);
+        CL_free(tokens);
+    }
+
+    // the script ends in the middle of a command
+    if (TOK_state_incomplete(state))
+        _SCR_put_command(w, start, end - start, NULL, true);
+
+    SNAP_put_u64(w, SC_END);
+    bool ok = SNAP_write(w, compiled);
+
+    TOK_state_free(state);
+    SNAP_free(w);
+    return ok;
+}
+
+/*
+ * Read a pipeline from a compiled script into a new command
+ *
+ * Returns: true on success, false if the compiled script is malformed
+ */
+static bool _SCR_get_pipeline(Script script, SnapReader r)
+{
+    uint64_t redirs, length, type, num_args, arg_type;
+    struct _script_cmd *cmd = _SCR_add(script, NULL);
+
+    if (!SNAP_get_u64(r, &redirs) ||
+        ((redirs & SC_INPUT) && (cmd->input = SNAP_get_str(r)) == NULL) ||
+        ((redirs & SC_OUTPUT) && (cmd->output = SNAP_get_str(r)) == NULL) ||
+        ((redirs & SC_INPUT_DATA) && (cmd->input_data = SNAP_get_str(r)) == NULL) ||
+        !SNAP_get_u64(r, &length) || length == 0)
+        return false;
+
+    for (uint64_t i = 0; i < length; i++)
+    {
+        if (!SNAP_get_u64(r, &type) || type > TOK_PROCSUB_OUT)
+            return false;
+
+        _SCR_add_node(script, type);
+        if (type != TOK_WORD && type != TOK_QUOTED_WORD)
+            continue;
+
+        if (!SNAP_get_u64(r, &num_args))
+            return false;
+
+        for (uint64_t j = 0; j < num_args; j++)
+        {
+            const char *text;
+            if (!SNAP_get_u64(r, &arg_type) || (text = SNAP_get_str(r)) == NULL)
+                return false;
+            _SCR_add_arg(script, arg_type, text);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Read the commands of a compiled script, if it was compiled from the
+ * same text by this version of the shell
+ *
+ * Parameters:
+ *   script   The script to add the commands to
+ *   r        The compiled script
+ *   hash     The hash of the text
+ *   size     The size of the text
+ *
+ * Returns: true on success, false if it cannot be used
+ */
+static bool _SCR_load(Script script, SnapReader r, uint64_t hash, size_t size)
+{
+    uint64_t file_hash, file_size, kind;
+
+    if (r == NULL || !SNAP_seek(r, SCR_SECTION))
+        return false;
+
+    const char *version = SNAP_get_str(r);
+    if (version == NULL || strcmp(version, PLAID_VERSION) != 0 ||
+        !SNAP_get_u64(r, &file_hash) || file_hash != hash ||
+        !SNAP_get_u64(r, &file_size) || file_size != size)
+        return false;
+
+    while (SNAP_get_u64(r, &kind))
+    {
+        if (kind == SC_END)
+            return true;
+
+        if (kind == SC_SOURCE)
+        {
+            const char *source = SNAP_get_str(r);
+            if (source == NULL)
+                break;
+            _SCR_add(script, source);
+        }
+
+        else if (kind != SC_PIPELINE || !_SCR_get_pipeline(script, r))
+            break;
+    }
+
+    _SCR_clear(script);
+    return false;
+}
+
+// Documented in .h file
+Script SCR_open(const char *file, const char *cache_dir)
+{
+    size_t size;
+    char *text = _SCR_read(file, &size);
+    if (text == NULL)
+        return NULL;
+
+    Script script = MEM_calloc(MEM_PIPELINE, 1, sizeof(struct _script));
+    assert(script != NULL);
+
+    uint64_t hash = SNAP_hash(text, size);
+    char *compiled = _SCR_compiled_file(file, cache_dir, hash);
+
+    script->snap = SNAP_open(compiled);
+    script->cached = _SCR_load(script, script->snap, hash, size);
+
+    // compiled now, and mapped like it will be by the next run
+    if (!script->cached)
+    {
+        SNAP_close(script->snap);
+        script->snap = _SCR_compile(text, size, hash, compiled) ? SNAP_open(compiled) : NULL;
+
+        if (!_SCR_load(script, script->snap, hash, size))
+        {
+            SNAP_close(script->snap);
+            script->snap = NULL;
+            script->text = text;
+            text = NULL;
+            _SCR_add(script, script->text);
+        }
+    }
+
+    free(compiled);
+    MEM_free(text);
+    return script;
+}
+
+// Documented in .h file
+void SCR_close(Script script)
+{
+    if (script == NULL)
+        return;
+
+    pipeline_free(script->pipeline);
+    MEM_free(script->cmds);
+    MEM_free(script->nodes);
+    MEM_free(script->args);
+    MEM_free(script->text);
+    SNAP_close(script->snap);
+    MEM_free(script);
+}
+
+// Documented in .h file
+int SCR_length(Script script)
+{
+    assert(script != NULL);
+    return script->length;
+}
+
+// Documented in .h file
+pipeline_t *SCR_pipeline(Script script, int n)
+{
+    assert(script != NULL && n >= 0 && n < script->length);
+    struct _script_cmd *cmd = &script->cmds[n];
+
+    pipeline_free(script->pipeline);
+    script->pipeline = NULL;
+    if (cmd->source != NULL)
+        return NULL;
+
+    // built from the mapped strings, but for the here-document, which
+    // the pipeline frees
+    pipeline_t *pipeline = pipeline_new();
+    pipeline_set_input(pipeline, (char *)cmd->input);
+    pipeline_set_output(pipeline, (char *)cmd->output);
+    pipeline_set_input_data(pipeline, cmd->input_data);
+
+    for (int i = cmd->first_node; i < cmd->first_node + cmd->num_nodes; i++)
+    {
+        struct _script_node *node = &script->nodes[i];
+        pipeline_cmd_t *pnode = pipeline_cmd_new(node->type);
+        pipeline_add_command(pipeline, pnode);
+
+        for (int j = node->first_arg; j < node->first_arg + node->num_args; j++)
+        {
+            struct _script_arg *arg = &script->args[j];
+            if (arg->type == TOK_PROCSUB_IN || arg->type == TOK_PROCSUB_OUT)
+                pipeline_cmd_add_procsub(pnode, arg->type, (char *)arg->text);
+            else
+                pipeline_cmd_add_arg(pnode, (char *)arg->text);
+        }
+    }
+
+    script->pipeline = pipeline;
+    return pipeline;
+}
+
+// Documented in .h file
+const char *SCR_source(Script script, int n)
+{
+    assert(script != NULL && n >= 0 && n < script->length);
+    return script->cmds[n].source;
+}
+
+// Documented in .h file
+bool SCR_cached(Script script)
+{
+    assert(script != NULL);
+    return script->cached;
+}
@@ -0,0 +1,100 @@
+/*
+ * script.h
+ *
+ * Scripts compiled to a binary form that is saved and memory-mapped by
+ * later runs. A command that expands nothing is stored as its pipeline,
+ * with the arguments already split; any other command is stored as its
+ * text and tokenized when it is run.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdbool.h>
+
+#include "pipeline.h"
+
+// the version of the shell that compiled a script; a script compiled by
+// another version is compiled again, so bump it when a line can tokenize
+// or parse differently
+#define PLAID_VERSION "1.2"
+
+// struct _script to be used in the .c as Script
+typedef struct _script *Script;
+
+/*
+ * Open a script, mapping the compiled form saved by an earlier run if it
+ * was compiled from the same text by this version of the shell, or
+ * compiling it and saving the compiled form for the next run. If it
+ * cannot be saved, the script is run from its text.
+ *
+ * The compiled form is saved next to the script, as NAME.pshc for
+ * NAME.psh or NAME, or in cache_dir, named by the hash of the text.
+ *
+ * Parameters:
+ *   file       The script
+ *   cache_dir  The directory for the compiled form, or NULL
+ *
+ * Returns: The script, or NULL if it could not be read, with errno set
+ */
+Script SCR_open(const char *file, const char *cache_dir);
+
+/*
+ * Close a script, unmapping its compiled form
+ *
+ * Parameters:
+ *   script   The script, or NULL
+ *
+ * Returns: None
+ */
+void SCR_close(Script script);
+
+/*
+ * Get the number of commands in a script
+ *
+ * Parameters:
+ *   script   The script
+ *
+ * Returns: The number of commands
+ */
+int SCR_length(Script script);
+
+/*
+ * Get the pipeline of a command that expands nothing. It is built from
+ * the compiled form each time, with its strings pointing into the
+ * mapped file.
+ *
+ * Parameters:
+ *   script   The script
+ *   n        The command, from 0
+ *
+ * Returns: The pipeline, owned by the script and valid until the script
+ *   is next used; or NULL if the command has to be tokenized
+ */
+pipeline_t *SCR_pipeline(Script script, int n);
+
+/*
+ * Get the text of a command that has to be tokenized when it is run
+ *
+ * Parameters:
+ *   script   The script
+ *   n        The command, from 0
+ *
+ * Returns: The lines of the command, separated by newlines; or NULL if
+ *   the command has a pipeline
+ */
+const char *SCR_source(Script script, int n);
+
+/*
+ * Check whether a script was run from a compiled form that an earlier
+ * run saved
+ *
+ * Parameters:
+ *   script   The script
+ *
+ * Returns: true if it was, false if it was compiled or read just now
+ */
+bool SCR_cached(Script script);
+
+#endif /* _SCRIPT_H_ */
@@ -0,0 +1,258 @@
+/**
+ * script_test.c
+ *
+ * This file contains the test cases for script.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "script.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+// a script with commands that can be compiled and commands that cannot
+static const char *script_text =
+    "echo hello world | wc -w\n"
+    "\n"
+    "echo $HOME\n"
+    "ls *.c > out.txt\n"
+    "cat <<END\n"
+    "one\n"
+    "\n"
+    "END\n"
+    "echo \"two\n"
+    "lines\" < in.txt\n"
+    "diff <(sort a) b\n"
+    "echo bad\\q\n";
+
+/*
+ * Writes a file
+ */
+static bool write_file(const char *file, const char *text)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    bool ok = write(fd, text, strlen(text)) == strlen(text);
+    close(fd);
+    return ok;
+}
+
+/*
+ * Finds the compiled script in a cache directory
+ *
+ * Parameters:
+ *   dir      The directory
+ *   file     Return space for the path of the compiled script
+ *   size     The size of file
+ *
+ * Returns: The number of compiled scripts in the directory
+ */
+static int find_compiled(const char *dir, char *file, size_t size)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    int count = 0;
+
+    while (d != NULL && (ent = readdir(d)) != NULL)
+    {
+        size_t len = strlen(ent->d_name);
+        if (len > 5 && strcmp(ent->d_name + len - 5, ".pshc") == 0)
+        {
+            snprintf(file, size, "%s/%s", dir, ent->d_name);
+            count++;
+        }
+    }
+
+    if (d != NULL)
+        closedir(d);
+    return count;
+}
+
+/*
+ * Checks the commands script_text is compiled to
+ *
+ * Returns: true if they are right, false otherwise
+ */
+static bool check_commands(Script script)
+{
+    pipeline_t *p;
+
+    if (SCR_length(script) != 7)
+        return false;
+
+    // the pipelines have their arguments split and redirections set
+    p = SCR_pipeline(script, 0);
+    if (p == NULL || p->length != 3 || strcmp(p->head->args[1], "hello") != 0 ||
+        p->head->args[3] != NULL || strcmp(p->head->next->next->args[0], "wc") != 0)
+        return false;
+
+    p = SCR_pipeline(script, 3);
+    if (p == NULL || strcmp(p->input_data, "one\n\n") != 0)
+        return false;
+
+    p = SCR_pipeline(script, 4);
+    if (p == NULL || strcmp(p->head->args[1], "two\nlines") != 0 || strcmp(p->input, "in.txt") != 0)
+        return false;
+
+    p = SCR_pipeline(script, 5);
+    if (p == NULL || p->head->arg_types[1] != TOK_PROCSUB_IN || strcmp(p->head->args[1], "sort a") != 0)
+        return false;
+
+    // variables, globs and errors are left for when the command is run
+    return SCR_pipeline(script, 1) == NULL && strcmp(SCR_source(script, 1), "echo $HOME") == 0 &&
+           SCR_pipeline(script, 2) == NULL && strcmp(SCR_source(script, 2), "ls *.c > out.txt") == 0 &&
+           SCR_pipeline(script, 6) == NULL && strcmp(SCR_source(script, 6), "echo bad\\q") == 0;
+}
+
+/*
+ * Tests compiling a script, and that the compiled form is used by the
+ * next run until the script changes
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_compile()
+{
+    char dir[] = "/tmp/plaid_script_XXXXXX";
+    char file[64];
+    char compiled[64];
+    Script script = NULL;
+    struct stat st;
+
+    test_assert(mkdtemp(dir) != NULL);
+    snprintf(file, sizeof(file), "%s/job.psh", dir);
+    snprintf(compiled, sizeof(compiled), "%s/job.pshc", dir);
+    test_assert(write_file(file, script_text));
+
+    // the first run compiles it next to the script
+    script = SCR_open(file, NULL);
+    test_assert(script != NULL && !SCR_cached(script));
+    test_assert(check_commands(script));
+    SCR_close(script);
+    test_assert(stat(compiled, &st) == 0);
+
+    // the next runs map it
+    script = SCR_open(file, NULL);
+    test_assert(script != NULL && SCR_cached(script));
+    test_assert(check_commands(script));
+    SCR_close(script);
+
+    // a changed script is compiled again
+    test_assert(write_file(file, "echo changed\n"));
+    script = SCR_open(file, NULL);
+    test_assert(script != NULL && !SCR_cached(script) && SCR_length(script) == 1);
+    test_assert(strcmp(SCR_pipeline(script, 0)->head->args[1], "changed") == 0);
+    SCR_close(script);
+
+    // as is one whose compiled form is damaged
+    test_assert(write_file(compiled, "PLAIDSNP garbage"));
+    script = SCR_open(file, NULL);
+    test_assert(script != NULL && !SCR_cached(script) && SCR_length(script) == 1);
+    SCR_close(script);
+    script = NULL;
+
+    test_assert(SCR_open("/tmp/no/such/script.psh", NULL) == NULL);
+
+    unlink(compiled);
+    unlink(file);
+    rmdir(dir);
+    return 1;
+
+test_error:
+    SCR_close(script);
+    unlink(compiled);
+    unlink(file);
+    rmdir(dir);
+    return 0;
+}
+
+/*
+ * Tests keeping compiled scripts in a cache directory, and running a
+ * script from its text when it cannot be compiled
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cache_dir()
+{
+    char dir[] = "/tmp/plaid_script_XXXXXX";
+    char cache_dir[64];
+    char file[64];
+    char compiled[128] = "";
+    Script script = NULL;
+
+    test_assert(mkdtemp(dir) != NULL);
+    snprintf(file, sizeof(file), "%s/job", dir);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+    test_assert(write_file(file, script_text));
+    test_assert(mkdir(cache_dir, 0755) == 0);
+
+    script = SCR_open(file, cache_dir);
+    test_assert(script != NULL && !SCR_cached(script));
+    SCR_close(script);
+    script = NULL;
+
+    // the compiled form is named by the hash of the script, not next to it
+    snprintf(compiled, sizeof(compiled), "%s/job.pshc", dir);
+    test_assert(access(compiled, F_OK) != 0);
+    test_assert(find_compiled(cache_dir, compiled, sizeof(compiled)) == 1);
+
+    script = SCR_open(file, cache_dir);
+    test_assert(script != NULL && SCR_cached(script));
+    test_assert(check_commands(script));
+    SCR_close(script);
+    script = NULL;
+
+    // without anywhere to keep it, the script is one command of text
+    script = SCR_open(file, "/tmp/no/such/dir");
+    test_assert(script != NULL && !SCR_cached(script) && SCR_length(script) == 1);
+    test_assert(SCR_pipeline(script, 0) == NULL && strcmp(SCR_source(script, 0), script_text) == 0);
+    SCR_close(script);
+    script = NULL;
+
+    unlink(compiled);
+    rmdir(cache_dir);
+    unlink(file);
+    rmdir(dir);
+    return 1;
+
+test_error:
+    SCR_close(script);
+    if (find_compiled(cache_dir, compiled, sizeof(compiled)) > 0)
+        unlink(compiled);
+    rmdir(cache_dir);
+    unlink(file);
+    rmdir(dir);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_compile();
+    num_tests++;
+    passed += test_cache_dir();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*
+ * serve.c
+ *
+ * A long-lived shell that runs command lines for local clients over a
+ * Unix domain socket
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "serve.h"
+
+// the largest request: the working directory and the command line
+#define SRV_MAX_MSG (64 * 1024)
+
+// the fds passed with a request: stdin, stdout and stderr
+#define SRV_NUM_FDS 3
+
+// the kinds of request
+#define SRV_COMMAND 'c'  // a command line
+#define SRV_PIPELINE 'p' // a pipeline encoded by FP_encode
+
+// a request is its kind, the working directory followed by a NUL, and
+// then the command line followed by a NUL or the encoded pipeline; the
+// reply is this
+struct srv_reply
+{
+    int status;
+};
+
+// a client connection, and the child running its request if any
+struct srv_client
+{
+    int sock;  // -1 once the client has hung up
+    pid_t pid; // 0 if no request is running
+    int pidfd;
+};
+
+// set by SIGTERM and SIGINT to stop serving
+static volatile sig_atomic_t srv_stop = 0;
+
+static void _SRV_on_stop(int sig)
+{
+    srv_stop = 1;
+}
+
+static int _SRV_pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/*
+ * Send a message, with fds attached if nfds > 0
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int _SRV_send(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+    struct iovec iov = {(void *)buf, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    char control[CMSG_SPACE(sizeof(int) * SRV_NUM_FDS)];
+
+    if (nfds > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t n;
+    do
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+
+    return n == len ? 0 : -1;
+}
+
+/*
+ * Receive a message and any fds attached to it
+ *
+ * Parameters:
+ *   sock     The socket
+ *   buf      Return space for the message
+ *   len      The size of buf
+ *   fds      Return space for up to SRV_NUM_FDS fds
+ *   nfds     Return space for the number of fds received
+ *
+ * Returns: The length of the message, 0 if the other end has closed
+ *   the socket, or -1 on error
+ */
+static ssize_t _SRV_recv(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+    struct iovec iov = {buf, len};
+    char control[CMSG_SPACE(sizeof(int) * SRV_NUM_FDS)];
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control, .msg_controllen = sizeof(control)};
+
+    ssize_t n;
+    do
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+
+    *nfds = 0;
+    if (n < 0)
+        return n;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+    }
+
+    return n;
+}
+
+/*
+ * Fill in the address of the socket at path
+ *
+ * Returns: true on success, false with errno set if path is too long
+ */
+static bool _SRV_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+/*
+ * Create the listening socket at path, replacing a socket there whose
+ * server is gone
+ *
+ * Returns: The socket, or -1 with errno set
+ */
+static int _SRV_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!_SRV_address(path, &addr))
+        return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        // a socket nobody accepts on is left over from a server that died
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        bool stale = errno == EADDRINUSE && probe >= 0 &&
+                     connect(probe, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == ECONNREFUSED;
+        if (probe >= 0)
+            close(probe);
+
+        if (!stale || unlink(path) != 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            if (stale)
+                errno = EADDRINUSE;
+            close(sock);
+            return -1;
+        }
+    }
+
+    if (listen(sock, SOMAXCONN) != 0)
+    {
+        int saved_errno = errno;
+        close(sock);
+        unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ * In the child forked for a request, make the client's fds and working
+ * directory its own and run the command line. Does not return.
+ *
+ * Parameters:
+ *   listener  The listening socket
+ *   clients   Every client connection, which the child must not hold
+ *   count     The number of clients
+ *   buf       The request
+ *   len       The length of the request
+ *   fds       The client's stdin, stdout and stderr
+ *   run       The function that runs a command line
+ *   run_pipeline  The function that runs an encoded pipeline
+ *   cb_data   Caller data for run and run_pipeline
+ */
+static void _SRV_run_child(int listener, struct srv_client *clients, int count, char *buf, size_t len,
+                           int *fds, SRV_run_callback run, SRV_run_pipeline_callback run_pipeline, void *cb_data)
+{
+    char *cwd = buf + 1;
+    char *body = cwd + strlen(cwd) + 1;
+
+    // the request's commands are in its own group, to be hung up together
+    setpgid(0, 0);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+
+    // a client that hangs up must see the end of the connection even
+    // while other requests run
+    close(listener);
+    for (int i = 0; i < count; i++)
+    {
+        if (clients[i].sock >= 0)
+            close(clients[i].sock);
+        if (clients[i].pid != 0)
+            close(clients[i].pidfd);
+    }
+
+    for (int i = 0; i < SRV_NUM_FDS; i++)
+        dup2(fds[i], i);
+    for (int i = 0; i < SRV_NUM_FDS; i++)
+    {
+        if (fds[i] >= SRV_NUM_FDS)
+            close(fds[i]);
+    }
+
+    if (chdir(cwd) != 0)
+    {
+        perror(cwd);
+        _exit(1);
+    }
+
+    int status;
+    if (buf[0] == SRV_PIPELINE)
+        status = run_pipeline(body, buf + len - body, cb_data);
+    else
+        status = run(body, cb_data);
+
+    fflush(NULL);
+    _exit(status & 0xff);
+}
+
+/*
+ * Take a request from a client: warm up for it, then fork a child to
+ * run it
+ *
+ * Returns: false if the client hung up or sent a bad request
+ */
+static bool _SRV_start_request(int listener, struct srv_client *clients, int count, int index, char *buf,
+                               SRV_warm_callback warm, SRV_run_callback run,
+                               SRV_run_pipeline_callback run_pipeline, void *cb_data)
+{
+    struct srv_client *client = &clients[index];
+    int fds[SRV_NUM_FDS], nfds;
+    ssize_t n = _SRV_recv(client->sock, buf, SRV_MAX_MSG - 1, fds, &nfds);
+    bool ok = n > 0 && nfds == SRV_NUM_FDS;
+
+    if (ok)
+    {
+        // the request must hold the working directory and something
+        // after it: a command line ends in a NUL, and a pipeline is only
+        // taken by a server that runs them
+        buf[n] = '\0';
+        size_t cwd_len = strlen(buf + 1);
+        if (buf[0] == SRV_COMMAND)
+            ok = cwd_len + 2 < n && buf[n - 1] == '\0';
+        else
+            ok = buf[0] == SRV_PIPELINE && run_pipeline != NULL && cwd_len + 2 < n;
+    }
+
+    if (ok)
+    {
+        if (warm != NULL && buf[0] == SRV_COMMAND)
+            warm(buf + strlen(buf + 1) + 2, cb_data);
+
+        // what the serving shell has buffered must not be written twice
+        fflush(NULL);
+
+        client->pid = fork();
+        if (client->pid == 0)
+            _SRV_run_child(listener, clients, count, buf, n, fds, run, run_pipeline, cb_data);
+
+        if (client->pid > 0)
+        {
+            setpgid(client->pid, client->pid);
+            client->pidfd = _SRV_pidfd_open(client->pid);
+        }
+
+        if (client->pid > 0 && client->pidfd < 0)
+        {
+            kill(client->pid, SIGKILL);
+            waitpid(client->pid, NULL, 0);
+        }
+
+        if (client->pid < 0 || client->pidfd < 0)
+        {
+            client->pid = 0;
+            ok = false;
+        }
+    }
+
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+
+    return ok;
+}
+
+/*
+ * Reap the child of a request that finished, and tell its client the
+ * status if the client is still there
+ */
+static void _SRV_finish_request(struct srv_client *client)
+{
+    struct srv_reply reply = {0};
+    int wstatus;
+
+    if (waitpid(client->pid, &wstatus, 0) == client->pid)
+        reply.status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+
+    if (client->sock >= 0)
+        _SRV_send(client->sock, &reply, sizeof(reply), NULL, 0);
+
+    close(client->pidfd);
+    client->pid = 0;
+}
+
+// Documented in .h file
+int SRV_serve(const char *path, SRV_warm_callback warm, SRV_run_callback run,
+              SRV_run_pipeline_callback run_pipeline, void *cb_data)
+{
+    assert(path != NULL && run != NULL);
+
+    int listener = _SRV_listen(path);
+    if (listener < 0)
+    {
+        fprintf(stderr, "plaid: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // stop on SIGTERM or SIGINT, letting poll() return to notice
+    struct sigaction sa = {0}, old_term, old_int;
+    sa.sa_handler = _SRV_on_stop;
+    sigemptyset(&sa.sa_mask);
+    srv_stop = 0;
+    sigaction(SIGTERM, &sa, &old_term);
+    sigaction(SIGINT, &sa, &old_int);
+
+    struct srv_client *clients = NULL;
+    struct pollfd *pfds = NULL;
+    int *owners = NULL;
+    int count = 0, cap = 0;
+    char *buf = malloc(SRV_MAX_MSG);
+    assert(buf != NULL);
+
+    while (!srv_stop)
+    {
+        // slot 0 is the listener; each client has its socket, and the
+        // pidfd of its request while one runs
+        if (2 * count + 1 > cap)
+        {
+            cap = (2 * count + 1) * 2;
+            pfds = realloc(pfds, cap * sizeof(struct pollfd));
+            owners = realloc(owners, cap * sizeof(int));
+            assert(pfds != NULL && owners != NULL);
+        }
+
+        int npfds = 0;
+        pfds[npfds++] = (struct pollfd){listener, POLLIN, 0};
+        for (int i = 0; i < count; i++)
+        {
+            // while a request runs, only a hang up is taken from its client
+            if (clients[i].sock >= 0)
+            {
+                owners[npfds] = i;
+                pfds[npfds++] = (struct pollfd){clients[i].sock, clients[i].pid != 0 ? 0 : POLLIN, 0};
+            }
+            if (clients[i].pid != 0)
+            {
+                owners[npfds] = i;
+                pfds[npfds++] = (struct pollfd){clients[i].pidfd, POLLIN, 0};
+            }
+        }
+
+        if (poll(pfds, npfds, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int p = 1; p < npfds; p++)
+        {
+            struct srv_client *client = &clients[owners[p]];
+            if (pfds[p].revents == 0)
+                continue;
+
+            if (client->pid != 0 && pfds[p].fd == client->pidfd)
+                _SRV_finish_request(client);
+            else if (client->pid != 0)
+            {
+                // the client is gone, so its commands should stop as the
+                // commands in a closed terminal do
+                kill(-client->pid, SIGHUP);
+                close(client->sock);
+                client->sock = -1;
+            }
+            else if (client->sock >= 0 && !_SRV_start_request(listener, clients, count, owners[p], buf,
+                                                                warm, run, run_pipeline, cb_data))
+            {
+                close(client->sock);
+                client->sock = -1;
+            }
+        }
+
+        // drop the clients that are gone and have nothing running
+        for (int i = 0; i < count; i++)
+        {
+            if (clients[i].sock < 0 && clients[i].pid == 0)
+                clients[i--] = clients[--count];
+        }
+
+        if (pfds[0].revents != 0)
+        {
+            int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (sock >= 0)
+            {
+                clients = realloc(clients, (count + 1) * sizeof(struct srv_client));
+                assert(clients != NULL);
+                clients[count++] = (struct srv_client){sock, 0, -1};
+            }
+        }
+    }
+
+    // requests still running finish, but their clients get no status
+    close(listener);
+    unlink(path);
+    for (int i = 0; i < count; i++)
+    {
+        if (clients[i].sock >= 0)
+            close(clients[i].sock);
+        if (clients[i].pid != 0)
+            close(clients[i].pidfd);
+    }
+
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    free(buf);
+    free(clients);
+    free(pfds);
+    free(owners);
+    return 0;
+}
+
+/*
+ * Make a request of either kind and wait for its reply
+ *
+ * Parameters:
+ *   path     The file name of the server's socket
+ *   kind     SRV_COMMAND or SRV_PIPELINE
+ *   body     The command line, with its NUL, or the encoded pipeline
+ *   len      The length of body
+ *   status   Return space for the exit status
+ *
+ * Returns: 0 on success, or -1 with errno set
+ */
+static int _SRV_request(const char *path, char kind, const void *body, size_t len, int *status)
+{
+    struct sockaddr_un addr;
+    char cwd[PATH_MAX];
+
+    if (!_SRV_address(path, &addr) || getcwd(cwd, sizeof(cwd)) == NULL)
+        return -1;
+
+    size_t cwd_len = strlen(cwd);
+    if (cwd_len + len + 2 > SRV_MAX_MSG - 1)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        int saved_errno = errno;
+        close(sock);
+        errno = saved_errno;
+        return -1;
+    }
+
+    char *buf = malloc(cwd_len + len + 2);
+    assert(buf != NULL);
+    buf[0] = kind;
+    memcpy(buf + 1, cwd, cwd_len + 1);
+    memcpy(buf + cwd_len + 2, body, len);
+
+    int fds[SRV_NUM_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int ret = _SRV_send(sock, buf, cwd_len + len + 2, fds, SRV_NUM_FDS);
+    free(buf);
+
+    if (ret == 0)
+    {
+        struct srv_reply reply;
+        int reply_fds[SRV_NUM_FDS], nfds;
+        ssize_t n = _SRV_recv(sock, &reply, sizeof(reply), reply_fds, &nfds);
+
+        if (n == sizeof(reply))
+            *status = reply.status;
+        else
+        {
+            ret = -1;
+            if (n >= 0)
+                errno = ECONNRESET;
+        }
+    }
+
+    int saved_errno = errno;
+    close(sock);
+    errno = saved_errno;
+    return ret;
+}
+
+// Documented in .h file
+int SRV_request(const char *path, const char *command, int *status)
+{
+    assert(path != NULL && command != NULL && status != NULL);
+    return _SRV_request(path, SRV_COMMAND, command, strlen(command) + 1, status);
+}
+
+// Documented in .h file
+int SRV_request_pipeline(const char *path, const void *pipeline, size_t len, int *status)
+{
+    assert(path != NULL && pipeline != NULL && status != NULL);
+    return _SRV_request(path, SRV_PIPELINE, pipeline, len, status);
+}
@@ -0,0 +1,108 @@
+/*
+ * serve.h
+ *
+ * A long-lived shell that runs command lines for local clients over a
+ * Unix domain socket. A client sends its working directory and a
+ * command line, or a pipeline it has already parsed and encoded with
+ * FP_encode, with its standard input, output and error attached as
+ * fds, and gets back the exit status. Each request runs in a fork of
+ * the serving shell, so it starts with the shell's caches as warm as
+ * the requests before it left them, and several run at once.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include <stddef.h>
+
+/*
+ * Prepares the serving shell for a request, before it forks to run it,
+ * e.g. by looking up its commands so that later requests find them
+ * cached. It must not block for long, since no other request is taken
+ * while it runs.
+ *
+ * Parameters:
+ *   command    The command line of the request
+ *   cb_data    Caller data passed to SRV_serve
+ *
+ * Returns: None
+ */
+typedef void (*SRV_warm_callback)(const char *command, void *cb_data);
+
+/*
+ * Runs the command line of a request, in the child forked for it, with
+ * the client's fds as its standard input, output and error and the
+ * client's working directory as its own.
+ *
+ * Parameters:
+ *   command    The command line, which may have several lines
+ *   cb_data    Caller data passed to SRV_serve
+ *
+ * Returns: The exit status for the client
+ */
+typedef int (*SRV_run_callback)(const char *command, void *cb_data);
+
+/*
+ * Runs the pipeline of a request, as SRV_run_callback runs a command
+ * line. The encoding is as the client sent it, and is not checked.
+ *
+ * Parameters:
+ *   pipeline   The pipeline, encoded by FP_encode
+ *   len        The length of the encoding
+ *   cb_data    Caller data passed to SRV_serve
+ *
+ * Returns: The exit status for the client
+ */
+typedef int (*SRV_run_pipeline_callback)(const void *pipeline, size_t len, void *cb_data);
+
+/*
+ * Serve requests on a socket at path until SIGTERM or SIGINT. A stale
+ * socket left at path by a server that is gone is replaced. A request
+ * whose client hangs up before it finishes is sent SIGHUP.
+ *
+ * Parameters:
+ *   path          The file name of the socket
+ *   warm          The function that prepares for a command line, or NULL
+ *   run           The function that runs a command line
+ *   run_pipeline  The function that runs an encoded pipeline, or NULL
+ *                 to refuse pipeline requests
+ *   cb_data       Caller data to pass to warm, run and run_pipeline
+ *
+ * Returns: 0 once stopped, having removed the socket, or 1 with an error
+ *   printed if the socket could not be set up
+ */
+int SRV_serve(const char *path, SRV_warm_callback warm, SRV_run_callback run,
+              SRV_run_pipeline_callback run_pipeline, void *cb_data);
+
+/*
+ * Run a command line on the shell serving at path, with this process's
+ * working directory, standard input, output and error, and wait for it
+ * to finish.
+ *
+ * Parameters:
+ *   path       The file name of the server's socket
+ *   command    The command line
+ *   status     Return space for the exit status of the command line
+ *
+ * Returns: 0 on success, or -1 with errno set if the server could not be
+ *   reached or went away before replying
+ */
+int SRV_request(const char *path, const char *command, int *status);
+
+/*
+ * Run a pipeline on the shell serving at path, as SRV_request runs a
+ * command line, so that the server need not tokenize or parse it.
+ *
+ * Parameters:
+ *   path       The file name of the server's socket
+ *   pipeline   The pipeline, encoded by FP_encode
+ *   len        The length of the encoding
+ *   status     Return space for the exit status of the pipeline
+ *
+ * Returns: 0 on success, or -1 with errno set if the server could not be
+ *   reached, refused the request or went away before replying
+ */
+int SRV_request_pipeline(const char *path, const void *pipeline, size_t len, int *status);
+
+#endif /* _SERVE_H_ */
@@ -0,0 +1,371 @@
+/**
+ * serve_test.c
+ *
+ * This file contains the test cases for serve.c
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "shell.h"
+#include "exec.h"
+#include "flatpipe.h"
+#include "mem.h"
+#include "serve.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+// the requests the test server has warmed up for
+static int warmed = 0;
+
+static void test_warm(const char *command, void *cb_data)
+{
+    warmed++;
+}
+
+/*
+ * Prints the number of requests warmed for, the working directory and
+ * the command line; "wait" first reads its input to the end
+ */
+static int test_run(const char *command, void *cb_data)
+{
+    char cwd[256], buf[64];
+
+    if (strcmp(command, "wait") == 0)
+        while (read(STDIN_FILENO, buf, sizeof(buf)) > 0)
+            ;
+
+    printf("%d %s %s\n", warmed, getcwd(cwd, sizeof(cwd)), command);
+    return strlen(command);
+}
+
+/*
+ * Runs a pipeline request as the serving shell does
+ */
+static int test_run_pipeline(const void *pipeline, size_t len, void *cb_data)
+{
+    return EXEC_run_encoded((shell_t *)cb_data, pipeline, len);
+}
+
+/*
+ * Start a test server at path, in a child, that runs pipeline requests
+ * only if pipelines is true
+ */
+static pid_t start_server(const char *path, bool pipelines)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shell_t sh = {VAR_new(), 0};
+        VAR_set(sh.vars, "PATH", "/usr/bin:/bin");
+        sh.in_fd = STDIN_FILENO;
+        sh.out_fd = STDOUT_FILENO;
+        sh.err_fd = STDERR_FILENO;
+
+        for (int fd = 3; fd < 64; fd++)
+            close(fd);
+        _exit(SRV_serve(path, test_warm, test_run, pipelines ? test_run_pipeline : NULL, &sh));
+    }
+
+    // it is up once it accepts a connection
+    for (int i = 0; i < 200; i++)
+    {
+        struct sockaddr_un addr = {AF_UNIX};
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        strcpy(addr.sun_path, path);
+        bool up = connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(sock);
+        if (up)
+            break;
+        usleep(10000);
+    }
+
+    return pid;
+}
+
+/*
+ * Make a request from a child in dir, with its stdin and stdout the
+ * given fds. The child exits with the status, or 255 on an error.
+ */
+static pid_t start_request(const char *path, const char *dir, const char *command, int in_fd, int out_fd)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int status;
+        dup2(in_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+
+        // the test's end of the pipes must close when the test closes it
+        for (int fd = 3; fd < 64; fd++)
+            close(fd);
+        if (chdir(dir) != 0 || SRV_request(path, command, &status) != 0)
+            _exit(255);
+        _exit(status);
+    }
+
+    return pid;
+}
+
+/*
+ * Make a pipeline request from a child, as start_request does, of the
+ * pipeline of a command line; or of a damaged encoding of it if damage
+ */
+static pid_t start_pipeline_request(const char *path, const char *line, bool damage, int out_fd)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        char errmsg[100];
+        size_t len;
+        int status;
+        CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+        pipeline_t *pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+        char *buf = FP_encode(pipeline, &len);
+        if (damage)
+            buf[0] ^= 1;
+
+        dup2(out_fd, STDOUT_FILENO);
+        for (int fd = 3; fd < 64; fd++)
+            close(fd);
+        if (SRV_request_pipeline(path, buf, len, &status) != 0)
+            _exit(255);
+        _exit(status);
+    }
+
+    return pid;
+}
+
+/*
+ * Returns the exit status of a request started with start_request
+ */
+static int request_status(pid_t pid)
+{
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+}
+
+/*
+ * Returns true if what is next in fd is expected
+ */
+static bool next_output(int fd, const char *expected)
+{
+    char buf[256] = {0};
+    ssize_t n = read(fd, buf, strlen(expected));
+    return n == strlen(expected) && strcmp(buf, expected) == 0;
+}
+
+/*
+ * Tests running requests, one after another and at the same time, and
+ * stopping the server
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_requests()
+{
+    char path[32] = "/tmp/serve_test.XXXXXX";
+    int in[2] = {-1, -1}, out[2] = {-1, -1};
+    pid_t server = -1;
+
+    test_assert(mkdtemp(path) != NULL);
+    strcat(path, "/sock");
+    test_assert(pipe(in) == 0 && pipe(out) == 0);
+
+    // a socket left by a server that is gone is replaced
+    struct sockaddr_un addr = {AF_UNIX};
+    int stale = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    strcpy(addr.sun_path, path);
+    test_assert(bind(stale, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    close(stale);
+
+    server = start_server(path, false);
+
+    // the command runs where the client is, with the client's fds
+    pid_t one = start_request(path, "/tmp", "echo one", in[0], out[1]);
+    test_assert(request_status(one) == 8);
+    test_assert(next_output(out[0], "1 /tmp echo one\n"));
+
+    // a request that is waiting does not hold up the next one
+    pid_t waiting = start_request(path, "/", "wait", in[0], out[1]);
+    usleep(100000);
+    pid_t two = start_request(path, "/tmp", "two", in[0], out[1]);
+    test_assert(request_status(two) == 3);
+    test_assert(next_output(out[0], "3 /tmp two\n"));
+
+    close(in[1]);
+    in[1] = -1;
+    test_assert(request_status(waiting) == 4);
+    test_assert(next_output(out[0], "2 / wait\n"));
+
+    // a server that runs no pipelines refuses them
+    pid_t pipeline = start_pipeline_request(path, "echo one", false, out[1]);
+    test_assert(request_status(pipeline) == 255);
+
+    test_assert(kill(server, SIGTERM) == 0);
+    test_assert(request_status(server) == 0);
+    server = -1;
+    test_assert(access(path, F_OK) != 0);
+
+    // with no server, a request fails
+    int status;
+    test_assert(SRV_request(path, "echo", &status) == -1);
+
+    close(in[0]);
+    close(out[0]);
+    close(out[1]);
+    *strrchr(path, '/') = '\0';
+    rmdir(path);
+    return 1;
+
+test_error:
+    if (server > 0)
+        kill(server, SIGKILL);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return 0;
+}
+
+/*
+ * Tests that the commands of a client that hangs up are hung up
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_hangup()
+{
+    char path[32] = "/tmp/serve_test.XXXXXX";
+    int in[2] = {-1, -1}, out[2] = {-1, -1};
+    pid_t server = -1;
+    bool hung_up = false;
+
+    test_assert(mkdtemp(path) != NULL);
+    strcat(path, "/sock");
+    test_assert(pipe(in) == 0 && pipe(out) == 0);
+    server = start_server(path, false);
+
+    pid_t client = start_request(path, "/", "wait", in[0], out[1]);
+    usleep(100000);
+    kill(client, SIGKILL);
+    waitpid(client, NULL, 0);
+    close(in[0]);
+    in[0] = -1;
+
+    // once the command is gone, nothing reads its input
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < 200 && !hung_up; i++)
+    {
+        hung_up = write(in[1], "x", 1) < 0 && errno == EPIPE;
+        usleep(10000);
+    }
+    signal(SIGPIPE, SIG_DFL);
+    test_assert(hung_up);
+
+    kill(server, SIGTERM);
+    test_assert(request_status(server) == 0);
+    server = -1;
+
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    *strrchr(path, '/') = '\0';
+    rmdir(path);
+    return 1;
+
+test_error:
+    if (server > 0)
+        kill(server, SIGKILL);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return 0;
+}
+
+/*
+ * Tests running pipelines that clients have already parsed
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_pipeline_requests()
+{
+    char path[32] = "/tmp/serve_test.XXXXXX";
+    char line[256] = "echo";
+    int out[2] = {-1, -1};
+    pid_t server = -1;
+
+    test_assert(mkdtemp(path) != NULL);
+    strcat(path, "/sock");
+    test_assert(pipe(out) == 0);
+    server = start_server(path, true);
+
+    // more arguments than a command first has room for
+    for (int i = 0; i < 60; i++)
+        strcat(line, " w");
+    strcat(line, " | wc -w");
+    pid_t client = start_pipeline_request(path, line, false, out[1]);
+    test_assert(request_status(client) == 0);
+    test_assert(next_output(out[0], "60\n"));
+
+    client = start_pipeline_request(path, "false", false, out[1]);
+    test_assert(request_status(client) == 1);
+
+    // a damaged encoding is an error, not a crash
+    client = start_pipeline_request(path, "echo one", true, out[1]);
+    test_assert(request_status(client) == 2);
+
+    kill(server, SIGTERM);
+    test_assert(request_status(server) == 0);
+    server = -1;
+
+    close(out[0]);
+    close(out[1]);
+    *strrchr(path, '/') = '\0';
+    rmdir(path);
+    return 1;
+
+test_error:
+    if (server > 0)
+        kill(server, SIGKILL);
+    close(out[0]);
+    close(out[1]);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_requests();
+    num_tests++;
+    passed += test_hangup();
+    num_tests++;
+    passed += test_pipeline_requests();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * shell.h
+ *
+ * State of a running shell, shared by the executor and the builtins
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SHELL_H_
+#define _SHELL_H_
+
+#include "vars.h"
+#include "zygote.h"
+#include "pathcache.h"
+#include "parsecache.h"
+#include "functions.h"
+#include "tokenize.h"
+#include "readbuf.h"
+
+// the state kept by the shell from one command to the next
+struct shell
+{
+    VarTable vars; // shell and environment variables
+    int status;    // exit status of the last pipeline
+    Zygote zygote; // launches external commands, or NULL to fork them
+    PathCache pathcache; // where commands were found, or NULL to search each time
+    ParseCache parsecache; // command lines already parsed, or NULL
+    FuncTable funcs;       // the functions defined, or NULL
+    TokState tok_state;    // expands the deferred words of compound commands and functions
+    bool exiting;          // exit was run inside a function, so the shell stops
+    ReadBuf readbuf;       // input the read builtin has buffered, or NULL to buffer none
+    bool read_ahead;       // the read running is a while loop's that may read a pipe in blocks
+    int in_fd;             // where commands read, unless redirected
+    int out_fd;            // where commands write, unless redirected
+    int err_fd;            // where commands and the executor report errors
+    int call_depth;        // the function calls running inside one another
+};
+
+typedef struct shell shell_t;
+
+#endif /* _SHELL_H_ */
@@ -0,0 +1,333 @@
+/*
+ * snapshot.c
+ *
+ * The snapshot file: a header with a magic number and the format
+ * version, then the sections. A section is its name, the length of its
+ * values, their checksum, and the values: numbers as 8 bytes and
+ * strings as their length, bytes and a NUL. Each section is checked
+ * only when it is read, so a small one can be read without going over
+ * a large one.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "mem.h"
+
+#define SNAP_MAGIC "PLAIDSNP"
+#define SNAP_VERSION 2
+
+struct snap_header
+{
+    char magic[8];
+    uint64_t version;
+};
+
+struct _snap_writer
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t section; // where the length and checksum of the current section are, or 0
+};
+
+struct _snap_reader
+{
+    char *map;
+    size_t size;
+    const char *pos; // the next value
+    const char *end; // the end of the current section
+};
+
+// Documented in .h file
+uint64_t SNAP_hash(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 14695981039346656037ull;
+    uint64_t word;
+    size_t i = 0;
+
+    // the shift folds the high bits, which a multiply only carries
+    // upwards, back into the low ones
+    for (; i + 8 <= len; i += 8)
+    {
+        memcpy(&word, p + i, 8);
+        h ^= word;
+        h *= 1099511628211ull;
+        h ^= h >> 32;
+    }
+
+    for (; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+/*
+ * Append bytes to a writer
+ */
+static void _SNAP_append(SnapWriter w, const void *data, size_t len)
+{
+    if (w->len + len > w->cap)
+    {
+        while (w->len + len > w->cap)
+            w->cap *= 2;
+        w->buf = MEM_realloc(MEM_CACHES, w->buf, w->cap);
+        assert(w->buf != NULL);
+    }
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/*
+ * Fill in the length and checksum of the current section, if there is one
+ */
+static void _SNAP_end_section(SnapWriter w)
+{
+    if (w->section == 0)
+        return;
+
+    const char *values = w->buf + w->section + 2 * sizeof(uint64_t);
+    uint64_t len = w->buf + w->len - values;
+    uint64_t checksum = SNAP_hash(values, len);
+
+    memcpy(w->buf + w->section, &len, sizeof(len));
+    memcpy(w->buf + w->section + sizeof(len), &checksum, sizeof(checksum));
+    w->section = 0;
+}
+
+// Documented in .h file
+SnapWriter SNAP_new()
+{
+    SnapWriter w = MEM_alloc(MEM_CACHES, sizeof(struct _snap_writer));
+    assert(w != NULL);
+
+    w->cap = 4096;
+    w->buf = MEM_alloc(MEM_CACHES, w->cap);
+    assert(w->buf != NULL);
+
+    // the header is filled in when the snapshot is written
+    w->len = sizeof(struct snap_header);
+    w->section = 0;
+
+    return w;
+}
+
+// Documented in .h file
+void SNAP_free(SnapWriter w)
+{
+    if (w == NULL)
+        return;
+
+    MEM_free(w->buf);
+    MEM_free(w);
+}
+
+// Documented in .h file
+void SNAP_section(SnapWriter w, const char *name)
+{
+    assert(w != NULL);
+
+    _SNAP_end_section(w);
+    _SNAP_append(w, name, strlen(name) + 1);
+
+    uint64_t unknown[2] = {0, 0};
+    w->section = w->len;
+    _SNAP_append(w, unknown, sizeof(unknown));
+}
+
+// Documented in .h file
+void SNAP_put_u64(SnapWriter w, uint64_t value)
+{
+    assert(w != NULL && w->section != 0);
+    _SNAP_append(w, &value, sizeof(value));
+}
+
+// Documented in .h file
+void SNAP_put_str(SnapWriter w, const char *s)
+{
+    assert(w != NULL && w->section != 0);
+
+    uint64_t len = strlen(s);
+    _SNAP_append(w, &len, sizeof(len));
+    _SNAP_append(w, s, len + 1);
+}
+
+// Documented in .h file
+bool SNAP_write(SnapWriter w, const char *file)
+{
+    assert(w != NULL);
+
+    _SNAP_end_section(w);
+
+    struct snap_header hdr;
+    memcpy(hdr.magic, SNAP_MAGIC, 8);
+    hdr.version = SNAP_VERSION;
+    memcpy(w->buf, &hdr, sizeof(hdr));
+
+    // written under a temporary name and renamed into place
+    size_t name_len = strlen(file) + 8;
+    char tmp[name_len];
+    snprintf(tmp, name_len, "%s.XXXXXX", file);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return false;
+
+    bool ok = write(fd, w->buf, w->len) == w->len;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, file) == 0;
+    if (!ok)
+        unlink(tmp);
+
+    return ok;
+}
+
+// Documented in .h file
+SnapReader SNAP_open(const char *file)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct snap_header))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    struct snap_header hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+
+    if (memcmp(hdr.magic, SNAP_MAGIC, 8) != 0 || hdr.version != SNAP_VERSION)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    SnapReader r = MEM_alloc(MEM_CACHES, sizeof(struct _snap_reader));
+    assert(r != NULL);
+
+    r->map = map;
+    r->size = st.st_size;
+    r->pos = r->end = map + sizeof(hdr);
+
+    return r;
+}
+
+// Documented in .h file
+void SNAP_close(SnapReader r)
+{
+    if (r == NULL)
+        return;
+
+    munmap(r->map, r->size);
+    MEM_free(r);
+}
+
+// Documented in .h file
+bool SNAP_seek(SnapReader r, const char *name)
+{
+    assert(r != NULL);
+
+    const char *p = r->map + sizeof(struct snap_header);
+    const char *end = r->map + r->size;
+
+    while (p < end)
+    {
+        const char *nul = memchr(p, '\0', end - p);
+        uint64_t len, checksum;
+        if (nul == NULL || end - (nul + 1) < sizeof(len) + sizeof(checksum))
+            break;
+
+        memcpy(&len, nul + 1, sizeof(len));
+        memcpy(&checksum, nul + 1 + sizeof(len), sizeof(checksum));
+        const char *values = nul + 1 + sizeof(len) + sizeof(checksum);
+        if (len > end - values)
+            break;
+
+        if (strcmp(p, name) == 0)
+        {
+            if (checksum != SNAP_hash(values, len))
+                return false;
+
+            r->pos = values;
+            r->end = values + len;
+            return true;
+        }
+
+        p = values + len;
+    }
+
+    return false;
+}
+
+// Documented in .h file
+bool SNAP_get_u64(SnapReader r, uint64_t *value)
+{
+    assert(r != NULL);
+
+    if (r->end - r->pos < sizeof(uint64_t))
+        return false;
+
+    memcpy(value, r->pos, sizeof(uint64_t));
+    r->pos += sizeof(uint64_t);
+    return true;
+}
+
+// Documented in .h file
+const char *SNAP_get_str(SnapReader r)
+{
+    uint64_t len;
+    const char *start = r->pos;
+
+    if (!SNAP_get_u64(r, &len) || len >= r->end - r->pos || r->pos[len] != '\0')
+    {
+        r->pos = start;
+        return NULL;
+    }
+
+    const char *s = r->pos;
+    r->pos += len + 1;
+    return s;
+}
+
+// Documented in .h file
+void SNAP_put_stat(SnapWriter w, const struct stat *st)
+{
+    SNAP_put_u64(w, st->st_dev);
+    SNAP_put_u64(w, st->st_ino);
+    SNAP_put_u64(w, st->st_mtim.tv_sec);
+    SNAP_put_u64(w, st->st_mtim.tv_nsec);
+}
+
+// Documented in .h file
+bool SNAP_check_stat(SnapReader r, const struct stat *st)
+{
+    uint64_t dev, ino, sec, nsec;
+
+    if (!SNAP_get_u64(r, &dev) || !SNAP_get_u64(r, &ino) ||
+        !SNAP_get_u64(r, &sec) || !SNAP_get_u64(r, &nsec))
+        return false;
+
+    return dev == st->st_dev && ino == st->st_ino &&
+           sec == st->st_mtim.tv_sec && nsec == st->st_mtim.tv_nsec;
+}
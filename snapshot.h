@@ -0,0 +1,182 @@
+/*
+ * snapshot.h
+ *
+ * A binary file that carries the shell's caches from one session to the
+ * next. It is written in named sections when the shell exits, and mapped
+ * into memory when the next shell starts. Each cache reads back its own
+ * section, which is checked against its checksum, and decides which of
+ * it is still valid. Compiled scripts are kept in the same format.
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// struct _snap_writer to be used in the .c as SnapWriter
+typedef struct _snap_writer *SnapWriter;
+
+// struct _snap_reader to be used in the .c as SnapReader
+typedef struct _snap_reader *SnapReader;
+
+/*
+ * Start a new snapshot, built in memory until it is written
+ *
+ * Parameters: None
+ *
+ * Returns: The writer
+ */
+SnapWriter SNAP_new();
+
+/*
+ * Free a writer without writing it
+ *
+ * Parameters:
+ *   w        The writer, or NULL
+ *
+ * Returns: None
+ */
+void SNAP_free(SnapWriter w);
+
+/*
+ * Start a section; the values put after this belong to it
+ *
+ * Parameters:
+ *   w        The writer
+ *   name     The name the section is found by
+ *
+ * Returns: None
+ */
+void SNAP_section(SnapWriter w, const char *name);
+
+/*
+ * Add a number to the current section
+ *
+ * Parameters:
+ *   w        The writer
+ *   value    The number
+ *
+ * Returns: None
+ */
+void SNAP_put_u64(SnapWriter w, uint64_t value);
+
+/*
+ * Add a string to the current section
+ *
+ * Parameters:
+ *   w        The writer
+ *   s        The string
+ *
+ * Returns: None
+ */
+void SNAP_put_str(SnapWriter w, const char *s);
+
+/*
+ * Write the snapshot to a file, replacing it atomically so that a shell
+ * starting at the same time sees either the old or the new snapshot
+ *
+ * Parameters:
+ *   w        The writer
+ *   file     The path of the file
+ *
+ * Returns: true on success, false otherwise
+ */
+bool SNAP_write(SnapWriter w, const char *file);
+
+/*
+ * Map a snapshot file and check its header
+ *
+ * Parameters:
+ *   file     The path of the file
+ *
+ * Returns: The reader, or NULL if there is no valid snapshot, e.g. it
+ *   was written by another version of the shell
+ */
+SnapReader SNAP_open(const char *file);
+
+/*
+ * Unmap a snapshot. Strings read from it are no longer valid.
+ *
+ * Parameters:
+ *   r        The reader, or NULL
+ *
+ * Returns: None
+ */
+void SNAP_close(SnapReader r);
+
+/*
+ * Move to the start of a section
+ *
+ * Parameters:
+ *   r        The reader
+ *   name     The name of the section
+ *
+ * Returns: true if the section exists, false if it does not or it has
+ *   been damaged
+ */
+bool SNAP_seek(SnapReader r, const char *name);
+
+/*
+ * Read the next number of the current section
+ *
+ * Parameters:
+ *   r        The reader
+ *   value    Return space for the number
+ *
+ * Returns: true on success, false at the end of the section
+ */
+bool SNAP_get_u64(SnapReader r, uint64_t *value);
+
+/*
+ * Read the next string of the current section
+ *
+ * Parameters:
+ *   r        The reader
+ *
+ * Returns: The string, which points into the mapped file, or NULL at
+ *   the end of the section
+ */
+const char *SNAP_get_str(SnapReader r);
+
+/*
+ * Add what identifies a version of a directory: its device, inode and
+ * modification time
+ *
+ * Parameters:
+ *   w        The writer
+ *   st       The directory's status, or all zeroes if it does not exist
+ *
+ * Returns: None
+ */
+void SNAP_put_stat(SnapWriter w, const struct stat *st);
+
+/*
+ * Read what SNAP_put_stat() added and compare it with a directory's
+ * status now, to tell whether what was saved about it is still valid
+ *
+ * Parameters:
+ *   r        The reader
+ *   st       The directory's status, or all zeroes if it does not exist
+ *
+ * Returns: true if the directory is unchanged, false if it changed or
+ *   at the end of the section
+ */
+bool SNAP_check_stat(SnapReader r, const struct stat *st);
+
+/*
+ * Hash some bytes, as the checksum of each section is. The bytes are
+ * taken eight at a time, in the manner of FNV-1a.
+ *
+ * Parameters:
+ *   data     The bytes
+ *   len      The number of bytes
+ *
+ * Returns: The hash
+ */
+uint64_t SNAP_hash(const void *data, size_t len);
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,302 @@
+/**
+ * snapshot_test.c
+ *
+ * This file contains the test cases for snapshot.c, and for the caches
+ * that are saved in snapshots
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "pathcache.h"
+#include "cmdindex.h"
+#include "mem.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Creates an empty file with the given mode
+ */
+static void touch(const char *file, mode_t mode)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd >= 0)
+        close(fd);
+    chmod(file, mode);
+}
+
+/*
+ * Sets the modification time of a file or directory to some seconds ago
+ */
+static void set_age(const char *file, int seconds)
+{
+    struct timespec times[2] = {{time(NULL) - seconds, 0}, {time(NULL) - seconds, 0}};
+    utimensat(AT_FDCWD, file, times, 0);
+}
+
+/*
+ * Returns the number of names an index completes a prefix to
+ */
+static int count_completions(CommandIndex ci, const char *path, const char *prefix)
+{
+    char **matches = CI_complete(ci, path, prefix);
+    int count = 0;
+
+    while (matches != NULL && matches[count] != NULL)
+        free(matches[count++]);
+    free(matches);
+
+    return count;
+}
+
+/*
+ * Tests writing sections and reading them back, in any order, and that
+ * a damaged snapshot is not read
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_sections()
+{
+    char file[] = "/tmp/plaid_snapshot_XXXXXX";
+    SnapWriter w = NULL;
+    SnapReader r = NULL;
+    uint64_t value;
+
+    int fd = mkstemp(file);
+    test_assert(fd >= 0);
+    close(fd);
+
+    w = SNAP_new();
+    SNAP_section(w, "first");
+    SNAP_put_u64(w, 42);
+    SNAP_put_str(w, "hello");
+    SNAP_section(w, "second");
+    SNAP_put_str(w, "");
+    SNAP_put_u64(w, UINT64_MAX);
+    test_assert(SNAP_write(w, file));
+    SNAP_free(w);
+    w = NULL;
+
+    r = SNAP_open(file);
+    test_assert(r != NULL);
+
+    test_assert(SNAP_seek(r, "second"));
+    test_assert(strcmp(SNAP_get_str(r), "") == 0);
+    test_assert(SNAP_get_u64(r, &value) && value == UINT64_MAX);
+    test_assert(!SNAP_get_u64(r, &value));
+
+    test_assert(SNAP_seek(r, "first"));
+    test_assert(SNAP_get_u64(r, &value) && value == 42);
+    test_assert(strcmp(SNAP_get_str(r), "hello") == 0);
+    test_assert(SNAP_get_str(r) == NULL);
+
+    test_assert(!SNAP_seek(r, "third"));
+    SNAP_close(r);
+    r = NULL;
+
+    // a section with a changed byte fails its checksum, and the others
+    // can still be read
+    fd = open(file, O_RDWR);
+    test_assert(fd >= 0);
+    char c;
+    pread(fd, &c, 1, 40);
+    c ^= 1;
+    pwrite(fd, &c, 1, 40);
+    close(fd);
+    r = SNAP_open(file);
+    test_assert(r != NULL);
+    test_assert(!SNAP_seek(r, "first"));
+    test_assert(SNAP_seek(r, "second"));
+    SNAP_close(r);
+    r = NULL;
+
+    // a section cut short cannot be read
+    test_assert(truncate(file, 80) == 0);
+    r = SNAP_open(file);
+    test_assert(r != NULL);
+    test_assert(!SNAP_seek(r, "second"));
+    SNAP_close(r);
+    r = NULL;
+
+    // nor can a file that is not a snapshot
+    test_assert(truncate(file, 8) == 0);
+    test_assert(SNAP_open(file) == NULL);
+
+    test_assert(SNAP_open("/tmp/no/such/snapshot") == NULL);
+
+    unlink(file);
+    return 1;
+
+test_error:
+    SNAP_free(w);
+    SNAP_close(r);
+    unlink(file);
+    return 0;
+}
+
+/*
+ * Tests saving the PATH cache and the command index, and that only what
+ * is about unchanged directories is loaded again
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_caches()
+{
+    char dir1[] = "/tmp/plaid_snapdir1_XXXXXX";
+    char dir2[] = "/tmp/plaid_snapdir2_XXXXXX";
+    char snap_file[] = "/tmp/plaid_snapshot_XXXXXX";
+    char path[128];
+    char file[128];
+    PathCache pc = NULL;
+    CommandIndex ci = NULL;
+    SnapWriter w = NULL;
+    SnapReader r = NULL;
+    char *found = NULL;
+
+    test_assert(mkdtemp(dir1) != NULL && mkdtemp(dir2) != NULL);
+    int fd = mkstemp(snap_file);
+    test_assert(fd >= 0);
+    close(fd);
+    snprintf(path, sizeof(path), "%s:%s", dir1, dir2);
+
+    snprintf(file, sizeof(file), "%s/plaidx", dir1);
+    touch(file, 0755);
+    snprintf(file, sizeof(file), "%s/plaidy", dir2);
+    touch(file, 0755);
+
+    // directories changed just now are never trusted from a snapshot
+    set_age(dir1, 3600);
+    set_age(dir2, 3600);
+
+    pc = PC_new();
+    ci = CI_new(path, NULL, NULL);
+    test_assert(ci != NULL);
+    found = PC_lookup(pc, path, "plaidy");
+    test_assert(found != NULL && strcmp(found, file) == 0);
+    test_assert(count_completions(ci, path, "plaid") == 2);
+
+    w = SNAP_new();
+    PC_save(pc, w);
+    CI_save(ci, w);
+    test_assert(SNAP_write(w, snap_file));
+    SNAP_free(w);
+    w = NULL;
+    PC_free(pc);
+    CI_free(ci);
+    pc = NULL;
+    ci = NULL;
+
+    // everything is loaded while nothing has changed
+    r = SNAP_open(snap_file);
+    test_assert(r != NULL);
+    pc = PC_new();
+    test_assert(PC_load(pc, r) == 1);
+    ci = CI_new(path, NULL, r);
+    r = NULL;
+    test_assert(ci != NULL);
+    test_assert(count_completions(ci, path, "plaid") == 2);
+    MEM_free(found);
+    found = PC_lookup(pc, path, "plaidy");
+    test_assert(found != NULL && strcmp(found, file) == 0);
+    PC_free(pc);
+    CI_free(ci);
+    pc = NULL;
+    ci = NULL;
+
+    // a new command in the first directory could come before a cached one,
+    // and the index must list it
+    snprintf(file, sizeof(file), "%s/plaidz", dir1);
+    touch(file, 0755);
+    set_age(dir1, 1800);
+
+    r = SNAP_open(snap_file);
+    test_assert(r != NULL);
+    pc = PC_new();
+    test_assert(PC_load(pc, r) == 0);
+    ci = CI_new(path, NULL, r);
+    r = NULL;
+    test_assert(ci != NULL);
+    test_assert(count_completions(ci, path, "plaid") == 3);
+    PC_free(pc);
+    CI_free(ci);
+    pc = NULL;
+    ci = NULL;
+
+    // the names of an unchanged directory come from the snapshot, even
+    // when they are no longer what a scan would find
+    w = SNAP_new();
+    SNAP_section(w, "cmdindex");
+    SNAP_put_u64(w, 1);
+    SNAP_put_str(w, dir2);
+    struct stat st;
+    stat(dir2, &st);
+    SNAP_put_stat(w, &st);
+    SNAP_put_u64(w, time(NULL));
+    SNAP_put_u64(w, 1);
+    SNAP_put_str(w, "plaidghost");
+    test_assert(SNAP_write(w, snap_file));
+    SNAP_free(w);
+    w = NULL;
+
+    r = SNAP_open(snap_file);
+    test_assert(r != NULL);
+    ci = CI_new(path, NULL, r);
+    r = NULL;
+    test_assert(ci != NULL);
+    test_assert(count_completions(ci, path, "plaidghost") == 1);
+    test_assert(count_completions(ci, path, "plaidy") == 0);
+    test_assert(count_completions(ci, path, "plaidx") == 1);
+    CI_free(ci);
+    ci = NULL;
+
+    snprintf(file, sizeof(file), "%s/plaidx", dir1);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s/plaidz", dir1);
+    unlink(file);
+    snprintf(file, sizeof(file), "%s/plaidy", dir2);
+    unlink(file);
+    rmdir(dir1);
+    rmdir(dir2);
+    unlink(snap_file);
+    MEM_free(found);
+    return 1;
+
+test_error:
+    SNAP_free(w);
+    SNAP_close(r);
+    PC_free(pc);
+    CI_free(ci);
+    MEM_free(found);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_sections();
+    num_tests++;
+    passed += test_caches();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
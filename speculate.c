@@ -0,0 +1,405 @@
+/*
+ * speculate.c
+ *
+ * A helper thread that resolves commands and expands globs in the line
+ * being typed, and a cache of the globs it expanded
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <glob.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "speculate.h"
+#include "mem.h"
+
+// the most globs kept from one line
+#define SPEC_MAX_GLOBS 32
+
+// characters that end a word and are not part of the next one
+#define SPEC_OPERATORS "|<>;&()"
+
+// a glob expanded by the helper thread
+struct _spec_glob
+{
+    char *pattern;
+    char *cwd;       // the working directory it was expanded in
+    struct stat dir; // the directory it searched, when it was expanded
+    char **matches;  // NULL if nothing matched
+    bool live;       // still in the line being typed
+};
+
+struct _speculator
+{
+    PathCache pc;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    // the latest hint not yet worked on, or NULL
+    char *line;
+    char *path;
+    bool stop;
+
+    struct _spec_glob globs[SPEC_MAX_GLOBS];
+    int num_globs;
+};
+
+/*
+ * Free a NULL-terminated array of strings and the array itself
+ */
+static void _SPEC_free_matches(char **matches)
+{
+    if (matches == NULL)
+        return;
+
+    for (int i = 0; matches[i] != NULL; i++)
+        MEM_free(matches[i]);
+    MEM_free(matches);
+}
+
+/*
+ * Copy a NULL-terminated array of strings, the strings with MEM_alloc
+ *
+ * Returns: The copy, or NULL if matches is NULL
+ */
+static char **_SPEC_copy_matches(char *const *matches, size_t count)
+{
+    if (matches == NULL)
+        return NULL;
+
+    char **copy = MEM_alloc(MEM_GLOB, (count + 1) * sizeof(char *));
+    assert(copy != NULL);
+
+    for (size_t i = 0; i < count; i++)
+        copy[i] = MEM_strdup(MEM_GLOB, matches[i]);
+    copy[count] = NULL;
+
+    return copy;
+}
+
+/*
+ * Count a NULL-terminated array of strings
+ */
+static size_t _SPEC_count(char **matches)
+{
+    size_t count = 0;
+    while (matches != NULL && matches[count] != NULL)
+        count++;
+    return count;
+}
+
+/*
+ * Expand a glob pattern now, as the tokenizer would
+ *
+ * Returns: The matches, as for SPEC_glob
+ */
+static char **_SPEC_glob_now(const char *pattern)
+{
+    glob_t globbuf;
+    char **matches = NULL;
+
+    if (glob(pattern, GLOB_TILDE_CHECK, NULL, &globbuf) == 0)
+    {
+        matches = _SPEC_copy_matches(globbuf.gl_pathv, globbuf.gl_pathc);
+        globfree(&globbuf);
+    }
+
+    return matches;
+}
+
+/*
+ * Find the one directory a pattern searches and stat it. A pattern
+ * with wildcards before its last '/' searches many directories, and is
+ * never cached.
+ *
+ * Returns: true if the pattern can be cached and st was filled in
+ */
+static bool _SPEC_stat_dir(const char *pattern, struct stat *st)
+{
+    const char *slash = strrchr(pattern, '/');
+    const char *wild = strpbrk(pattern, "*?[");
+
+    if (pattern[0] == '~' || (slash != NULL && wild < slash))
+        return false;
+
+    if (slash == NULL)
+        return stat(".", st) == 0;
+    if (slash == pattern)
+        return stat("/", st) == 0;
+
+    char dir[slash - pattern + 1];
+    memcpy(dir, pattern, slash - pattern);
+    dir[slash - pattern] = '\0';
+    return stat(dir, st) == 0;
+}
+
+/*
+ * Returns true if two stats are of the same, unmodified directory
+ */
+static bool _SPEC_same_dir(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * Find the cached glob of a pattern in a directory. The lock must be held.
+ *
+ * Returns: The glob, or NULL if there is none
+ */
+static struct _spec_glob *_SPEC_find(Speculator spec, const char *pattern, const char *cwd)
+{
+    for (int i = 0; i < spec->num_globs; i++)
+    {
+        if (strcmp(spec->globs[i].pattern, pattern) == 0 && strcmp(spec->globs[i].cwd, cwd) == 0)
+            return &spec->globs[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * On the helper thread, expand a glob unless an up to date result is
+ * already cached
+ */
+static void _SPEC_speculate_glob(Speculator spec, const char *pattern)
+{
+    struct stat dir;
+    char *cwd = getcwd(NULL, 0);
+
+    // the directory is stat'ed first, so a change while globbing is noticed later
+    if (cwd == NULL || !_SPEC_stat_dir(pattern, &dir))
+    {
+        free(cwd);
+        return;
+    }
+
+    pthread_mutex_lock(&spec->lock);
+    struct _spec_glob *cached = _SPEC_find(spec, pattern, cwd);
+    bool fresh = cached != NULL && _SPEC_same_dir(&cached->dir, &dir);
+    if (cached != NULL)
+        cached->live = fresh;
+    pthread_mutex_unlock(&spec->lock);
+
+    if (fresh)
+    {
+        free(cwd);
+        return;
+    }
+
+    char **matches = _SPEC_glob_now(pattern);
+
+    // a cd while globbing means the matches are for the wrong directory
+    char *cwd_after = getcwd(NULL, 0);
+    bool moved = cwd_after == NULL || strcmp(cwd, cwd_after) != 0;
+    free(cwd_after);
+
+    pthread_mutex_lock(&spec->lock);
+    cached = _SPEC_find(spec, pattern, cwd);
+    if (!moved && cached == NULL && spec->num_globs < SPEC_MAX_GLOBS)
+    {
+        cached = &spec->globs[spec->num_globs++];
+        cached->pattern = MEM_strdup(MEM_CACHES, pattern);
+        cached->cwd = cwd;
+        cached->matches = NULL;
+        cwd = NULL;
+    }
+    if (!moved && cached != NULL)
+    {
+        _SPEC_free_matches(cached->matches);
+        cached->matches = matches;
+        cached->dir = dir;
+        cached->live = true;
+        matches = NULL;
+    }
+    pthread_mutex_unlock(&spec->lock);
+
+    _SPEC_free_matches(matches);
+    free(cwd);
+}
+
+/*
+ * On the helper thread, resolve the commands and expand the globs of a
+ * line being typed. Words with quotes, escapes or expansions are left
+ * to the tokenizer.
+ */
+static void _SPEC_work(Speculator spec, const char *line, const char *path)
+{
+    pthread_mutex_lock(&spec->lock);
+    for (int i = 0; i < spec->num_globs; i++)
+        spec->globs[i].live = false;
+    pthread_mutex_unlock(&spec->lock);
+
+    bool command = true;
+    const char *p = line;
+
+    while (*p != '\0')
+    {
+        if (isspace(*p))
+        {
+            p++;
+            continue;
+        }
+
+        // a command follows a pipe or a separator, but not a redirection
+        if (strchr(SPEC_OPERATORS, *p) != NULL)
+        {
+            command = strchr("|;&(", *p) != NULL;
+            p++;
+            continue;
+        }
+
+        size_t len = strcspn(p, " \t\n" SPEC_OPERATORS);
+        char *word = MEM_strndup(MEM_CACHES, p, len);
+        bool plain = strpbrk(word, "'\"$\\`") == NULL;
+        p += len;
+
+        // a command name is only complete once something follows it
+        if (command && plain && *p != '\0' && strchr(word, '/') == NULL)
+            MEM_free(PC_lookup(spec->pc, path, word));
+        else if (!command && plain && strpbrk(word, "*?[") != NULL)
+            _SPEC_speculate_glob(spec, word);
+
+        command = false;
+        MEM_free(word);
+    }
+
+    // drop the globs of words that are no longer in the line
+    pthread_mutex_lock(&spec->lock);
+    int kept = 0;
+    for (int i = 0; i < spec->num_globs; i++)
+    {
+        if (spec->globs[i].live)
+        {
+            spec->globs[kept++] = spec->globs[i];
+            continue;
+        }
+        MEM_free(spec->globs[i].pattern);
+        free(spec->globs[i].cwd);
+        _SPEC_free_matches(spec->globs[i].matches);
+    }
+    spec->num_globs = kept;
+    pthread_mutex_unlock(&spec->lock);
+}
+
+/*
+ * The helper thread: work on the latest hint until stopped
+ */
+static void *_SPEC_thread(void *arg)
+{
+    Speculator spec = (Speculator)arg;
+
+    pthread_mutex_lock(&spec->lock);
+    while (!spec->stop)
+    {
+        if (spec->line == NULL)
+        {
+            pthread_cond_wait(&spec->cond, &spec->lock);
+            continue;
+        }
+
+        char *line = spec->line;
+        char *path = spec->path;
+        spec->line = NULL;
+        spec->path = NULL;
+        pthread_mutex_unlock(&spec->lock);
+
+        _SPEC_work(spec, line, path);
+        MEM_free(line);
+        MEM_free(path);
+
+        pthread_mutex_lock(&spec->lock);
+    }
+    pthread_mutex_unlock(&spec->lock);
+
+    return NULL;
+}
+
+// Documented in .h file
+Speculator SPEC_new(PathCache pc)
+{
+    Speculator spec = MEM_calloc(MEM_CACHES, 1, sizeof(struct _speculator));
+    assert(spec != NULL);
+
+    spec->pc = pc;
+    pthread_mutex_init(&spec->lock, NULL);
+    pthread_cond_init(&spec->cond, NULL);
+
+    if (pthread_create(&spec->tid, NULL, _SPEC_thread, spec) != 0)
+    {
+        pthread_cond_destroy(&spec->cond);
+        pthread_mutex_destroy(&spec->lock);
+        MEM_free(spec);
+        return NULL;
+    }
+
+    return spec;
+}
+
+// Documented in .h file
+void SPEC_free(Speculator spec)
+{
+    if (spec == NULL)
+        return;
+
+    pthread_mutex_lock(&spec->lock);
+    spec->stop = true;
+    pthread_cond_signal(&spec->cond);
+    pthread_mutex_unlock(&spec->lock);
+    pthread_join(spec->tid, NULL);
+
+    for (int i = 0; i < spec->num_globs; i++)
+    {
+        MEM_free(spec->globs[i].pattern);
+        free(spec->globs[i].cwd);
+        _SPEC_free_matches(spec->globs[i].matches);
+    }
+
+    MEM_free(spec->line);
+    MEM_free(spec->path);
+    pthread_cond_destroy(&spec->cond);
+    pthread_mutex_destroy(&spec->lock);
+    MEM_free(spec);
+}
+
+// Documented in .h file
+void SPEC_hint(Speculator spec, const char *line, const char *path)
+{
+    assert(spec != NULL);
+
+    pthread_mutex_lock(&spec->lock);
+    MEM_free(spec->line);
+    MEM_free(spec->path);
+    spec->line = MEM_strdup(MEM_CACHES, line);
+    spec->path = path != NULL ? MEM_strdup(MEM_CACHES, path) : NULL;
+    pthread_cond_signal(&spec->cond);
+    pthread_mutex_unlock(&spec->lock);
+}
+
+// Documented in .h file
+char **SPEC_glob(Speculator spec, const char *pattern)
+{
+    struct stat dir;
+    char *cwd;
+
+    if (spec == NULL || !_SPEC_stat_dir(pattern, &dir) || (cwd = getcwd(NULL, 0)) == NULL)
+        return _SPEC_glob_now(pattern);
+
+    pthread_mutex_lock(&spec->lock);
+    struct _spec_glob *cached = _SPEC_find(spec, pattern, cwd);
+    bool hit = cached != NULL && _SPEC_same_dir(&cached->dir, &dir);
+    char **matches = hit ? _SPEC_copy_matches(cached->matches, _SPEC_count(cached->matches)) : NULL;
+    pthread_mutex_unlock(&spec->lock);
+
+    free(cwd);
+    return hit ? matches : _SPEC_glob_now(pattern);
+}
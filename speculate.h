@@ -0,0 +1,65 @@
+/*
+ * speculate.h
+ *
+ * Work done on a helper thread while a command line is still being
+ * typed: the command is looked up in the PATH cache and the globs in
+ * the line are expanded, so that both are ready when Enter is pressed
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _SPECULATE_H_
+#define _SPECULATE_H_
+
+#include "pathcache.h"
+
+// struct _speculator to be used in the .c as Speculator
+typedef struct _speculator *Speculator;
+
+/*
+ * Start the helper thread
+ *
+ * Parameters:
+ *   pc       The cache to resolve commands into
+ *
+ * Returns: The speculator, or NULL if the thread could not be started
+ */
+Speculator SPEC_new(PathCache pc);
+
+/*
+ * Stop the helper thread and free the speculator and its results
+ *
+ * Parameters:
+ *   spec     The speculator, or NULL
+ *
+ * Returns: None
+ */
+void SPEC_free(Speculator spec);
+
+/*
+ * Tell the helper thread what the line being typed looks like now. Only
+ * the latest line is worked on; earlier ones not yet started are dropped.
+ *
+ * Parameters:
+ *   spec     The speculator, or NULL to expand the pattern now
+ *   line     The text typed so far
+ *   path     The value of PATH, or NULL for the default
+ *
+ * Returns: None
+ */
+void SPEC_hint(Speculator spec, const char *line, const char *path);
+
+/*
+ * Expand a glob pattern as glob() would, using the helper thread's
+ * result if it globbed the same pattern in the same directory and the
+ * directory has not changed since
+ *
+ * Parameters:
+ *   spec     The speculator, or NULL to expand the pattern now
+ *   pattern  The pattern
+ *
+ * Returns: The matching paths as a NULL-terminated array of strings,
+ *   the array and the strings from MEM_alloc, or NULL if nothing matches
+ */
+char **SPEC_glob(Speculator spec, const char *pattern);
+
+#endif /* _SPECULATE_H_ */
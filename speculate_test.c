@@ -0,0 +1,179 @@
+/**
+ * speculate_test.c
+ *
+ * This file contains the test cases for pathcache.c and speculate.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "speculate.h"
+#include "mem.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Creates an empty file with the given mode
+ */
+static void touch(const char *file, mode_t mode)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd >= 0)
+        close(fd);
+    chmod(file, mode);
+}
+
+/*
+ * Frees an array returned by SPEC_glob
+ */
+static void free_matches(char **matches)
+{
+    for (int i = 0; matches != NULL && matches[i] != NULL; i++)
+        MEM_free(matches[i]);
+    MEM_free(matches);
+}
+
+/*
+ * Tests finding commands in the PATH, and noticing when they have gone
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_pathcache()
+{
+    char dir1[] = "/tmp/plaid_pc1_XXXXXX";
+    char dir2[] = "/tmp/plaid_pc2_XXXXXX";
+    char path[128], file1[128], file2[128], plain[128];
+    char *found = NULL;
+    PathCache pc = PC_new();
+
+    test_assert(mkdtemp(dir1) != NULL && mkdtemp(dir2) != NULL);
+    snprintf(path, sizeof(path), "%s:%s", dir1, dir2);
+    snprintf(file1, sizeof(file1), "%s/tool", dir1);
+    snprintf(file2, sizeof(file2), "%s/tool", dir2);
+    snprintf(plain, sizeof(plain), "%s/data", dir1);
+    touch(file1, 0755);
+    touch(file2, 0755);
+    touch(plain, 0644);
+
+    found = PC_lookup(pc, path, "tool");
+    test_assert(found != NULL && strcmp(found, file1) == 0);
+    MEM_free(found);
+
+    // a file that is not executable is not a command
+    found = PC_lookup(pc, path, "data");
+    test_assert(found == NULL);
+
+    // the cached file is gone, so the search continues in the PATH
+    unlink(file1);
+    found = PC_lookup(pc, path, "tool");
+    test_assert(found != NULL && strcmp(found, file2) == 0);
+    MEM_free(found);
+
+    // a different PATH starts over
+    found = PC_lookup(pc, dir1, "tool");
+    test_assert(found == NULL);
+
+    unlink(file2);
+    unlink(plain);
+    rmdir(dir1);
+    rmdir(dir2);
+    PC_free(pc);
+    return 1;
+
+test_error:
+    MEM_free(found);
+    PC_free(pc);
+    return 0;
+}
+
+/*
+ * Tests that globs expanded ahead of time match what glob() finds,
+ * including after the directory changes
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_speculative_glob()
+{
+    char dir[] = "/tmp/plaid_spec_XXXXXX";
+    char pattern[128], file_a[128], file_b[128], line[160];
+    char **matches = NULL;
+    PathCache pc = PC_new();
+    Speculator spec = SPEC_new(pc);
+
+    test_assert(spec != NULL && mkdtemp(dir) != NULL);
+    snprintf(pattern, sizeof(pattern), "%s/*.c", dir);
+    snprintf(file_a, sizeof(file_a), "%s/a.c", dir);
+    snprintf(file_b, sizeof(file_b), "%s/b.c", dir);
+    touch(file_a, 0644);
+
+    snprintf(line, sizeof(line), "ls -l %s | wc", pattern);
+    SPEC_hint(spec, line, "/usr/bin:/bin");
+
+    // whether or not the helper thread has finished, the result is the same
+    for (int i = 0; i < 20; i++)
+    {
+        matches = SPEC_glob(spec, pattern);
+        test_assert(matches != NULL && strcmp(matches[0], file_a) == 0 && matches[1] == NULL);
+        free_matches(matches);
+        matches = NULL;
+        usleep(1000);
+    }
+
+    // a new file in the directory is not missed
+    touch(file_b, 0644);
+    matches = SPEC_glob(spec, pattern);
+    test_assert(matches != NULL && matches[1] != NULL && strcmp(matches[1], file_b) == 0);
+    free_matches(matches);
+    matches = NULL;
+
+    unlink(file_a);
+    unlink(file_b);
+    matches = SPEC_glob(spec, pattern);
+    test_assert(matches == NULL);
+
+    // the command was found while the line was "typed"
+    char *ls = PC_lookup(pc, "/usr/bin:/bin", "ls");
+    test_assert(ls != NULL);
+    MEM_free(ls);
+
+    rmdir(dir);
+    SPEC_free(spec);
+    PC_free(pc);
+    return 1;
+
+test_error:
+    free_matches(matches);
+    SPEC_free(spec);
+    PC_free(pc);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_pathcache();
+    num_tests++;
+    passed += test_speculative_glob();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
@@ -7,7 +7,15 @@ typedef enum
     TOK_QUOTED_WORD,
     TOK_LESSTHAN,
     TOK_GREATERTHAN,
-    TOK_PIPE
+    TOK_PIPE,
+    TOK_HEREDOC,   // <<DELIM; the text is the body of the here-document
+    TOK_HERESTRING, // <<<, followed by the word to feed to stdin
+    TOK_PROCSUB_IN, // <(command); the text is the command
+    TOK_PROCSUB_OUT, // >(command); the text is the command
+    TOK_SEMI,        // ; or the end of a line, between the commands of a compound command
+    TOK_KEYWORD,     // for, while, if, NAME(), do, done, then, elif, else, fi, { or } at the start of a command
+    TOK_DEFERRED,    // a word of a compound command expanded each time it runs; the text is the source
+    TOK_DEFERRED_HEREDOC // a here-document of a compound command; the text is the unexpanded body
 } TokenType;
 
 typedef struct
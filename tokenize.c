@@ -10,8 +10,60 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <assert.h>
+#include <inttypes.h>
 
 #include "tokenize.h"
+#include "arith.h"
+#include "mem.h"
+
+// where the lexer is between two calls to TOK_tokenize_chunk
+typedef enum
+{
+    TS_BLANK,  // between tokens
+    TS_WORD,   // inside an unquoted word
+    TS_QUOTED  // inside a double-quoted word
+} TokMode;
+
+struct _tok_state
+{
+    CList tokens;    // tokens completed so far for the current command
+    TokMode mode;    // lexer mode at the end of the last chunk
+    bool escape;     // the last chunk ended with a backslash
+    bool resuming;   // the last chunk was incomplete
+    char *word;      // the word being built
+    size_t word_len; // length of word
+    size_t word_cap; // allocated size of word
+    VarTable vars;   // variables for $NAME expansion, or NULL
+
+    TOK_subst_callback subst; // runs $(...) commands, or NULL
+    void *subst_data;         // passed to subst
+
+    TOK_glob_callback glob; // expands globs, or NULL to call glob()
+    void *glob_data;        // passed to glob
+
+    bool want_delim;     // the next word is a here-document delimiter
+    char *heredoc_delim; // delimiter of the pending here-document, or NULL
+    bool heredoc_expand; // expand variables in the body (unquoted delimiter)
+    bool in_heredoc;     // the chunks are here-document body lines
+    int heredoc_pos;     // position of the TOK_HEREDOC token in tokens
+
+    bool deferred;          // every command is tokenized as a compound command's
+    bool compound;          // the command started with for, while, if or NAME()
+    int depth;              // the for, while, if and NAME() not yet closed by done, fi or }
+    bool cmd_start;         // the next word of the compound command starts a command
+    bool word_expands;      // the word being built has a $ expansion
+    const char *raw_start;  // where the word being built starts in the chunk
+    char *raw;              // the source of the word being built, from earlier chunks
+    size_t raw_len;         // length of raw
+    size_t raw_cap;         // allocated size of raw
+
+    const char *command; // the command of the words expanded by TOK_expand_arg, or NULL
+    TokState expander;   // the state TOK_expand last expanded a word with, or NULL
+};
+
+// the keywords of compound commands, other than for, while, if and NAME()
+static const char *_TOK_keywords[] = {"do", "done", "then", "elif", "else", "fi", "{", "}", NULL};
 
 // Documented in .h file
 const char *TT_to_str(TokenType tt)
@@ -28,222 +80,1267 @@ const char *TT_to_str(TokenType tt)
         return "GREATERTHAN";
     case TOK_PIPE:
         return "PIPE";
+    case TOK_HEREDOC:
+        return "HEREDOC";
+    case TOK_HERESTRING:
+        return "HERESTRING";
+    case TOK_PROCSUB_IN:
+        return "PROCSUB_IN";
+    case TOK_PROCSUB_OUT:
+        return "PROCSUB_OUT";
+    case TOK_SEMI:
+        return "SEMI";
+    case TOK_KEYWORD:
+        return "KEYWORD";
+    case TOK_DEFERRED:
+        return "DEFERRED";
+    case TOK_DEFERRED_HEREDOC:
+        return "DEFERRED_HEREDOC";
     }
     __builtin_unreachable();
 }
 
+/*
+ * Append a character to the word being built, growing it as needed
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   c        The character to append
+ *
+ * Returns: None
+ */
+static void _TOK_word_putc(TokState state, char c)
+{
+    if (state->word_len + 1 >= state->word_cap)
+    {
+        state->word_cap = state->word_cap ? state->word_cap * 2 : 64;
+        state->word = MEM_realloc(MEM_TOKENS, state->word, state->word_cap);
+        assert(state->word != NULL);
+    }
+
+    state->word[state->word_len++] = c;
+    state->word[state->word_len] = '\0';
+}
+
+/*
+ * Append source text to the word being built, for a word of a compound
+ * command that is expanded each time it runs
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   text     The source text
+ *   len      The length of text
+ *
+ * Returns: None
+ */
+static void _TOK_raw_append(TokState state, const char *text, size_t len)
+{
+    if (state->raw_len + len + 1 > state->raw_cap)
+    {
+        while (state->raw_len + len + 1 > state->raw_cap)
+            state->raw_cap = state->raw_cap ? state->raw_cap * 2 : 64;
+        state->raw = MEM_realloc(MEM_TOKENS, state->raw, state->raw_cap);
+        assert(state->raw != NULL);
+    }
+
+    memcpy(state->raw + state->raw_len, text, len);
+    state->raw_len += len;
+    state->raw[state->raw_len] = '\0';
+}
+
+/*
+ * Whether a word starts a function definition: a name followed by ()
+ */
+static bool _TOK_funcdef(const char *word)
+{
+    int len = strlen(word);
+    return len > 2 && strcmp(word + len - 2, "()") == 0 && VAR_valid_name(word, len - 2);
+}
+
+/*
+ * Check whether a finished unquoted word is a keyword of a compound
+ * command, and count the for, while, if and function definitions that
+ * are still open; a definition is open from its NAME() to its '}'.
+ * Only a command line that starts with one of them is a compound
+ * command, and within one the keywords are only recognized at the
+ * start of a command.
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   word     The word
+ *
+ * Returns: true if the word is a keyword
+ */
+static bool _TOK_keyword(TokState state, const char *word)
+{
+    bool opens = strcmp(word, "for") == 0 || strcmp(word, "while") == 0 || strcmp(word, "if") == 0 ||
+                 _TOK_funcdef(word);
+    bool closes = strcmp(word, "done") == 0 || strcmp(word, "fi") == 0 || strcmp(word, "}") == 0;
+
+    if (!state->compound)
+    {
+        if (!opens || state->tokens->length > 0)
+            return false;
+
+        state->compound = true;
+    }
+
+    else if (!state->cmd_start)
+        return false;
+
+    else if (!opens)
+    {
+        int i = 0;
+        while (_TOK_keywords[i] != NULL && strcmp(word, _TOK_keywords[i]) != 0)
+            i++;
+
+        if (_TOK_keywords[i] == NULL)
+            return false;
+    }
+
+    state->depth += opens ? 1 : closes ? -1 : 0;
+
+    // the name after for, and whatever follows done, fi or }, are not commands
+    state->cmd_start = strcmp(word, "for") != 0 && !closes;
+    return true;
+}
+
+/*
+ * Append a word token to the list, freeing its text if the list
+ * drops it (CL_append ignores empty and all-space words)
+ *
+ * Parameters:
+ *   tokens   The list of tokens
+ *   tok      The token, whose text is from MEM_alloc
+ *
+ * Returns: None
+ */
+static void _TOK_append(CList tokens, Token tok)
+{
+    int length = tokens->length;
+
+    CL_append(tokens, tok);
+
+    if (tokens->length == length)
+        MEM_free(tok.text);
+}
+
+// the command of the words tokenized so far, found by _TOK_find_command
+struct _tok_command
+{
+    const char *name; // the first word since the last |, ; or keyword, or NULL
+    bool redirect;    // the last token redirects, so the next word is a file
+};
+
+static void _TOK_find_command(int pos, Token tok, void *cb_data)
+{
+    struct _tok_command *command = cb_data;
+
+    if (tok.type == TOK_PIPE || tok.type == TOK_SEMI || tok.type == TOK_KEYWORD)
+        *command = (struct _tok_command){NULL, false};
+    else if (tok.type == TOK_LESSTHAN || tok.type == TOK_GREATERTHAN || tok.type == TOK_HERESTRING)
+        command->redirect = true;
+    else if (tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD || tok.type == TOK_DEFERRED)
+    {
+        if (!command->redirect && command->name == NULL)
+            command->name = tok.text;
+        command->redirect = false;
+    }
+}
+
+/*
+ * Whether a command is test or [, which are given empty quoted words,
+ * as in [ -n "$X" ]; other commands are not
+ */
+static bool _TOK_is_test(const char *command)
+{
+    return command != NULL && (strcmp(command, "test") == 0 || strcmp(command, "[") == 0);
+}
+
+/*
+ * Whether the word being finished is an argument of test or [
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *
+ * Returns: true if the command of the word is test or [
+ */
+static bool _TOK_keeps_empty(TokState state)
+{
+    struct _tok_command command = {state->command, false};
+    CL_foreach(state->tokens, _TOK_find_command, &command);
+
+    return _TOK_is_test(command.name);
+}
+
+/*
+ * Append a finished unquoted word to the token list, expanding globs
+ * and a leading tilde.
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   word     The word, with escapes already translated
+ *
+ * Returns: None
+ */
+static void _TOK_append_word(TokState state, const char *word)
+{
+    glob_t globbuf;
+
+    // words without wildcards or a tilde would glob to themselves
+    if (strpbrk(word, "*?[") == NULL && word[0] != '~')
+    {
+        _TOK_append(state->tokens, (Token){TOK_WORD, MEM_strdup(MEM_TOKENS, word)});
+        return;
+    }
+
+    if (state->glob != NULL)
+    {
+        char **matches = state->glob(word, state->glob_data);
+        if (matches != NULL)
+        {
+            // the tokens take over the strings
+            for (int i = 0; matches[i] != NULL; i++)
+                _TOK_append(state->tokens, (Token){TOK_WORD, matches[i]});
+            MEM_free(matches);
+        }
+        else
+            _TOK_append(state->tokens, (Token){TOK_WORD, MEM_strdup(MEM_TOKENS, word)});
+    }
+
+    else if (glob(word, GLOB_TILDE_CHECK, NULL, &globbuf) == 0)
+    {
+        for (int i = 0; i < globbuf.gl_pathc; i++)
+            _TOK_append(state->tokens, (Token){TOK_WORD, MEM_strdup(MEM_GLOB, globbuf.gl_pathv[i])});
+
+        globfree(&globbuf);
+    }
+    else
+    {
+        // If no matches found, add the original word to tokens
+        _TOK_append(state->tokens, (Token){TOK_WORD, MEM_strdup(MEM_TOKENS, word)});
+    }
+}
+
+/*
+ * Finish the word being built and add it to the token list. In a
+ * compound command, a word with an expansion, a glob or a leading tilde
+ * is added as its source text, to be expanded each time it runs.
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *   end      The end of the word's source in the chunk, or NULL
+ *
+ * Returns: None
+ */
+static void _TOK_finish_word(TokState state, const char *end)
+{
+    const char *word = state->word_len > 0 ? state->word : "";
+    bool keyword = false;
+
+    // the word after << is the delimiter; the body is filled in later
+    if (state->want_delim)
+    {
+        state->want_delim = false;
+        state->heredoc_delim = MEM_strdup(MEM_TOKENS, word);
+        state->heredoc_expand = state->mode != TS_QUOTED;
+        state->heredoc_pos = state->tokens->length;
+        CL_append(state->tokens, (Token){TOK_HEREDOC, NULL});
+    }
+
+    else if (state->mode == TS_WORD && !state->word_expands && _TOK_keyword(state, word))
+    {
+        CL_append(state->tokens, (Token){TOK_KEYWORD, MEM_strdup(MEM_TOKENS, word)});
+        keyword = true;
+    }
+
+    else if (state->compound && (state->word_expands ||
+                                 (state->mode == TS_WORD && (strpbrk(word, "*?[") != NULL || word[0] == '~'))))
+    {
+        if (state->raw_start != NULL && end != NULL)
+            _TOK_raw_append(state, state->raw_start, end - state->raw_start);
+        CL_append(state->tokens, (Token){TOK_DEFERRED, MEM_strndup(MEM_TOKENS, state->raw != NULL ? state->raw : "", state->raw_len)});
+    }
+
+    else if (state->mode == TS_QUOTED && word[strspn(word, " \t\n\v\f\r")] == '\0' && _TOK_keeps_empty(state))
+        CL_append_any(state->tokens, (Token){TOK_QUOTED_WORD, MEM_strdup(MEM_TOKENS, word)});
+    else if (state->mode == TS_QUOTED)
+        _TOK_append(state->tokens, (Token){TOK_QUOTED_WORD, MEM_strdup(MEM_TOKENS, word)});
+    else
+        _TOK_append_word(state, word);
+
+    if (!keyword)
+        state->cmd_start = false;
+
+    state->word_len = 0;
+    state->word_expands = false;
+    state->raw_len = 0;
+    state->raw_start = NULL;
+    state->mode = TS_BLANK;
+}
+
+/*
+ * Returns true if c may follow a backslash
+ */
+static bool _TOK_legal_escape(char c)
+{
+    return c != '\0' && strchr("nrt\"\\ |<>$", c) != NULL;
+}
+
+/*
+ * Translate the character following a backslash in an unquoted word
+ */
+static char _TOK_translate_escape(char c)
+{
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    default:
+        return c;
+    }
+}
+
+/*
+ * Expand the variable reference starting at p ($NAME, ${NAME}, $?, $#,
+ * a positional parameter $0 to $9, or $@) into the word being built. A
+ * '$' that does not start a reference is kept as typed.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   p          Points to the '$'
+ *   split      Whether $@ makes a word of each positional parameter,
+ *              as it does outside a here-document
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A pointer to the first character after the reference, or
+ *   NULL if the reference is malformed.
+ */
+static const char *_TOK_expand_var(TokState state, const char *p, bool split, char *errmsg, size_t errmsg_sz)
+{
+    const char *name = p + 1;
+    const char *end = NULL;
+    int len = 0;
+
+    if (*name == '{')
+    {
+        name++;
+        const char *close = strchr(name, '}');
+        if (close == NULL || !VAR_valid_name(name, close - name))
+        {
+            snprintf(errmsg, errmsg_sz, "Bad substitution");
+            return NULL;
+        }
+
+        len = close - name;
+        end = close + 1;
+    }
+    else if (*name == '@')
+    {
+        char **args = VAR_args(state->vars);
+
+        // each parameter is a word of its own, even inside quotes
+        for (int i = 1; args != NULL && args[i] != NULL; i++)
+        {
+            if (i > 1 && split)
+            {
+                TokMode mode = state->mode;
+                _TOK_finish_word(state, NULL);
+                state->mode = mode;
+            }
+            else if (i > 1)
+                _TOK_word_putc(state, ' ');
+
+            for (const char *c = args[i]; *c != '\0'; c++)
+                _TOK_word_putc(state, *c);
+        }
+
+        return name + 1;
+    }
+    else if (*name == '?' || *name == '#' || isdigit(*name))
+    {
+        len = 1;
+        end = name + 1;
+    }
+    else
+    {
+        while (isalnum(name[len]) || name[len] == '_')
+            len++;
+
+        if (!VAR_valid_name(name, len))
+        {
+            _TOK_word_putc(state, '$');
+            return p + 1;
+        }
+
+        end = name + len;
+    }
+
+    char *key = MEM_strndup(MEM_TOKENS, name, len);
+    const char *value = VAR_get(state->vars, key);
+    MEM_free(key);
+
+    while (value != NULL && *value != '\0')
+        _TOK_word_putc(state, *value++);
+
+    return end;
+}
+
+/*
+ * Find the ')' that closes a command substitution, skipping nested
+ * parentheses, quoted strings and escaped characters
+ *
+ * Parameters:
+ *   p        Points just after the opening "$("
+ *
+ * Returns: A pointer to the closing ')', or NULL if there is none
+ */
+static const char *_TOK_find_close_paren(const char *p)
+{
+    int depth = 1;
+    bool quoted = false;
+
+    for (; *p != '\0'; p++)
+    {
+        if (*p == '\\' && *(p + 1) != '\0')
+            p++;
+        else if (*p == '"')
+            quoted = !quoted;
+        else if (!quoted && *p == '(')
+            depth++;
+        else if (!quoted && *p == ')' && --depth == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+/*
+ * Run the command substitution starting at p ($(command)) and add its
+ * output, without trailing newlines, to the word being built. Outside
+ * quotes, the output is split into words at whitespace.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   p          Points to the '$'
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A pointer to the first character after the closing ')', or
+ *   NULL if the substitution is not terminated.
+ */
+static const char *_TOK_substitute(TokState state, const char *p, char *errmsg, size_t errmsg_sz)
+{
+    const char *close = _TOK_find_close_paren(p + 2);
+    if (close == NULL)
+    {
+        snprintf(errmsg, errmsg_sz, "Unterminated command substitution");
+        return NULL;
+    }
+
+    char *command = MEM_strndup(MEM_TOKENS, p + 2, close - (p + 2));
+    char *output = state->subst(command, state->subst_data);
+    MEM_free(command);
+
+    if (output == NULL)
+        return close + 1;
+
+    // drop the trailing newlines
+    size_t len = strlen(output);
+    while (len > 0 && output[len - 1] == '\n')
+        len--;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (state->mode == TS_WORD && isspace(output[i]))
+        {
+            // each run of whitespace ends a word
+            if (state->word_len > 0)
+            {
+                _TOK_finish_word(state, NULL);
+                state->mode = TS_WORD;
+            }
+        }
+        else
+            _TOK_word_putc(state, output[i]);
+    }
+
+    MEM_free(output);
+    return close + 1;
+}
+
+/*
+ * Find the end of the arithmetic expansion $((expression)) starting at p
+ *
+ * Parameters:
+ *   p        Points to the '$'
+ *
+ * Returns: A pointer to the last ')' of the closing "))", or NULL if p
+ *   does not start an arithmetic expansion
+ */
+static const char *_TOK_find_arith(const char *p)
+{
+    if (*(p + 1) != '(' || *(p + 2) != '(')
+        return NULL;
+
+    // $( (command) ) is a command substitution
+    const char *close = _TOK_find_close_paren(p + 2);
+    return close != NULL && close - 1 > p + 2 && *(close - 1) == ')' ? close : NULL;
+}
+
+/*
+ * Evaluate the arithmetic expansion starting at p ($((expression))) in
+ * the shell, and add its value to the word being built
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   p          Points to the '$'
+ *   close      Points to the last ')' of the expansion
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A pointer to the first character after the expansion, or
+ *   NULL if the expression is malformed.
+ */
+static const char *_TOK_arithmetic(TokState state, const char *p, const char *close, char *errmsg, size_t errmsg_sz)
+{
+    char value[24];
+    int64_t result;
+
+    char *expr = MEM_strndup(MEM_TOKENS, p + 3, close - 1 - (p + 3));
+    bool ok = ARITH_eval(state->vars, expr, &result, errmsg, errmsg_sz);
+    MEM_free(expr);
+
+    if (!ok)
+        return NULL;
+
+    snprintf(value, sizeof(value), "%" PRId64, result);
+    for (const char *c = value; *c != '\0'; c++)
+        _TOK_word_putc(state, *c);
+
+    return close + 1;
+}
+
+/*
+ * Whether the '$' at p starts an expansion: one the state can expand,
+ * or any in a deferred state, which only keeps their source
+ */
+static bool _TOK_expands(TokState state, const char *p)
+{
+    if (state->deferred)
+        return true;
+
+    return (*(p + 1) == '(' && state->subst != NULL) || state->vars != NULL;
+}
+
+/*
+ * Expand the $NAME, ${NAME}, $?, $((expression)) or $(command) starting
+ * at p into the word being built. In a compound command, the expansion
+ * is only skipped, and the word is expanded from its source each time
+ * it runs.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   p          Points to the '$'
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A pointer to the first character after the expansion, or
+ *   NULL if it is malformed.
+ */
+static const char *_TOK_expansion(TokState state, const char *p, char *errmsg, size_t errmsg_sz)
+{
+    const char *arith = state->vars != NULL || state->deferred ? _TOK_find_arith(p) : NULL;
+    bool subst = *(p + 1) == '(' && (state->subst != NULL || state->deferred);
+    state->word_expands = true;
+
+    if (!state->compound && arith != NULL)
+        return _TOK_arithmetic(state, p, arith, errmsg, errmsg_sz);
+
+    if (!state->compound)
+        return subst ? _TOK_substitute(state, p, errmsg, errmsg_sz) : _TOK_expand_var(state, p, true, errmsg, errmsg_sz);
+
+    if (arith != NULL)
+        return arith + 1;
+
+    if (!subst)
+        return p + 1;
+
+    const char *close = _TOK_find_close_paren(p + 2);
+    if (close == NULL)
+    {
+        snprintf(errmsg, errmsg_sz, "Unterminated command substitution");
+        return NULL;
+    }
+
+    return close + 1;
+}
+
+/*
+ * Add a line of a here-document body to the word being built, expanding
+ * $NAME, ${NAME}, $?, $((expression)) and $(command), followed by a
+ * newline
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   line       The body line, without the trailing newline
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true if the line was added, false on error
+ */
+static bool _TOK_expand_line(TokState state, const char *line, char *errmsg, size_t errmsg_sz)
+{
+    const char *p = line;
+    const char *close;
+
+    while (*p != '\0')
+    {
+        if (*p == '\\' && *(p + 1) == '$')
+        {
+            _TOK_word_putc(state, '$');
+            p += 2;
+        }
+
+        else if (*p == '$' && state->vars != NULL && (close = _TOK_find_arith(p)) != NULL)
+            p = _TOK_arithmetic(state, p, close, errmsg, errmsg_sz);
+
+        else if (*p == '$' && *(p + 1) == '(' && state->subst != NULL)
+            p = _TOK_substitute(state, p, errmsg, errmsg_sz);
+
+        else if (*p == '$' && state->vars != NULL)
+            p = _TOK_expand_var(state, p, false, errmsg, errmsg_sz);
+
+        else
+            _TOK_word_putc(state, *p++);
+
+        if (p == NULL)
+            return false;
+    }
+
+    _TOK_word_putc(state, '\n');
+    return true;
+}
+
+/*
+ * Add one line to the body of the pending here-document, or finish the
+ * body if the line is the delimiter. With an unquoted delimiter,
+ * $NAME, ${NAME}, $?, $((expression)) and $(command) are expanded in the
+ * line, except in a compound command, which expands the body each time
+ * it runs.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   line       The body line, without the trailing newline
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true if the line was added or ended the body, false on error
+ */
+static bool _TOK_heredoc_line(TokState state, const char *line, char *errmsg, size_t errmsg_sz)
+{
+    if (strcmp(line, state->heredoc_delim) == 0)
+    {
+        // store the finished body in the TOK_HEREDOC token
+        struct _cl_node *node = state->tokens->head;
+        for (int i = 0; i < state->heredoc_pos; i++)
+            node = node->next;
+        node->tok_elt.text = MEM_strndup(MEM_TOKENS, state->word_len > 0 ? state->word : "", state->word_len);
+        if (state->compound && state->heredoc_expand && strchr(node->tok_elt.text, '$') != NULL)
+            node->tok_elt.type = TOK_DEFERRED_HEREDOC;
+
+        MEM_free(state->heredoc_delim);
+        state->heredoc_delim = NULL;
+        state->in_heredoc = false;
+        state->word_len = 0;
+        return true;
+    }
+
+    if (state->heredoc_expand && !state->compound)
+        return _TOK_expand_line(state, line, errmsg, errmsg_sz);
+
+    for (const char *p = line; *p != '\0'; p++)
+        _TOK_word_putc(state, *p);
+
+    _TOK_word_putc(state, '\n');
+    return true;
+}
+
+/*
+ * Hand the tokens of a finished line over to the caller, unless the line
+ * is in the middle of a compound command, which continues on the next
+ * line as if after a ';'
+ *
+ * Parameters:
+ *   state    The tokenizer state
+ *
+ * Returns: The tokens of the command, or NULL if it is incomplete
+ */
+static CList _TOK_end_line(TokState state)
+{
+    if (state->compound && state->depth > 0)
+    {
+        CL_append(state->tokens, (Token){TOK_SEMI, NULL});
+        state->cmd_start = true;
+        state->resuming = true;
+        return NULL;
+    }
+
+    CList tokens = state->tokens;
+    state->tokens = CL_new();
+    state->resuming = false;
+    state->compound = false;
+    state->depth = 0;
+
+    return tokens;
+}
+
+/*
+ * Create a tokenizer state that expands words as state does
+ */
+static TokState _TOK_state_expander(TokState state)
+{
+    TokState expander = TOK_state_new();
+    TOK_state_set_vars(expander, state->vars);
+    TOK_state_set_subst(expander, state->subst, state->subst_data);
+    TOK_state_set_glob(expander, state->glob, state->glob_data);
+
+    return expander;
+}
+
 // Documented in .h file
-CList TOK_tokenize_input(const char *user_input, char *errmsg, size_t errmsg_sz)
+TokState TOK_state_new()
 {
+    TokState state = (TokState)MEM_alloc(MEM_TOKENS, sizeof(struct _tok_state));
+    assert(state != NULL);
+
+    state->tokens = CL_new();
+    state->mode = TS_BLANK;
+    state->escape = false;
+    state->resuming = false;
+    state->word = NULL;
+    state->word_len = 0;
+    state->word_cap = 0;
+    state->vars = NULL;
+    state->subst = NULL;
+    state->subst_data = NULL;
+    state->glob = NULL;
+    state->glob_data = NULL;
+    state->want_delim = false;
+    state->heredoc_delim = NULL;
+    state->heredoc_expand = false;
+    state->in_heredoc = false;
+    state->heredoc_pos = 0;
+    state->deferred = false;
+    state->compound = false;
+    state->depth = 0;
+    state->cmd_start = false;
+    state->word_expands = false;
+    state->raw_start = NULL;
+    state->raw = NULL;
+    state->raw_len = 0;
+    state->raw_cap = 0;
+    state->command = NULL;
+    state->expander = NULL;
+
+    return state;
+}
+
+// Documented in .h file
+void TOK_state_free(TokState state)
+{
+    if (state == NULL)
+        return;
+
+    CL_free(state->tokens);
+    MEM_free(state->word);
+    MEM_free(state->raw);
+    MEM_free(state->heredoc_delim);
+    TOK_state_free(state->expander);
+    MEM_free(state);
+}
+
+// Documented in .h file
+void TOK_state_reset(TokState state)
+{
+    assert(state != NULL);
+
+    CL_free(state->tokens);
+    state->tokens = CL_new();
+    state->mode = TS_BLANK;
+    state->escape = false;
+    state->resuming = false;
+    state->word_len = 0;
+    state->want_delim = false;
+    MEM_free(state->heredoc_delim);
+    state->heredoc_delim = NULL;
+    state->in_heredoc = false;
+    state->compound = false;
+    state->depth = 0;
+    state->cmd_start = false;
+    state->word_expands = false;
+    state->raw_start = NULL;
+    state->raw_len = 0;
+}
+
+// Documented in .h file
+void TOK_state_set_vars(TokState state, VarTable vars)
+{
+    assert(state != NULL);
+    state->vars = vars;
+}
+
+// Documented in .h file
+void TOK_state_set_subst(TokState state, TOK_subst_callback subst, void *cb_data)
+{
+    assert(state != NULL);
+    state->subst = subst;
+    state->subst_data = cb_data;
+}
+
+// Documented in .h file
+void TOK_state_set_glob(TokState state, TOK_glob_callback glob_fn, void *cb_data)
+{
+    assert(state != NULL);
+    state->glob = glob_fn;
+    state->glob_data = cb_data;
+}
+
+// Documented in .h file
+void TOK_state_set_deferred(TokState state, bool deferred)
+{
+    assert(state != NULL);
+    state->deferred = deferred;
+}
+
+// Documented in .h file
+bool TOK_state_incomplete(TokState state)
+{
+    return state != NULL && state->resuming;
+}
+
+// Documented in .h file
+CList TOK_tokenize_chunk(TokState state, const char *input, char *errmsg, size_t errmsg_sz)
+{
+    assert(state != NULL);
+
     // clear the error message
     errmsg[0] = '\0';
-    CList tokens = CL_new();
-    glob_t globbuf;
 
-    while (user_input != NULL && *user_input != '\0')
+    // a here-document body line is not tokenized
+    if (state->in_heredoc)
+    {
+        if (!_TOK_heredoc_line(state, input != NULL ? input : "", errmsg, errmsg_sz))
+        {
+            TOK_state_reset(state);
+            return NULL;
+        }
+
+        if (state->in_heredoc)
+            return NULL;
+
+        return _TOK_end_line(state);
+    }
+
+    // a continuation line either joins the escaped line or adds a newline to the open quote
+    if (state->resuming)
+    {
+        if (state->escape)
+            state->escape = false;
+        else if (state->mode == TS_QUOTED)
+        {
+            _TOK_word_putc(state, '\n');
+            if (state->compound)
+                _TOK_raw_append(state, "\n", 1);
+        }
+
+        state->raw_start = input;
+        state->resuming = false;
+    }
+
+    // a new command of a deferred state starts as a compound command's
+    else if (state->deferred)
     {
-        // Skip any leading spaces
-        if (isspace(*user_input))
-            user_input++;
+        state->compound = true;
+        state->cmd_start = true;
+    }
 
-        else if (*user_input)
+    const char *p = input;
+    while (p != NULL && *p != '\0')
+    {
+        if (state->mode == TS_BLANK)
         {
-            if (*user_input == '<')
+            // Skip any leading spaces
+            if (isspace(*p))
+                p++;
+
+            // <(command) and >(command) are left for the executor to start
+            else if ((*p == '<' || *p == '>') && *(p + 1) == '(')
             {
-                Token tok = {TOK_LESSTHAN, NULL};
-                CL_append(tokens, (Token)tok);
-                user_input++;
+                const char *close = _TOK_find_close_paren(p + 2);
+                if (close == NULL)
+                {
+                    snprintf(errmsg, errmsg_sz, "Unterminated process substitution");
+                    TOK_state_reset(state);
+                    return NULL;
+                }
+
+                TokenType type = *p == '<' ? TOK_PROCSUB_IN : TOK_PROCSUB_OUT;
+                CL_append(state->tokens, (Token){type, MEM_strndup(MEM_TOKENS, p + 2, close - (p + 2))});
+                p = close + 1;
             }
 
-            else if (*user_input == '>')
+            else if (*p == '<' && *(p + 1) == '<' && *(p + 2) == '<')
             {
-                Token tok = {TOK_GREATERTHAN, NULL};
-                CL_append(tokens, (Token)tok);
-                user_input++;
+                CL_append(state->tokens, (Token){TOK_HERESTRING, NULL});
+                p += 3;
             }
 
-            else if (*user_input == '|')
+            else if (*p == '<' && *(p + 1) == '<')
             {
-                Token tok = {TOK_PIPE, NULL};
-                CL_append(tokens, (Token)tok);
-                user_input++;
+                // only one here-document body can follow a command
+                if (state->want_delim || state->heredoc_delim != NULL)
+                {
+                    snprintf(errmsg, errmsg_sz, "Multiple redirection");
+                    TOK_state_reset(state);
+                    return NULL;
+                }
+
+                state->want_delim = true;
+                p += 2;
+            }
+
+            else if (*p == '<')
+            {
+                CL_append(state->tokens, (Token){TOK_LESSTHAN, NULL});
+                p++;
+            }
+
+            else if (*p == '>')
+            {
+                CL_append(state->tokens, (Token){TOK_GREATERTHAN, NULL});
+                p++;
+            }
+
+            else if (*p == '|')
+            {
+                CL_append(state->tokens, (Token){TOK_PIPE, NULL});
+                p++;
+            }
+
+            // only a compound command is split into commands at a ';'
+            else if (*p == ';' && state->compound)
+            {
+                CL_append(state->tokens, (Token){TOK_SEMI, NULL});
+                state->cmd_start = true;
+                p++;
             }
 
             // Check for a quoted word
-            else if (*user_input == '"')
+            else if (*p == '"')
             {
-                char *quoted_word = malloc(strlen(user_input) - 1);
-                const char *end_quoted = user_input + 1;
+                state->mode = TS_QUOTED;
+                state->raw_start = p++;
+            }
+
+            // Else, a word starts here
+            else
+            {
+                state->mode = TS_WORD;
+                state->raw_start = p;
+            }
+        }
+
+        else if (state->mode == TS_WORD)
+        {
+            if (isspace(*p) || *p == '<' || *p == '>' || *p == '|' || *p == '"' || (*p == ';' && state->compound))
+                _TOK_finish_word(state, p);
 
-                while (*end_quoted != '"')
+            else if (*p == '\\')
+            {
+                // a trailing backslash continues the word on the next line
+                if (*(p + 1) == '\0')
                 {
-                    // Check for illegal escape characters
-                    if (*end_quoted == '\\')
-                    {
-                        if (*(end_quoted + 1) != 'n' && *(end_quoted + 1) != 'r' && *(end_quoted + 1) != 't' && *(end_quoted + 1) != '"' && *(end_quoted + 1) != '\\' && *(end_quoted + 1) != ' ' && *(end_quoted + 1) != '|' && *(end_quoted + 1) != '<' && *(end_quoted + 1) != '>')
-                        {
-                            snprintf(errmsg, errmsg_sz, "Illegal escape character '%c", *(end_quoted + 1));
-                            CL_free(tokens);
-                            free(quoted_word);
-                            return NULL;
-                        }
-                    }
-
-                    end_quoted++;
-
-                    // if we reach the end of the string without finding the closing quote, return an error
-                    if (*end_quoted == '\0')
-                    {
-                        snprintf(errmsg, errmsg_sz, "Unterminated quote");
-                        free(quoted_word);
-                        CL_free(tokens);
-                        return NULL;
-                    }
+                    state->escape = true;
+                    p++;
+                    break;
                 }
 
-                // Else, we found the closing quote, so copy the quoted word into a new string
-                char *w = malloc(end_quoted - user_input);
-                if (w == NULL)
+                if (!_TOK_legal_escape(*(p + 1)))
                 {
-                    snprintf(errmsg, errmsg_sz, "Unable to allocate memory for quoted word");
-                    CL_free(tokens);
+                    snprintf(errmsg, errmsg_sz, "Illegal escape character '%c", *(p + 1));
+                    TOK_state_reset(state);
                     return NULL;
                 }
 
-                snprintf(w, end_quoted - user_input, "%s", user_input + 1);
-                Token tok = {TOK_QUOTED_WORD, w};
-                CL_append(tokens, (Token)tok);
-
-                // deallocate the memory
-                free(quoted_word);
-
-                // move the pointer to the next character after the closing quote
-                user_input = end_quoted + 1;
+                _TOK_word_putc(state, _TOK_translate_escape(*(p + 1)));
+                p += 2;
             }
 
-            // Check for a word
-            else
+            else if (*p == '$' && _TOK_expands(state, p))
             {
-                char *word = malloc(strlen(user_input) + 1);
-                int i = 0;
-                while (*user_input != '\0' && !isspace(*user_input) && *user_input != '<' && *user_input != '>' && *user_input != '|' && *user_input != '"')
+                p = _TOK_expansion(state, p, errmsg, errmsg_sz);
+                if (p == NULL)
                 {
-                    if (*user_input == '\\')
-                    {
-                        switch (*(user_input + 1))
-                        {
-                        case 'n':
-                            word[i++] = '\n';
-                            break;
-
-                        case 'r':
-                            word[i++] = '\r';
-                            break;
-
-                        case 't':
-                            word[i++] = '\t';
-                            break;
-
-                        case '"':
-                            word[i++] = '\"';
-                            break;
-
-                        case '\\':
-                            word[i++] = '\\';
-                            break;
-
-                        case ' ':
-                            word[i++] = ' ';
-                            break;
-
-                        case '|':
-                            word[i++] = '|';
-                            break;
-
-                        case '<':
-                            word[i++] = '<';
-                            break;
-
-                        case '>':
-                            word[i++] = '>';
-                            break;
-
-                        default:
-                            snprintf(errmsg, errmsg_sz, "Illegal escape character '%c", *(user_input + 1));
-                            CL_free(tokens);
-                            free(word);
-
-                            return NULL;
-                        }
-                        user_input += 2;
-                    }
-                    else
-                    {
-                        word[i++] = *user_input++;
-                    }
+                    TOK_state_reset(state);
+                    return NULL;
                 }
-                word[i] = '\0';
+            }
 
-                // Check for globbing characters
-                switch (*word)
-                {
-                case '*':
-                case '?':
-                case '[':
-                    glob(word, GLOB_NOCHECK, NULL, &globbuf);
-                    break;
+            else
+                _TOK_word_putc(state, *p++);
+        }
 
-                case '~':
-                    char *tilde_rep = malloc(sizeof(char) * (strlen(word) + strlen(getenv("HOME")) + 1));
-                    strcpy(tilde_rep, word);
-                    glob(tilde_rep, GLOB_TILDE_CHECK, NULL, &globbuf);
-                    free(tilde_rep);
-                    tilde_rep = NULL;
-                    break;
+        else // TS_QUOTED
+        {
+            if (*p == '"')
+            {
+                _TOK_finish_word(state, p + 1);
+                p++;
+            }
 
-                default:
-                    glob(word, GLOB_TILDE_CHECK, NULL, &globbuf);
+            else if (*p == '\\')
+            {
+                // a trailing backslash continues the quote on the next line
+                if (*(p + 1) == '\0')
+                {
+                    state->escape = true;
+                    p++;
                     break;
                 }
 
-                if (globbuf.gl_pathc != 0)
+                // escapes inside quotes are checked, but kept as typed
+                if (!_TOK_legal_escape(*(p + 1)))
                 {
-                    for (int i = 0; i < globbuf.gl_pathc; i++)
-                    {
-                        char *w = strdup(globbuf.gl_pathv[i]);
-                        Token tok = {TOK_WORD, w};
-                        CL_append(tokens, tok);
-                    }
+                    snprintf(errmsg, errmsg_sz, "Illegal escape character '%c", *(p + 1));
+                    TOK_state_reset(state);
+                    return NULL;
                 }
-                else
+
+                // \$ is a literal dollar sign, even when expanding variables
+                if (*(p + 1) == '$')
                 {
-                    // If no matches found, add the original word to tokens
-                    Token tok = {TOK_WORD, strdup(word)};
-                    CL_append(tokens, tok);
-
-                    // deallocate the memory
-                    if (word != NULL)
-                    {
-                        free(word);
-                        word = NULL;
-                    }
+                    _TOK_word_putc(state, '$');
+                    p += 2;
                 }
+                else
+                    _TOK_word_putc(state, *p++);
+            }
 
-                if (globbuf.gl_pathc != 0)
-                    globfree(&globbuf);
-
-                if (word != NULL)
+            else if (*p == '$' && _TOK_expands(state, p))
+            {
+                p = _TOK_expansion(state, p, errmsg, errmsg_sz);
+                if (p == NULL)
                 {
-                    free(word);
-                    word = NULL;
+                    TOK_state_reset(state);
+                    return NULL;
                 }
             }
+
+            else
+                _TOK_word_putc(state, *p++);
         }
     }
 
+    // an open quote or trailing backslash needs a continuation line
+    if (state->escape || state->mode == TS_QUOTED)
+    {
+        // keep the source of the word, without the backslash
+        if (state->compound && state->raw_start != NULL)
+            _TOK_raw_append(state, state->raw_start, p - state->raw_start - (state->escape ? 1 : 0));
+
+        state->raw_start = NULL;
+        state->resuming = true;
+        return NULL;
+    }
+
+    if (state->mode == TS_WORD)
+        _TOK_finish_word(state, p);
+
+    if (state->want_delim)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect delimiter after here-document");
+        TOK_state_reset(state);
+        return NULL;
+    }
+
+    // the here-document body follows on the next lines
+    if (state->heredoc_delim != NULL)
+    {
+        state->in_heredoc = true;
+        state->resuming = true;
+        return NULL;
+    }
+
+    // hand the completed list over to the caller
+    return _TOK_end_line(state);
+}
+
+// Documented in .h file
+CList TOK_tokenize_input(const char *user_input, char *errmsg, size_t errmsg_sz)
+{
+    TokState state = TOK_state_new();
+    CList tokens = TOK_tokenize_chunk(state, user_input, errmsg, errmsg_sz);
+
+    // there are no more lines to come, so an incomplete input is an error
+    TOK_state_end_input(state, errmsg, errmsg_sz);
+
+    TOK_state_free(state);
+    return tokens;
+}
+
+// Documented in .h file
+bool TOK_state_end_input(TokState state, char *errmsg, size_t errmsg_sz)
+{
+    if (!TOK_state_incomplete(state))
+        return false;
+
+    if (state->in_heredoc)
+        snprintf(errmsg, errmsg_sz, "Unterminated here-document");
+    else if (state->mode == TS_QUOTED)
+        snprintf(errmsg, errmsg_sz, "Unterminated quote");
+    else if (state->escape)
+        snprintf(errmsg, errmsg_sz, "Unterminated escape");
+    else
+        snprintf(errmsg, errmsg_sz, "Unterminated compound command");
+
+    TOK_state_reset(state);
+    return true;
+}
+
+/*
+ * Expand the source of a deferred word that is a lone variable
+ * reference, $NAME or "$NAME", with or without braces, as tokenizing it
+ * would but without a lexer. Most words of loop bodies are.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   command    The command of the word, or NULL
+ *   source     The source of the word
+ *
+ * Returns: A newly-created CList of the word it expands to, or NULL if
+ *   source is not a lone reference, or is unquoted and its value would
+ *   be globbed
+ */
+static CList _TOK_expand_reference(TokState state, const char *command, const char *source)
+{
+    char key[64];
+    bool quoted = source[0] == '"';
+    const char *name = source + quoted + 1;
+
+    if (state->vars == NULL || source[quoted] != '$')
+        return NULL;
+
+    bool braced = *name == '{';
+    name += braced;
+
+    int len = 0;
+    while (isalnum(name[len]) || name[len] == '_')
+        len++;
+
+    const char *end = name + len;
+    if ((braced && *end++ != '}') || (quoted && *end++ != '"') || *end != '\0' ||
+        len >= sizeof(key) || !VAR_valid_name(name, len))
+        return NULL;
+
+    memcpy(key, name, len);
+    key[len] = '\0';
+    const char *value = VAR_get(state->vars, key);
+    if (value == NULL)
+        value = "";
+
+    if (!quoted && (strpbrk(value, "*?[") != NULL || value[0] == '~'))
+        return NULL;
+
+    CList tokens = CL_new();
+    Token tok = {quoted ? TOK_QUOTED_WORD : TOK_WORD, MEM_strdup(MEM_TOKENS, value)};
+    if (quoted && _TOK_is_test(command))
+        CL_append_any(tokens, tok);
+    else
+        _TOK_append(tokens, tok);
+
+    return tokens;
+}
+
+// Documented in .h file
+CList TOK_expand(TokState state, const char *source, char *errmsg, size_t errmsg_sz)
+{
+    return TOK_expand_arg(state, NULL, source, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+CList TOK_expand_arg(TokState state, const char *command, const char *source, char *errmsg, size_t errmsg_sz)
+{
+    assert(state != NULL);
+
+    errmsg[0] = '\0';
+    CList tokens = _TOK_expand_reference(state, command, source);
+    if (tokens != NULL)
+        return tokens;
+
+    // the expander of the last word is reused; a substitution in this
+    // word that expands words with the same state finds none and makes its own
+    TokState expander = state->expander;
+    state->expander = NULL;
+    if (expander == NULL)
+        expander = _TOK_state_expander(state);
+    else
+    {
+        TOK_state_set_vars(expander, state->vars);
+        TOK_state_set_subst(expander, state->subst, state->subst_data);
+        TOK_state_set_glob(expander, state->glob, state->glob_data);
+    }
+
+    expander->command = command;
+    tokens = TOK_tokenize_chunk(expander, source, errmsg, errmsg_sz);
+    if (tokens == NULL)
+        TOK_state_reset(expander);
+
+    if (state->expander == NULL)
+        state->expander = expander;
+    else
+        TOK_state_free(expander);
+
     return tokens;
 }
 
+// Documented in .h file
+char *TOK_expand_heredoc(TokState state, const char *body, char *errmsg, size_t errmsg_sz)
+{
+    assert(state != NULL);
+
+    TokState expander = _TOK_state_expander(state);
+    char *data = NULL;
+    const char *p = body;
+
+    errmsg[0] = '\0';
+
+    // each line of the body ends with a newline
+    while (*p != '\0')
+    {
+        const char *nl = strchr(p, '\n');
+        char *line = nl != NULL ? MEM_strndup(MEM_TOKENS, p, nl - p) : MEM_strdup(MEM_TOKENS, p);
+        bool ok = _TOK_expand_line(expander, line, errmsg, errmsg_sz);
+        MEM_free(line);
+
+        if (!ok)
+            goto done;
+
+        p = nl != NULL ? nl + 1 : p + strlen(p);
+    }
+
+    data = MEM_strndup(MEM_PIPELINE, expander->word_len > 0 ? expander->word : "", expander->word_len);
+
+done:
+    TOK_state_free(expander);
+    return data;
+}
+
 // Documented in .h file
 TokenType TOK_next_type(CList tokens)
 {
@@ -12,6 +12,27 @@
 
 #include "clist.h"
 #include "token.h"
+#include "vars.h"
+
+// Lexer state that is kept between calls to TOK_tokenize_chunk
+typedef struct _tok_state *TokState;
+
+/*
+ * Runs the command of a $(...) substitution.
+ *
+ * Returns: The command's output, from MEM_alloc, or NULL if it produced
+ *   none
+ */
+typedef char *(*TOK_subst_callback)(const char *command, void *cb_data);
+
+/*
+ * Expands a glob pattern in an unquoted word.
+ *
+ * Returns: The matching paths as a NULL-terminated array of strings,
+ *   the array and the strings from MEM_alloc, which the tokens take
+ *   over; or NULL if nothing matches
+ */
+typedef char **(*TOK_glob_callback)(const char *pattern, void *cb_data);
 
 /*
  * For diagnostics; convert a TokenType to a printable string
@@ -33,12 +54,208 @@ const char *TT_to_str(TokenType tt);
  *
  * Returns: A newly-created CList representing the tokenized input,
  *   with one token per list element. If an error is encountered,
- *   copies an error message into errmsg and returns NULL.
+ *   copies an error message into errmsg and returns NULL. Since no
+ *   continuation line can follow, an unterminated quote or a
+ *   trailing backslash is an error.
  *
  *   It is up to the caller to call CL_free on the returned list.
  */
 CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
 
+/*
+ * Create a new tokenizer state
+ *
+ * Parameters: None
+ *
+ * Returns: The new state. It is up to the caller to call
+ *   TOK_state_free on it.
+ */
+TokState TOK_state_new();
+
+/*
+ * Destroy a tokenizer state, including any partially tokenized input
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *
+ * Returns: None
+ */
+void TOK_state_free(TokState state);
+
+/*
+ * Discard any partially tokenized input, so that the next chunk starts
+ * a new command
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *
+ * Returns: None
+ */
+void TOK_state_reset(TokState state);
+
+/*
+ * Enable $NAME, ${NAME} and $? expansion in words and quoted words,
+ * and $((expression)) arithmetic, which may assign the variables.
+ * Without a variable table, a '$' is kept as typed.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   vars       The variables to expand, or NULL to disable expansion
+ *
+ * Returns: None
+ */
+void TOK_state_set_vars(TokState state, VarTable vars);
+
+/*
+ * Enable $(command) substitution in words and quoted words. The
+ * output of the command replaces the substitution, without trailing
+ * newlines; outside quotes it is split into words at whitespace.
+ * Without a callback, "$(" is kept as typed.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   subst      The function that runs the command, or NULL
+ *   cb_data    Caller data to pass to subst
+ *
+ * Returns: None
+ */
+void TOK_state_set_subst(TokState state, TOK_subst_callback subst, void *cb_data);
+
+/*
+ * Expand the globs of unquoted words with a callback, e.g. one that
+ * reuses expansions done ahead of time, instead of calling glob()
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   glob_fn    The function that expands a pattern, or NULL for glob()
+ *   cb_data    Caller data to pass to glob_fn
+ *
+ * Returns: None
+ */
+void TOK_state_set_glob(TokState state, TOK_glob_callback glob_fn, void *cb_data);
+
+/*
+ * Tokenize every command as the commands of a compound command are,
+ * keeping its expansions, globs and tildes as TOK_DEFERRED tokens and
+ * splitting it at ';', so that it can be parsed with CTL_parse without
+ * variables or callbacks and expanded when it runs
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   deferred   true to defer the expansions, false to expand them
+ *
+ * Returns: None
+ */
+void TOK_state_set_deferred(TokState state, bool deferred);
+
+/*
+ * Returns true if the last chunk ended inside a quote, with a trailing
+ * backslash or inside a compound command, so that a continuation line
+ * is expected.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *
+ * Returns: true if the input so far is incomplete
+ */
+bool TOK_state_incomplete(TokState state);
+
+/*
+ * End the input: if it stopped in the middle of a command, say why and
+ * discard the partial command, as TOK_state_reset does
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   errmsg     Return space for an error message, filled in if the input
+ *              was incomplete
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true if the input was incomplete
+ */
+bool TOK_state_end_input(TokState state, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Tokenize one line of input, continuing from where the previous line
+ * left off. Only the bytes of input are scanned; the tokens and the
+ * partial word from earlier lines are kept in state.
+ *
+ * A line ending with a backslash is joined with the next line. A line
+ * ending inside a quote continues the quoted word with a newline.
+ *
+ * A command that starts with for, while, if or a function definition
+ * NAME() is a compound command, which continues until its last done, fi
+ * or }. Its commands are separated
+ * by TOK_SEMI tokens, at a ';' or the end of a line, and its keywords
+ * are TOK_KEYWORD tokens. Its words with an expansion, a glob or a
+ * leading tilde are TOK_DEFERRED tokens holding their source, and a
+ * here-document with an expansion is a TOK_DEFERRED_HEREDOC holding its
+ * unexpanded body, so that they can be expanded each time they run.
+ *
+ * Parameters:
+ *   state      The tokenizer state
+ *   input      One line of input, without the trailing newline
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created CList holding all the tokens of the
+ *   command once it is complete. If the input is incomplete, returns
+ *   NULL with an empty errmsg and TOK_state_incomplete(state) is
+ *   true. If an error is encountered, copies an error message into
+ *   errmsg, resets state and returns NULL.
+ *
+ *   It is up to the caller to call CL_free on the returned list.
+ */
+CList TOK_tokenize_chunk(TokState state, const char *input, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Expand the source of a TOK_DEFERRED word, as if it was typed on its
+ * own with the variables, substitutions and globs of a tokenizer state
+ *
+ * Parameters:
+ *   state      The tokenizer state, which is not changed
+ *   source     The source of the word
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created CList of the words the source expands to,
+ *   which the caller must CL_free; or NULL with an error message in
+ *   errmsg.
+ */
+CList TOK_expand(TokState state, const char *source, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Expand the source of a TOK_DEFERRED argument of a command, as
+ * TOK_expand does. As when tokenizing, empty quoted words are kept when
+ * the command is test or [.
+ *
+ * Parameters:
+ *   state      The tokenizer state, which is not changed
+ *   command    The command, or NULL
+ *   source     The source of the word
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created CList of the words the source expands to,
+ *   which the caller must CL_free; or NULL with an error message in
+ *   errmsg.
+ */
+CList TOK_expand_arg(TokState state, const char *command, const char *source, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Expand the body of a TOK_DEFERRED_HEREDOC, as a here-document with an
+ * unquoted delimiter is expanded
+ *
+ * Parameters:
+ *   state      The tokenizer state, which is not changed
+ *   body       The unexpanded body
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The expanded body, from MEM_alloc for a pipeline to take
+ *   over; or NULL with an error message in errmsg.
+ */
+char *TOK_expand_heredoc(TokState state, const char *body, char *errmsg, size_t errmsg_sz);
+
 /*
  * Returns the TokenType for the next token. Does not modify the list
  * of tokens.
@@ -15,6 +15,7 @@
 #include "clist.h"
 #include "tokenize.h"
 #include "token.h"
+#include "mem.h"
 
 // If value is not true; prints a failure message and returns 0.
 #define test_assert(value)                                               \
@@ -330,6 +331,579 @@ test_error:
     return 0;
 }
 
+/*
+ * Tests the TOK_tokenize_chunk function with continuation lines
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_chunk()
+{
+    char errmsg[128];
+    CList list = NULL;
+    TokState state = TOK_state_new();
+
+    // a complete line comes back at once
+    list = TOK_tokenize_chunk(state, "echo a b", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(!TOK_state_incomplete(state));
+    test_assert(CL_length(list) == 3);
+    CL_free(list);
+
+    // echo "a <newline> b" => WORD “echo”; QUOTED_WORD “a\nb”
+    list = TOK_tokenize_chunk(state, "echo \"a", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(errmsg[0] == '\0');
+    test_assert(TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "b\" | wc", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(!TOK_state_incomplete(state));
+    test_assert(CL_length(list) == 4);
+    test_assert(CL_nth(list, 1).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 1).text, "a\nb") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_PIPE);
+    CL_free(list);
+
+    // ec\ <newline> ho hi => WORD “echo”; WORD “hi”
+    list = TOK_tokenize_chunk(state, "ec\\", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "ho hi", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(strcmp(CL_nth(list, 0).text, "echo") == 0);
+    test_assert(strcmp(CL_nth(list, 1).text, "hi") == 0);
+    CL_free(list);
+
+    // several continuations: cat \ <newline> a \ <newline> b
+    list = TOK_tokenize_chunk(state, "cat \\", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "a \\", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "b", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 3);
+    CL_free(list);
+
+    // an error in a continuation line discards the whole command
+    list = TOK_tokenize_chunk(state, "echo \"a", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "\\c\"", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strlen(errmsg) > 0);
+    test_assert(!TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "pwd", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 1);
+    CL_free(list);
+
+    // the one-shot tokenizer still reports incomplete input as an error
+    list = TOK_tokenize_input("echo \"hi", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Unterminated quote") == 0);
+
+    // input that ends in a continuation is reported, and the state starts over
+    test_assert(!TOK_state_end_input(state, errmsg, sizeof(errmsg)));
+    list = TOK_tokenize_chunk(state, "echo con\\", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    test_assert(TOK_state_end_input(state, errmsg, sizeof(errmsg)));
+    test_assert(strcmp(errmsg, "Unterminated escape") == 0);
+    test_assert(!TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "pwd", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 1);
+    CL_free(list);
+
+    TOK_state_free(state);
+    return 1;
+
+test_error:
+    CL_free(list);
+    TOK_state_free(state);
+    return 0;
+}
+
+/*
+ * Tests $NAME, ${NAME} and $? expansion
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_vars()
+{
+    char errmsg[128];
+    CList list = NULL;
+    TokState state = TOK_state_new();
+    VarTable vars = VAR_new();
+
+    VAR_set(vars, "A", "one");
+    VAR_set(vars, "B_2", "two words");
+    VAR_set(vars, "?", "1");
+    TOK_state_set_vars(state, vars);
+
+    // echo $A ${B_2}x "$A-$B_2" \$A $ $? $UNSET => echo one “two wordsx” “one-two words” $A $ 1
+    list = TOK_tokenize_chunk(state, "echo $A ${B_2}x \"$A-$B_2\" \\$A $ $? $UNSET", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(CL_length(list) == 7);
+    test_assert(strcmp(CL_nth(list, 1).text, "one") == 0);
+    test_assert(strcmp(CL_nth(list, 2).text, "two wordsx") == 0);
+    test_assert(CL_nth(list, 3).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 3).text, "one-two words") == 0);
+    test_assert(strcmp(CL_nth(list, 4).text, "$A") == 0);
+    test_assert(strcmp(CL_nth(list, 5).text, "$") == 0);
+    test_assert(strcmp(CL_nth(list, 6).text, "1") == 0);
+    CL_free(list);
+
+    // [ -n "$UNSET" ] => test and [ are given the empty word, other commands are not
+    list = TOK_tokenize_chunk(state, "[ -n \"$UNSET\" ] | echo \"$UNSET\" x", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 7);
+    test_assert(CL_nth(list, 2).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 2).text, "") == 0);
+    test_assert(strcmp(CL_nth(list, 3).text, "]") == 0);
+    test_assert(strcmp(CL_nth(list, 6).text, "x") == 0);
+    CL_free(list);
+
+    // the same for the source of a word expanded on its own
+    list = TOK_expand_arg(state, "test", "\"$UNSET\"", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 1 && strcmp(CL_nth(list, 0).text, "") == 0);
+    CL_free(list);
+    list = TOK_expand(state, "\"$UNSET\"", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 0);
+    CL_free(list);
+
+    // echo ${A => Bad substitution
+    list = TOK_tokenize_chunk(state, "echo ${A", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Bad substitution") == 0);
+
+    // in a function, $@ is a word for each parameter even inside quotes
+    char *args[] = {"f", "x y", "z", NULL};
+    VAR_push_args(vars, args);
+    list = TOK_tokenize_chunk(state, "echo $1 \"<$@>\" $# $0 $3.", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 7);
+    test_assert(strcmp(CL_nth(list, 1).text, "x y") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 2).text, "<x y") == 0);
+    test_assert(strcmp(CL_nth(list, 3).text, "z>") == 0);
+    test_assert(strcmp(CL_nth(list, 4).text, "2") == 0);
+    test_assert(strcmp(CL_nth(list, 5).text, "f") == 0);
+    test_assert(strcmp(CL_nth(list, 6).text, ".") == 0);
+    CL_free(list);
+    VAR_pop_args(vars);
+
+    // without a variable table, $ is kept as typed
+    list = TOK_tokenize_input("echo $A", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(strcmp(CL_nth(list, 1).text, "$A") == 0);
+    CL_free(list);
+
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    CL_free(list);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests $((expression)) arithmetic expansion
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_arith()
+{
+    char errmsg[128];
+    CList list = NULL;
+    char *body = NULL;
+    TokState state = TOK_state_new();
+    VarTable vars = VAR_new();
+
+    VAR_set(vars, "n", "4");
+    TOK_state_set_vars(state, vars);
+
+    // echo $((1 + 2 * n)) "<$((n += 1))>" $(( (n) ))x => echo 9 “<5>” 5x
+    list = TOK_tokenize_chunk(state, "echo $((1 + 2 * n)) \"<$((n += 1))>\" $(( (n) ))x", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(CL_length(list) == 4);
+    test_assert(strcmp(CL_nth(list, 1).text, "9") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 2).text, "<5>") == 0);
+    test_assert(strcmp(CL_nth(list, 3).text, "5x") == 0);
+    test_assert(strcmp(VAR_get(vars, "n"), "5") == 0);
+    CL_free(list);
+
+    // echo $((1 / 0)) => Division by zero
+    list = TOK_tokenize_chunk(state, "echo $((1 / 0))", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Division by zero") == 0);
+
+    // a here-document expands arithmetic in its body
+    list = TOK_tokenize_chunk(state, "cat <<E", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "$((n * n))", errmsg, sizeof(errmsg));
+    list = TOK_tokenize_chunk(state, "E", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(strcmp(CL_nth(list, 1).text, "25\n") == 0);
+    CL_free(list);
+
+    // in a compound command, the expression is evaluated each time it runs
+    list = TOK_tokenize_chunk(state, "while true; do echo $((n++)); done", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 8);
+    test_assert(CL_nth(list, 5).type == TOK_DEFERRED);
+    test_assert(strcmp(CL_nth(list, 5).text, "$((n++))") == 0);
+    test_assert(strcmp(VAR_get(vars, "n"), "5") == 0);
+    body = TOK_expand_heredoc(state, "$((n++)) $((n++))\n", errmsg, sizeof(errmsg));
+    test_assert(body != NULL && strcmp(body, "5 6\n") == 0);
+    CL_free(list);
+
+    // without a variable table, $(( is kept as typed
+    list = TOK_tokenize_input("echo $((1))", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(strcmp(CL_nth(list, 1).text, "$((1))") == 0);
+    CL_free(list);
+
+    MEM_free(body);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    CL_free(list);
+    MEM_free(body);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * A substitution callback that echoes the command back in brackets,
+ * followed by newlines that should be dropped
+ */
+static char *fake_subst(const char *command, void *cb_data)
+{
+    int *calls = (int *)cb_data;
+    char *output = MEM_alloc(MEM_TOKENS, strlen(command) + 5);
+
+    (*calls)++;
+    sprintf(output, "[%s]\n\n", command);
+    return output;
+}
+
+/*
+ * Tests $(...) command substitution
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_subst()
+{
+    char errmsg[128];
+    CList list = NULL;
+    TokState state = TOK_state_new();
+    int calls = 0;
+
+    TOK_state_set_subst(state, fake_subst, &calls);
+
+    // echo a$(b c)d "$(e  f)" => echo “a[b” “c]d” “[e  f]”
+    list = TOK_tokenize_chunk(state, "echo a$(b c)d \"$(e  f)\"", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(calls == 2);
+    test_assert(CL_length(list) == 4);
+    test_assert(strcmp(CL_nth(list, 1).text, "a[b") == 0);
+    test_assert(strcmp(CL_nth(list, 2).text, "c]d") == 0);
+    test_assert(CL_nth(list, 3).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(list, 3).text, "[e  f]") == 0);
+    CL_free(list);
+
+    // nested parentheses and quotes are passed through whole
+    list = TOK_tokenize_chunk(state, "echo $(a (b) \")\")", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 4);
+    test_assert(strcmp(CL_nth(list, 1).text, "[a") == 0);
+    test_assert(strcmp(CL_nth(list, 2).text, "(b)") == 0);
+    test_assert(strcmp(CL_nth(list, 3).text, "\")\"]") == 0);
+    CL_free(list);
+
+    // echo $(a => Unterminated command substitution
+    list = TOK_tokenize_chunk(state, "echo $(a", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Unterminated command substitution") == 0);
+
+    TOK_state_free(state);
+    return 1;
+
+test_error:
+    CL_free(list);
+    TOK_state_free(state);
+    return 0;
+}
+
+/*
+ * Tests here-documents and here-strings
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_heredoc()
+{
+    char errmsg[128];
+    CList list = NULL;
+    TokState state = TOK_state_new();
+    VarTable vars = VAR_new();
+
+    VAR_set(vars, "X", "world");
+    TOK_state_set_vars(state, vars);
+
+    // cat <<EOF | wc => WORD “cat”; HEREDOC “hello world\n\n$X\n”; PIPE; WORD “wc”
+    list = TOK_tokenize_chunk(state, "cat <<EOF | wc", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "hello $X", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "\\$X", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "EOF", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(!TOK_state_incomplete(state));
+    test_assert(CL_length(list) == 4);
+    test_assert(CL_nth(list, 1).type == TOK_HEREDOC);
+    test_assert(strcmp(CL_nth(list, 1).text, "hello world\n\n$X\n") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_PIPE);
+    CL_free(list);
+
+    // a quoted delimiter keeps the body as typed
+    list = TOK_tokenize_chunk(state, "cat << \"END\"", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "$X", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "END", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(strcmp(CL_nth(list, 1).text, "$X\n") == 0);
+    CL_free(list);
+
+    // cat <<< "a $X" => WORD “cat”; HERESTRING; QUOTED_WORD “a world”
+    list = TOK_tokenize_chunk(state, "cat <<< \"a $X\"", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 3);
+    test_assert(CL_nth(list, 1).type == TOK_HERESTRING);
+    test_assert(strcmp(CL_nth(list, 2).text, "a world") == 0);
+    CL_free(list);
+
+    // diff <(ls a) >(wc -l) => WORD “diff”; PROCSUB_IN “ls a”; PROCSUB_OUT “wc -l”
+    list = TOK_tokenize_chunk(state, "diff <(ls a) >(wc -l)", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 3);
+    test_assert(CL_nth(list, 1).type == TOK_PROCSUB_IN);
+    test_assert(strcmp(CL_nth(list, 1).text, "ls a") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_PROCSUB_OUT);
+    test_assert(strcmp(CL_nth(list, 2).text, "wc -l") == 0);
+    CL_free(list);
+
+    // cat <(ls => Unterminated process substitution
+    list = TOK_tokenize_chunk(state, "cat <(ls", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Unterminated process substitution") == 0);
+
+    // cat << => Expect delimiter after here-document
+    list = TOK_tokenize_chunk(state, "cat <<", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Expect delimiter after here-document") == 0);
+
+    // the one-shot tokenizer cannot read a body
+    list = TOK_tokenize_input("cat <<EOF", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Unterminated here-document") == 0);
+
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    CL_free(list);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests the keywords, separators and deferred words of compound commands
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_compound()
+{
+    char errmsg[128];
+    CList list = NULL;
+    CList words = NULL;
+    char *body = NULL;
+    TokState state = TOK_state_new();
+    VarTable vars = VAR_new();
+
+    VAR_set(vars, "X", "a b");
+    TOK_state_set_vars(state, vars);
+
+    // for i in x "$X"; do echo $i ~ done; done => KEYWORD “for”; WORD “i”; WORD “in”; WORD “x”;
+    //   DEFERRED “"$X"”; SEMI; KEYWORD “do”; WORD “echo”; DEFERRED “$i”; DEFERRED “~”; WORD “done”;
+    //   SEMI; KEYWORD “done”
+    list = TOK_tokenize_chunk(state, "for i in x \"$X\"; do echo $i ~ done; done", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(CL_length(list) == 13);
+    test_assert(CL_nth(list, 0).type == TOK_KEYWORD);
+    test_assert(CL_nth(list, 2).type == TOK_WORD);
+    test_assert(CL_nth(list, 4).type == TOK_DEFERRED);
+    test_assert(strcmp(CL_nth(list, 4).text, "\"$X\"") == 0);
+    test_assert(CL_nth(list, 5).type == TOK_SEMI);
+    test_assert(CL_nth(list, 6).type == TOK_KEYWORD);
+    test_assert(strcmp(CL_nth(list, 8).text, "$i") == 0);
+    test_assert(CL_nth(list, 9).type == TOK_DEFERRED);
+    test_assert(CL_nth(list, 10).type == TOK_WORD);
+    test_assert(CL_nth(list, 12).type == TOK_KEYWORD);
+    CL_free(list);
+
+    // the command continues until its done, with a SEMI for each line
+    list = TOK_tokenize_chunk(state, "while true", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "do if false; then echo \"$X", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "y\"; fi", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "done", errmsg, sizeof(errmsg));
+    test_assert(list != NULL && !TOK_state_incomplete(state));
+    test_assert(CL_length(list) == 14);
+    test_assert(CL_nth(list, 2).type == TOK_SEMI);
+    test_assert(CL_nth(list, 9).type == TOK_DEFERRED);
+    test_assert(strcmp(CL_nth(list, 9).text, "\"$X\ny\"") == 0);
+    test_assert(CL_nth(list, 13).type == TOK_KEYWORD);
+
+    // the source of a deferred word expands as it would have when typed
+    words = TOK_expand(state, CL_nth(list, 9).text, errmsg, sizeof(errmsg));
+    test_assert(CL_length(words) == 1);
+    test_assert(strcmp(CL_nth(words, 0).text, "a b\ny") == 0);
+    CL_free(words);
+    words = TOK_expand(state, "$X*", errmsg, sizeof(errmsg));
+    test_assert(CL_length(words) == 1);
+    test_assert(strcmp(CL_nth(words, 0).text, "a b*") == 0);
+    CL_free(words);
+
+    // lone references, expanded without the lexer, give the same words
+    words = TOK_expand(state, "\"${X}\"", errmsg, sizeof(errmsg));
+    test_assert(CL_length(words) == 1 && CL_nth(words, 0).type == TOK_QUOTED_WORD);
+    test_assert(strcmp(CL_nth(words, 0).text, "a b") == 0);
+    CL_free(words);
+    words = TOK_expand(state, "$X", errmsg, sizeof(errmsg));
+    test_assert(CL_length(words) == 1 && CL_nth(words, 0).type == TOK_WORD);
+    test_assert(strcmp(CL_nth(words, 0).text, "a b") == 0);
+    CL_free(words);
+    words = TOK_expand(state, "\"$UNSET\"", errmsg, sizeof(errmsg));
+    test_assert(CL_length(words) == 0);
+    CL_free(words);
+    words = NULL;
+    CL_free(list);
+
+    // an expanding here-document keeps its body for when it runs
+    list = TOK_tokenize_chunk(state, "if true; then cat <<E", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "$X \\$X", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    list = TOK_tokenize_chunk(state, "E", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "fi", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 8);
+    test_assert(CL_nth(list, 5).type == TOK_DEFERRED_HEREDOC);
+    test_assert(strcmp(CL_nth(list, 5).text, "$X \\$X\n") == 0);
+    body = TOK_expand_heredoc(state, CL_nth(list, 5).text, errmsg, sizeof(errmsg));
+    test_assert(body != NULL && strcmp(body, "a b $X\n") == 0);
+    CL_free(list);
+
+    // only a command that starts with a keyword is a compound command
+    list = TOK_tokenize_chunk(state, "echo for; if", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 3);
+    test_assert(strcmp(CL_nth(list, 1).text, "for;") == 0);
+    test_assert(CL_nth(list, 2).type == TOK_WORD);
+    CL_free(list);
+
+    // a function definition is open from its name to its }, which may be
+    // on a later line
+    list = TOK_tokenize_chunk(state, "greet() { echo $1", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "}; greet x", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 9);
+    test_assert(CL_nth(list, 0).type == TOK_KEYWORD);
+    test_assert(strcmp(CL_nth(list, 0).text, "greet()") == 0);
+    test_assert(CL_nth(list, 1).type == TOK_KEYWORD);
+    test_assert(CL_nth(list, 3).type == TOK_DEFERRED);
+    test_assert(CL_nth(list, 5).type == TOK_KEYWORD);
+    test_assert(strcmp(CL_nth(list, 5).text, "}") == 0);
+    test_assert(CL_nth(list, 7).type == TOK_WORD);
+    CL_free(list);
+
+    // a } that is not at the start of a command is a word
+    list = TOK_tokenize_chunk(state, "f() { echo }", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    TOK_state_reset(state);
+
+    list = TOK_tokenize_input("for i in a; do", errmsg, sizeof(errmsg));
+    test_assert(list == NULL);
+    test_assert(strcmp(errmsg, "Unterminated compound command") == 0);
+
+    MEM_free(body);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    MEM_free(body);
+    CL_free(words);
+    CL_free(list);
+    TOK_state_free(state);
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests a deferred state, which keeps every expansion for later without
+ * variables or callbacks
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tokenize_deferred()
+{
+    char errmsg[128];
+    CList list = NULL;
+    TokState state = TOK_state_new();
+
+    TOK_state_set_deferred(state, true);
+
+    // echo $X "$(date)" *.c; echo $((1 + 2)) => WORD “echo”; DEFERRED “$X”; DEFERRED “"$(date)"”;
+    //   DEFERRED “*.c”; SEMI; WORD “echo”; DEFERRED “$((1 + 2))”
+    list = TOK_tokenize_chunk(state, "echo $X \"$(date)\" *.c; echo $((1 + 2))", errmsg, sizeof(errmsg));
+    test_assert(list != NULL);
+    test_assert(CL_length(list) == 7);
+    test_assert(CL_nth(list, 0).type == TOK_WORD);
+    test_assert(CL_nth(list, 1).type == TOK_DEFERRED);
+    test_assert(strcmp(CL_nth(list, 2).text, "\"$(date)\"") == 0);
+    test_assert(CL_nth(list, 3).type == TOK_DEFERRED);
+    test_assert(CL_nth(list, 4).type == TOK_SEMI);
+    test_assert(strcmp(CL_nth(list, 6).text, "$((1 + 2))") == 0);
+    CL_free(list);
+
+    // each line starts a new command, which may be compound
+    list = TOK_tokenize_chunk(state, "if true", errmsg, sizeof(errmsg));
+    test_assert(list == NULL && TOK_state_incomplete(state));
+    list = TOK_tokenize_chunk(state, "then echo ~; fi", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 8);
+    test_assert(CL_nth(list, 0).type == TOK_KEYWORD);
+    test_assert(CL_nth(list, 5).type == TOK_DEFERRED);
+    CL_free(list);
+
+    list = TOK_tokenize_chunk(state, "echo a", errmsg, sizeof(errmsg));
+    test_assert(CL_length(list) == 2);
+    test_assert(CL_nth(list, 1).type == TOK_WORD);
+    CL_free(list);
+
+    TOK_state_free(state);
+    return 1;
+
+test_error:
+    CL_free(list);
+    TOK_state_free(state);
+    return 0;
+}
+
 int main()
 {
     int passed = 0;
@@ -341,6 +915,20 @@ int main()
     passed += test_tok_next_consume();
     num_tests++;
     passed += test_tokenize_input();
+    num_tests++;
+    passed += test_tokenize_chunk();
+    num_tests++;
+    passed += test_tokenize_vars();
+    num_tests++;
+    passed += test_tokenize_arith();
+    num_tests++;
+    passed += test_tokenize_subst();
+    num_tests++;
+    passed += test_tokenize_heredoc();
+    num_tests++;
+    passed += test_tokenize_compound();
+    num_tests++;
+    passed += test_tokenize_deferred();
 
     printf("Passed %d/%d test cases\n", passed, num_tests);
     fflush(stdout);
@@ -0,0 +1,456 @@
+/*
+ * vars.c
+ *
+ * An open-addressing hash table of shell variables
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "vars.h"
+#include "mem.h"
+
+#define VAR_INITIAL_SLOTS 64
+
+// a removed entry, so that probing continues past it
+#define TOMBSTONE ((char *)&_tombstone)
+static char _tombstone;
+
+struct _var_slot
+{
+    char *name; // NULL for an empty slot, TOMBSTONE for a removed one
+    char *value;
+    uint32_t hash;
+    bool exported;
+};
+
+// the positional parameters of a function call
+struct _var_frame
+{
+    char **args;              // $0 and then $1, $2, ..., NULL-terminated
+    int argc;                 // the number of positional parameters
+    char count[16];           // $#
+    struct _var_frame *up;    // the caller's frame
+};
+
+struct _vartable
+{
+    struct _var_slot *slots;
+    int capacity; // always a power of two
+    int count;    // live entries
+    int used;     // live entries plus tombstones
+
+    char **envp;  // cached environment array
+    bool dirty;   // an exported variable changed since envp was built
+
+    uint64_t generation; // counts the changes to any variable
+
+    struct _var_frame *frame; // the positional parameters, or NULL outside functions
+};
+
+/*
+ * FNV-1a hash of the first len characters of a name
+ */
+static uint32_t _VAR_hash(const char *name, int len)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * Find the slot holding name, or the slot where it should be inserted
+ *
+ * Parameters:
+ *   vars     The table
+ *   name     The variable name
+ *   len      The length of the name
+ *   hash     The hash of the name
+ *
+ * Returns: The matching slot if found. Otherwise, the first tombstone
+ *   or empty slot on the probe sequence.
+ */
+static struct _var_slot *_VAR_probe(VarTable vars, const char *name, int len, uint32_t hash)
+{
+    struct _var_slot *insert = NULL;
+    uint32_t mask = vars->capacity - 1;
+
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct _var_slot *slot = &vars->slots[i];
+
+        if (slot->name == NULL)
+            return insert ? insert : slot;
+
+        if (slot->name == TOMBSTONE)
+        {
+            if (insert == NULL)
+                insert = slot;
+        }
+        else if (slot->hash == hash && strncmp(slot->name, name, len) == 0 && slot->name[len] == '\0')
+            return slot;
+    }
+}
+
+/*
+ * Double the table (or just drop the tombstones) once it is 3/4 used
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: None
+ */
+static void _VAR_grow(VarTable vars)
+{
+    if ((vars->used + 1) * 4 < vars->capacity * 3)
+        return;
+
+    struct _var_slot *old = vars->slots;
+    int old_capacity = vars->capacity;
+
+    if ((vars->count + 1) * 2 >= vars->capacity)
+        vars->capacity *= 2;
+
+    vars->slots = MEM_calloc(MEM_VARS, vars->capacity, sizeof(struct _var_slot));
+    assert(vars->slots != NULL);
+    vars->used = vars->count;
+
+    // reinsert the live entries
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (old[i].name == NULL || old[i].name == TOMBSTONE)
+            continue;
+
+        uint32_t mask = vars->capacity - 1;
+        uint32_t j = old[i].hash & mask;
+        while (vars->slots[j].name != NULL)
+            j = (j + 1) & mask;
+
+        vars->slots[j] = old[i];
+    }
+
+    MEM_free(old);
+}
+
+/*
+ * Find or create the slot for a variable
+ */
+static struct _var_slot *_VAR_lookup_or_insert(VarTable vars, const char *name)
+{
+    int len = strlen(name);
+    uint32_t hash = _VAR_hash(name, len);
+
+    _VAR_grow(vars);
+
+    struct _var_slot *slot = _VAR_probe(vars, name, len, hash);
+    if (slot->name == NULL || slot->name == TOMBSTONE)
+    {
+        if (slot->name == NULL)
+            vars->used++;
+
+        slot->name = MEM_strdup(MEM_VARS, name);
+        slot->value = NULL;
+        slot->hash = hash;
+        slot->exported = false;
+        vars->count++;
+    }
+
+    return slot;
+}
+
+/*
+ * Free the cached environment array
+ */
+static void _VAR_free_environ(VarTable vars)
+{
+    if (vars->envp == NULL)
+        return;
+
+    for (int i = 0; vars->envp[i] != NULL; i++)
+        MEM_free(vars->envp[i]);
+
+    MEM_free(vars->envp);
+    vars->envp = NULL;
+}
+
+// Documented in .h file
+VarTable VAR_new()
+{
+    VarTable vars = (VarTable)MEM_alloc(MEM_VARS, sizeof(struct _vartable));
+    assert(vars != NULL);
+
+    vars->capacity = VAR_INITIAL_SLOTS;
+    vars->slots = MEM_calloc(MEM_VARS, vars->capacity, sizeof(struct _var_slot));
+    assert(vars->slots != NULL);
+    vars->count = 0;
+    vars->used = 0;
+    vars->envp = NULL;
+    vars->dirty = true;
+    vars->generation = 0;
+    vars->frame = NULL;
+
+    return vars;
+}
+
+// Documented in .h file
+void VAR_free(VarTable vars)
+{
+    if (vars == NULL)
+        return;
+
+    for (int i = 0; i < vars->capacity; i++)
+    {
+        if (vars->slots[i].name != NULL && vars->slots[i].name != TOMBSTONE)
+        {
+            MEM_free(vars->slots[i].name);
+            MEM_free(vars->slots[i].value);
+        }
+    }
+
+    while (vars->frame != NULL)
+        VAR_pop_args(vars);
+
+    _VAR_free_environ(vars);
+    MEM_free(vars->slots);
+    MEM_free(vars);
+}
+
+// Documented in .h file
+void VAR_import(VarTable vars, char **envp)
+{
+    assert(vars != NULL);
+
+    for (int i = 0; envp != NULL && envp[i] != NULL; i++)
+    {
+        const char *eq = strchr(envp[i], '=');
+        if (eq == NULL || eq == envp[i])
+            continue;
+
+        char *name = MEM_strndup(MEM_VARS, envp[i], eq - envp[i]);
+        VAR_set(vars, name, eq + 1);
+        VAR_export(vars, name);
+        MEM_free(name);
+    }
+}
+
+// Documented in .h file
+const char *VAR_get(VarTable vars, const char *name)
+{
+    assert(vars != NULL);
+
+    // $#, and $0, $1, ... come from the innermost function call
+    if (strcmp(name, "#") == 0)
+        return vars->frame != NULL ? vars->frame->count : "0";
+
+    if (isdigit(name[0]))
+    {
+        int n = atoi(name);
+        return vars->frame != NULL && n <= vars->frame->argc ? vars->frame->args[n] : NULL;
+    }
+
+    int len = strlen(name);
+    struct _var_slot *slot = _VAR_probe(vars, name, len, _VAR_hash(name, len));
+
+    if (slot->name == NULL || slot->name == TOMBSTONE)
+        return NULL;
+
+    return slot->value;
+}
+
+// Documented in .h file
+void VAR_set(VarTable vars, const char *name, const char *value)
+{
+    assert(vars != NULL);
+
+    struct _var_slot *slot = _VAR_lookup_or_insert(vars, name);
+
+    // setting the same value again, as for $? after most commands, is no change
+    if (slot->value != NULL && strcmp(slot->value, value) == 0)
+        return;
+
+    MEM_free(slot->value);
+    slot->value = MEM_strdup(MEM_VARS, value);
+    vars->generation++;
+
+    if (slot->exported)
+        vars->dirty = true;
+}
+
+// Documented in .h file
+void VAR_export(VarTable vars, const char *name)
+{
+    assert(vars != NULL);
+
+    struct _var_slot *slot = _VAR_lookup_or_insert(vars, name);
+
+    if (slot->value == NULL)
+        slot->value = MEM_strdup(MEM_VARS, "");
+
+    if (!slot->exported)
+    {
+        slot->exported = true;
+        vars->dirty = true;
+        vars->generation++;
+    }
+}
+
+// Documented in .h file
+bool VAR_unset(VarTable vars, const char *name)
+{
+    assert(vars != NULL);
+
+    int len = strlen(name);
+    struct _var_slot *slot = _VAR_probe(vars, name, len, _VAR_hash(name, len));
+
+    if (slot->name == NULL || slot->name == TOMBSTONE)
+        return false;
+
+    if (slot->exported)
+        vars->dirty = true;
+
+    MEM_free(slot->name);
+    MEM_free(slot->value);
+    slot->name = TOMBSTONE;
+    slot->value = NULL;
+    vars->count--;
+    vars->generation++;
+
+    return true;
+}
+
+// Documented in .h file
+int VAR_count(VarTable vars)
+{
+    if (vars == NULL)
+        return 0;
+
+    return vars->count;
+}
+
+// Documented in .h file
+uint64_t VAR_generation(VarTable vars)
+{
+    assert(vars != NULL);
+    return vars->generation;
+}
+
+// Documented in .h file
+char **VAR_environ(VarTable vars)
+{
+    assert(vars != NULL);
+
+    if (!vars->dirty)
+        return vars->envp;
+
+    _VAR_free_environ(vars);
+
+    vars->envp = MEM_alloc(MEM_VARS, (vars->count + 1) * sizeof(char *));
+    assert(vars->envp != NULL);
+
+    int n = 0;
+    for (int i = 0; i < vars->capacity; i++)
+    {
+        struct _var_slot *slot = &vars->slots[i];
+        if (slot->name == NULL || slot->name == TOMBSTONE || !slot->exported)
+            continue;
+
+        size_t sz = strlen(slot->name) + strlen(slot->value) + 2;
+        vars->envp[n] = MEM_alloc(MEM_VARS, sz);
+        assert(vars->envp[n] != NULL);
+        snprintf(vars->envp[n], sz, "%s=%s", slot->name, slot->value);
+        n++;
+    }
+    vars->envp[n] = NULL;
+
+    vars->dirty = false;
+    return vars->envp;
+}
+
+// Documented in .h file
+void VAR_foreach(VarTable vars, VAR_foreach_callback callback, void *cb_data)
+{
+    if (vars == NULL || callback == NULL)
+        return;
+
+    for (int i = 0; i < vars->capacity; i++)
+    {
+        struct _var_slot *slot = &vars->slots[i];
+        if (slot->name != NULL && slot->name != TOMBSTONE)
+            callback(slot->name, slot->value, slot->exported, cb_data);
+    }
+}
+
+// Documented in .h file
+void VAR_push_args(VarTable vars, char **args)
+{
+    assert(vars != NULL && args != NULL && args[0] != NULL);
+
+    struct _var_frame *frame = MEM_alloc(MEM_VARS, sizeof(struct _var_frame));
+    assert(frame != NULL);
+
+    frame->argc = 0;
+    while (args[frame->argc + 1] != NULL)
+        frame->argc++;
+
+    frame->args = MEM_alloc(MEM_VARS, (frame->argc + 2) * sizeof(char *));
+    assert(frame->args != NULL);
+    for (int i = 0; i <= frame->argc; i++)
+        frame->args[i] = MEM_strdup(MEM_VARS, args[i]);
+    frame->args[frame->argc + 1] = NULL;
+
+    snprintf(frame->count, sizeof(frame->count), "%d", frame->argc);
+    frame->up = vars->frame;
+    vars->frame = frame;
+    vars->generation++;
+}
+
+// Documented in .h file
+void VAR_pop_args(VarTable vars)
+{
+    assert(vars != NULL);
+
+    struct _var_frame *frame = vars->frame;
+    if (frame == NULL)
+        return;
+
+    for (int i = 0; frame->args[i] != NULL; i++)
+        MEM_free(frame->args[i]);
+    MEM_free(frame->args);
+
+    vars->frame = frame->up;
+    MEM_free(frame);
+    vars->generation++;
+}
+
+// Documented in .h file
+char **VAR_args(VarTable vars)
+{
+    assert(vars != NULL);
+    return vars->frame != NULL ? vars->frame->args : NULL;
+}
+
+// Documented in .h file
+bool VAR_valid_name(const char *name, int len)
+{
+    if (name == NULL || len <= 0 || !(isalpha(name[0]) || name[0] == '_'))
+        return false;
+
+    for (int i = 1; i < len; i++)
+    {
+        if (!(isalnum(name[i]) || name[i] == '_'))
+            return false;
+    }
+
+    return true;
+}
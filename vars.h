@@ -0,0 +1,195 @@
+/*
+ * vars.h
+ *
+ * A hashed store of shell variables, and the environment built from it
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _VARS_H_
+#define _VARS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// struct _vartable to be used in the .c as VarTable
+typedef struct _vartable *VarTable;
+
+typedef void (*VAR_foreach_callback)(const char *name, const char *value, bool exported, void *cb_data);
+
+/*
+ * Create a new, empty variable table
+ *
+ * Parameters: None
+ *
+ * Returns: The new table
+ */
+VarTable VAR_new();
+
+/*
+ * Destroy a variable table, calling MEM_free() on all its memory,
+ * including the array returned by VAR_environ.
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: None
+ */
+void VAR_free(VarTable vars);
+
+/*
+ * Import an environment array as exported variables
+ *
+ * Parameters:
+ *   vars     The table
+ *   envp     A NULL-terminated array of "NAME=value" strings
+ *
+ * Returns: None
+ */
+void VAR_import(VarTable vars, char **envp);
+
+/*
+ * Look up a variable. A name of digits is a positional parameter of
+ * the innermost function call ($0 is the function's name), and "#" is
+ * the number of them.
+ *
+ * Parameters:
+ *   vars     The table
+ *   name     The variable name
+ *
+ * Returns: The value, or NULL if the variable is not set. The value
+ *   remains valid until the variable is next changed.
+ */
+const char *VAR_get(VarTable vars, const char *name);
+
+/*
+ * Set a variable, keeping its exported flag if it already exists.
+ * New variables are not exported.
+ *
+ * Parameters:
+ *   vars     The table
+ *   name     The variable name
+ *   value    The new value, which is copied
+ *
+ * Returns: None
+ */
+void VAR_set(VarTable vars, const char *name, const char *value);
+
+/*
+ * Mark a variable as exported, creating it with an empty value if it
+ * does not exist
+ *
+ * Parameters:
+ *   vars     The table
+ *   name     The variable name
+ *
+ * Returns: None
+ */
+void VAR_export(VarTable vars, const char *name);
+
+/*
+ * Remove a variable
+ *
+ * Parameters:
+ *   vars     The table
+ *   name     The variable name
+ *
+ * Returns: true if the variable existed, false otherwise
+ */
+bool VAR_unset(VarTable vars, const char *name);
+
+/*
+ * Return the number of variables in the table
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: The number of variables
+ */
+int VAR_count(VarTable vars);
+
+/*
+ * Return a number that changes whenever a variable is set to a new
+ * value, exported or removed, so that what was computed from the
+ * variables can tell whether it is still current
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: The generation of the table
+ */
+uint64_t VAR_generation(VarTable vars);
+
+/*
+ * Return the exported variables as an environment array for execve.
+ * The array is only rebuilt when an exported variable has changed
+ * since the last call.
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: A NULL-terminated array of "NAME=value" strings, owned by
+ *   the table and valid until the next change to an exported variable.
+ */
+char **VAR_environ(VarTable vars);
+
+/*
+ * Call the callback for every variable in the table, in no
+ * particular order
+ *
+ * Parameters:
+ *   vars       The table
+ *   callback   The function to call
+ *   cb_data    Caller data to pass to the function
+ *
+ * Returns: None
+ */
+void VAR_foreach(VarTable vars, VAR_foreach_callback callback, void *cb_data);
+
+/*
+ * Start a frame of positional parameters for a function call. The
+ * frame hides the caller's until it is popped.
+ *
+ * Parameters:
+ *   vars     The table
+ *   args     The function's name and then its arguments, NULL-terminated,
+ *            which are copied
+ *
+ * Returns: None
+ */
+void VAR_push_args(VarTable vars, char **args);
+
+/*
+ * End the innermost frame of positional parameters, going back to the
+ * caller's
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: None
+ */
+void VAR_pop_args(VarTable vars);
+
+/*
+ * Get the positional parameters of the innermost function call
+ *
+ * Parameters:
+ *   vars     The table
+ *
+ * Returns: The function's name and then its arguments, NULL-terminated
+ *   and valid until the frame is popped; or NULL outside a function
+ */
+char **VAR_args(VarTable vars);
+
+/*
+ * Returns true if name is a valid variable name: a letter or
+ * underscore followed by letters, digits and underscores.
+ *
+ * Parameters:
+ *   name     The name to check
+ *   len      The number of characters of name to check
+ *
+ * Returns: true if the name is valid
+ */
+bool VAR_valid_name(const char *name, int len);
+
+#endif /* _VARS_H_ */
@@ -0,0 +1,217 @@
+/**
+ * vars_test.c
+ *
+ * This file contains the test cases for vars.c
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "vars.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Returns true if envp contains the string entry
+ */
+static bool env_contains(char **envp, const char *entry)
+{
+    for (int i = 0; envp[i] != NULL; i++)
+    {
+        if (strcmp(envp[i], entry) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Tests VAR_set, VAR_get and VAR_unset, including growing the table
+ * and reusing removed slots
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_set_get_unset()
+{
+    VarTable vars = VAR_new();
+    char name[32], value[32];
+
+    test_assert(VAR_get(vars, "HOME") == NULL);
+    test_assert(VAR_count(vars) == 0);
+
+    VAR_set(vars, "HOME", "/home/plaid");
+    test_assert(strcmp(VAR_get(vars, "HOME"), "/home/plaid") == 0);
+    VAR_set(vars, "HOME", "/tmp");
+    test_assert(strcmp(VAR_get(vars, "HOME"), "/tmp") == 0);
+    test_assert(VAR_count(vars) == 1);
+
+    // enough variables to grow the table several times
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(name, sizeof(name), "VAR_%d", i);
+        snprintf(value, sizeof(value), "%d", i * 7);
+        VAR_set(vars, name, value);
+    }
+    test_assert(VAR_count(vars) == 1001);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(name, sizeof(name), "VAR_%d", i);
+        snprintf(value, sizeof(value), "%d", i * 7);
+        test_assert(strcmp(VAR_get(vars, name), value) == 0);
+    }
+
+    // remove every other one, then make sure the rest are still found
+    for (int i = 0; i < 1000; i += 2)
+    {
+        snprintf(name, sizeof(name), "VAR_%d", i);
+        test_assert(VAR_unset(vars, name));
+        test_assert(!VAR_unset(vars, name));
+    }
+    test_assert(VAR_count(vars) == 501);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(name, sizeof(name), "VAR_%d", i);
+        test_assert((VAR_get(vars, name) == NULL) == (i % 2 == 0));
+    }
+
+    // churn through removed slots without the table filling up
+    for (int i = 0; i < 10000; i++)
+    {
+        VAR_set(vars, "CHURN", "x");
+        VAR_unset(vars, "CHURN");
+    }
+    test_assert(VAR_count(vars) == 501);
+    test_assert(strcmp(VAR_get(vars, "HOME"), "/tmp") == 0);
+
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests VAR_import, VAR_export and VAR_environ
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_environ()
+{
+    VarTable vars = VAR_new();
+    char *env[] = {"PATH=/bin:/usr/bin", "EMPTY=", "EQ=a=b", NULL};
+    char **envp = NULL;
+
+    VAR_import(vars, env);
+    test_assert(strcmp(VAR_get(vars, "EQ"), "a=b") == 0);
+    test_assert(strcmp(VAR_get(vars, "EMPTY"), "") == 0);
+
+    envp = VAR_environ(vars);
+    test_assert(env_contains(envp, "PATH=/bin:/usr/bin"));
+    test_assert(env_contains(envp, "EQ=a=b"));
+
+    // unexported variables do not change the environment
+    VAR_set(vars, "LOCAL", "1");
+    test_assert(VAR_environ(vars) == envp);
+    test_assert(!env_contains(envp, "LOCAL=1"));
+
+    VAR_export(vars, "LOCAL");
+    envp = VAR_environ(vars);
+    test_assert(env_contains(envp, "LOCAL=1"));
+
+    VAR_set(vars, "LOCAL", "2");
+    envp = VAR_environ(vars);
+    test_assert(env_contains(envp, "LOCAL=2"));
+    test_assert(!env_contains(envp, "LOCAL=1"));
+
+    VAR_unset(vars, "PATH");
+    envp = VAR_environ(vars);
+    test_assert(!env_contains(envp, "PATH=/bin:/usr/bin"));
+
+    test_assert(VAR_valid_name("_a1", 3));
+    test_assert(!VAR_valid_name("1a", 2));
+    test_assert(!VAR_valid_name("a-b", 3));
+    test_assert(!VAR_valid_name("", 0));
+
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+/*
+ * Tests the frames of positional parameters of function calls
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_args()
+{
+    VarTable vars = VAR_new();
+    char *outer[] = {"f", "a", "b c", NULL};
+    char *inner[] = {"g", NULL};
+
+    // outside a function there are no parameters
+    test_assert(VAR_args(vars) == NULL);
+    test_assert(VAR_get(vars, "1") == NULL);
+    test_assert(strcmp(VAR_get(vars, "#"), "0") == 0);
+
+    uint64_t generation = VAR_generation(vars);
+    VAR_push_args(vars, outer);
+    test_assert(VAR_generation(vars) != generation);
+    test_assert(strcmp(VAR_get(vars, "0"), "f") == 0);
+    test_assert(strcmp(VAR_get(vars, "2"), "b c") == 0);
+    test_assert(VAR_get(vars, "3") == NULL);
+    test_assert(strcmp(VAR_get(vars, "#"), "2") == 0);
+    test_assert(VAR_args(vars)[1] != outer[1] && strcmp(VAR_args(vars)[1], "a") == 0);
+
+    // a call hides its caller's parameters until it returns
+    VAR_push_args(vars, inner);
+    test_assert(strcmp(VAR_get(vars, "0"), "g") == 0);
+    test_assert(VAR_get(vars, "1") == NULL);
+    test_assert(strcmp(VAR_get(vars, "#"), "0") == 0);
+    VAR_pop_args(vars);
+    test_assert(strcmp(VAR_get(vars, "1"), "a") == 0);
+
+    // the parameters are not variables
+    test_assert(VAR_count(vars) == 0);
+
+    // a frame still open is freed with the table
+    VAR_free(vars);
+    return 1;
+
+test_error:
+    VAR_free(vars);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_set_get_unset();
+    num_tests++;
+    passed += test_environ();
+    num_tests++;
+    passed += test_args();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}
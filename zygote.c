@@ -0,0 +1,510 @@
+/*
+ * zygote.c
+ *
+ * A helper process that launches commands for the shell, so the shell
+ * never has to fork its own large address space
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "mem.h"
+
+// the largest request: the working directory, arguments and environment
+#define ZYG_MAX_MSG (256 * 1024)
+
+// the fds passed with a request: stdin, stdout and stderr
+#define ZYG_NUM_FDS 3
+
+enum zyg_type
+{
+    ZYG_SPAWN,   // shell to zygote: launch a command
+    ZYG_SPAWNED, // zygote to shell: the pid, with its pidfd attached
+    ZYG_EXITED,  // zygote to shell: a command has exited
+};
+
+// the start of every message; a request is followed by its strings
+struct zyg_header
+{
+    enum zyg_type type;
+    pid_t pid;
+    int status;
+    int argc;
+    int envc;
+};
+
+struct zyg_exit
+{
+    pid_t pid;
+    int status;
+};
+
+struct _zygote
+{
+    int sock;
+    pid_t pid;
+    char *buf;
+
+    // statuses that arrived before they were waited for
+    struct zyg_exit *exited;
+    int num_exited;
+    int cap_exited;
+};
+
+static int _ZYG_pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/*
+ * Send a message, with fds attached if nfds > 0
+ *
+ * Returns: 0 on success, -1 on error
+ */
+static int _ZYG_send(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+    struct iovec iov = {(void *)buf, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    char control[CMSG_SPACE(sizeof(int) * ZYG_NUM_FDS)];
+
+    if (nfds > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t n;
+    do
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+
+    return n == len ? 0 : -1;
+}
+
+/*
+ * Receive a message and any fds attached to it
+ *
+ * Parameters:
+ *   sock     The socket
+ *   buf      Return space for the message
+ *   len      The size of buf
+ *   fds      Return space for up to ZYG_NUM_FDS fds
+ *   nfds     Return space for the number of fds received
+ *
+ * Returns: The length of the message, 0 if the other end has closed
+ *   the socket, or -1 on error
+ */
+static ssize_t _ZYG_recv(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+    struct iovec iov = {buf, len};
+    char control[CMSG_SPACE(sizeof(int) * ZYG_NUM_FDS)];
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = control, .msg_controllen = sizeof(control)};
+
+    ssize_t n;
+    do
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+
+    *nfds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+    }
+
+    return n;
+}
+
+/*
+ * Exec a command, trying the file the shell found for it first, then
+ * searching the PATH in its environment if the command has no '/'. Only
+ * returns if the command could not be executed.
+ */
+static void _ZYG_exec(const char *file, char **argv, char **envp)
+{
+    if (*file != '\0')
+        execve(file, argv, envp);
+
+    if (strchr(argv[0], '/') != NULL)
+    {
+        execve(argv[0], argv, envp);
+        return;
+    }
+
+    const char *path = "/usr/bin:/bin";
+    for (int i = 0; envp[i] != NULL; i++)
+    {
+        if (strncmp(envp[i], "PATH=", 5) == 0)
+            path = envp[i] + 5;
+    }
+
+    size_t name_len = strlen(argv[0]);
+    int saved_errno = ENOENT;
+
+    while (*path != '\0')
+    {
+        const char *end = strchrnul(path, ':');
+        size_t dir_len = end - path;
+        char file[dir_len + name_len + 2];
+
+        // an empty PATH element means the current directory
+        if (dir_len == 0)
+            strcpy(file, argv[0]);
+        else
+            sprintf(file, "%.*s/%s", (int)dir_len, path, argv[0]);
+
+        execve(file, argv, envp);
+
+        // keep a more useful error than "not found" from a later element
+        if (errno != ENOENT && errno != ENOTDIR)
+            saved_errno = errno;
+
+        path = *end ? end + 1 : end;
+    }
+
+    errno = saved_errno;
+}
+
+/*
+ * In the zygote, launch the command in a request
+ *
+ * Parameters:
+ *   buf      The request
+ *   len      The length of the request
+ *   fds      The stdin, stdout and stderr of the command
+ *
+ * Returns: The pid of the command, or -1 on error
+ */
+static pid_t _ZYG_launch(char *buf, size_t len, int *fds)
+{
+    struct zyg_header *hdr = (struct zyg_header *)buf;
+    char *argv[hdr->argc + 1];
+    char *envp[hdr->envc + 1];
+
+    // the strings are the working directory, the file to run ("" to search
+    // the PATH), the arguments and the environment
+    char *s = buf + sizeof(struct zyg_header);
+    char *cwd = s;
+    s += strlen(s) + 1;
+    char *file = s;
+    s += strlen(s) + 1;
+    for (int i = 0; i < hdr->argc; i++, s += strlen(s) + 1)
+        argv[i] = s;
+    argv[hdr->argc] = NULL;
+    for (int i = 0; i < hdr->envc; i++, s += strlen(s) + 1)
+        envp[i] = s;
+    envp[hdr->envc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        for (int i = 0; i < ZYG_NUM_FDS; i++)
+            dup2(fds[i], i);
+
+        if (chdir(cwd) != 0)
+            perror(cwd);
+
+        _ZYG_exec(file, argv, envp);
+
+        ZYG_exec_failed(argv[0]);
+        _exit(2);
+    }
+
+    return pid;
+}
+
+/*
+ * The zygote's main loop: launch commands on request, and report each
+ * one's status when it exits. Returns when the shell closes the socket.
+ */
+static void _ZYG_serve(int sock)
+{
+    struct pollfd *pfds = NULL;
+    pid_t *pids = NULL;
+    int count = 0, cap = 0;
+    char *buf = malloc(ZYG_MAX_MSG);
+    assert(buf != NULL);
+
+    while (true)
+    {
+        // slot 0 is the socket, the rest are the pidfds of running commands
+        if (count + 2 > cap)
+        {
+            cap = (count + 2) * 2;
+            pfds = realloc(pfds, cap * sizeof(struct pollfd));
+            pids = realloc(pids, cap * sizeof(pid_t));
+            assert(pfds != NULL && pids != NULL);
+        }
+        pfds[0] = (struct pollfd){sock, POLLIN, 0};
+
+        if (poll(pfds, count + 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 1; i <= count; i++)
+        {
+            if (pfds[i].revents == 0)
+                continue;
+
+            struct zyg_header exited = {ZYG_EXITED, pids[i], 0, 0, 0};
+            waitpid(pids[i], &exited.status, 0);
+            _ZYG_send(sock, &exited, sizeof(exited), NULL, 0);
+
+            close(pfds[i].fd);
+            pfds[i] = pfds[count];
+            pids[i] = pids[count];
+            count--;
+            i--;
+        }
+
+        if (pfds[0].revents == 0)
+            continue;
+
+        int fds[ZYG_NUM_FDS], nfds;
+        ssize_t n = _ZYG_recv(sock, buf, ZYG_MAX_MSG - 1, fds, &nfds);
+        if (n <= 0)
+            break;
+        buf[n] = '\0';
+
+        struct zyg_header reply = {ZYG_SPAWNED, -1, 0, 0, 0};
+        int pidfd = -1;
+
+        if (n >= sizeof(struct zyg_header) && nfds == ZYG_NUM_FDS)
+            reply.pid = _ZYG_launch(buf, n, fds);
+
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+
+        if (reply.pid > 0)
+            pidfd = _ZYG_pidfd_open(reply.pid);
+
+        _ZYG_send(sock, &reply, sizeof(reply), &pidfd, pidfd >= 0 ? 1 : 0);
+
+        if (pidfd >= 0)
+        {
+            count++;
+            pfds[count] = (struct pollfd){pidfd, POLLIN, 0};
+            pids[count] = reply.pid;
+        }
+    }
+
+    free(buf);
+    free(pfds);
+    free(pids);
+}
+
+// Documented in .h file
+Zygote ZYG_start()
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+        return NULL;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return NULL;
+    }
+
+    if (pid == 0)
+    {
+        // the zygote stays out of the way of the terminal's signals, which
+        // are meant for the commands and the shell
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        close(sv[0]);
+
+        _ZYG_serve(sv[1]);
+        _exit(0);
+    }
+
+    close(sv[1]);
+
+    Zygote zyg = MEM_alloc(MEM_IO, sizeof(struct _zygote));
+    assert(zyg != NULL);
+    zyg->sock = sv[0];
+    zyg->pid = pid;
+    zyg->buf = MEM_alloc(MEM_IO, ZYG_MAX_MSG);
+    assert(zyg->buf != NULL);
+    zyg->exited = NULL;
+    zyg->num_exited = 0;
+    zyg->cap_exited = 0;
+
+    return zyg;
+}
+
+// Documented in .h file
+void ZYG_stop(Zygote zyg)
+{
+    if (zyg == NULL)
+        return;
+
+    close(zyg->sock);
+    waitpid(zyg->pid, NULL, 0);
+
+    MEM_free(zyg->exited);
+    MEM_free(zyg->buf);
+    MEM_free(zyg);
+}
+
+/*
+ * Read one message from the zygote, keeping exit statuses for ZYG_wait
+ *
+ * Parameters:
+ *   zyg      The zygote
+ *   hdr      Return space for the message
+ *   pidfd    Return space for an attached pidfd, or -1 if none
+ *
+ * Returns: true on success, false if the zygote has gone away
+ */
+static bool _ZYG_read_reply(Zygote zyg, struct zyg_header *hdr, int *pidfd)
+{
+    int fds[ZYG_NUM_FDS], nfds;
+
+    ssize_t n = _ZYG_recv(zyg->sock, hdr, sizeof(*hdr), fds, &nfds);
+    if (n != sizeof(*hdr))
+        return false;
+
+    *pidfd = nfds > 0 ? fds[0] : -1;
+
+    if (hdr->type == ZYG_EXITED)
+    {
+        if (zyg->num_exited == zyg->cap_exited)
+        {
+            zyg->cap_exited = zyg->cap_exited ? zyg->cap_exited * 2 : 8;
+            zyg->exited = MEM_realloc(MEM_IO, zyg->exited, zyg->cap_exited * sizeof(struct zyg_exit));
+            assert(zyg->exited != NULL);
+        }
+        zyg->exited[zyg->num_exited++] = (struct zyg_exit){hdr->pid, hdr->status};
+    }
+
+    return true;
+}
+
+/*
+ * Append a string and its NUL to a request
+ *
+ * Returns: false if the request would be too large, true otherwise
+ */
+static bool _ZYG_pack(char *buf, size_t *len, const char *s)
+{
+    size_t sz = strlen(s) + 1;
+    if (*len + sz > ZYG_MAX_MSG)
+        return false;
+
+    memcpy(buf + *len, s, sz);
+    *len += sz;
+    return true;
+}
+
+// Documented in .h file
+int ZYG_spawn(Zygote zyg, const char *file, char **argv, char **envp, int in_fd, int out_fd, int err_fd,
+              pid_t *pid)
+{
+    assert(zyg != NULL);
+
+    struct zyg_header *hdr = (struct zyg_header *)zyg->buf;
+    *hdr = (struct zyg_header){ZYG_SPAWN, 0, 0, 0, 0};
+    size_t len = sizeof(struct zyg_header);
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL)
+        return -1;
+
+    // pack the working directory and file, then the arguments and the environment
+    bool fits = _ZYG_pack(zyg->buf, &len, cwd) && _ZYG_pack(zyg->buf, &len, file != NULL ? file : "");
+    for (; fits && argv[hdr->argc] != NULL; hdr->argc++)
+        fits = _ZYG_pack(zyg->buf, &len, argv[hdr->argc]);
+    for (; fits && envp[hdr->envc] != NULL; hdr->envc++)
+        fits = _ZYG_pack(zyg->buf, &len, envp[hdr->envc]);
+    free(cwd);
+
+    // a command too large for one message is left to the caller
+    if (!fits)
+        return -1;
+
+    int fds[ZYG_NUM_FDS] = {in_fd, out_fd, err_fd};
+    if (_ZYG_send(zyg->sock, zyg->buf, len, fds, ZYG_NUM_FDS) != 0)
+        return -1;
+
+    // exit statuses of earlier commands may arrive ahead of the reply
+    struct zyg_header reply;
+    int pidfd;
+    do
+    {
+        if (!_ZYG_read_reply(zyg, &reply, &pidfd))
+            return -1;
+    } while (reply.type != ZYG_SPAWNED);
+
+    if (reply.pid <= 0 || pidfd < 0)
+        return -1;
+
+    *pid = reply.pid;
+    return pidfd;
+}
+
+// Documented in .h file
+int ZYG_wait(Zygote zyg, pid_t pid)
+{
+    assert(zyg != NULL);
+
+    while (true)
+    {
+        for (int i = 0; i < zyg->num_exited; i++)
+        {
+            if (zyg->exited[i].pid != pid)
+                continue;
+
+            int status = zyg->exited[i].status;
+            zyg->exited[i] = zyg->exited[--zyg->num_exited];
+            return status;
+        }
+
+        struct zyg_header hdr;
+        int pidfd;
+        if (!_ZYG_read_reply(zyg, &hdr, &pidfd))
+            return -1;
+
+        if (pidfd >= 0)
+            close(pidfd);
+    }
+}
+
+// Documented in .h file
+void ZYG_exec_failed(const char *command)
+{
+    dprintf(STDERR_FILENO, "%s: Command not found\n", command);
+}
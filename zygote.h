@@ -0,0 +1,84 @@
+/*
+ * zygote.h
+ *
+ * A small helper process, started with the shell, that forks and execs
+ * external commands on request so that the shell itself is never forked
+ *
+ * Author: Niyomwungeri Parmenide Ishimwe <parmenin@andrew.cmu.edu>
+ */
+#ifndef _ZYGOTE_H_
+#define _ZYGOTE_H_
+
+#include <sys/types.h>
+
+// struct _zygote to be used in the .c as Zygote
+typedef struct _zygote *Zygote;
+
+/*
+ * Start the zygote. This should be done early, while the shell process
+ * is still small, since the zygote is a fork of it.
+ *
+ * Parameters: None
+ *
+ * Returns: The zygote, or NULL if it could not be started
+ */
+Zygote ZYG_start();
+
+/*
+ * Stop the zygote and free its handle. Commands it launched keep running.
+ *
+ * Parameters:
+ *   zyg      The zygote
+ *
+ * Returns: None
+ */
+void ZYG_stop(Zygote zyg);
+
+/*
+ * Launch a command through the zygote. The command's standard input,
+ * output and error are copies of in_fd, out_fd and err_fd, passed to
+ * the zygote over its socket.
+ *
+ * Parameters:
+ *   zyg      The zygote
+ *   file     The executable, already found in the PATH, or NULL to
+ *            search the PATH of envp for a command without a '/'
+ *   argv     The command and its arguments
+ *   envp     The environment of the command
+ *   in_fd    The standard input of the command
+ *   out_fd   The standard output of the command
+ *   err_fd   The standard error of the command
+ *   pid      Return space for the process ID of the command
+ *
+ * Returns: A pidfd for the command, which becomes readable when it exits,
+ *   or -1 if the zygote could not launch it
+ */
+int ZYG_spawn(Zygote zyg, const char *file, char **argv, char **envp, int in_fd, int out_fd, int err_fd,
+              pid_t *pid);
+
+/*
+ * Wait for a command launched by the zygote to exit. The command is not
+ * a child of the shell, so the zygote reaps it and reports its status.
+ *
+ * Parameters:
+ *   zyg      The zygote
+ *   pid      The process ID returned by ZYG_spawn
+ *
+ * Returns: The wait status of the command, as from waitpid, or -1 if
+ *   the zygote has gone away
+ */
+int ZYG_wait(Zygote zyg, pid_t pid);
+
+/*
+ * Report, on the standard error, a command that could not be executed.
+ * Both the zygote and a child forked by the shell call it once exec has
+ * failed, so a missing command reads the same either way.
+ *
+ * Parameters:
+ *   command  The command name
+ *
+ * Returns: None
+ */
+void ZYG_exec_failed(const char *command);
+
+#endif /* _ZYGOTE_H_ */
@@ -0,0 +1,160 @@
+/**
+ * zygote_test.c
+ *
+ * This file contains the test cases for zygote.c
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "shell.h"
+#include "exec.h"
+#include "parser.h"
+
+// If value is not true; prints a failure message and returns 0.
+#define test_assert(value)                                               \
+    {                                                                    \
+        if (!(value))                                                    \
+        {                                                                \
+            printf("FAIL %s[%d]: %s\n", __FUNCTION__, __LINE__, #value); \
+            goto test_error;                                             \
+        }                                                                \
+    }
+
+/*
+ * Tests launching commands through a zygote, passing them fds and
+ * collecting their exit statuses in any order
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_spawn_wait()
+{
+    char *envp[] = {"PATH=/usr/bin:/bin", "GREETING=hello", NULL};
+    char *echo_args[] = {"sh", "-c", "echo $GREETING", NULL};
+    char *fail_args[] = {"sh", "-c", "exit 3", NULL};
+    char *missing_args[] = {"no-such-command-here", NULL};
+    char output[64];
+    pid_t pid1, pid2, pid3;
+    int pidfd1 = -1, pidfd2 = -1, pidfd3 = -1;
+
+    Zygote zyg = ZYG_start();
+    int out_fd = memfd_create("output", 0);
+    int err_fd = memfd_create("errors", 0);
+    test_assert(zyg != NULL);
+
+    pidfd1 = ZYG_spawn(zyg, NULL, echo_args, envp, STDIN_FILENO, out_fd, STDERR_FILENO, &pid1);
+    pidfd2 = ZYG_spawn(zyg, NULL, fail_args, envp, STDIN_FILENO, out_fd, STDERR_FILENO, &pid2);
+    test_assert(pidfd1 >= 0 && pidfd2 >= 0 && pid1 != pid2);
+
+    // the second command's status can be collected first
+    struct pollfd pfd = {pidfd2, POLLIN, 0};
+    test_assert(poll(&pfd, 1, 5000) == 1);
+    int status = ZYG_wait(zyg, pid2);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+
+    status = ZYG_wait(zyg, pid1);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    lseek(out_fd, 0, SEEK_SET);
+    ssize_t n = read(out_fd, output, sizeof(output) - 1);
+    output[n > 0 ? n : 0] = '\0';
+    test_assert(strcmp(output, "hello\n") == 0);
+
+    // the zygote reports a command it could not exec like the shell does,
+    // with a single message on the standard error it was given
+    pidfd3 = ZYG_spawn(zyg, NULL, missing_args, envp, STDIN_FILENO, out_fd, err_fd, &pid3);
+    test_assert(pidfd3 >= 0);
+    status = ZYG_wait(zyg, pid3);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 2);
+
+    lseek(err_fd, 0, SEEK_SET);
+    n = read(err_fd, output, sizeof(output) - 1);
+    output[n > 0 ? n : 0] = '\0';
+    test_assert(strcmp(output, "no-such-command-here: Command not found\n") == 0);
+
+    close(pidfd1);
+    close(pidfd2);
+    close(pidfd3);
+    close(out_fd);
+    close(err_fd);
+    ZYG_stop(zyg);
+    return 1;
+
+test_error:
+    close(out_fd);
+    close(err_fd);
+    ZYG_stop(zyg);
+    return 0;
+}
+
+/*
+ * Tests that a command the shell forks itself, with no zygote, is
+ * reported just as the zygote reports it
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_fork_not_found()
+{
+    char errmsg[100];
+    char output[256];
+    shell_t sh = {VAR_new(), 0};
+    pipeline_t *pipeline = NULL;
+
+    CList tokens = TOK_tokenize_input("no-such-command-here", errmsg, sizeof(errmsg));
+    int err_fd = memfd_create("errors", 0);
+    test_assert(tokens != NULL && err_fd >= 0);
+    pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline != NULL);
+
+    VAR_set(sh.vars, "PATH", "/usr/bin:/bin");
+    sh.in_fd = STDIN_FILENO;
+    sh.out_fd = STDOUT_FILENO;
+    sh.err_fd = err_fd;
+    test_assert(EXEC_pipeline(&sh, pipeline, STDOUT_FILENO) == 2);
+
+    // the child's one message, then the shell's note of its status
+    lseek(err_fd, 0, SEEK_SET);
+    ssize_t n = read(err_fd, output, sizeof(output) - 1);
+    output[n > 0 ? n : 0] = '\0';
+    const char *message = "no-such-command-here: Command not found\n";
+    test_assert(strncmp(output, message, strlen(message)) == 0);
+    test_assert(strstr(output, "No such file") == NULL);
+
+    pipeline_free(pipeline);
+    CL_free(tokens);
+    VAR_free(sh.vars);
+    close(err_fd);
+    return 1;
+
+test_error:
+    pipeline_free(pipeline);
+    CL_free(tokens);
+    VAR_free(sh.vars);
+    if (err_fd >= 0)
+        close(err_fd);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_spawn_wait();
+    num_tests++;
+    passed += test_fork_not_found();
+
+    printf("Passed %d/%d test cases\n", passed, num_tests);
+    fflush(stdout);
+    return 0;
+}